@@ -0,0 +1,222 @@
+#include "AdmissionControl.h"
+#include "DaemonClock.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string.h>
+
+/* FNV-1a; good enough to spread IP strings over the bucket table */
+static unsigned long long hashString(const char * s)
+{
+   unsigned long long h = 14695981039346656037ULL;
+   while (*s != '\0')
+   {
+      h ^= (unsigned char) *s++;
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+/* spread integer keys so neighbouring pids do not share a probe window */
+static unsigned long long mixKey(unsigned long long k)
+{
+   k ^= k >> 33;
+   k *= 0xff51afd7ed558ccdULL;
+   k ^= k >> 33;
+   return k;
+}
+
+TokenBucketTable::TokenBucketTable(int rate, int burst)
+: buckets(NULL), rate(rate), burst(burst > 0 ? burst : rate)
+{
+   if (rate > 0)
+   {
+      buckets = new Bucket[TABLE_SIZE];
+      memset(buckets, 0, sizeof(Bucket) * TABLE_SIZE);
+   }
+}
+
+TokenBucketTable::~TokenBucketTable()
+{
+   delete [] buckets;
+}
+
+/*
+ * Method Name: allow
+ *
+ * Description: refills the bucket for key according to elapsed time and
+ *                 spends one token from it.
+ *
+ * Arguments  : unsigned long long key - hashed client identity
+ *              long long now - monotonic time in microseconds
+ *
+ * Returns    : bool - true if the request may proceed
+ *
+ */
+bool TokenBucketTable::allow(unsigned long long key, long long now)
+{
+   if (buckets == NULL || rate <= 0)
+      return true;  //limit disabled
+
+   unsigned int start = (unsigned int) key & (TABLE_SIZE - 1);
+   Bucket * b = NULL;
+   Bucket * victim = NULL;
+
+   for (int i = 0; i < PROBE_WINDOW; i++)
+   {
+      Bucket * candidate = &buckets[(start + i) & (TABLE_SIZE - 1)];
+      if (candidate->last != 0 && candidate->key == key)
+      {
+         b = candidate;
+         break;
+      }
+      if (victim == NULL || candidate->last < victim->last)
+         victim = candidate;
+   }
+
+   if (b == NULL)
+   {
+      //new (or evicted) client starts with a full bucket
+      b = victim;
+      b->key = key;
+      b->tokens = burst;
+      b->last = now;
+   }
+   else
+   {
+      b->tokens += (now - b->last) * rate / 1000000.0;
+      if (b->tokens > burst)
+         b->tokens = burst;
+      b->last = now;
+   }
+
+   if (b->tokens < 1.0)
+      return false;
+   b->tokens -= 1.0;
+   return true;
+}
+
+void TokenBucketTable::setLimits(int rate, int burst)
+{
+   if (rate > 0 && buckets == NULL)
+   {
+      buckets = new Bucket[TABLE_SIZE];
+      memset(buckets, 0, sizeof(Bucket) * TABLE_SIZE);
+   }
+   this->rate = rate;
+   this->burst = burst > 0 ? burst : rate;
+}
+
+AdmissionControl::AdmissionControl(CookieDaemonConfig * config)
+: peers(config->getPeerRate(), config->getPeerBurst()),
+  ips(config->getIPRate(), config->getIPBurst()),
+  maxConcurrent(config->getMaxConcurrent()), inFlight(0)
+{
+}
+
+/*
+ * Method Name: admitPeer
+ *
+ * Description: identifies the peer connected on fd and charges its token
+ *                 bucket.
+ *
+ * Arguments  : int fd - accepted socket
+ *
+ * Returns    : bool - false if the peer is over its rate
+ *
+ */
+bool AdmissionControl::admitPeer(int fd)
+{
+   return admitPeerKey(peerKey(fd));
+}
+
+/*
+ * Method Name: peerKey
+ *
+ * Description: identifies a local process with SO_PEERCRED, keyed by uid
+ *                 and pid so one runaway Apache child cannot starve its
+ *                 siblings.  A TCP peer is keyed by its address, so each
+ *                 web node gets one bucket however many connections it
+ *                 opens.
+ *
+ * Arguments  : int fd - accepted socket
+ *
+ * Returns    : unsigned long long - key for admitPeerKey(); 0 if the peer
+ *                 cannot be identified
+ *
+ */
+unsigned long long AdmissionControl::peerKey(int fd)
+{
+   struct sockaddr_storage sa;
+   socklen_t salen = sizeof(sa);
+   if (getpeername(fd, (struct sockaddr *) &sa, &salen) < 0)
+      return 0;
+
+   unsigned long long key;
+   if (sa.ss_family == AF_INET)
+   {
+      key = ((struct sockaddr_in *) &sa)->sin_addr.s_addr;
+   }
+   else if (sa.ss_family == AF_INET6)
+   {
+      const unsigned char * addr = ((struct sockaddr_in6 *) &sa)->sin6_addr.s6_addr;
+      key = 14695981039346656037ULL;
+      for (int i = 0; i < 16; i++)
+      {
+         key ^= addr[i];
+         key *= 1099511628211ULL;
+      }
+   }
+   else
+   {
+      struct ucred cred;
+      socklen_t len = sizeof(cred);
+      if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+         return 0;  //not a local peer; nothing to key on
+      key = ((unsigned long long) cred.uid << 32) | (unsigned int) cred.pid;
+   }
+   return mixKey(key) | 1;  //never 0
+}
+
+bool AdmissionControl::admitPeerKey(unsigned long long key)
+{
+   if (key == 0)
+      return true;
+   return peers.allow(key, monotonicMicros());
+}
+
+/*
+ * Method Name: admitIP
+ *
+ * Description: charges the token bucket of the client IP named in a cookie
+ *
+ * Arguments  : const char * IP - IP field of a parsed cookie
+ *
+ * Returns    : bool - false if the IP is over its rate
+ *
+ */
+bool AdmissionControl::admitIP(const char * IP)
+{
+   return ips.allow(hashString(IP), monotonicMicros());
+}
+
+bool AdmissionControl::enter()
+{
+   if (maxConcurrent > 0 && inFlight >= maxConcurrent)
+      return false;
+   inFlight++;
+   return true;
+}
+
+void AdmissionControl::leave()
+{
+   if (inFlight > 0)
+      inFlight--;
+}
+
+void AdmissionControl::reconfigure(CookieDaemonConfig * config)
+{
+   peers.setLimits(config->getPeerRate(), config->getPeerBurst());
+   ips.setLimits(config->getIPRate(), config->getIPBurst());
+   maxConcurrent = config->getMaxConcurrent();
+}
@@ -0,0 +1,93 @@
+#ifndef ADMISSION_CONTROL_H
+#define ADMISSION_CONTROL_H
+
+#include "CookieDaemonConfig.h"
+
+/*
+ * Class Name  : TokenBucketTable
+ *
+ * Description : Fixed-size table of token buckets keyed by a 64-bit hash.
+ *              Each key may spend up to burst tokens at once and earns rate
+ *              tokens per second.  The table never grows: when a key is not
+ *              present, the least recently used bucket in its probe window is
+ *              recycled, so memory stays bounded no matter how many distinct
+ *              clients show up.
+ *
+ * Method Index: TokenBucketTable(int rate, int burst) - constructor; a rate
+ *                  of 0 disables the table (allow() always succeeds).
+ *               bool allow(unsigned long long key, long long now) - spends
+ *                  one token for key at monotonic time now (microseconds).
+ *                  Returns true if a token was available.
+ *               void setLimits(int rate, int burst) - changes the rate and
+ *                  burst; existing buckets keep their tokens up to the new
+ *                  burst.
+ *
+ */
+class TokenBucketTable
+{
+   public:
+      TokenBucketTable(int rate, int burst);
+      ~TokenBucketTable();
+      bool allow(unsigned long long key, long long now);
+      void setLimits(int rate, int burst);
+   private:
+      struct Bucket
+      {
+         unsigned long long key;
+         double tokens;
+         long long last;   /* monotonic micros of last refill; 0 = unused */
+      };
+      static const int TABLE_SIZE = 1024;  /* must be a power of two */
+      static const int PROBE_WINDOW = 4;
+      Bucket * buckets;
+      double rate;
+      double burst;
+};
+
+/*
+ * Class Name  : AdmissionControl
+ *
+ * Description : Decides whether cookieDaemon should spend a database round
+ *              trip on a request.  Combines a per-peer token bucket (keyed by
+ *              the SO_PEERCRED uid/pid of a local connecting process, or the
+ *              address of a TCP peer), a per-IP
+ *              token bucket (keyed by the IP inside the cookie) and a global
+ *              limit on requests in flight.  All limits are read from
+ *              CookieDaemonConfig and default to off.
+ *
+ * Method Index: AdmissionControl(CookieDaemonConfig * config) - constructor
+ *               bool admitPeer(int fd) - charges the peer connected on fd.
+ *                  Returns false if that peer is over its rate.
+ *               static unsigned long long peerKey(int fd) - identifies the
+ *                  peer connected on fd, so a connection carrying many
+ *                  requests need only look once; 0 if unknown
+ *               bool admitPeerKey(unsigned long long key) - charges the peer
+ *                  with that key, as admitPeer() does
+ *               bool admitIP(const char * IP) - charges the cookie IP.
+ *                  Returns false if that IP is over its rate.
+ *               bool enter() - reserves an in-flight slot.  Returns false
+ *                  if MAX_CONCURRENT requests are already in flight.
+ *               void leave() - releases a slot reserved by enter().
+ *               void reconfigure(CookieDaemonConfig * config) - takes new
+ *                  limits from a reloaded config.
+ *
+ */
+class AdmissionControl
+{
+   public:
+      AdmissionControl(CookieDaemonConfig * config);
+      bool admitPeer(int fd);
+      static unsigned long long peerKey(int fd);
+      bool admitPeerKey(unsigned long long key);
+      bool admitIP(const char * IP);
+      bool enter();
+      void leave();
+      void reconfigure(CookieDaemonConfig * config);
+   private:
+      TokenBucketTable peers;
+      TokenBucketTable ips;
+      int maxConcurrent;
+      int inFlight;
+};
+
+#endif
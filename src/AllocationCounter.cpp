@@ -0,0 +1,38 @@
+#include "AllocationCounter.h"
+#include <stddef.h>
+
+/* glibc's allocator, under the names it exports for wrappers like these */
+extern "C"
+{
+   void * __libc_malloc(size_t size);
+   void * __libc_calloc(size_t count, size_t size);
+   void * __libc_realloc(void * pointer, size_t size);
+   void __libc_free(void * pointer);
+}
+
+static volatile long allocations = 0;
+
+extern "C" void * malloc(size_t size)
+{
+   __sync_fetch_and_add(&allocations, 1);
+   return __libc_malloc(size);
+}
+
+extern "C" void * calloc(size_t count, size_t size)
+{
+   __sync_fetch_and_add(&allocations, 1);
+   return __libc_calloc(count, size);
+}
+
+extern "C" void * realloc(void * pointer, size_t size)
+{
+   __sync_fetch_and_add(&allocations, 1);
+   return __libc_realloc(pointer, size);
+}
+
+extern "C" void free(void * pointer)
+{
+   __libc_free(pointer);
+}
+
+long AllocationCounter::getCount() { return allocations; }
@@ -0,0 +1,25 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+/*
+ * Class Name  : AllocationCounter
+ *
+ * Description : Counts heap allocations made anywhere in the process, to
+ *              check that the daemon's request path makes none.  Built
+ *              only with make COUNT_ALLOCATIONS=1, which links a malloc(),
+ *              calloc() and realloc() that count each call before handing
+ *              it to glibc's allocator; operator new goes through malloc()
+ *              and is counted too.  The daemon reports the count as the
+ *              "allocations" metric, and benchCookie divides it by the
+ *              requests it sent.
+ *
+ * Method Index: static long getCount() - allocations so far
+ *
+ */
+class AllocationCounter
+{
+   public:
+      static long getCount();
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include "CaptureLog.h"
+#include "CookieProtocol.h"
+#include "DaemonLog.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * Method Name: CaptureLog
+ *
+ * Description: Class constructor.  Opens (or creates) the capture file for
+ *                 appending.
+ *
+ * Arguments  : const std::string &path - CAPTURE_PATH
+ *              TimerWheel * timers - the loop's, for the flush timer
+ *
+ * Returns    : none
+ */
+CaptureLog::CaptureLog(const std::string &path, TimerWheel * timers)
+: path(path), timers(timers), used(0), recorded(0)
+{
+   fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0640);
+   if (fd < 0)
+      throw std::runtime_error("Cannot open CAPTURE_PATH " + path + ": " + strerror(errno));
+   flushTimer.callback = flushDue;
+   flushTimer.context = this;
+}
+
+CaptureLog::~CaptureLog()
+{
+   flush();
+   timers->cancel(&flushTimer);
+   close(fd);
+}
+
+/*
+ * Method Name: record
+ *
+ * Description: adds one answered check to the buffer, writing the buffer
+ *                 out first if the record would not fit
+ *
+ * Arguments  : long long time - arrival, microseconds since the epoch
+ *              int latency - microseconds from arrival to reply
+ *              int result - the reply: softLifetime, 0, or -1 if busy
+ *              const char * text - the cookie text; cut at MAX_TEXT
+ *
+ * Returns    : none
+ */
+void CaptureLog::record(long long time, int latency, int result, const char * text)
+{
+   size_t length = strlen(text);
+   if (length > (size_t) MAX_TEXT)
+      length = MAX_TEXT;
+   if (used + HEADER_SIZE + length > BUFFER_SIZE)
+      flush();
+
+   unsigned char * out = buffer + used;
+   out[0] = MAGIC;
+   out[1] = (unsigned char) length;
+   CookieProtocol::putInt((unsigned int) ((unsigned long long) time >> 32), out + 2);
+   CookieProtocol::putInt((unsigned int) time, out + 6);
+   CookieProtocol::putInt((unsigned int) latency, out + 10);
+   CookieProtocol::putInt((unsigned int) result, out + 14);
+   memcpy(out + HEADER_SIZE, text, length);
+   used += HEADER_SIZE + length;
+   recorded++;
+
+   if (!TimerWheel::scheduled(&flushTimer))
+      timers->schedule(&flushTimer, FLUSH_DELAY_MS);
+}
+
+void CaptureLog::flush()
+{
+   /* one write(), so records from several processes never interleave */
+   if (used > 0 && write(fd, buffer, used) != (ssize_t) used)
+      DaemonLog::write("CaptureLog: error writing %s - %s\n", path.c_str(), strerror(errno));
+   used = 0;
+}
+
+void CaptureLog::flushDue(TimerWheel::Timer * timer)
+{
+   ((CaptureLog *) timer->context)->flush();
+}
+
+std::string CaptureLog::getPath() { return path; }
+unsigned long CaptureLog::getRecorded() { return recorded; }
+
+int CaptureLog::read(FILE * in, Record &record)
+{
+   unsigned char header[HEADER_SIZE];
+   size_t got = fread(header, 1, HEADER_SIZE, in);
+   if (got == 0)
+      return 0;
+   if (got < (size_t) HEADER_SIZE || header[0] != MAGIC)
+      return -1;
+
+   size_t length = header[1];
+   record.time = (long long) (((unsigned long long) CookieProtocol::getInt(header + 2) << 32) | CookieProtocol::getInt(header + 6));
+   record.latency = (int) CookieProtocol::getInt(header + 10);
+   record.result = (int) CookieProtocol::getInt(header + 14);
+   if (fread(record.text, 1, length, in) != length)
+      return -1;
+   record.text[length] = '\0';
+   return 1;
+}
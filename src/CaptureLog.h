@@ -0,0 +1,82 @@
+#ifndef CAPTURE_LOG_H
+#define CAPTURE_LOG_H
+
+#include <stdio.h>
+#include <string>
+#include "TimerWheel.h"
+
+/*
+ * Class Name  : CaptureLog
+ *
+ * Description : Binary log of the cookie checks a daemon answers, written
+ *              when CAPTURE_PATH is set and read back by replayCookie.
+ *              Each record is the time the request arrived, the cookie
+ *              text as the client sent it, the reply and how long the
+ *              daemon took to give it:
+ *
+ *                 byte  0      MAGIC
+ *                 byte  1      length of the cookie text
+ *                 bytes 2-9    arrival, microseconds since the epoch
+ *                 bytes 10-13  latency, microseconds
+ *                 bytes 14-17  reply: softLifetime, 0, or -1 if busy
+ *                 bytes 18-    cookie text, not terminated
+ *
+ *              Numbers are big-endian, as in CookieProtocol.  Every record
+ *              stands alone, so pre-fork workers append to the same file:
+ *              records are buffered and written with O_APPEND a whole
+ *              buffer at a time, when it fills and a second after the
+ *              first record it holds.  Records from different processes
+ *              are therefore only roughly in time order.
+ *
+ * Method Index: CaptureLog(const std::string &path, TimerWheel * timers) -
+ *                  constructor; opens path for appending and flushes on
+ *                  timers.  Throws std::runtime_error if it cannot.
+ *               ~CaptureLog() - flushes and closes
+ *               void record(long long time, int latency, int result,
+ *                  const char * text) - logs one answered check
+ *               void flush() - writes what is buffered
+ *               std::string getPath()
+ *               unsigned long getRecorded() - records logged so far
+ *               static int read(FILE * in, Record &record) - the next
+ *                  record of a capture: 1, 0 at the end, -1 if the file is
+ *                  not a capture or is cut short
+ *
+ */
+class CaptureLog
+{
+   public:
+      static const unsigned char MAGIC = 0xCA;
+      static const int HEADER_SIZE = 18;
+      static const int MAX_TEXT = 255;
+
+      struct Record
+      {
+         long long time;    /* microseconds since the epoch */
+         int latency;       /* microseconds */
+         int result;
+         char text[MAX_TEXT + 1];
+      };
+
+      CaptureLog(const std::string &path, TimerWheel * timers);
+      ~CaptureLog();
+      void record(long long time, int latency, int result, const char * text);
+      void flush();
+      std::string getPath();
+      unsigned long getRecorded();
+      static int read(FILE * in, Record &record);
+   private:
+      static const size_t BUFFER_SIZE = 65536;
+      static const int FLUSH_DELAY_MS = 1000;
+
+      static void flushDue(TimerWheel::Timer * timer);
+
+      std::string path;
+      int fd;
+      TimerWheel * timers;
+      TimerWheel::Timer flushTimer;
+      unsigned char buffer[BUFFER_SIZE];
+      size_t used;
+      unsigned long recorded;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#include "ConcurrencyLimiter.h"
+#include "DaemonClock.h"
+
+ConcurrencyLimiter::ConcurrencyLimiter(CookieDaemonConfig * config)
+: limit(config->getDBLimitInitial()), maxLimit(config->getDBLimitMax()),
+  tolerance(config->getDBLatencyTolerance()), inFlight(0), samples(0),
+  baseline(0), windowMin(0), smoothed(0), lastDecrease(0)
+{
+   if (limit < MIN_LIMIT)
+      limit = MIN_LIMIT;
+   if (maxLimit > 0 && limit > maxLimit)
+      limit = maxLimit;
+}
+
+/*
+ * Method Name: acquire
+ *
+ * Description: reserves a slot for one database call if fewer than the
+ *                 current limit are in flight.
+ *
+ * Arguments  : none
+ *
+ * Returns    : bool - true if the call may proceed
+ *
+ */
+bool ConcurrencyLimiter::acquire()
+{
+   if (maxLimit > 0 && inFlight >= (int) limit)
+      return false;
+   inFlight++;
+   return true;
+}
+
+/*
+ * Method Name: release
+ *
+ * Description: returns a slot taken by acquire() and adjusts the limit from
+ *                 the call's latency (see record()): additive increase
+ *                 while latency is near the baseline, multiplicative
+ *                 decrease when it is not.
+ *
+ * Arguments  : long long latency - duration of the call in microseconds
+ *              bool failed - true if the call errored; treated as congestion
+ *
+ * Returns    : none
+ *
+ */
+void ConcurrencyLimiter::release(long long latency, bool failed)
+{
+   if (inFlight > 0)
+      inFlight--;
+   record(latency, failed);
+}
+
+/*
+ * Method Name: record
+ *
+ * Description: adjusts the limit from a call's latency, as release(), for
+ *                 a call that did not go through acquire()
+ *
+ * Arguments  : long long latency - duration of the call in microseconds
+ *              bool failed - true if the call errored
+ *
+ * Returns    : none
+ *
+ */
+void ConcurrencyLimiter::record(long long latency, bool failed)
+{
+   smoothed = (smoothed == 0) ? latency : (smoothed * 7 + latency) / 8;
+
+   if (windowMin == 0 || latency < windowMin)
+      windowMin = latency;
+   if (baseline == 0)
+      baseline = windowMin;  //first call seeds the baseline
+   if (++samples % WINDOW == 0)
+   {
+      baseline = windowMin;
+      windowMin = 0;
+   }
+
+   if (maxLimit <= 0)
+      return;
+
+   if (failed || latency * 100 > baseline * tolerance)
+   {
+      //one cut per round trip, so a burst of completions from the same
+      //slow period does not collapse the limit
+      long long now = monotonicMicros();
+      if (now - lastDecrease > smoothed)
+      {
+         limit *= 0.9;
+         if (limit < MIN_LIMIT)
+            limit = MIN_LIMIT;
+         lastDecrease = now;
+      }
+   }
+   else
+   {
+      limit += 1.0 / limit;
+      if (limit > maxLimit)
+         limit = maxLimit;
+   }
+}
+
+int ConcurrencyLimiter::getLimit() { return (int) limit; }
+int ConcurrencyLimiter::getInFlight() { return inFlight; }
+long long ConcurrencyLimiter::getSmoothedLatency() { return smoothed; }
+
+void ConcurrencyLimiter::reconfigure(CookieDaemonConfig * config)
+{
+   maxLimit = config->getDBLimitMax();
+   tolerance = config->getDBLatencyTolerance();
+   if (maxLimit > 0 && limit > maxLimit)
+      limit = maxLimit;
+}
@@ -0,0 +1,64 @@
+#ifndef CONCURRENCY_LIMITER_H
+#define CONCURRENCY_LIMITER_H
+
+#include "CookieDaemonConfig.h"
+
+/*
+ * Class Name  : ConcurrencyLimiter
+ *
+ * Description : Adaptive (AIMD) limit on the number of database calls
+ *              cookieDaemon has in flight.  Every completed call reports its
+ *              latency.  While latency stays within DB_LATENCY_TOLERANCE
+ *              percent of the recent best latency the limit grows by roughly
+ *              one per limit's worth of calls; when latency rises above it
+ *              (or a call fails) the limit is cut by 10%, at most once per
+ *              observed round trip.  The baseline is re-taken every window of
+ *              calls so a permanently slower database is eventually accepted
+ *              as normal rather than throttled forever.
+ *
+ *              Owned by the request loop; not thread-safe.
+ *
+ * Method Index: ConcurrencyLimiter(CookieDaemonConfig * config) - constructor.
+ *                  DB_LIMIT_MAX of 0 disables limiting.
+ *               bool acquire() - reserves a slot for one database call.
+ *                  Returns false if the current limit is reached; the
+ *                  caller should fail fast instead of queueing.
+ *               void release(long long latency, bool failed) - returns the
+ *                  slot and feeds the call's latency (microseconds) back
+ *                  into the limit.
+ *               void record(long long latency, bool failed) - feeds back
+ *                  the latency of a call that took no slot
+ *               int getLimit() - current limit, rounded down
+ *               int getInFlight() - calls currently holding a slot
+ *               long long getSmoothedLatency() - EWMA of call latency (us)
+ *               void reconfigure(CookieDaemonConfig * config) - takes a new
+ *                  DB_LIMIT_MAX and DB_LATENCY_TOLERANCE from a reloaded
+ *                  config; the current limit is kept if it still fits
+ *
+ */
+class ConcurrencyLimiter
+{
+   public:
+      ConcurrencyLimiter(CookieDaemonConfig * config);
+      bool acquire();
+      void release(long long latency, bool failed);
+      void record(long long latency, bool failed);
+      int getLimit();
+      int getInFlight();
+      long long getSmoothedLatency();
+      void reconfigure(CookieDaemonConfig * config);
+   private:
+      static const int WINDOW = 500;   /* calls per baseline window */
+      static const int MIN_LIMIT = 1;
+      double limit;
+      int maxLimit;
+      int tolerance;         /* percent of baseline latency */
+      int inFlight;
+      long samples;
+      long long baseline;    /* best latency of the previous window */
+      long long windowMin;   /* best latency so far this window */
+      long long smoothed;
+      long long lastDecrease;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#include "CookieBackend.h"
+#include "OCCI_IGSPnet.h"
+#include "Local_IGSPnet.h"
+#include <stdexcept>
+
+/*
+ * Method Name: create
+ *
+ * Description: builds the backend named by DB_BACKEND: "oracle" (the
+ *                 default) or "local".
+ *
+ * Arguments  : CookieDaemonConfig * config - daemon configuration
+ *              bool threaded - backend will be used from a thread other than
+ *                 the one creating it
+ *              bool replica - connect to the read replica instead of the
+ *                 primary
+ *
+ * Returns    : CookieBackend * - caller must delete
+ *
+ */
+CookieBackend * CookieBackend::create(CookieDaemonConfig * config, bool threaded, bool replica)
+{
+   if (config->getBackend().compare("local") == 0)
+      return new Local_IGSPnet(config, replica);
+   if (config->getBackend().compare("oracle") == 0)
+      return new OCCI_IGSPnet(threaded, replica);
+   throw std::runtime_error("Unknown DB_BACKEND " + config->getBackend());
+}
+
+bool CookieBackend::replicaConfigured(CookieDaemonConfig * config)
+{
+   if (config->getBackend().compare("local") == 0)
+      return config->getLocalReplicaPath().length() > 0;
+   return config->getReplicaConnectionString().length() > 0;
+}
@@ -0,0 +1,167 @@
+#ifndef COOKIE_BACKEND_H
+#define COOKIE_BACKEND_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "CookieDaemonConfig.h"
+
+/* One IGSPnet user as seen by the replica sync; times are epoch seconds */
+struct UserRecord
+{
+   char userID[13];
+   int enabled;
+   char cookieVersion[2];   /* user's active cookie version */
+   char dukey[2];
+   long long modified;
+};
+
+/* One issued cookie as seen by the replica sync; times are epoch seconds */
+struct CookieRecord
+{
+   char userID[13];
+   char IP[16];
+   char clientID[5];
+   char cookieVersion[2];
+   int softLifetime;
+   long long softTS;        /* last time the cookie was used */
+   long long hardTS;        /* absolute expiry */
+   long long modified;
+};
+
+/* A cookie a read replica found valid, whose soft timestamp is still to be
+ * refreshed on the primary */
+struct CookieTouch
+{
+   char userID[13];
+   char IP[16];
+   char clientID[5];
+   char cookieVersion[2];
+   int softLifetime;        /* set by touchCookies(): 0 if the primary now rejects it */
+};
+
+/* Key of a UserRecord (userID) or CookieRecord (userID|IP|clientID) in a
+ * map of them.  It lives in a fixed buffer, so finding a record by the
+ * fields of a parsed cookie does not allocate. */
+struct RecordKey
+{
+   char text[36];
+
+   RecordKey(const char * userID)
+   {
+      snprintf(text, sizeof (text), "%s", userID);
+   }
+   RecordKey(const char * userID, const char * IP, const char * clientID)
+   {
+      snprintf(text, sizeof (text), "%s|%s|%s", userID, IP, clientID);
+   }
+   bool operator<(const RecordKey &other) const { return strcmp(text, other.text) < 0; }
+};
+
+/*
+ * Class Name  : CookieBackend
+ *
+ * Description : Interface to the store of IGSPnet users and cookies.
+ *              OCCI_IGSPnet implements it against Oracle; Local_IGSPnet is an
+ *              in-memory stand-in for testing without a database.
+ *              DB_BACKEND in the config picks one.
+ *
+ *              A backend may instead be connected to a read replica of the
+ *              database (DB_REPLICA_CONN_STRING, or LOCAL_REPLICA_PATH for
+ *              the stand-in).  DBPool sends it readCookie() and the primary
+ *              touchCookies() for what it found valid.
+ *
+ * Method Index: static CookieBackend * create(CookieDaemonConfig * config,
+ *                  bool threaded, bool replica) - builds the configured
+ *                  backend, on the read replica if replica.  Throws
+ *                  std::runtime_error (or SQLException) if it cannot start.
+ *               static bool replicaConfigured(CookieDaemonConfig * config)
+ *                  - true if the config names a read replica for the
+ *                  backend
+ *               int checkCookie(...), int insertCookie(...) - see
+ *                  OCCI_IGSPnet.h
+ *               int readCookie(const char * userID, const char * IP,
+ *                  const char * clientID, const char * cookieVersion) -
+ *                  checkCookie without the write: softLifetime if the
+ *                  cookie is valid, 0 if it is not, or MISS if a lagging
+ *                  replica cannot tell (the user or cookie is missing, or
+ *                  the cookie looks soft-expired).  Throws if the database
+ *                  cannot be reached.
+ *               void touchCookies(CookieTouch * touches, int count) -
+ *                  refreshes the soft timestamps of up to TOUCH_BATCH
+ *                  cookies in one round trip, setting each one's
+ *                  softLifetime as checkCookie would.  Throws if the
+ *                  database cannot be reached.
+ *               long replicaLag() - seconds the replica is behind its
+ *                  primary; 0 for a primary, -1 if it cannot tell.  Throws
+ *                  if the database cannot be reached.
+ *               int fetchUsers(long long since,
+ *                  std::vector<UserRecord> &users) - appends every user
+ *                  modified after since (epoch seconds) to users.  Returns
+ *                  0, or -1 if the backend cannot provide a sync.
+ *               int fetchCookies(long long since,
+ *                  std::vector<CookieRecord> &cookies) - likewise for
+ *                  unexpired cookies.
+ *               static int judgeCookie(const UserRecord * user,
+ *                  const CookieRecord * cookie, const char * cookieVersion,
+ *                  long long now) - readCookie's answer from a replica's
+ *                  rows (NULL if it has none).  Inline, so signCookie
+ *                  can link OCCI_IGSPnet.o without CookieBackend.o.
+ *
+ */
+class CookieBackend
+{
+   public:
+      static const int MISS = -1;
+      static const int TOUCH_BATCH = 64;
+
+      virtual ~CookieBackend() {}
+      static CookieBackend * create(CookieDaemonConfig * config, bool threaded, bool replica = false);
+      static bool replicaConfigured(CookieDaemonConfig * config);
+      virtual int checkCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion) = 0;
+      virtual int insertCookie(const char * userID, const char * IP, const int hardLifetime, const int softLifetime, char * dukey, char * cookieVersion, char * clientID) = 0;
+      virtual int readCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion) = 0;
+      virtual void touchCookies(CookieTouch * touches, int count) = 0;
+      virtual long replicaLag() = 0;
+      virtual int fetchUsers(long long since, std::vector<UserRecord> &users) = 0;
+      virtual int fetchCookies(long long since, std::vector<CookieRecord> &cookies) = 0;
+      static int judgeCookie(const UserRecord * user, const CookieRecord * cookie, const char * cookieVersion, long long now);
+};
+
+/*
+ * Method Name: judgeCookie
+ *
+ * Description: decides a cookie from a read replica's rows, as CHECK_COOKIE
+ *                 would on the primary, where it can.  Only a hard expiry
+ *                 is conclusive as a rejection.  A disabled user may have
+ *                 been re-enabled on the primary, and a cookie version
+ *                 other than the user's may be a new login after a version
+ *                 bump.  A user or cookie the replica does not have may
+ *                 simply not have arrived yet, and a cookie that looks
+ *                 soft-expired may have been used since on the primary.
+ *                 A valid answer can be stale too (a user disabled since),
+ *                 which DB_REPLICA_MAX_LAG bounds.
+ *
+ * Arguments  : const UserRecord * user - the cookie's user; NULL if none
+ *              const CookieRecord * cookie - the cookie; NULL if none
+ *              const char * cookieVersion - version the cookie presents
+ *              long long now - epoch seconds
+ *
+ * Returns    : int - softLifetime if valid, 0 if invalid, MISS if the
+ *                 primary must decide
+ *
+ */
+inline int CookieBackend::judgeCookie(const UserRecord * user, const CookieRecord * cookie, const char * cookieVersion, long long now)
+{
+   if (user == NULL || !user->enabled || strcmp(user->cookieVersion, cookieVersion) != 0)
+      return MISS;
+   if (cookie == NULL || strcmp(cookie->cookieVersion, cookieVersion) != 0)
+      return MISS;
+   if (now >= cookie->hardTS)
+      return 0;
+   if (now >= cookie->softTS + cookie->softLifetime)
+      return MISS;
+   return cookie->softLifetime;
+}
+
+#endif
@@ -0,0 +1,359 @@
+#include "CookieClient.h"
+#include "CookieProtocol.h"
+#include "IGSPnet_Cookie_Streamer.h"
+#include "RSA_Sign_Verify.h"
+#include "DaemonClock.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+
+/*
+ * Method Name: CookieClient
+ *
+ * Description: Class constructor.  Attaches the daemon's cache read-only if
+ *    CACHE_SHM_PATH is set and readable; otherwise every check goes to the
+ *    daemon.
+ *
+ * Arguments  : CookieDaemonConfig * config - SOCKET_PATH (or DAEMON_HOST
+ *                 and DAEMON_PORT), DAEMON_PROTOCOL, REQUEST_TIMEOUT and
+ *                 CACHE_SHM_PATH
+ *
+ * Returns    : none
+ */
+CookieClient::CookieClient(CookieDaemonConfig * config)
+: socketPath(config->getSocketPath()), daemonHost(config->getDaemonHost()),
+  daemonPort(config->getDaemonPort()), binary(config->getDaemonProtocol() == "binary"),
+  timeout(0), deadline(0), cache(NULL)
+{
+   setTimeout(config->getRequestTimeout());
+   if (config->getCacheShmPath().length() > 0)
+      cache = VerificationCache::attach(config->getCacheShmPath().c_str());
+}
+
+CookieClient::~CookieClient()
+{
+   delete cache;
+}
+
+int CookieClient::check(const char * cookieText, char * response)
+{
+   if (checkCache(cookieText, response) == 0)
+      return 0;
+   deadline = (timeout > 0) ? monotonicMicros() + timeout * 1000LL : 0;
+   return askDaemon(cookieText, response);
+}
+
+void CookieClient::setTimeout(int milliseconds)
+{
+   timeout = (milliseconds > 0) ? milliseconds : 0;
+}
+
+/* milliseconds to the deadline, rounded up; 0 if it has passed, -1 if there
+ * is none */
+int CookieClient::remaining()
+{
+   if (deadline == 0)
+      return -1;
+   long long left = deadline - monotonicMicros();
+   return (left > 0) ? (int) ((left + 999) / 1000) : 0;
+}
+
+/* bounds the next connect(), send() or recv() on s by the deadline.  false,
+ * reported, if it has passed already. */
+bool CookieClient::arm(int s)
+{
+   int left = remaining();
+   if (left < 0)
+      return true;
+   if (left == 0)
+   {
+      fprintf(stderr, "daemon did not answer within %d ms\n", timeout);
+      return false;
+   }
+   struct timeval tv;
+   tv.tv_sec = left / 1000;
+   tv.tv_usec = (left % 1000) * 1000;
+   setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+   setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+   return true;
+}
+
+/* whether the call that just failed ran out of time; reported if so */
+bool CookieClient::timedOut(const char * call)
+{
+   if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINPROGRESS)
+      return false;
+   fprintf(stderr, "%s(): daemon did not answer within %d ms\n", call, timeout);
+   return true;
+}
+
+/* answers from the cache if it has a fresh entry; -1 otherwise */
+int CookieClient::checkCache(const char * cookieText, char * response)
+{
+   if (cache == NULL)
+      return -1;
+
+   char cookieTextForParse[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
+   char userID[13];
+   char dukey[2];
+   char IP[16];
+   char cookieVersion[2];
+   char clientID[5];
+
+   if (strlen(cookieText) >= sizeof(cookieTextForParse))
+      return -1;
+   strcpy(cookieTextForParse, cookieText);
+   if (IGSPnet_Cookie_Streamer::parseCookie(cookieTextForParse, userID, dukey, IP, cookieVersion, clientID) != 0)
+      return -1;  //let the daemon reject it
+
+   int softLifetime = cache->lookup(userID, IP, clientID, cookieVersion, time(NULL), FRESH_MARGIN);
+   if (softLifetime == VerificationCache::MISS)
+      return -1;
+   sprintf(response, "%d", softLifetime);
+   return 0;
+}
+
+/*
+ * Method Name: askDaemon
+ *
+ * Description: sends the cookie text over the daemon's socket and reads its
+ *                 reply
+ *
+ * Arguments  : const char * cookieText - cookie to check
+ *              char * response - receives the reply, NUL-terminated
+ *
+ * Returns    : int - 0 on success, -1 on error (already logged)
+ */
+int CookieClient::askDaemon(const char * cookieText, char * response)
+{
+   int s;
+   int count;
+   bool framed = daemonHost.length() > 0;
+
+   if ((s = connectDaemon()) < 0)
+      return -1;
+   if (binary)
+      return askDaemonBinary(s, cookieText, response, CookieProtocol::VERSION);
+
+   std::string request(cookieText);
+   if (framed)
+      request += '\n';
+   if (!arm(s) || send(s, request.data(), request.length(), MSG_NOSIGNAL) < 0)
+   {
+      if (remaining() != 0 && !timedOut("send"))
+         fprintf(stderr, "send(): error sending cookie to daemon\n");
+      close(s);
+      return -1;
+   }
+
+   /* the local daemon replies and closes; a remote one replies with a
+    * line and waits for more */
+   int total = 0;
+   count = 0;
+   while (total < RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE - 1)
+   {
+      if (!arm(s))
+      {
+         close(s);
+         return -1;
+      }
+      count = recv(s, response + total, RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE - 1 - total, 0);
+      if (count <= 0)
+         break;
+      total += count;
+      if (!framed || memchr(response, '\n', total) != NULL)
+         break;
+   }
+   bool late = (count < 0 && timedOut("recv"));
+   close(s);
+   if (late)
+      return -1;
+   if (count < 0)
+   {
+      fprintf(stderr, "recv(): error receiving from daemon\n");
+      return -1;
+   }
+   else if (total == 0)
+   {
+      fprintf(stderr, "server closed connection\n");
+      return -1;
+   }
+   response[total] = '\0';
+   if (framed)
+      response[strcspn(response, "\r\n")] = '\0';
+   return 0;
+}
+
+/*
+ * Method Name: askDaemonBinary
+ *
+ * Description: sends the cookie text as a CHECK frame and turns the
+ *                 response frame back into the text protocol's reply.  A
+ *                 version 2 frame carries the time left to the deadline;
+ *                 a daemon that only speaks version 1 is asked again in
+ *                 that.
+ *
+ * Arguments  : int s - connection to the daemon; closed before returning
+ *              const char * cookieText - cookie to check
+ *              char * response - receives the reply, NUL-terminated
+ *              int version - of the frame to send
+ *
+ * Returns    : int - 0 on success, -1 on error (already logged)
+ */
+int CookieClient::askDaemonBinary(int s, const char * cookieText, char * response, int version)
+{
+   static const unsigned int REQUEST_ID = 1;  //one request per connection
+   std::string request;
+   int left = remaining();
+   CookieProtocol::appendFrame(request, CookieProtocol::CHECK, CookieProtocol::OK, REQUEST_ID, cookieText, strlen(cookieText),
+      version, (left > 0) ? left : 0);
+   if (!arm(s) || send(s, request.data(), request.length(), MSG_NOSIGNAL) < 0)
+   {
+      if (remaining() != 0 && !timedOut("send"))
+         fprintf(stderr, "send(): error sending cookie to daemon\n");
+      close(s);
+      return -1;
+   }
+
+   /* a CHECK response is a header and a 4-byte soft lifetime, or a bare
+    * header if the check was not answered */
+   unsigned char frame[CookieProtocol::MAX_HEADER_SIZE + 4];
+   size_t total = 0;
+   size_t wanted = CookieProtocol::HEADER_SIZE;
+   size_t size = 0;
+   CookieProtocol::Header header;
+   bool decoded = false;
+   bool late = false;
+   while (total < wanted)
+   {
+      if (!arm(s))
+      {
+         late = true;
+         break;
+      }
+      ssize_t count = recv(s, frame + total, wanted - total, 0);
+      if (count <= 0)
+      {
+         late = (count < 0 && timedOut("recv"));
+         break;
+      }
+      total += count;
+      if (total == CookieProtocol::HEADER_SIZE && !decoded)
+         wanted = size = CookieProtocol::headerSize(frame);
+      if (total == size && !decoded)
+      {
+         if (CookieProtocol::decodeHeader(frame, header) != 0 || header.id != REQUEST_ID || header.length > 4)
+            break;
+         decoded = true;
+         wanted += header.length;
+      }
+   }
+   close(s);
+   if (late)
+      return -1;
+   if (!decoded || total < wanted)
+   {
+      fprintf(stderr, "recv(): no binary reply from daemon\n");
+      return -1;
+   }
+
+   if (header.status == CookieProtocol::UNSUPPORTED && header.version < version)
+   {
+      if ((s = connectDaemon()) < 0)
+         return -1;
+      return askDaemonBinary(s, cookieText, response, header.version);
+   }
+   if (header.status == CookieProtocol::OK && header.length == 4)
+      sprintf(response, "%d", (int) CookieProtocol::getInt(frame + size));
+   else if (header.status == CookieProtocol::BUSY)
+      strcpy(response, BUSY_RESPONSE);
+   else if (header.status == CookieProtocol::BAD_REQUEST)
+      strcpy(response, "0");  //unparsable cookie
+   else if (header.status == CookieProtocol::TIMEOUT)
+   {
+      fprintf(stderr, "daemon did not answer within %d ms\n", timeout);
+      return -1;
+   }
+   else
+   {
+      fprintf(stderr, "daemon refused CHECK - status %d\n", header.status);
+      return -1;
+   }
+   return 0;
+}
+
+/*
+ * Method Name: connectDaemon
+ *
+ * Description: opens a connection to the daemon: SOCKET_PATH, or
+ *                 DAEMON_HOST and DAEMON_PORT if a host is configured,
+ *                 giving up at the deadline
+ *
+ * Arguments  : none
+ *
+ * Returns    : int - connected socket, or -1 on error (already logged)
+ */
+int CookieClient::connectDaemon()
+{
+   int s;
+
+   if (daemonHost.length() > 0)
+   {
+      struct addrinfo hints;
+      struct addrinfo * found;
+      char service[16];
+
+      bzero(&hints, sizeof (hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      sprintf(service, "%d", daemonPort);
+      int rc = getaddrinfo(daemonHost.c_str(), service, &hints, &found);
+      if (rc != 0)
+      {
+         fprintf(stderr, "getaddrinfo(): could not resolve %s - %s\n", daemonHost.c_str(), gai_strerror(rc));
+         return -1;
+      }
+      s = -1;
+      bool late = false;
+      for (struct addrinfo * a = found; a != NULL && s < 0 && !late; a = a->ai_next)
+      {
+         s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+         if (s >= 0 && (!arm(s) || connect(s, a->ai_addr, a->ai_addrlen) < 0))
+         {
+            late = (remaining() == 0 || timedOut("connect"));
+            close(s);
+            s = -1;
+         }
+      }
+      freeaddrinfo(found);
+      if (s < 0 && !late)
+         fprintf(stderr, "connect(): could not connect to %s port %d\n", daemonHost.c_str(), daemonPort);
+      return s;
+   }
+
+   struct sockaddr_un sa;
+   if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+   {
+      fprintf(stderr, "socket(): could not open socket\n");
+      return -1;
+   }
+
+   bzero(&sa, sizeof (sa));
+   sa.sun_family = AF_UNIX;
+   strncpy(sa.sun_path, socketPath.c_str(), sizeof (sa.sun_path) - 1);
+
+   if (!arm(s) || connect(s, (struct sockaddr *) &sa, sizeof (sa)) < 0)
+   {
+      if (remaining() != 0 && !timedOut("connect"))
+         fprintf(stderr, "connect(): could not connect to socket %s\n", sa.sun_path);
+      close(s);
+      return -1;
+   }
+   return s;
+}
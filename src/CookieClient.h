@@ -0,0 +1,73 @@
+#ifndef COOKIE_CLIENT_H
+#define COOKIE_CLIENT_H
+
+#include <string>
+#include "CookieDaemonConfig.h"
+#include "VerificationCache.h"
+
+/*
+ * Class Name  : CookieClient
+ *
+ * Description : Client side of the cookieDaemon protocol.  Sends a cookie's
+ *              text (userID::dukey::IP::cookieVersion::clientID) to the
+ *              daemon and returns its reply.  The daemon is the local one
+ *              on SOCKET_PATH, or a remote one on DAEMON_HOST and
+ *              DAEMON_PORT, asked with a newline-framed request.  With
+ *              DAEMON_PROTOCOL set to binary, either daemon is asked with a
+ *              CookieProtocol CHECK frame instead.
+ *
+ *              If the daemon publishes its verification cache
+ *              (CACHE_SHM_PATH) and this process can read it, a cookie the
+ *              daemon recently validated is answered from the cache with no
+ *              round trip.  Entries within FRESH_MARGIN seconds of expiry
+ *              still go to the daemon, so the daemon, not the client, decides
+ *              when a cookie next needs the database.
+ *
+ *              Each check has a deadline, REQUEST_TIMEOUT milliseconds from
+ *              its start unless setTimeout() says otherwise.  Connecting,
+ *              sending and waiting for the reply all stop when it passes,
+ *              and a binary CHECK carries what is left of it so the daemon
+ *              can give up at the same time.  Resolving DAEMON_HOST is not
+ *              bounded; use an address or /etc/hosts where that matters.
+ *
+ * Method Index: CookieClient(CookieDaemonConfig * config) - constructor;
+ *                  attaches the cache if there is one
+ *               int check(const char * cookieText, char * response) - asks
+ *                  the cache, then the daemon.  Returns 0 with the daemon's
+ *                  reply ("0", a soft lifetime or, from a binary BUSY
+ *                  only, BUSY_RESPONSE) in
+ *                  response, which must hold SOCKET_RW_BUFFER_SIZE bytes; or
+ *                  -1, with the error logged, if the daemon cannot be asked
+ *                  or does not answer in time.
+ *               void setTimeout(int milliseconds) - the deadline for later
+ *                  checks; 0 for none
+ *
+ */
+class CookieClient
+{
+   public:
+      CookieClient(CookieDaemonConfig * config);
+      ~CookieClient();
+      int check(const char * cookieText, char * response);
+      void setTimeout(int milliseconds);
+   private:
+      static const int FRESH_MARGIN = 5;
+
+      int checkCache(const char * cookieText, char * response);
+      int askDaemon(const char * cookieText, char * response);
+      int askDaemonBinary(int s, const char * cookieText, char * response, int version);
+      int connectDaemon();
+      int remaining();
+      bool arm(int s);
+      bool timedOut(const char * call);
+
+      std::string socketPath;
+      std::string daemonHost;      /* empty for the local daemon */
+      int daemonPort;
+      bool binary;                 /* DAEMON_PROTOCOL binary */
+      int timeout;                 /* milliseconds; 0 for no deadline */
+      long long deadline;          /* the current check's, in monotonicMicros() */
+      VerificationCache * cache;   /* NULL if not published to us */
+};
+
+#endif
@@ -5,7 +5,22 @@
 #include <stdlib.h>
 #include <string.h>
 
-CookieDaemonConfig::CookieDaemonConfig(std::string filename) {
+CookieDaemonConfig * CookieDaemonConfig::snapshot = NULL;
+pthread_mutex_t CookieDaemonConfig::snapshotLock = PTHREAD_MUTEX_INITIALIZER;
+
+CookieDaemonConfig::CookieDaemonConfig(std::string filename)
+: refs(1), peer_rate(0), peer_burst(0), ip_rate(0), ip_burst(0), max_concurrent(0),
+  db_limit_initial(4), db_limit_max(0), db_latency_tolerance(200),
+  db_pool_size(1), hedge_percentile(0), hedge_max_percent(5), db_pipeline_depth(0),
+  db_replica_pool_size(2), db_replica_max_lag(5),
+  db_replica_trust_unknown_lag(0), touch_batch_delay(200),
+  backend("oracle"), replica_sync_interval(0), replica_full_sync_interval(900),
+  cache_capacity(0), cache_ttl(60), cache_refresh_ahead(0),
+  cache_stale_grace(0), cache_shm_mode(0600),
+  cache_snapshot_interval(300), worker_processes(0),
+  tcp_listen_address("0.0.0.0"), tcp_listen_port(0), tcp_max_connections(1024),
+  tcp_idle_timeout(60), daemon_port(0), log_format("plain"), log_rate_limit(10),
+  log_buffer(4096), request_timeout(2000) {
   readFile(filename);
 }
 
@@ -27,6 +42,55 @@ CookieDaemonConfig * CookieDaemonConfig::getConfig() {
     return NULL;
   }
 }
+/*
+  Return a reference to the process's shared config, reading it with
+  getConfig() the first time.  Caller must release() it.  NULL if there is
+  no valid config.
+*/
+CookieDaemonConfig * CookieDaemonConfig::current() {
+  pthread_mutex_lock(&snapshotLock);
+  if(snapshot == NULL) {
+    snapshot = getConfig();
+  }
+  CookieDaemonConfig *config = snapshot;
+  if(config != NULL) {
+    config->acquire();
+  }
+  pthread_mutex_unlock(&snapshotLock);
+  return config;
+}
+
+/*
+  Re-read the config file and, if it is valid, make it the one current()
+  returns.  Holders of the old snapshot keep it until they release() it.
+  Returns false, leaving the current snapshot in place, if the file is not
+  valid.
+*/
+bool CookieDaemonConfig::reload() {
+  CookieDaemonConfig *fresh = getConfig();
+  if(fresh == NULL) {
+    return false;
+  }
+  pthread_mutex_lock(&snapshotLock);
+  CookieDaemonConfig *old = snapshot;
+  snapshot = fresh;
+  pthread_mutex_unlock(&snapshotLock);
+  if(old != NULL) {
+    old->release();
+  }
+  return true;
+}
+
+void CookieDaemonConfig::acquire() {
+  __sync_fetch_and_add(&refs, 1);
+}
+
+void CookieDaemonConfig::release() {
+  if(__sync_sub_and_fetch(&refs, 1) == 0) {
+    delete this;
+  }
+}
+
 /* Populate values from a named file. File is interpreted as
  * space-separated keys and values, one per line.
  */
@@ -38,12 +102,22 @@ void CookieDaemonConfig::readFile(std::string filename) {
   }
 }
 
-/* Config objects are only valid if they have nonzero values for all members */
+/* Config objects are only valid if they have nonzero values for all required
+ * members.  The local stand-in backend needs its data file instead of
+ * database credentials, and a web node that only asks a remote daemon
+ * (DAEMON_HOST) needs neither.
+ */
 bool CookieDaemonConfig::isValid() {
-  return (socket_path.length() > 0
-    && db_conn_string.length() > 0
-    && db_user.length() > 0
-    && db_pass.length() > 0
+  bool backendValid;
+  if(backend.compare("local") == 0) {
+    backendValid = local_backend_path.length() > 0;
+  } else {
+    backendValid = (db_conn_string.length() > 0
+      && db_user.length() > 0
+      && db_pass.length() > 0);
+  }
+  bool remoteClient = daemon_host.length() > 0;
+  return ((remoteClient || (socket_path.length() > 0 && backendValid))
     && private_key_path.length() > 0
     && cert_path.length() > 0);
 }
@@ -62,6 +136,102 @@ void CookieDaemonConfig::setValue(std::string key, std::string value) {
     private_key_path = std::string(value);
   } else if(key.compare("CERT_PATH") == 0) {
     cert_path = std::string(value);
+  } else if(key.compare("PEER_RATE") == 0) {
+    peer_rate = atoi(value.c_str());
+  } else if(key.compare("PEER_BURST") == 0) {
+    peer_burst = atoi(value.c_str());
+  } else if(key.compare("IP_RATE") == 0) {
+    ip_rate = atoi(value.c_str());
+  } else if(key.compare("IP_BURST") == 0) {
+    ip_burst = atoi(value.c_str());
+  } else if(key.compare("MAX_CONCURRENT") == 0) {
+    max_concurrent = atoi(value.c_str());
+  } else if(key.compare("DB_LIMIT_INITIAL") == 0) {
+    db_limit_initial = atoi(value.c_str());
+  } else if(key.compare("DB_LIMIT_MAX") == 0) {
+    db_limit_max = atoi(value.c_str());
+  } else if(key.compare("DB_LATENCY_TOLERANCE") == 0) {
+    db_latency_tolerance = atoi(value.c_str());
+  } else if(key.compare("DB_POOL_SIZE") == 0) {
+    db_pool_size = atoi(value.c_str());
+  } else if(key.compare("HEDGE_PERCENTILE") == 0) {
+    hedge_percentile = atoi(value.c_str());
+  } else if(key.compare("HEDGE_MAX_PERCENT") == 0) {
+    hedge_max_percent = atoi(value.c_str());
+  } else if(key.compare("DB_PIPELINE_DEPTH") == 0) {
+    db_pipeline_depth = atoi(value.c_str());
+  } else if(key.compare("DB_REPLICA_CONN_STRING") == 0) {
+    db_replica_conn_string = std::string(value);
+  } else if(key.compare("DB_REPLICA_POOL_SIZE") == 0) {
+    db_replica_pool_size = atoi(value.c_str());
+  } else if(key.compare("DB_REPLICA_MAX_LAG") == 0) {
+    db_replica_max_lag = atoi(value.c_str());
+  } else if(key.compare("DB_REPLICA_TRUST_UNKNOWN_LAG") == 0) {
+    db_replica_trust_unknown_lag = atoi(value.c_str());
+  } else if(key.compare("TOUCH_BATCH_DELAY") == 0) {
+    touch_batch_delay = atoi(value.c_str());
+  } else if(key.compare("DB_BACKEND") == 0) {
+    backend = std::string(value);
+  } else if(key.compare("LOCAL_BACKEND_PATH") == 0) {
+    local_backend_path = std::string(value);
+  } else if(key.compare("LOCAL_REPLICA_PATH") == 0) {
+    local_replica_path = std::string(value);
+  } else if(key.compare("REPLICA_SYNC_INTERVAL") == 0) {
+    replica_sync_interval = atoi(value.c_str());
+  } else if(key.compare("REPLICA_FULL_SYNC_INTERVAL") == 0) {
+    replica_full_sync_interval = atoi(value.c_str());
+  } else if(key.compare("REPLICA_USERS_VIEW") == 0) {
+    replica_users_view = std::string(value);
+  } else if(key.compare("REPLICA_COOKIES_VIEW") == 0) {
+    replica_cookies_view = std::string(value);
+  } else if(key.compare("CACHE_CAPACITY") == 0) {
+    cache_capacity = atoi(value.c_str());
+  } else if(key.compare("CACHE_TTL") == 0) {
+    cache_ttl = atoi(value.c_str());
+  } else if(key.compare("CACHE_REFRESH_AHEAD") == 0) {
+    cache_refresh_ahead = atoi(value.c_str());
+  } else if(key.compare("CACHE_STALE_GRACE") == 0) {
+    cache_stale_grace = atoi(value.c_str());
+  } else if(key.compare("CACHE_SHM_PATH") == 0) {
+    cache_shm_path = std::string(value);
+  } else if(key.compare("CACHE_SHM_MODE") == 0) {
+    cache_shm_mode = (int) strtol(value.c_str(), NULL, 8);
+  } else if(key.compare("CACHE_SNAPSHOT_PATH") == 0) {
+    cache_snapshot_path = std::string(value);
+  } else if(key.compare("CACHE_SNAPSHOT_INTERVAL") == 0) {
+    cache_snapshot_interval = atoi(value.c_str());
+  } else if(key.compare("ADMIN_SOCKET_PATH") == 0) {
+    admin_socket_path = std::string(value);
+  } else if(key.compare("WORKER_PROCESSES") == 0) {
+    worker_processes = atoi(value.c_str());
+  } else if(key.compare("HANDOFF_SOCKET_PATH") == 0) {
+    handoff_socket_path = std::string(value);
+  } else if(key.compare("TCP_LISTEN_ADDRESS") == 0) {
+    tcp_listen_address = std::string(value);
+  } else if(key.compare("TCP_LISTEN_PORT") == 0) {
+    tcp_listen_port = atoi(value.c_str());
+  } else if(key.compare("TCP_MAX_CONNECTIONS") == 0) {
+    tcp_max_connections = atoi(value.c_str());
+  } else if(key.compare("TCP_IDLE_TIMEOUT") == 0) {
+    tcp_idle_timeout = atoi(value.c_str());
+  } else if(key.compare("DAEMON_HOST") == 0) {
+    daemon_host = std::string(value);
+  } else if(key.compare("DAEMON_PORT") == 0) {
+    daemon_port = atoi(value.c_str());
+  } else if(key.compare("DAEMON_PROTOCOL") == 0) {
+    daemon_protocol = std::string(value);
+  } else if(key.compare("IO_ENGINE") == 0) {
+    io_engine = std::string(value);
+  } else if(key.compare("LOG_FORMAT") == 0) {
+    log_format = std::string(value);
+  } else if(key.compare("LOG_RATE_LIMIT") == 0) {
+    log_rate_limit = atoi(value.c_str());
+  } else if(key.compare("LOG_BUFFER") == 0) {
+    log_buffer = atoi(value.c_str());
+  } else if(key.compare("REQUEST_TIMEOUT") == 0) {
+    request_timeout = atoi(value.c_str());
+  } else if(key.compare("CAPTURE_PATH") == 0) {
+    capture_path = std::string(value);
   }
 }
 
@@ -75,12 +245,93 @@ void CookieDaemonConfig::print() {
   printf("Password: %s\n", db_pass.c_str());
   printf("Private Key Path: %s\n", private_key_path.c_str());
   printf("Certificate Path: %s\n", cert_path.c_str());
+  printf("Peer rate/burst: %d/%d\n", peer_rate, peer_burst);
+  printf("IP rate/burst: %d/%d\n", ip_rate, ip_burst);
+  printf("Max concurrent: %d\n", max_concurrent);
+  printf("DB limit initial/max: %d/%d\n", db_limit_initial, db_limit_max);
+  printf("DB latency tolerance: %d%%\n", db_latency_tolerance);
+  printf("DB pool size: %d\n", db_pool_size);
+  printf("Hedge percentile/max percent: %d/%d\n", hedge_percentile, hedge_max_percent);
+  printf("DB pipeline depth: %d\n", db_pipeline_depth);
+  printf("Read replica connection string: %s\n", db_replica_conn_string.c_str());
+  printf("Read replica pool size/max lag: %d/%d\n", db_replica_pool_size, db_replica_max_lag);
+  printf("Trust unknown replica lag: %d\n", db_replica_trust_unknown_lag);
+  printf("Touch batch delay: %d\n", touch_batch_delay);
+  printf("Backend: %s\n", backend.c_str());
+  printf("Local backend path: %s\n", local_backend_path.c_str());
+  printf("Local replica path: %s\n", local_replica_path.c_str());
+  printf("Replica sync/full sync interval: %d/%d\n", replica_sync_interval, replica_full_sync_interval);
+  printf("Replica users view: %s\n", replica_users_view.c_str());
+  printf("Replica cookies view: %s\n", replica_cookies_view.c_str());
+  printf("Cache capacity/TTL: %d/%d\n", cache_capacity, cache_ttl);
+  printf("Cache refresh ahead/stale grace: %d/%d\n", cache_refresh_ahead, cache_stale_grace);
+  printf("Cache shared memory path/mode: %s/%o\n", cache_shm_path.c_str(), cache_shm_mode);
+  printf("Cache snapshot path/interval: %s/%d\n", cache_snapshot_path.c_str(), cache_snapshot_interval);
+  printf("Admin socket path: %s\n", admin_socket_path.c_str());
+  printf("Worker processes: %d\n", worker_processes);
+  printf("Handoff socket path: %s\n", handoff_socket_path.c_str());
+  printf("TCP listen address/port: %s/%d\n", tcp_listen_address.c_str(), tcp_listen_port);
+  printf("TCP max connections/idle timeout: %d/%d\n", tcp_max_connections, tcp_idle_timeout);
+  printf("Daemon host/port: %s/%d\n", daemon_host.c_str(), daemon_port);
+  printf("Daemon protocol: %s\n", daemon_protocol.c_str());
+  printf("I/O engine: %s\n", io_engine.c_str());
+  printf("Log format/rate limit/buffer: %s/%d/%d\n", log_format.c_str(), log_rate_limit, log_buffer);
+  printf("Capture path: %s\n", capture_path.c_str());
+  printf("Request timeout: %d\n", request_timeout);
 }
 
 /* Accessors */
-std::string CookieDaemonConfig::getSocketPath() { return socket_path; }
-std::string CookieDaemonConfig::getConnectionString() { return db_conn_string; }
-std::string CookieDaemonConfig::getDBUser() { return db_user; }
-std::string CookieDaemonConfig::getDBPass() { return db_pass; }
-std::string CookieDaemonConfig::getPrivateKeyPath() { return private_key_path; }
-std::string CookieDaemonConfig::getCertPath() { return cert_path; }
+const std::string &CookieDaemonConfig::getSocketPath() { return socket_path; }
+const std::string &CookieDaemonConfig::getConnectionString() { return db_conn_string; }
+const std::string &CookieDaemonConfig::getDBUser() { return db_user; }
+const std::string &CookieDaemonConfig::getDBPass() { return db_pass; }
+const std::string &CookieDaemonConfig::getPrivateKeyPath() { return private_key_path; }
+const std::string &CookieDaemonConfig::getCertPath() { return cert_path; }
+int CookieDaemonConfig::getPeerRate() { return peer_rate; }
+int CookieDaemonConfig::getPeerBurst() { return peer_burst; }
+int CookieDaemonConfig::getIPRate() { return ip_rate; }
+int CookieDaemonConfig::getIPBurst() { return ip_burst; }
+int CookieDaemonConfig::getMaxConcurrent() { return max_concurrent; }
+int CookieDaemonConfig::getDBLimitInitial() { return db_limit_initial; }
+int CookieDaemonConfig::getDBLimitMax() { return db_limit_max; }
+int CookieDaemonConfig::getDBLatencyTolerance() { return db_latency_tolerance; }
+int CookieDaemonConfig::getDBPoolSize() { return db_pool_size; }
+int CookieDaemonConfig::getHedgePercentile() { return hedge_percentile; }
+int CookieDaemonConfig::getHedgeMaxPercent() { return hedge_max_percent; }
+int CookieDaemonConfig::getDBPipelineDepth() { return db_pipeline_depth; }
+const std::string &CookieDaemonConfig::getReplicaConnectionString() { return db_replica_conn_string; }
+int CookieDaemonConfig::getDBReplicaPoolSize() { return db_replica_pool_size; }
+int CookieDaemonConfig::getDBReplicaMaxLag() { return db_replica_max_lag; }
+int CookieDaemonConfig::getDBReplicaTrustUnknownLag() { return db_replica_trust_unknown_lag; }
+int CookieDaemonConfig::getTouchBatchDelay() { return touch_batch_delay; }
+const std::string &CookieDaemonConfig::getBackend() { return backend; }
+const std::string &CookieDaemonConfig::getLocalBackendPath() { return local_backend_path; }
+const std::string &CookieDaemonConfig::getLocalReplicaPath() { return local_replica_path; }
+int CookieDaemonConfig::getReplicaSyncInterval() { return replica_sync_interval; }
+int CookieDaemonConfig::getReplicaFullSyncInterval() { return replica_full_sync_interval; }
+const std::string &CookieDaemonConfig::getReplicaUsersView() { return replica_users_view; }
+const std::string &CookieDaemonConfig::getReplicaCookiesView() { return replica_cookies_view; }
+int CookieDaemonConfig::getCacheCapacity() { return cache_capacity; }
+int CookieDaemonConfig::getCacheTTL() { return cache_ttl; }
+int CookieDaemonConfig::getCacheRefreshAhead() { return cache_refresh_ahead; }
+int CookieDaemonConfig::getCacheStaleGrace() { return cache_stale_grace; }
+const std::string &CookieDaemonConfig::getCacheShmPath() { return cache_shm_path; }
+int CookieDaemonConfig::getCacheShmMode() { return cache_shm_mode; }
+const std::string &CookieDaemonConfig::getCacheSnapshotPath() { return cache_snapshot_path; }
+int CookieDaemonConfig::getCacheSnapshotInterval() { return cache_snapshot_interval; }
+const std::string &CookieDaemonConfig::getAdminSocketPath() { return admin_socket_path; }
+int CookieDaemonConfig::getWorkerProcesses() { return worker_processes; }
+const std::string &CookieDaemonConfig::getHandoffSocketPath() { return handoff_socket_path; }
+const std::string &CookieDaemonConfig::getTcpListenAddress() { return tcp_listen_address; }
+int CookieDaemonConfig::getTcpListenPort() { return tcp_listen_port; }
+int CookieDaemonConfig::getTcpMaxConnections() { return tcp_max_connections; }
+int CookieDaemonConfig::getTcpIdleTimeout() { return tcp_idle_timeout; }
+const std::string &CookieDaemonConfig::getDaemonHost() { return daemon_host; }
+int CookieDaemonConfig::getDaemonPort() { return daemon_port; }
+const std::string &CookieDaemonConfig::getDaemonProtocol() { return daemon_protocol; }
+const std::string &CookieDaemonConfig::getIoEngine() { return io_engine; }
+const std::string &CookieDaemonConfig::getLogFormat() { return log_format; }
+int CookieDaemonConfig::getLogRateLimit() { return log_rate_limit; }
+int CookieDaemonConfig::getLogBuffer() { return log_buffer; }
+const std::string &CookieDaemonConfig::getCapturePath() { return capture_path; }
+int CookieDaemonConfig::getRequestTimeout() { return request_timeout; }
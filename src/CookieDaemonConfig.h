@@ -4,6 +4,14 @@
  * cookieDaemon's connection to an oracle database.
  *
  * Construct with a path to a config file
+ *
+ * A long-running process shares one config snapshot between its threads:
+ * current() hands out a counted reference to it, loading it on first use,
+ * and reload() re-reads the file and swaps a new snapshot in (cookieDaemon
+ * does so on SIGHUP).  A snapshot is never modified once published, so
+ * holders can read it without locking; each release()s it when done and
+ * the last one frees it.  String settings are returned by reference, so
+ * reading one copies nothing; copy it to keep it past the release().
  */
 
 /* Example config:
@@ -11,6 +19,51 @@ SOCKET_PATH /path/to/cookieDaemon.sock
 DB_CONN_STRING //127.0.0.1:1521/MYSID
 DB_USER username
 DB_PASS password
+PEER_RATE 50
+PEER_BURST 100
+IP_RATE 20
+IP_BURST 60
+MAX_CONCURRENT 32
+DB_LIMIT_INITIAL 4
+DB_LIMIT_MAX 64
+DB_LATENCY_TOLERANCE 200
+DB_POOL_SIZE 2
+HEDGE_PERCENTILE 95
+HEDGE_MAX_PERCENT 5
+DB_PIPELINE_DEPTH 16
+DB_REPLICA_CONN_STRING //10.0.0.6:1521/MYSID_RO
+DB_REPLICA_POOL_SIZE 2
+DB_REPLICA_MAX_LAG 5
+DB_REPLICA_TRUST_UNKNOWN_LAG 0
+TOUCH_BATCH_DELAY 200
+DB_BACKEND oracle
+REPLICA_SYNC_INTERVAL 10
+REPLICA_USERS_VIEW IGSPNET2.REPLICA_USERS
+REPLICA_COOKIES_VIEW IGSPNET2.REPLICA_COOKIES
+CACHE_CAPACITY 65536
+CACHE_TTL 60
+CACHE_REFRESH_AHEAD 10
+CACHE_STALE_GRACE 300
+CACHE_SHM_PATH /dev/shm/cookieDaemon.cache
+CACHE_SHM_MODE 0640
+CACHE_SNAPSHOT_PATH /path/to/cookieDaemon.snapshot
+CACHE_SNAPSHOT_INTERVAL 300
+ADMIN_SOCKET_PATH /path/to/cookieDaemon.admin.sock
+HANDOFF_SOCKET_PATH /path/to/cookieDaemon.handoff.sock
+WORKER_PROCESSES 4
+TCP_LISTEN_ADDRESS 10.0.0.5
+TCP_LISTEN_PORT 7433
+TCP_MAX_CONNECTIONS 1024
+TCP_IDLE_TIMEOUT 60
+DAEMON_HOST cookied.example.org
+DAEMON_PORT 7433
+DAEMON_PROTOCOL binary
+IO_ENGINE io_uring
+LOG_FORMAT json
+LOG_RATE_LIMIT 10
+LOG_BUFFER 4096
+CAPTURE_PATH /path/to/cookieDaemon.capture
+REQUEST_TIMEOUT 2000
 */
 
 #ifndef COOKIE_DAEMON_CONFIG_H
@@ -21,6 +74,12 @@ DB_PASS password
 #define FATAL_EXIT 1
 #define USER_EXIT 2
 
+// Reply for a request shed under load, distinct from "0" so clients do not
+// mistake overload for an expired cookie.  Only binary clients are told it
+// (as BUSY); the daemon's text replies say "0" instead, because older
+// verifyCookie binaries take any other reply as a valid soft lifetime.
+#define BUSY_RESPONSE "-1"
+
 // Environment variable to read for config file location
 #define CONFIG_ENV "COOKIE_DAEMON_CONFIG"
 
@@ -28,19 +87,75 @@ DB_PASS password
 #define DEFAULT_CONFIG_PATH "/var/system/cookied/cookied.conf"
 
 #include <iostream>
+#include <pthread.h>
 
 class CookieDaemonConfig {
   public:
     CookieDaemonConfig(std::string filename);
     static CookieDaemonConfig * getConfig();
+    static CookieDaemonConfig * current();
+    static bool reload();
+    void acquire();
+    void release();
     void print();
-    std::string getSocketPath();
-    std::string getConnectionString();
-    std::string getDBUser();
-    std::string getDBPass();
-    std::string getPrivateKeyPath();
-    std::string getCertPath();
+    const std::string &getSocketPath();
+    const std::string &getConnectionString();
+    const std::string &getDBUser();
+    const std::string &getDBPass();
+    const std::string &getPrivateKeyPath();
+    const std::string &getCertPath();
+    int getPeerRate();
+    int getPeerBurst();
+    int getIPRate();
+    int getIPBurst();
+    int getMaxConcurrent();
+    int getDBLimitInitial();
+    int getDBLimitMax();
+    int getDBLatencyTolerance();
+    int getDBPoolSize();
+    int getHedgePercentile();
+    int getHedgeMaxPercent();
+    int getDBPipelineDepth();
+    const std::string &getReplicaConnectionString();
+    int getDBReplicaPoolSize();
+    int getDBReplicaMaxLag();
+    int getDBReplicaTrustUnknownLag();
+    int getTouchBatchDelay();
+    const std::string &getBackend();
+    const std::string &getLocalBackendPath();
+    const std::string &getLocalReplicaPath();
+    int getReplicaSyncInterval();
+    int getReplicaFullSyncInterval();
+    const std::string &getReplicaUsersView();
+    const std::string &getReplicaCookiesView();
+    int getCacheCapacity();
+    int getCacheTTL();
+    int getCacheRefreshAhead();
+    int getCacheStaleGrace();
+    const std::string &getCacheShmPath();
+    int getCacheShmMode();
+    const std::string &getCacheSnapshotPath();
+    int getCacheSnapshotInterval();
+    const std::string &getAdminSocketPath();
+    int getWorkerProcesses();
+    const std::string &getHandoffSocketPath();
+    const std::string &getTcpListenAddress();
+    int getTcpListenPort();
+    int getTcpMaxConnections();
+    int getTcpIdleTimeout();
+    const std::string &getDaemonHost();
+    int getDaemonPort();
+    const std::string &getDaemonProtocol();
+    const std::string &getIoEngine();
+    const std::string &getLogFormat();
+    int getLogRateLimit();
+    int getLogBuffer();
+    const std::string &getCapturePath();
+    int getRequestTimeout();
   private:
+    static CookieDaemonConfig * snapshot;   // what current() returns
+    static pthread_mutex_t snapshotLock;
+    int refs;
     void setValue(std::string key, std::string value);
     void readFile(std::string filename);
     bool isValid();
@@ -50,6 +165,67 @@ class CookieDaemonConfig {
     std::string db_pass;
     std::string private_key_path;
     std::string cert_path;
+    // Optional tuning knobs; 0 disables the corresponding limit
+    int peer_rate;
+    int peer_burst;
+    int ip_rate;
+    int ip_burst;
+    int max_concurrent;
+    // Adaptive limit on in-flight database calls; see ConcurrencyLimiter.h
+    int db_limit_initial;
+    int db_limit_max;
+    int db_latency_tolerance;
+    // Connection pool and request hedging; see DBPool.h
+    int db_pool_size;
+    int hedge_percentile;
+    int hedge_max_percent;
+    // Non-blocking CHECK_COOKIE sessions (0 = none); see OCIPipeline.h
+    int db_pipeline_depth;
+    // Read replica for validity lookups (empty = none); see DBPool.h
+    std::string db_replica_conn_string;
+    int db_replica_pool_size;
+    int db_replica_max_lag;
+    int db_replica_trust_unknown_lag;
+    int touch_batch_delay;
+    // Backend selection (oracle or local stand-in); see CookieBackend.h
+    std::string backend;
+    std::string local_backend_path;
+    std::string local_replica_path;
+    // Local replica of user/cookie state; see UserReplica.h
+    int replica_sync_interval;
+    int replica_full_sync_interval;
+    std::string replica_users_view;
+    std::string replica_cookies_view;
+    // Verification cache and its admin socket; see VerificationCache.h
+    int cache_capacity;
+    int cache_ttl;
+    int cache_refresh_ahead;
+    int cache_stale_grace;
+    std::string cache_shm_path;
+    int cache_shm_mode;
+    std::string cache_snapshot_path;
+    int cache_snapshot_interval;
+    std::string admin_socket_path;
+    // Pre-forked worker processes; 0 serves from a single process
+    int worker_processes;
+    // Socket a newly started daemon takes the listeners over; see SocketHandoff.h
+    std::string handoff_socket_path;
+    // TCP listener for remote web nodes (port 0 = none); see TcpFrontend.h
+    std::string tcp_listen_address;
+    int tcp_listen_port;
+    int tcp_max_connections;
+    int tcp_idle_timeout;
+    // Remote daemon for verifyCookie on a web node; see CookieClient.h
+    std::string daemon_host;
+    int daemon_port;
+    std::string daemon_protocol;
+    std::string io_engine;
+    std::string log_format;
+    int log_rate_limit;
+    int log_buffer;
+    std::string capture_path;
+    // Milliseconds a check may take end to end (0 = unbounded)
+    int request_timeout;
 };
 
 #endif
@@ -0,0 +1,60 @@
+#include "CookieProtocol.h"
+
+void CookieProtocol::putInt(unsigned int value, unsigned char * out)
+{
+   out[0] = (value >> 24) & 0xff;
+   out[1] = (value >> 16) & 0xff;
+   out[2] = (value >> 8) & 0xff;
+   out[3] = value & 0xff;
+}
+
+unsigned int CookieProtocol::getInt(const unsigned char * in)
+{
+   return ((unsigned int) in[0] << 24) | ((unsigned int) in[1] << 16)
+      | ((unsigned int) in[2] << 8) | (unsigned int) in[3];
+}
+
+size_t CookieProtocol::headerSize(const unsigned char * in)
+{
+   return (in[1] == 2) ? MAX_HEADER_SIZE : HEADER_SIZE;
+}
+
+void CookieProtocol::encodeHeader(const Header &header, unsigned char * out)
+{
+   out[0] = MAGIC;
+   out[1] = header.version;
+   out[2] = header.op;
+   out[3] = header.status;
+   putInt(header.id, out + 4);
+   putInt(header.length, out + 8);
+   if (header.version == 2)
+      putInt(header.timeout, out + 12);
+}
+
+int CookieProtocol::decodeHeader(const unsigned char * in, Header &header)
+{
+   if (in[0] != MAGIC)
+      return -1;
+   header.version = in[1];
+   header.op = in[2];
+   header.status = in[3];
+   header.id = getInt(in + 4);
+   header.length = getInt(in + 8);
+   header.timeout = (header.version == 2) ? getInt(in + 12) : 0;
+   return 0;
+}
+
+void CookieProtocol::appendFrame(std::string &out, int op, int status, unsigned int id, const char * body, size_t length, int version, unsigned int timeout)
+{
+   Header header;
+   unsigned char encoded[MAX_HEADER_SIZE];
+   header.version = version;
+   header.op = op;
+   header.status = (status == TIMEOUT && version < 2) ? BUSY : status;
+   header.id = id;
+   header.length = length;
+   header.timeout = timeout;
+   encodeHeader(header, encoded);
+   out.append((const char *) encoded, headerSize(encoded));
+   out.append(body, length);
+}
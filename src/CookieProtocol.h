@@ -0,0 +1,116 @@
+#ifndef COOKIE_PROTOCOL_H
+#define COOKIE_PROTOCOL_H
+
+#include <string>
+#include <stddef.h>
+
+/*
+ * Class Name  : CookieProtocol
+ *
+ * Description : Framing for cookieDaemon's binary protocol, spoken on
+ *              SOCKET_PATH and on the TCP listener alongside the legacy text
+ *              requests.  A connection is binary if its first byte is MAGIC,
+ *              which no cookie text can start with.
+ *
+ *              Every request and every response is one frame: a header of
+ *              headerSize() bytes followed by length bytes of body.
+ *              Integers are unsigned and in network byte order.
+ *
+ *                 offset 0  magic    (MAGIC)
+ *                        1  version  (VERSION)
+ *                        2  op       (CHECK, VERIFY_SIGNED, SIGN, STATS)
+ *                        3  status   (0 in requests)
+ *                        4  id       (4 bytes; chosen by the client)
+ *                        8  length   (4 bytes; body length)
+ *                       12  timeout  (4 bytes; version 2 only)
+ *
+ *              timeout is how many milliseconds the client will wait for
+ *              the response; 0 leaves it to the daemon's REQUEST_TIMEOUT,
+ *              as does a version 1 header, which ends at length.  A request
+ *              still unanswered when its time is up is answered TIMEOUT,
+ *              and is dropped unrun if it has not yet reached the database.
+ *              Responses carry a timeout of 0.
+ *
+ *              A response carries the version, op and id of its request.
+ *              A client may send any number of requests without waiting,
+ *              and must match responses to requests by id: the daemon does
+ *              not promise to answer in order.  A request with a version
+ *              the daemon does not speak is answered UNSUPPORTED, with the
+ *              daemon's version in the header, and the connection closed.
+ *
+ *              Bodies:
+ *                 CHECK          request: cookie text
+ *                                response: 4-byte soft lifetime; 0 = invalid
+ *                 VERIFY_SIGNED  request: signed cookie (cookie:::sig)
+ *                                response: as CHECK; a bad signature is 0
+ *                 SIGN           request: "userID IP softLifetime
+ *                                   hardLifetime", as signCookie's arguments
+ *                                response: signed cookie text
+ *                 STATS          request: empty
+ *                                response: the daemon's counters, as text
+ *
+ * Method Index: static size_t headerSize(const unsigned char * in) - the
+ *                  size of the header starting at in, from its version;
+ *                  reads the first two bytes
+ *               static void encodeHeader(const Header &header,
+ *                  unsigned char * out) - writes header's headerSize()
+ *                  bytes to out
+ *               static int decodeHeader(const unsigned char * in,
+ *                  Header &header) - reads headerSize(in) bytes.  Returns
+ *                  0, or -1 if they do not start with MAGIC.
+ *               static void appendFrame(std::string &out, int op,
+ *                  int status, unsigned int id, const char * body,
+ *                  size_t length, int version, unsigned int timeout) -
+ *                  appends a whole frame to out; by default a VERSION
+ *                  frame with no timeout.  A version 1 frame cannot say
+ *                  TIMEOUT, so it says BUSY instead.
+ *               static void putInt(unsigned int value, unsigned char * out),
+ *                  static unsigned int getInt(const unsigned char * in) -
+ *                  4-byte network order integers
+ *
+ */
+class CookieProtocol
+{
+   public:
+      static const unsigned char MAGIC = 0xC5;
+      static const unsigned char VERSION = 2;
+      static const size_t HEADER_SIZE = 12;      /* version 1; the start of any header */
+      static const size_t MAX_HEADER_SIZE = 16;  /* version 2 */
+      /* longest request body accepted; a signed cookie fits with room */
+      static const unsigned int MAX_REQUEST = 4096;
+
+      /* op codes */
+      static const int CHECK = 1;
+      static const int VERIFY_SIGNED = 2;
+      static const int SIGN = 3;
+      static const int STATS = 4;
+
+      /* status codes */
+      static const int OK = 0;
+      static const int BUSY = 1;          /* shed; retry later */
+      static const int BAD_REQUEST = 2;   /* malformed body or frame */
+      static const int UNSUPPORTED = 3;   /* unknown op or version */
+      static const int FORBIDDEN = 4;     /* op not allowed on this connection */
+      static const int REFUSED = 5;       /* SIGN: user disabled or lifetimes invalid */
+      static const int FAILED = 6;        /* database or signing error */
+      static const int TIMEOUT = 7;       /* deadline passed; version 2 only */
+
+      struct Header
+      {
+         unsigned char version;
+         unsigned char op;
+         unsigned char status;
+         unsigned int id;
+         unsigned int length;
+         unsigned int timeout;  /* milliseconds; 0 for the daemon's default */
+      };
+
+      static size_t headerSize(const unsigned char * in);
+      static void encodeHeader(const Header &header, unsigned char * out);
+      static int decodeHeader(const unsigned char * in, Header &header);
+      static void appendFrame(std::string &out, int op, int status, unsigned int id, const char * body, size_t length, int version = VERSION, unsigned int timeout = 0);
+      static void putInt(unsigned int value, unsigned char * out);
+      static unsigned int getInt(const unsigned char * in);
+};
+
+#endif
@@ -0,0 +1,1198 @@
+#include "DBPool.h"
+#include "DaemonClock.h"
+#include "DaemonLog.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+/*
+ * Method Name: DBPool
+ *
+ * Description: Class constructor.  Connects DB_POOL_SIZE backends, and
+ *    DB_REPLICA_POOL_SIZE to the read replica if there is one, and unless
+ *    that makes a single connection starts a thread for each.  The threads
+ *    connect their own backends, so the connections (and the statements
+ *    each prepares) are made in parallel; this returns once the first
+ *    primary connection is up and the rest join as they come.  A primary
+ *    connection that fails then is retried once a second.  The check
+ *    pipeline, if DB_PIPELINE_DEPTH asks for one, connects on its own thread
+ *    without holding this up.  Throws like
+ *    CookieBackend::create() if every primary connection fails, and
+ *    std::runtime_error if it cannot make its eventfd.
+ *
+ * Arguments  : CookieDaemonConfig * config - pool sizes and knobs
+ *
+ * Returns    : none
+ */
+DBPool::DBPool(CookieDaemonConfig * config)
+: workers(NULL), size(config->getDBPoolSize()), pipelined(0), stopping(false), connected(0), connectFailures(0),
+  wakeup(-1), freeJobs(NULL),
+  hedgePercentile(0), hedgeBudget(0), hedgeEarn(0), hedgeDelay(0),
+  latencyCount(0), latencyNext(0), hedges(0), hedgeWins(0), expired(0),
+  maxLag(config->getDBReplicaMaxLag()), trustUnknownLag(config->getDBReplicaTrustUnknownLag() != 0),
+  touchDelay(config->getTouchBatchDelay() * 1000LL),
+  touches(CookieBackend::TOUCH_BATCH * 4), touchSince(0), touchHeld(0), replicaReads(0), replicaFallbacks(0),
+  touchesWritten(0), touchBatches(0), touchesRejected(0), touchesDropped(0)
+{
+   if (size < 1)
+      size = 1;
+   replicas = CookieBackend::replicaConfigured(config) ? config->getDBReplicaPoolSize() : 0;
+   if (replicas < 0)
+      replicas = 0;
+   //non-blocking OCI is Oracle's; the stand-in has nothing to pipeline
+   pipelineDepth = config->getDBPipelineDepth();
+   pipelines = (pipelineDepth > 0) ? 1 : 0;
+   if (pipelines > 0 && config->getBackend().compare("oracle") != 0)
+   {
+      DaemonLog::write("DBPool(): DB_PIPELINE_DEPTH needs DB_BACKEND oracle; disabled\n");
+      pipelines = 0;
+   }
+   threaded = size > 1 || replicas > 0 || pipelines > 0;
+   setHedging(config->getHedgePercentile(), config->getHedgeMaxPercent());
+
+   wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (wakeup < 0)
+      throw std::runtime_error(std::string("eventfd(): ") + strerror(errno));
+
+   pthread_mutex_init(&lock, NULL);
+   pthread_cond_init(&ready, NULL);
+   pthread_condattr_t attr;
+   pthread_condattr_init(&attr);
+   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+   workers = new Worker[size + replicas + pipelines];
+   for (int i = 0; i < size + replicas + pipelines; i++)
+   {
+      workers[i].pool = this;
+      workers[i].index = i;
+      workers[i].db = NULL;
+      workers[i].busy = false;
+      workers[i].replica = i >= size;
+      workers[i].down = false;
+      workers[i].lag = -1;  //unknown until probed
+      workers[i].probed = 0;
+      workers[i].batch = (replicas > 0 && i < size) ? new CookieTouch[CookieBackend::TOUCH_BATCH] : NULL;
+      workers[i].pipelined = i >= size + replicas;
+      workers[i].pipeline = NULL;
+      workers[i].slots = NULL;
+      workers[i].inFlight = 0;
+      if (workers[i].pipelined)
+      {
+         workers[i].slots = new Slot[pipelineDepth];
+         for (int j = 0; j < pipelineDepth; j++)
+         {
+            workers[i].slots[j].job = NULL;
+            workers[i].slots[j].done = false;
+         }
+      }
+      pthread_cond_init(&workers[i].wake, &attr);
+   }
+   pthread_condattr_destroy(&attr);
+
+   if (!threaded)
+   {
+      workers[0].db = CookieBackend::create(config, false);  //throws on failure
+      connected = 1;
+      return;
+   }
+
+   //signals belong to the request loop, not to the database threads
+   sigset_t all, old;
+   sigfillset(&all);
+   pthread_sigmask(SIG_BLOCK, &all, &old);
+   for (int i = 0; i < size + replicas + pipelines; i++)
+      pthread_create(&workers[i].thread, NULL, workerMain, &workers[i]);
+   pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+   pthread_mutex_lock(&lock);
+   while (connected == 0 && connectFailures < size)
+      pthread_cond_wait(&ready, &lock);
+   if (connected == 0)
+   {
+      stopWorkers();
+      freeWorkers();
+      throw std::runtime_error("no database connection - " + connectError);
+   }
+   pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Method Name: ~DBPool
+ *
+ * Description: Class destructor.  Stops the worker threads once their
+ *    current call (if any) finishes and disconnects every connection.
+ *    Answers not yet taken are dropped; queued touches are written first.
+ *    Called from cookieDaemon's cleanup(), once the request loop has
+ *    stopped, so it waits for any worker holding the pool lock.
+ *
+ * Arguments  : none
+ *
+ * Returns    : none
+ */
+DBPool::~DBPool()
+{
+   if (threaded)
+   {
+      pthread_mutex_lock(&lock);
+      stopWorkers();
+   }
+   freeWorkers();
+}
+
+/* tells the worker threads to stop and waits for them; called with lock,
+ * which it releases */
+void DBPool::stopWorkers()
+{
+   stopping = true;
+   for (int i = 0; i < size + replicas + pipelines; i++)
+      pthread_cond_signal(&workers[i].wake);
+   pthread_mutex_unlock(&lock);
+   for (int i = 0; i < size + replicas + pipelines; i++)
+      pthread_join(workers[i].thread, NULL);
+}
+
+/* disconnects every connection and frees what the pool holds */
+void DBPool::freeWorkers()
+{
+   for (int i = 0; i < size + replicas + pipelines; i++)
+   {
+      delete workers[i].db;
+      delete [] workers[i].batch;
+      delete workers[i].pipeline;
+      delete [] workers[i].slots;
+   }
+   delete [] workers;
+   while (freeJobs != NULL)
+   {
+      CheckJob * job = freeJobs;
+      freeJobs = job->next;
+      delete job;
+   }
+   close(wakeup);
+}
+
+/*
+ * Method Name: startCheck
+ *
+ * Description: queues the check on the least loaded usable read replica
+ *                 connection, as CookieBackend::readCookie, or else on the
+ *                 least loaded primary one, as CookieBackend::checkCookie.
+ *                 Its answer carries context.
+ *
+ * Arguments  : const char * userID, IP, clientID, cookieVersion - as
+ *                 CookieBackend::checkCookie; must fit the cookie field sizes
+ *                 enforced by parseCookie()
+ *              void * context - the caller's, returned with the answer
+ *              long long deadline - monotonicMicros() after which the
+ *                 check is dropped if not yet started; 0 for never
+ *              bool primaryOnly - skip the read replica, which may not
+ *                 have a recent change yet
+ *
+ * Returns    : none
+ *
+ */
+void DBPool::startCheck(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, void * context, long long deadline, bool primaryOnly)
+{
+   CheckJob * job = newJob(false, userID, IP, context, deadline);
+   strcpy(job->clientID, clientID);
+   strcpy(job->cookieVersion, cookieVersion);
+
+   if (!threaded)
+   {
+      run(job, workers[0].db, 0);
+      releaseJob(job);  //never dispatched; no threads to lock out
+      return;
+   }
+
+   pthread_mutex_lock(&lock);
+   job->primary = primaryOnly ? -1 : pickReplica();
+   if (job->primary < 0)
+      job->primary = pickCheckWorker();
+   dispatch(job, job->primary);
+   if (hedgePercentile > 0)
+   {
+      hedgeBudget += hedgeEarn;
+      if (hedgeBudget > 10)
+         hedgeBudget = 10;  //don't let a quiet spell bank a storm of hedges
+      if (hedgeDelay > 0)
+      {
+         job->refs++;
+         unhedged.push_back(job);
+      }
+   }
+   pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Method Name: startInsert
+ *
+ * Description: queues CookieBackend::insertCookie on the least loaded
+ *                 pooled connection.  Its answer carries context and, if
+ *                 the insert worked, the new cookie's dukey, cookieVersion
+ *                 and clientID.
+ *
+ * Arguments  : as CookieBackend::insertCookie; userID and IP must fit the
+ *                 cookie field sizes
+ *              void * context - the caller's, returned with the answer
+ *              long long deadline - as for startCheck()
+ *
+ * Returns    : none
+ *
+ */
+void DBPool::startInsert(const char * userID, const char * IP, int hardLifetime, int softLifetime, void * context, long long deadline)
+{
+   CheckJob * job = newJob(true, userID, IP, context, deadline);
+   job->hardLifetime = hardLifetime;
+   job->softLifetime = softLifetime;
+
+   if (!threaded)
+   {
+      run(job, workers[0].db, 0);
+      releaseJob(job);  //never dispatched; no threads to lock out
+      return;
+   }
+
+   pthread_mutex_lock(&lock);
+   job->primary = pickWorker(-1);
+   dispatch(job, job->primary);
+   pthread_mutex_unlock(&lock);
+}
+
+/* a job from the free list, or a new one; takes lock */
+DBPool::CheckJob * DBPool::newJob(bool insert, const char * userID, const char * IP, void * context, long long deadline)
+{
+   pthread_mutex_lock(&lock);
+   CheckJob * job = freeJobs;
+   if (job != NULL)
+      freeJobs = job->next;
+   pthread_mutex_unlock(&lock);
+   if (job == NULL)
+      job = new CheckJob;
+   job->insert = insert;
+   strcpy(job->userID, userID);
+   strcpy(job->IP, IP);
+   job->context = context;
+   job->started = monotonicMicros();
+   job->deadline = deadline;
+   job->primary = 0;
+   job->winner = -1;
+   job->refs = 0;
+   return job;
+}
+
+/*
+ * Method Name: run
+ *
+ * Description: makes job's database call on db and, unless another worker
+ *                 answered first, posts the answer.  A job whose deadline
+ *                 has passed is answered expired instead of being made.
+ *                 On a read replica the check is a readCookie; if that
+ *                 cannot decide, or fails, the job goes on to a primary
+ *                 connection instead of being answered.  Called without
+ *                 lock.
+ *
+ * Arguments  : CheckJob * job - the call
+ *              CookieBackend * db - connection to make it on
+ *              int worker - that connection's index
+ *
+ * Returns    : none
+ */
+void DBPool::run(CheckJob * job, CookieBackend * db, int worker)
+{
+   int result = 0;
+   bool failed = false;
+   bool replica = workers[worker].replica;
+   long long started = monotonicMicros();
+   if (job->deadline != 0 && started >= job->deadline)
+   {
+      pthread_mutex_lock(&lock);
+      expired++;
+      post(job, job->insert ? -1 : 0, false, true, worker);
+      pthread_mutex_unlock(&lock);
+      return;
+   }
+   try
+   {
+      if (job->insert)
+         result = db->insertCookie(job->userID, job->IP, job->hardLifetime, job->softLifetime, job->dukey, job->cookieVersion, job->clientID);
+      else if (replica)
+         result = db->readCookie(job->userID, job->IP, job->clientID, job->cookieVersion);
+      else
+         result = db->checkCookie(job->userID, job->IP, job->clientID, job->cookieVersion);
+   }
+   catch (std::exception &e)
+   {
+      DaemonLog::write("%s(): Database error - %s\n", job->insert ? "insertCookie" : replica ? "readCookie" : "checkCookie", e.what());
+      result = job->insert ? -1 : 0;
+      failed = true;
+   }
+   long long now = monotonicMicros();
+
+   pthread_mutex_lock(&lock);
+   if (replica && (failed || result == CookieBackend::MISS))
+   {
+      if (failed)
+         workers[worker].down = true;  //until its next probe gets through
+      fallBack(job);
+      pthread_mutex_unlock(&lock);
+      return;
+   }
+   if (!job->insert)
+      recordLatency(now - started);  //the hedge delay is a check percentile
+   if (replica)
+   {
+      replicaReads++;
+      if (result > 0 && job->winner < 0)
+         queueTouch(job);
+   }
+   post(job, result, failed, false, worker);
+   pthread_mutex_unlock(&lock);
+}
+
+/* sends a check the read replica could not answer to the primary; caller
+ * holds lock */
+void DBPool::fallBack(CheckJob * job)
+{
+   replicaFallbacks++;
+   if (job->winner >= 0)
+      return;  //a hedge already answered it
+   job->primary = pickCheckWorker();
+   dispatch(job, job->primary);
+}
+
+/* queues the soft timestamp refresh a replica-validated check still owes
+ * the primary, waking the primary workers when there is a batch to time or
+ * a full one to write; caller holds lock */
+void DBPool::queueTouch(CheckJob * job)
+{
+   if (touches.size() >= MAX_TOUCHES)
+   {
+      touchesDropped++;
+      return;
+   }
+   CookieTouch touch;
+   strcpy(touch.userID, job->userID);
+   strcpy(touch.IP, job->IP);
+   strcpy(touch.clientID, job->clientID);
+   strcpy(touch.cookieVersion, job->cookieVersion);
+   touch.softLifetime = 0;
+   touches.push_back(touch);
+
+   if (touches.size() == 1)
+      touchSince = monotonicMicros();
+   if (touches.size() == 1 || touches.size() == (size_t) CookieBackend::TOUCH_BATCH)
+   {
+      for (int i = 0; i < size; i++)
+         pthread_cond_signal(&workers[i].wake);
+   }
+}
+
+/* answers job, unless another worker already has; caller holds lock */
+void DBPool::post(CheckJob * job, int result, bool failed, bool dropped, int worker)
+{
+   if (job->winner >= 0)
+      return;
+   job->winner = worker;
+   if (worker != job->primary)
+      hedgeWins++;
+
+   Answer answer;
+   answer.context = job->context;
+   answer.result = result;
+   answer.failed = failed;
+   answer.expired = dropped;
+   answer.latency = monotonicMicros() - job->started;
+   if (job->insert && result == 0 && !dropped)
+   {
+      strcpy(answer.clientID, job->clientID);
+      strcpy(answer.cookieVersion, job->cookieVersion);
+      strcpy(answer.dukey, job->dukey);
+   }
+   answers.push_back(answer);
+
+   uint64_t one = 1;
+   if (write(wakeup, &one, sizeof (one)) < 0)
+      DaemonLog::write("DBPool: Cannot signal an answer - %s\n", strerror(errno));
+}
+
+bool DBPool::isThreaded() { return threaded; }
+
+int DBPool::getFd() { return wakeup; }
+
+/*
+ * Method Name: takeAnswers
+ *
+ * Description: hands over every answer waiting.  Resets getFd() first, so
+ *                 an answer posted while this runs wakes the next poll().
+ *
+ * Arguments  : std::vector<Answer> &taken - answers are appended
+ *
+ * Returns    : none
+ */
+void DBPool::takeAnswers(std::vector<Answer> &taken)
+{
+   uint64_t count;
+   if (read(wakeup, &count, sizeof (count)) < 0 && errno != EAGAIN)
+      DaemonLog::write("DBPool: Cannot read answer count - %s\n", strerror(errno));
+
+   pthread_mutex_lock(&lock);
+   taken.insert(taken.end(), answers.begin(), answers.end());
+   answers.clear();
+   pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Method Name: hedge
+ *
+ * Description: issues a second copy, on another connection, of each check
+ *                 still unanswered after the hedge delay, as the hedge
+ *                 budget allows
+ *
+ * Arguments  : none
+ *
+ * Returns    : none
+ */
+void DBPool::hedge()
+{
+   if (!threaded)
+      return;
+   pthread_mutex_lock(&lock);
+   long long now = monotonicMicros();
+   while (!unhedged.empty())
+   {
+      CheckJob * job = unhedged.front();
+      if (job->winner < 0 && hedgePercentile > 0 && now - job->started < hedgeDelay)
+         break;  //the rest started later
+      unhedged.pop_front();
+      if (job->winner < 0 && hedgePercentile > 0 && hedgeBudget >= 1.0
+         && (job->deadline == 0 || now < job->deadline))
+      {
+         int second = pickWorker(job->primary);
+         if (second >= 0)  //else the others are still connecting
+         {
+            hedgeBudget -= 1.0;
+            hedges++;
+            dispatch(job, second);
+         }
+      }
+      releaseJob(job);
+   }
+   pthread_mutex_unlock(&lock);
+}
+
+int DBPool::hedgeWait()
+{
+   if (!threaded)
+      return -1;
+   pthread_mutex_lock(&lock);
+   int wait = -1;
+   if (!unhedged.empty())
+   {
+      long long due = unhedged.front()->started + hedgeDelay - monotonicMicros();
+      wait = (due > 0) ? (int) ((due + 999) / 1000) : 0;
+   }
+   pthread_mutex_unlock(&lock);
+   return wait;
+}
+
+void DBPool::reconfigure(CookieDaemonConfig * config)
+{
+   pthread_mutex_lock(&lock);
+   setHedging(config->getHedgePercentile(), config->getHedgeMaxPercent());
+   maxLag = config->getDBReplicaMaxLag();
+   trustUnknownLag = config->getDBReplicaTrustUnknownLag() != 0;
+   touchDelay = config->getTouchBatchDelay() * 1000LL;
+   pthread_mutex_unlock(&lock);
+}
+
+/* validates and applies the hedging knobs; caller holds lock once threads run */
+void DBPool::setHedging(int percentile, int maxPercent)
+{
+   if (percentile > 0 && size < 2)
+   {
+      DaemonLog::write("DBPool(): hedging needs DB_POOL_SIZE of at least 2; disabled\n");
+      percentile = 0;
+   }
+   if (percentile > 99)
+      percentile = 99;
+   hedgePercentile = percentile;
+   hedgeEarn = maxPercent / 100.0;
+}
+
+unsigned long DBPool::getHedges() { return hedges; }
+unsigned long DBPool::getHedgeWins() { return hedgeWins; }
+long long DBPool::getHedgeDelay() { return hedgeDelay; }
+unsigned long DBPool::getExpired() { return expired; }
+unsigned long DBPool::getReplicaReads() { return replicaReads; }
+unsigned long DBPool::getReplicaFallbacks() { return replicaFallbacks; }
+unsigned long DBPool::getTouchesWritten() { return touchesWritten; }
+unsigned long DBPool::getTouchBatches() { return touchBatches; }
+unsigned long DBPool::getTouchesRejected() { return touchesRejected; }
+unsigned long DBPool::getTouchesDropped() { return touchesDropped; }
+
+unsigned long DBPool::getPipelined() { return pipelined; }
+
+int DBPool::getPipelineInFlight()
+{
+   pthread_mutex_lock(&lock);
+   int running = (pipelines > 0) ? workers[size + replicas].inFlight : 0;
+   pthread_mutex_unlock(&lock);
+   return running;
+}
+
+int DBPool::getConnected()
+{
+   pthread_mutex_lock(&lock);
+   int up = connected;
+   pthread_mutex_unlock(&lock);
+   return up;
+}
+
+int DBPool::getReplicasReady()
+{
+   pthread_mutex_lock(&lock);
+   int ready = 0;
+   for (int i = size; i < size + replicas; i++)
+   {
+      if (usable(&workers[i]))
+         ready++;
+   }
+   pthread_mutex_unlock(&lock);
+   return ready;
+}
+
+long DBPool::getReplicaLag()
+{
+   pthread_mutex_lock(&lock);
+   long lag = -1;
+   for (int i = size; i < size + replicas; i++)
+   {
+      if (workers[i].db != NULL && !workers[i].down && workers[i].lag > lag)
+         lag = workers[i].lag;
+   }
+   pthread_mutex_unlock(&lock);
+   return lag;
+}
+
+void * DBPool::workerMain(void * arg)
+{
+   Worker * w = (Worker *) arg;
+   if (w->pipelined)
+      w->pool->runPipeline(w);
+   else
+      w->pool->runWorker(w);
+   return NULL;
+}
+
+/*
+ * Method Name: runWorker
+ *
+ * Description: worker thread body.  Takes jobs off this worker's queue and
+ *                 runs them on its connection.  A check that another worker
+ *                 has already answered is skipped rather than re-run, and
+ *                 one queued on a read replica that has since become
+ *                 unusable goes to the primary.  First the worker
+ *                 connects its backend: a primary worker retries each
+ *                 second until it gets through, and a read replica worker
+ *                 connects on its first probe.  Between jobs a read
+ *                 replica worker probes its lag and a primary worker
+ *                 writes touches, each when due; at shutdown the primary
+ *                 workers write what touches are left.
+ *
+ * Arguments  : Worker * w - the worker this thread drives
+ *
+ * Returns    : none
+ */
+void DBPool::runWorker(Worker * w)
+{
+   pthread_mutex_lock(&lock);
+   while (1)
+   {
+      long long due = choreDue(w);
+      while (w->queue.empty() && !stopping && (due == 0 || monotonicMicros() < due))
+      {
+         if (due == 0)
+            pthread_cond_wait(&w->wake, &lock);
+         else
+         {
+            struct timespec ts;
+            ts.tv_sec = due / 1000000;
+            ts.tv_nsec = (due % 1000000) * 1000;
+            pthread_cond_timedwait(&w->wake, &lock, &ts);
+         }
+         due = choreDue(w);
+      }
+      if (stopping)
+      {
+         if (w->replica || w->db == NULL || touches.empty())
+            break;
+         due = 1;  //the last touches, before disconnecting
+      }
+
+      if (due != 0 && monotonicMicros() >= due)
+      {
+         w->busy = true;
+         if (w->replica)
+            probeReplica(w);
+         else if (w->db == NULL)
+            connectPrimary(w);
+         else
+            flushTouches(w);
+         w->busy = false;
+         continue;
+      }
+
+      CheckJob * job = w->queue.front();
+      w->queue.pop_front();
+
+      if (job->winner >= 0)
+      {
+         releaseJob(job);  //the other connection already answered
+         continue;
+      }
+      if (w->replica && !usable(w))
+      {
+         fallBack(job);
+         releaseJob(job);
+         continue;
+      }
+
+      w->busy = true;
+      pthread_mutex_unlock(&lock);
+      run(job, w->db, w->index);
+      pthread_mutex_lock(&lock);
+      w->busy = false;
+      releaseJob(job);
+   }
+   pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Method Name: runPipeline
+ *
+ * Description: pipeline worker thread body.  Connects the OCIPipeline,
+ *                 then keeps up to DB_PIPELINE_DEPTH checks from this
+ *                 worker's queue in flight on it.  Each pass starts queued
+ *                 checks on idle sessions and polls the running ones,
+ *                 answering each as it finishes, and naps POLL_INTERVAL if
+ *                 none did.  A queued check that another worker has
+ *                 answered is skipped, and one whose deadline has passed
+ *                 is answered expired; one already running is left to
+ *                 finish.  While the pipeline is down its queued checks go
+ *                 to the primary workers, and it reconnects once a second.
+ *
+ * Arguments  : Worker * w - the pipeline worker
+ *
+ * Returns    : none
+ */
+void DBPool::runPipeline(Worker * w)
+{
+   pthread_mutex_lock(&lock);
+   while (!stopping)
+   {
+      if (w->down)
+      {
+         while (!w->queue.empty())
+         {
+            CheckJob * job = w->queue.front();
+            w->queue.pop_front();
+            if (job->winner < 0)
+            {
+               job->primary = pickWorker(-1);
+               dispatch(job, job->primary);
+            }
+            releaseJob(job);
+         }
+      }
+      if (w->inFlight == 0 && (w->pipeline == NULL || w->down))
+      {
+         long long due = w->probed + PROBE_INTERVAL;
+         if (w->probed == 0 || monotonicMicros() >= due)
+            connectPipeline(w);
+         else
+         {
+            struct timespec ts;
+            ts.tv_sec = due / 1000000;
+            ts.tv_nsec = (due % 1000000) * 1000;
+            pthread_cond_timedwait(&w->wake, &lock, &ts);
+         }
+         continue;
+      }
+
+      while (!w->down && !w->queue.empty() && w->inFlight < pipelineDepth)
+      {
+         CheckJob * job = w->queue.front();
+         w->queue.pop_front();
+         if (job->winner >= 0)
+         {
+            releaseJob(job);  //the other connection already answered
+            continue;
+         }
+         if (job->deadline != 0 && monotonicMicros() >= job->deadline)
+         {
+            expired++;
+            post(job, 0, false, true, w->index);
+            releaseJob(job);
+            continue;
+         }
+         int i = 0;
+         while (w->slots[i].job != NULL)
+            i++;
+         w->slots[i].job = job;
+         w->slots[i].starting = true;
+         w->inFlight++;
+      }
+      if (w->inFlight == 0)
+      {
+         pthread_cond_wait(&w->wake, &lock);
+         continue;
+      }
+
+      //the jobs are ours until answered, so run them without lock
+      w->busy = true;
+      pthread_mutex_unlock(&lock);
+      bool finished = false;
+      char reason[128] = "";
+      for (int i = 0; i < pipelineDepth; i++)
+      {
+         Slot * slot = &w->slots[i];
+         if (slot->job == NULL)
+            continue;
+         CheckJob * job = slot->job;
+         bool starting = slot->starting;
+         slot->failed = false;
+         try
+         {
+            if (starting)
+            {
+               slot->starting = false;
+               slot->since = monotonicMicros();
+               slot->result = w->pipeline->startCheck(i, job->userID, job->IP, job->clientID, job->cookieVersion);
+            }
+            else
+               slot->result = w->pipeline->pollCheck(i);
+         }
+         catch (std::exception &e)
+         {
+            DaemonLog::write("checkCookie(): Database error - %s\n", e.what());
+            if (starting)  //its session would not even reconnect
+               snprintf(reason, sizeof (reason), "%s", e.what());
+            slot->result = 0;
+            slot->failed = true;
+         }
+         if (slot->failed || slot->result != OCIPipeline::STILL_EXECUTING)
+         {
+            slot->done = true;
+            finished = true;
+         }
+      }
+
+      pthread_mutex_lock(&lock);
+      w->busy = false;
+      long long now = monotonicMicros();
+      for (int i = 0; i < pipelineDepth; i++)
+      {
+         Slot * slot = &w->slots[i];
+         if (!slot->done)
+            continue;
+         if (!slot->failed)
+         {
+            recordLatency(now - slot->since);
+            pipelined++;
+         }
+         post(slot->job, slot->result, slot->failed, false, w->index);
+         releaseJob(slot->job);
+         slot->job = NULL;
+         slot->done = false;
+         w->inFlight--;
+      }
+      if (reason[0] != '\0' && !w->down)
+      {
+         w->probed = now;
+         pipelineDown(w, reason);
+      }
+      if (!finished && (w->queue.empty() || w->inFlight == pipelineDepth))
+      {
+         pthread_mutex_unlock(&lock);
+         struct timespec nap;
+         nap.tv_sec = 0;
+         nap.tv_nsec = POLL_INTERVAL;
+         nanosleep(&nap, NULL);
+         pthread_mutex_lock(&lock);
+      }
+   }
+   pthread_mutex_unlock(&lock);
+}
+
+/* least loaded connected primary worker, other than exclude; -1 if none.
+ * Caller holds lock. */
+int DBPool::pickWorker(int exclude)
+{
+   int best = -1;
+   size_t bestLoad = 0;
+   for (int i = 0; i < size; i++)
+   {
+      if (i == exclude || workers[i].db == NULL)
+         continue;
+      size_t load = workers[i].queue.size() + (workers[i].busy ? 1 : 0);
+      if (best < 0 || load < bestLoad)
+      {
+         best = i;
+         bestLoad = load;
+      }
+   }
+   return best;
+}
+
+/* the pipeline worker if it is up, else the least loaded connected
+ * primary worker; caller holds lock */
+int DBPool::pickCheckWorker()
+{
+   if (pipelines > 0)
+   {
+      Worker * w = &workers[size + replicas];
+      if (w->pipeline != NULL && !w->down)
+         return w->index;
+   }
+   return pickWorker(-1);
+}
+
+/* least loaded usable read replica worker; -1 if none.  Caller holds
+ * lock. */
+int DBPool::pickReplica()
+{
+   int best = -1;
+   size_t bestLoad = 0;
+   for (int i = size; i < size + replicas; i++)
+   {
+      if (!usable(&workers[i]))
+         continue;
+      size_t load = workers[i].queue.size() + (workers[i].busy ? 1 : 0);
+      if (best < 0 || load < bestLoad)
+      {
+         best = i;
+         bestLoad = load;
+      }
+   }
+   return best;
+}
+
+/* whether checks may go to read replica worker w; one whose lag is unknown
+ * takes none unless DB_REPLICA_TRUST_UNKNOWN_LAG says so.  Caller holds
+ * lock. */
+bool DBPool::usable(Worker * w)
+{
+   if (w->db == NULL || w->down)
+      return false;
+   return (w->lag < 0) ? trustUnknownLag : w->lag <= maxLag;
+}
+
+/* monotonicMicros() when w next has a chore, 1 if one is overdue, 0 if it
+ * has none; caller holds lock */
+long long DBPool::choreDue(Worker * w)
+{
+   if (w->replica || w->db == NULL)
+      return w->probed + PROBE_INTERVAL;
+   if (touches.empty())
+      return 0;
+   long long due = (touches.size() >= (size_t) CookieBackend::TOUCH_BATCH) ? 1 : touchSince + touchDelay;
+   return (due < touchHeld) ? touchHeld : due;
+}
+
+/*
+ * Method Name: connectPrimary
+ *
+ * Description: connects primary worker w's backend.  The first attempt
+ *                 of each is counted for the constructor, which waits for
+ *                 one to get through or all to fail; a failure is logged
+ *                 once and retried on the next call.  Called with lock,
+ *                 which is dropped around the connect.
+ *
+ * Arguments  : Worker * w - a primary worker with no connection
+ *
+ * Returns    : none
+ */
+void DBPool::connectPrimary(Worker * w)
+{
+   bool first = w->probed == 0;
+   w->probed = monotonicMicros();
+   pthread_mutex_unlock(&lock);
+
+   CookieBackend * db = NULL;
+   char reason[128] = "";
+   CookieDaemonConfig * config = CookieDaemonConfig::current();
+   try
+   {
+      db = CookieBackend::create(config, true);
+   }
+   catch (std::exception &e)
+   {
+      snprintf(reason, sizeof (reason), "%s", e.what());
+   }
+   config->release();
+
+   pthread_mutex_lock(&lock);
+   if (db != NULL)
+   {
+      w->db = db;
+      connected++;
+      if (w->down)
+         DaemonLog::write("DBPool: connection %d is back\n", w->index);
+      w->down = false;
+   }
+   else if (!w->down)
+   {
+      DaemonLog::write("DBPool: connection %d failed - %s; retrying every second\n", w->index, reason);
+      w->down = true;
+   }
+   if (first && db == NULL)
+   {
+      connectFailures++;
+      if (connectError.empty())
+         connectError = reason;
+   }
+   pthread_cond_broadcast(&ready);
+}
+
+/*
+ * Method Name: connectPipeline
+ *
+ * Description: connects the pipeline worker's OCIPipeline, or reconnects
+ *                 its failed sessions, and logs when that brings it back.
+ *                 Called with lock, which is dropped around the connect.
+ *
+ * Arguments  : Worker * w - the pipeline worker, with nothing in flight
+ *
+ * Returns    : none
+ */
+void DBPool::connectPipeline(Worker * w)
+{
+   w->probed = monotonicMicros();
+   OCIPipeline * pipeline = w->pipeline;
+   pthread_mutex_unlock(&lock);
+
+   char reason[128] = "";
+   try
+   {
+      if (pipeline == NULL)
+         pipeline = new OCIPipeline(pipelineDepth);
+      else
+         pipeline->reconnect();
+   }
+   catch (std::exception &e)
+   {
+      snprintf(reason, sizeof (reason), "%s", e.what());
+   }
+
+   pthread_mutex_lock(&lock);
+   w->pipeline = pipeline;
+   if (reason[0] != '\0')
+   {
+      if (!w->down)
+         pipelineDown(w, reason);
+   }
+   else if (w->down)
+   {
+      w->down = false;
+      DaemonLog::write("DBPool: check pipeline is back\n");
+   }
+}
+
+/* takes checks off the pipeline worker until it reconnects; caller holds
+ * lock */
+void DBPool::pipelineDown(Worker * w, const char * reason)
+{
+   w->down = true;
+   DaemonLog::write("DBPool: check pipeline unavailable - %s; its checks go to the primary\n", reason);
+}
+
+/*
+ * Method Name: probeReplica
+ *
+ * Description: asks read replica worker w's connection how far behind it
+ *                 is, connecting it first if it never has, and logs when
+ *                 that makes the connection usable or not.  Called with
+ *                 lock, which is dropped around the database call.
+ *
+ * Arguments  : Worker * w - a read replica worker
+ *
+ * Returns    : none
+ */
+void DBPool::probeReplica(Worker * w)
+{
+   w->probed = monotonicMicros();
+   CookieBackend * db = w->db;
+   pthread_mutex_unlock(&lock);
+
+   long lag = 0;
+   char reason[128] = "";
+   try
+   {
+      if (db == NULL)
+      {
+         CookieDaemonConfig * config = CookieDaemonConfig::current();
+         try
+         {
+            db = CookieBackend::create(config, true, true);
+         }
+         catch (...)
+         {
+            config->release();
+            throw;
+         }
+         config->release();
+      }
+      lag = db->replicaLag();
+   }
+   catch (std::exception &e)
+   {
+      snprintf(reason, sizeof (reason), "%s", e.what());
+   }
+
+   pthread_mutex_lock(&lock);
+   bool was = usable(w);
+   bool wasDown = w->down;
+   bool fresh = w->db == NULL && db != NULL;
+   w->db = db;
+   w->down = reason[0] != '\0';
+   if (!w->down)
+      w->lag = lag;
+   bool is = usable(w);
+   if (was && !is && w->down)
+      DaemonLog::write("DBPool: read replica %d unreachable - %s; its checks go to the primary\n", w->index - size, reason);
+   else if (was && !is && w->lag < 0)
+      DaemonLog::write("DBPool: read replica %d cannot report its lag; its checks go to the primary\n", w->index - size);
+   else if (was && !is)
+      DaemonLog::write("DBPool: read replica %d is %lds behind; its checks go to the primary\n", w->index - size, w->lag);
+   else if (!was && is && !(fresh && !wasDown))  //not just its first connect
+      DaemonLog::write("DBPool: read replica %d is back, %lds behind\n", w->index - size, w->lag);
+   else if (fresh && !is && !w->down && w->lag < 0)
+      DaemonLog::write("DBPool: read replica %d cannot report its lag; it gets no checks unless DB_REPLICA_TRUST_UNKNOWN_LAG is set\n", w->index - size);
+   else if (!wasDown && w->down && w->db == NULL)
+      DaemonLog::write("DBPool: read replica %d unreachable - %s; its probe will retry\n", w->index - size, reason);
+}
+
+static bool sameCookie(const CookieTouch &a, const CookieTouch &b)
+{
+   return strcmp(a.clientID, b.clientID) == 0 && strcmp(a.userID, b.userID) == 0
+      && strcmp(a.IP, b.IP) == 0 && strcmp(a.cookieVersion, b.cookieVersion) == 0;
+}
+
+/*
+ * Method Name: flushTouches
+ *
+ * Description: writes up to TOUCH_BATCH queued touches on primary worker
+ *                 w's connection, in one round trip.  A cookie used again
+ *                 before its touch was written is written once.  If the write fails
+ *                 they are queued again and no batch is tried for
+ *                 TOUCH_RETRY, unless the pool is stopping.  Called with lock, which is dropped
+ *                 around the database call.
+ *
+ * Arguments  : Worker * w - a primary worker
+ *
+ * Returns    : none
+ */
+void DBPool::flushTouches(Worker * w)
+{
+   int count = 0;
+   while (count < CookieBackend::TOUCH_BATCH && !touches.empty())
+   {
+      CookieTouch &touch = touches.front();
+      int i = 0;
+      while (i < count && !sameCookie(w->batch[i], touch))
+         i++;
+      if (i == count)
+         w->batch[count++] = touch;  //else it is in this batch already
+      touches.pop_front();
+   }
+   touchSince = monotonicMicros();  //any left over wait for the next batch
+   pthread_mutex_unlock(&lock);
+
+   bool failed = false;
+   try
+   {
+      w->db->touchCookies(w->batch, count);
+   }
+   catch (std::exception &e)
+   {
+      DaemonLog::write("touchCookies(): Database error - %s\n", e.what());
+      failed = true;
+   }
+
+   pthread_mutex_lock(&lock);
+   if (failed)
+   {
+      touchHeld = monotonicMicros() + TOUCH_RETRY;
+      for (int i = 0; i < count; i++)
+      {
+         if (stopping || touches.size() >= MAX_TOUCHES)
+            touchesDropped++;
+         else
+            touches.push_back(w->batch[i]);
+      }
+      return;
+   }
+   touchBatches++;
+   touchesWritten += count;
+   for (int i = 0; i < count; i++)
+   {
+      if (w->batch[i].softLifetime == 0)
+         touchesRejected++;
+   }
+}
+
+/* queue job on a worker; caller holds lock */
+void DBPool::dispatch(CheckJob * job, int worker)
+{
+   job->refs++;
+   workers[worker].queue.push_back(job);
+   pthread_cond_signal(&workers[worker].wake);
+}
+
+/* drop one reference to job, recycling it with the last; caller holds lock */
+void DBPool::releaseJob(CheckJob * job)
+{
+   if (--job->refs <= 0)
+   {
+      job->next = freeJobs;
+      freeJobs = job;
+   }
+}
+
+/*
+ * Method Name: recordLatency
+ *
+ * Description: adds a check latency to the sample ring and, every
+ *                 HEDGE_RECOMPUTE samples, recomputes the hedge delay as the
+ *                 HEDGE_PERCENTILE-th percentile of the ring.  Caller holds
+ *                 lock.
+ *
+ * Arguments  : long long latency - microseconds one check took
+ *
+ * Returns    : none
+ */
+void DBPool::recordLatency(long long latency)
+{
+   latencies[latencyNext] = latency;
+   latencyNext = (latencyNext + 1) % LATENCY_SAMPLES;
+   if (latencyCount < LATENCY_SAMPLES)
+      latencyCount++;
+
+   if (hedgePercentile <= 0 || latencyNext % HEDGE_RECOMPUTE != 0)
+      return;
+
+   long long sorted[LATENCY_SAMPLES];
+   std::copy(latencies, latencies + latencyCount, sorted);
+   int rank = latencyCount * hedgePercentile / 100;
+   std::nth_element(sorted, sorted + rank, sorted + latencyCount);
+   hedgeDelay = sorted[rank];
+}
@@ -0,0 +1,297 @@
+#ifndef DBPOOL_H
+#define DBPOOL_H
+
+#include <pthread.h>
+#include <vector>
+#include "CookieBackend.h"
+#include "CookieDaemonConfig.h"
+#include "OCIPipeline.h"
+#include "RingQueue.h"
+
+/*
+ * Class Name  : DBPool
+ *
+ * Description : A set of DB_POOL_SIZE CookieBackend connections (normally
+ *              OCCI_IGSPnet), each driven by its own thread, used by
+ *              cookieDaemon for checkCookie and insertCookie.
+ *
+ *              Calls are asynchronous: startCheck() and startInsert() queue
+ *              a call and return at once, tagged with the caller's context.
+ *              When calls finish, getFd() polls readable and takeAnswers()
+ *              returns them, so the request loop keeps serving while the
+ *              database works.
+ *
+ *              With hedging enabled (HEDGE_PERCENTILE > 0 and at least two
+ *              connections), a check that has not returned within the
+ *              HEDGE_PERCENTILE-th percentile of recent check latency is
+ *              issued again on a second connection by hedge() and whichever
+ *              answers first wins.  CHECK_COOKIE only refreshes the
+ *              cookie's soft timestamp, so running it twice is harmless.
+ *              Hedges are capped at HEDGE_MAX_PERCENT of checks so a slow
+ *              database is not hit with double load.
+ *
+ *              A call may carry a deadline.  One still queued when its
+ *              deadline passes is dropped without being made, and answered
+ *              as expired, so a backlog behind a stuck session drains
+ *              without adding to it.  A call already running is left to
+ *              finish.
+ *
+ *              With a read replica configured, DB_REPLICA_POOL_SIZE more
+ *              connections are made to it, each with its own thread, and
+ *              checks go to them as CookieBackend::readCookie.  A cookie
+ *              the replica finds valid is answered at once and its touch
+ *              (the soft timestamp refresh CHECK_COOKIE would have made) is
+ *              queued; the primary connections write queued touches in
+ *              batches of up to TOUCH_BATCH, once TOUCH_BATCH_DELAY has
+ *              passed or a batch is full.  A check the replica cannot
+ *              decide, or that fails there, goes on to the primary.  Each
+ *              replica connection probes its lag once a second; one that is
+ *              unreachable, more than DB_REPLICA_MAX_LAG seconds behind, or
+ *              unable to report its lag (unless DB_REPLICA_TRUST_UNKNOWN_LAG
+ *              is set) gets no checks until it recovers, and if none is usable
+ *              checks go to the primary as before.
+ *
+ *              With DB_PIPELINE_DEPTH set (and the Oracle backend), one more
+ *              thread drives an OCIPipeline of that many non-blocking
+ *              sessions, and checks go there rather than to the primary
+ *              connections, which keep inserts, touches and hedges.  That
+ *              thread keeps up to DB_PIPELINE_DEPTH checks in flight at
+ *              once instead of one per thread.  If the pipeline cannot
+ *              connect, checks go to the primary connections until it can.
+ *
+ *              Each thread makes its own connection, so they are made in
+ *              parallel and the pool is ready once the first primary one
+ *              is; until the others are up, calls go to those that are.
+ *
+ *              With a single connection and no read replica no threads are
+ *              started: each call runs to completion inside startCheck()
+ *              or startInsert(), and its answer is waiting when they
+ *              return.
+ *
+ *              Finished jobs go on a free list for the next call, and the
+ *              queues only grow, so once the pool has seen its busiest
+ *              moment a call allocates nothing.
+ *
+ * Method Index: DBPool(CookieDaemonConfig * config) - constructor; connects
+ *                  every pooled connection in parallel, returning once a
+ *                  primary one is up.  Throws std::runtime_error if every
+ *                  primary connection fails; one that fails while another
+ *                  got through is retried each second, and a read replica
+ *                  connection that fails is retried by its probe.
+ *               ~DBPool() - waits for running calls, then disconnects
+ *               void startCheck(const char * userID, const char * IP,
+ *                  const char * clientID, const char * cookieVersion,
+ *                  void * context, long long deadline, bool primaryOnly) -
+ *                  as CookieBackend::checkCookie, on the least loaded
+ *                  usable read replica connection (unless primaryOnly), or
+ *                  else primary connection.  deadline is in
+ *                  monotonicMicros(); 0 for none.
+ *               void startInsert(const char * userID, const char * IP,
+ *                  int hardLifetime, int softLifetime, void * context,
+ *                  long long deadline) - as CookieBackend::insertCookie.
+ *                  Never hedged, since an insert is not idempotent.
+ *               bool isThreaded() - false if calls run inline, one at a
+ *                  time, inside startCheck() and startInsert()
+ *               int getFd() - an fd that polls readable when answers are
+ *                  waiting
+ *               void takeAnswers(std::vector<Answer> &taken) - appends
+ *                  every waiting answer, in the order the calls finished
+ *               void hedge() - hedges the checks that have waited too long
+ *               int hedgeWait() - milliseconds until hedge() next has
+ *                  work; -1 if none
+ *               unsigned long getHedges() - hedged checks issued
+ *               unsigned long getHedgeWins() - hedges that answered first
+ *               long long getHedgeDelay() - current hedge delay (us)
+ *               unsigned long getExpired() - calls dropped unmade
+ *               unsigned long getReplicaReads() - checks the read replica
+ *                  answered
+ *               unsigned long getReplicaFallbacks() - checks it passed on
+ *                  to the primary
+ *               int getReplicasReady() - read replica connections checks
+ *                  may go to now
+ *               long getReplicaLag() - the largest lag its connections
+ *                  last reported, in seconds; -1 if unknown
+ *               unsigned long getTouchesWritten(),
+ *                  unsigned long getTouchBatches() - touches written to
+ *                  the primary, and the batches they took
+ *               unsigned long getTouchesRejected() - touches the primary
+ *                  answered 0, for cookies invalidated since the replica
+ *                  last caught up
+ *               unsigned long getTouchesDropped() - touches never written,
+ *                  for want of room or a primary
+ *               int getConnected() - primary connections up now
+ *               unsigned long getPipelined() - checks the pipeline answered
+ *               int getPipelineInFlight() - checks running on it now
+ *               void reconfigure(CookieDaemonConfig * config) - takes new
+ *                  hedging, lag and touch knobs from a reloaded config.
+ *                  The connections stay up; DB_POOL_SIZE and the read
+ *                  replica settings only change on restart.
+ *
+ */
+class DBPool
+{
+   public:
+      /* one finished call */
+      struct Answer
+      {
+         void * context;        /* as passed to startCheck() or startInsert() */
+         int result;            /* as CookieBackend's; 0 or -1 if failed */
+         bool failed;           /* the database call threw */
+         bool expired;          /* dropped unmade: its deadline passed first */
+         long long latency;     /* microseconds from start to answer */
+         char clientID[5];      /* filled in by a successful insert */
+         char cookieVersion[2]; /* likewise */
+         char dukey[2];         /* likewise */
+      };
+
+      DBPool(CookieDaemonConfig * config);
+      ~DBPool();
+      void startCheck(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, void * context, long long deadline, bool primaryOnly);
+      void startInsert(const char * userID, const char * IP, int hardLifetime, int softLifetime, void * context, long long deadline);
+      bool isThreaded();
+      int getFd();
+      void takeAnswers(std::vector<Answer> &taken);
+      void hedge();
+      int hedgeWait();
+      unsigned long getHedges();
+      unsigned long getHedgeWins();
+      long long getHedgeDelay();
+      unsigned long getExpired();
+      unsigned long getReplicaReads();
+      unsigned long getReplicaFallbacks();
+      int getReplicasReady();
+      long getReplicaLag();
+      unsigned long getTouchesWritten();
+      unsigned long getTouchBatches();
+      unsigned long getTouchesRejected();
+      unsigned long getTouchesDropped();
+      int getConnected();
+      unsigned long getPipelined();
+      int getPipelineInFlight();
+      void reconfigure(CookieDaemonConfig * config);
+   private:
+      /* one check, possibly running on two connections at once, or one
+       * insert */
+      struct CheckJob
+      {
+         bool insert;
+         char userID[13];
+         char IP[16];
+         char clientID[5];      /* filled in by an insert */
+         char cookieVersion[2]; /* likewise */
+         char dukey[2];         /* likewise */
+         int hardLifetime;      /* insert only */
+         int softLifetime;
+         void * context;
+         long long started;
+         long long deadline;  /* monotonicMicros(); 0 = none */
+         int primary;      /* worker first given the job */
+         int winner;       /* index of the worker that answered; -1 = none yet */
+         int refs;         /* each worker and queue holding the job */
+         CheckJob * next;  /* on the free list */
+      };
+      /* one pipeline session and the check on it */
+      struct Slot
+      {
+         CheckJob * job;        /* NULL if idle */
+         bool starting;         /* given a job, not yet started */
+         bool done;             /* answered by the last poll */
+         bool failed;
+         int result;
+         long long since;       /* monotonicMicros() it started */
+      };
+      struct Worker
+      {
+         DBPool * pool;
+         int index;
+         CookieBackend * db;    /* NULL until it first connects */
+         pthread_t thread;
+         pthread_cond_t wake;
+         RingQueue<CheckJob *> queue;
+         bool busy;
+         bool replica;          /* on the read replica */
+         bool down;             /* primary: connect failed; read replica: last call or probe failed */
+         long lag;              /* read replica: seconds, as last probed */
+         long long probed;      /* monotonicMicros() of last probe or connect attempt */
+         CookieTouch * batch;   /* primary: touches being written */
+         bool pipelined;        /* drives the OCIPipeline, not db */
+         OCIPipeline * pipeline;  /* pipeline worker: NULL until it first connects */
+         Slot * slots;          /* pipeline worker: one per session */
+         int inFlight;          /* pipeline worker: slots with a job */
+      };
+      static const int LATENCY_SAMPLES = 1024;
+      static const int HEDGE_RECOMPUTE = 64;  /* samples between percentile updates */
+      static const long long PROBE_INTERVAL = 1000000;  /* us between lag probes */
+      static const long long TOUCH_RETRY = 1000000;     /* us to hold touches after a failed batch */
+      static const size_t MAX_TOUCHES = 65536;  /* queued beyond this are dropped */
+      static const long POLL_INTERVAL = 100000;  /* ns the pipeline naps when no check finished */
+
+      static void * workerMain(void * arg);
+      void runWorker(Worker * w);
+      void runPipeline(Worker * w);
+      void stopWorkers();
+      void freeWorkers();
+      CheckJob * newJob(bool insert, const char * userID, const char * IP, void * context, long long deadline);
+      void run(CheckJob * job, CookieBackend * db, int worker);
+      void post(CheckJob * job, int result, bool failed, bool dropped, int worker);
+      int pickWorker(int exclude);
+      int pickReplica();
+      int pickCheckWorker();
+      bool usable(Worker * w);
+      void fallBack(CheckJob * job);
+      void queueTouch(CheckJob * job);
+      long long choreDue(Worker * w);
+      void connectPrimary(Worker * w);
+      void connectPipeline(Worker * w);
+      void pipelineDown(Worker * w, const char * reason);
+      void probeReplica(Worker * w);
+      void flushTouches(Worker * w);
+      void dispatch(CheckJob * job, int worker);
+      void releaseJob(CheckJob * job);
+      void recordLatency(long long latency);
+      void setHedging(int percentile, int maxPercent);
+
+      Worker * workers;         /* size primary, then replicas read replica, then pipelines pipeline */
+      int size;
+      int replicas;
+      int pipelines;            /* 1 with DB_PIPELINE_DEPTH, else 0 */
+      int pipelineDepth;
+      unsigned long pipelined;  /* checks the pipeline answered */
+      bool threaded;            /* false: one connection, driven inline */
+      bool stopping;
+      pthread_mutex_t lock;
+      pthread_cond_t ready;     /* signalled as primary connections come up or fail */
+      int connected;            /* primary connections up */
+      int connectFailures;      /* primary connections whose first attempt failed */
+      std::string connectError; /* the first of those failures */
+      int wakeup;               /* eventfd; written when answers are added */
+      std::vector<Answer> answers;
+      CheckJob * freeJobs;      /* finished jobs, for newJob() to reuse */
+      RingQueue<CheckJob *> unhedged;  /* checks that may yet need a hedge */
+
+      int hedgePercentile;
+      double hedgeBudget;      /* tokens; one is spent per hedge */
+      double hedgeEarn;        /* tokens earned per check */
+      long long hedgeDelay;
+      long long latencies[LATENCY_SAMPLES];
+      int latencyCount;
+      int latencyNext;
+      unsigned long hedges;
+      unsigned long hedgeWins;
+      unsigned long expired;   /* calls dropped unmade */
+
+      int maxLag;              /* DB_REPLICA_MAX_LAG */
+      bool trustUnknownLag;    /* DB_REPLICA_TRUST_UNKNOWN_LAG */
+      long long touchDelay;    /* TOUCH_BATCH_DELAY, us */
+      RingQueue<CookieTouch> touches;  /* waiting to be written */
+      long long touchSince;    /* monotonicMicros() the oldest was queued */
+      long long touchHeld;     /* no batch before this, after a failure */
+      unsigned long replicaReads;
+      unsigned long replicaFallbacks;
+      unsigned long touchesWritten;
+      unsigned long touchBatches;
+      unsigned long touchesRejected;
+      unsigned long touchesDropped;
+};
+
+#endif
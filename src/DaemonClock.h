@@ -0,0 +1,19 @@
+#ifndef DAEMON_CLOCK_H
+#define DAEMON_CLOCK_H
+
+#include <time.h>
+
+/*
+ * Monotonic time helpers shared by the daemon's rate limiters and
+ * latency measurements.  Inline so the hot path does not pay a call.
+ */
+
+/* microseconds on the monotonic clock; unaffected by wall-clock changes */
+inline long long monotonicMicros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+#endif
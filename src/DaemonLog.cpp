@@ -0,0 +1,363 @@
+#include "DaemonLog.h"
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+DaemonLog::Record * DaemonLog::ring = NULL;
+unsigned long long DaemonLog::mask = 0;
+volatile unsigned long long DaemonLog::tail = 0;
+unsigned long long DaemonLog::head = 0;
+volatile int DaemonLog::format = DaemonLog::PLAIN;
+volatile int DaemonLog::rateLimit = 0;
+DaemonLog::Site DaemonLog::sites[DaemonLog::SITES];
+volatile unsigned long DaemonLog::dropped = 0;
+volatile unsigned long DaemonLog::suppressed = 0;
+pthread_t DaemonLog::writer;
+pid_t DaemonLog::writerPid = 0;
+volatile bool DaemonLog::stopping = false;
+
+/*
+ * Method Name: start
+ *
+ * Description: sets up the ring and starts the writer thread, with every
+ *                 signal blocked so they still reach the request loop
+ *
+ * Arguments  : CookieDaemonConfig * config - LOG_BUFFER, LOG_FORMAT and
+ *                 LOG_RATE_LIMIT
+ *
+ * Returns    : none
+ */
+void DaemonLog::start(CookieDaemonConfig * config)
+{
+   if (ring != NULL)
+      return;
+   unsigned long long size = 16;
+   while (size < (unsigned long long) config->getLogBuffer())
+      size <<= 1;
+   ring = new Record[size];
+   mask = size - 1;
+   reconfigure(config);
+   atexit(stop);
+   restart();
+}
+
+void DaemonLog::restart()
+{
+   if (ring == NULL)
+      return;
+   reset();
+   stopping = false;
+
+   sigset_t all, old;
+   sigfillset(&all);
+   pthread_sigmask(SIG_BLOCK, &all, &old);
+   if (pthread_create(&writer, NULL, writerMain, NULL) == 0)
+      writerPid = getpid();
+   else
+      writerPid = 0;
+   pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* empties the ring; in a fresh child, whatever is queued is the parent's */
+void DaemonLog::reset()
+{
+   for (unsigned long long i = 0; i <= mask; i++)
+      ring[i].sequence = i;
+   head = 0;
+   tail = 0;
+   __sync_synchronize();
+}
+
+void DaemonLog::stop()
+{
+   if (writerPid == 0 || writerPid != getpid())
+      return;
+   stopping = true;
+   pthread_join(writer, NULL);
+   writerPid = 0;
+}
+
+void DaemonLog::reconfigure(CookieDaemonConfig * config)
+{
+   std::string name = config->getLogFormat();
+   if (name == "json")
+      format = JSON;
+   else if (name == "kv")
+      format = KV;
+   else
+      format = PLAIN;
+   rateLimit = config->getLogRateLimit();
+}
+
+unsigned long DaemonLog::getDropped() { return dropped; }
+unsigned long DaemonLog::getSuppressed() { return suppressed; }
+
+/*
+ * Method Name: write
+ *
+ * Description: logs one message.  Claims the next slot of the ring with a
+ *                 compare-and-swap, formats the message straight into it
+ *                 and publishes it by bumping the slot's sequence number;
+ *                 the writer thread does the rest.  Never blocks.
+ *
+ * Arguments  : const char * format - printf format; also identifies the
+ *                 message for rate limiting
+ *              ... - its arguments
+ *
+ * Returns    : none
+ */
+void DaemonLog::write(const char * format, ...)
+{
+   va_list args;
+   va_start(args, format);
+   if (writerPid == 0)
+   {
+      /* not started, or stopped: the old synchronous way */
+      vfprintf(stderr, format, args);
+      if (format[0] == '\0' || format[strlen(format) - 1] != '\n')
+         fputc('\n', stderr);
+      va_end(args);
+      return;
+   }
+   if (!admit(format))
+   {
+      va_end(args);
+      return;
+   }
+
+   unsigned long long position = tail;
+   Record * r;
+   for (;;)
+   {
+      r = &ring[position & mask];
+      long long lag = (long long) (r->sequence - position);
+      if (lag == 0)
+      {
+         if (__sync_bool_compare_and_swap(&tail, position, position + 1))
+            break;
+         position = tail;
+      }
+      else if (lag < 0)
+      {
+         __sync_fetch_and_add(&dropped, 1);  //full
+         va_end(args);
+         return;
+      }
+      else
+         position = tail;  //another thread took it
+   }
+
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   r->time = (long long) tv.tv_sec * 1000000LL + tv.tv_usec;
+   vsnprintf(r->text, TEXT_SIZE, format, args);
+   va_end(args);
+   size_t length = strlen(r->text);
+   if (length > 0 && r->text[length - 1] == '\n')
+      r->text[length - 1] = '\0';
+   __sync_synchronize();  //the record lands before it is published
+   r->sequence = position + 1;
+}
+
+/*
+ * Method Name: admit
+ *
+ * Description: the rate limit.  Counts the message against its format
+ *                 string's site for the current second; a site is claimed
+ *                 with a compare-and-swap the first time its format is
+ *                 seen.  The count resets racily at each new second, which
+ *                 may let a few extra through but never blocks.
+ *
+ * Arguments  : const char * format - the message's format string
+ *
+ * Returns    : bool - false if the message is over LOG_RATE_LIMIT
+ */
+bool DaemonLog::admit(const char * format)
+{
+   int limit = rateLimit;
+   if (limit <= 0)
+      return true;
+   unsigned long hash = ((unsigned long) format >> 3) * 2654435761UL;
+   for (int i = 0; i < SITE_PROBES; i++)
+   {
+      Site * s = &sites[(hash + i) & (SITES - 1)];
+      if (s->format != format
+         && !(s->format == NULL && __sync_bool_compare_and_swap(&s->format, (const char *) NULL, format))
+         && s->format != format)
+         continue;
+
+      long now = (long) time(NULL);
+      if (s->second != now)
+      {
+         s->second = now;
+         s->count = 0;
+      }
+      if (__sync_add_and_fetch(&s->count, 1) <= (unsigned int) limit)
+         return true;
+      __sync_fetch_and_add(&s->suppressed, 1);
+      __sync_fetch_and_add(&suppressed, 1);
+      return false;
+   }
+   return true;  //no site free to track it
+}
+
+void * DaemonLog::writerMain(void * arg)
+{
+   std::string out;
+   out.reserve(BATCH + 4 * TEXT_SIZE);  //so writing never needs malloc()
+   time_t reported = time(NULL);
+   for (;;)
+   {
+      bool more = drain(out);
+      time_t now = time(NULL);
+      if (now != reported || (!more && stopping))
+      {
+         report(out);
+         reported = now;
+      }
+      flush(out);
+      if (!more)
+      {
+         if (stopping)
+            break;
+         struct timespec nap = { 0, IDLE_WAIT_MS * 1000000L };
+         nanosleep(&nap, NULL);
+      }
+   }
+   return NULL;
+}
+
+/* renders published records into out, up to a batch; true if more wait */
+bool DaemonLog::drain(std::string &out)
+{
+   while (out.length() < BATCH)
+   {
+      Record * r = &ring[head & mask];
+      if (r->sequence != head + 1)
+         return false;
+      __sync_synchronize();
+      render(r->text, r->time, out);
+      __sync_synchronize();  //done with it before it is reused
+      r->sequence = head + mask + 1;
+      head++;
+   }
+   return true;
+}
+
+/* logs how many messages each site has had suppressed since last time */
+void DaemonLog::report(std::string &out)
+{
+   for (int i = 0; i < SITES; i++)
+   {
+      if (sites[i].suppressed == 0)
+         continue;
+      unsigned int count = __sync_fetch_and_and(&sites[i].suppressed, 0);
+      char text[TEXT_SIZE];
+      snprintf(text, sizeof (text), "DaemonLog: suppressed %u more like \"%s", count, sites[i].format);
+      size_t length = strlen(text);
+      if (length > 0 && text[length - 1] == '\n')
+         length--;
+      strcpy(text + (length < sizeof (text) - 2 ? length : sizeof (text) - 2), "\"");
+
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      render(text, (long long) tv.tv_sec * 1000000LL + tv.tv_usec, out);
+   }
+}
+
+/* one line of LOG_FORMAT */
+void DaemonLog::render(const char * text, long long time, std::string &out)
+{
+   if (format == PLAIN)
+   {
+      out += text;
+      out += '\n';
+      return;
+   }
+
+   /* UTC by hand: gmtime_r() takes a libc lock that a fork() can leave
+    * held in the child */
+   long long seconds = time / 1000000;
+   long long days = seconds / 86400;
+   int secondOfDay = (int) (seconds % 86400);
+   long long era = days + 719468;  //days since 0000-03-01
+   long long cycle = era / 146097;
+   int dayOfCycle = (int) (era - cycle * 146097);
+   int yearOfCycle = (dayOfCycle - dayOfCycle / 1460 + dayOfCycle / 36524 - dayOfCycle / 146096) / 365;
+   int dayOfYear = dayOfCycle - (365 * yearOfCycle + yearOfCycle / 4 - yearOfCycle / 100);
+   int monthIndex = (5 * dayOfYear + 2) / 153;  //from March
+   int day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+   int month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+   long long year = yearOfCycle + cycle * 400 + (month <= 2);
+   char stamp[64];
+   snprintf(stamp, sizeof (stamp), "%04lld-%02d-%02dT%02d:%02d:%02d.%06dZ", year, month, day,
+      secondOfDay / 3600, secondOfDay / 60 % 60, secondOfDay % 60, (int) (time % 1000000));
+   char pid[16];
+   snprintf(pid, sizeof (pid), "%d", (int) getpid());
+
+   if (format == JSON)
+   {
+      out += "{\"time\":\"";
+      out += stamp;
+      out += "\",\"pid\":";
+      out += pid;
+      out += ",\"msg\":";
+      quote(text, true, out);
+      out += "}\n";
+   }
+   else
+   {
+      out += "time=";
+      out += stamp;
+      out += " pid=";
+      out += pid;
+      out += " msg=";
+      quote(text, false, out);
+      out += '\n';
+   }
+}
+
+/* text as a double-quoted string; JSON escapes control characters too */
+void DaemonLog::quote(const char * text, bool json, std::string &out)
+{
+   out += '"';
+   for (const char * p = text; *p != '\0'; p++)
+   {
+      unsigned char c = (unsigned char) *p;
+      if (c == '"' || c == '\\')
+      {
+         out += '\\';
+         out += (char) c;
+      }
+      else if (c < 0x20)
+      {
+         char escaped[8];
+         if (json)
+            snprintf(escaped, sizeof (escaped), "\\u%04x", c);
+         else
+            snprintf(escaped, sizeof (escaped), "\\x%02x", c);
+         out += escaped;
+      }
+      else
+         out += (char) c;
+   }
+   out += '"';
+}
+
+void DaemonLog::flush(std::string &out)
+{
+   size_t done = 0;
+   while (done < out.length())
+   {
+      ssize_t n = ::write(STDERR_FILENO, out.data() + done, out.length() - done);
+      if (n < 0)
+         break;  //nowhere to complain; the lines are lost
+      done += n;
+   }
+   out.clear();
+}
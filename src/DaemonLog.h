@@ -0,0 +1,103 @@
+#ifndef DAEMON_LOG_H
+#define DAEMON_LOG_H
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <string>
+#include "CookieDaemonConfig.h"
+
+/*
+ * Class Name  : DaemonLog
+ *
+ * Description : cookieDaemon's log, kept off the request path.  write()
+ *              formats its message into a fixed-size record and claims a
+ *              slot for it in a lock-free ring; a background thread takes
+ *              the records out, renders them as LOG_FORMAT lines (plain,
+ *              json or kv) and writes them to stderr in batches.  Any
+ *              thread may write.  A record that finds the ring full is
+ *              dropped and counted, so a flood of messages can cost the
+ *              daemon log lines but never stall a request.
+ *
+ *              Each message is rate-limited by its format string: past
+ *              LOG_RATE_LIMIT per second, further ones are counted instead
+ *              of formatted, and the writer logs how many it suppressed.
+ *
+ *              Until start(), and after stop(), write() goes straight to
+ *              stderr as it always did.  The writer thread does not survive
+ *              fork(): a pre-fork worker calls restart() to drop the
+ *              master's unwritten records and start its own.
+ *
+ * Method Index: static void start(CookieDaemonConfig * config) - sizes the
+ *                  ring from LOG_BUFFER and starts the writer
+ *               static void restart() - in a child after fork()
+ *               static void stop() - writes what is queued and stops the
+ *                  writer; registered with atexit() by start()
+ *               static void write(const char * format, ...) - logs one
+ *                  message (printf-style; a trailing newline is optional)
+ *               static void reconfigure(CookieDaemonConfig * config) -
+ *                  LOG_FORMAT and LOG_RATE_LIMIT from a reloaded config
+ *               static unsigned long getDropped() - records the ring had
+ *                  no room for
+ *               static unsigned long getSuppressed() - messages over the
+ *                  rate limit
+ *
+ */
+class DaemonLog
+{
+   public:
+      static void start(CookieDaemonConfig * config);
+      static void restart();
+      static void stop();
+      static void write(const char * format, ...) __attribute__((format(printf, 1, 2)));
+      static void reconfigure(CookieDaemonConfig * config);
+      static unsigned long getDropped();
+      static unsigned long getSuppressed();
+   private:
+      static const int TEXT_SIZE = 240;
+      static const int SITES = 128;        /* power of two */
+      static const int SITE_PROBES = 8;
+      static const int IDLE_WAIT_MS = 10;  /* writer's nap when the ring is empty */
+      static const size_t BATCH = 65536;   /* bytes per write() */
+
+      enum Format { PLAIN, JSON, KV };
+
+      struct Record
+      {
+         volatile unsigned long long sequence;  /* ring position it is ready for */
+         long long time;                        /* microseconds since the epoch */
+         char text[TEXT_SIZE];
+      };
+
+      /* a call site, by format string, for rate limiting */
+      struct Site
+      {
+         const char * volatile format;
+         volatile long second;
+         volatile unsigned int count;         /* this second */
+         volatile unsigned int suppressed;    /* since the writer last reported */
+      };
+
+      static bool admit(const char * format);
+      static void * writerMain(void * arg);
+      static bool drain(std::string &out);
+      static void report(std::string &out);
+      static void render(const char * text, long long time, std::string &out);
+      static void quote(const char * text, bool json, std::string &out);
+      static void flush(std::string &out);
+      static void reset();
+
+      static Record * ring;
+      static unsigned long long mask;
+      static volatile unsigned long long tail;  /* next position to claim */
+      static unsigned long long head;           /* next position to write; writer only */
+      static volatile int format;
+      static volatile int rateLimit;
+      static Site sites[SITES];
+      static volatile unsigned long dropped;
+      static volatile unsigned long suppressed;
+      static pthread_t writer;
+      static pid_t writerPid;                   /* process the writer runs in; 0 if none */
+      static volatile bool stopping;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "DaemonMetrics.h"
+
+DaemonMetrics::DaemonMetrics()
+: requests(0), checked(0), coalesced(0), refreshes(0), stale_served(0),
+  parse_failures(0), rejected_peer(0), rejected_ip(0),
+  rejected_concurrency(0), rejected_db_limit(0), db_failures(0), timeouts(0), bad_signatures(0),
+  signed_cookies(0), db_limit(0), db_in_flight(0), db_latency_us(0), hedges(0),
+  hedge_wins(0), hedge_delay_us(0), db_expired(0), db_connections(0), pipeline_checks(0),
+  pipeline_in_flight(0), replica_db_reads(0),
+  replica_db_fallbacks(0), replica_db_ready(0), replica_db_lag(-1), touches_written(0),
+  touch_batches(0), touches_rejected(0), touches_dropped(0),
+  replica_hits(0), replica_misses(0), replica_users(0), replica_cookies(0),
+  replica_sync_age(-1), cache_hits(0), cache_misses(0),
+  cache_reclaimed(0), timers(0), tcp_connections(0), tcp_accepted(0),
+  io_uring_enters(0), log_dropped(0), log_suppressed(0),
+  captured(0), allocations(-1), startup_ms(0), first_verify_ms(-1)
+{
+}
+
+/*
+ * Method Name: print
+ *
+ * Description: writes one "name value" line per counter to out.
+ *
+ * Arguments  : FILE * out - stream to write to (normally stderr)
+ *
+ * Returns    : none
+ *
+ */
+void DaemonMetrics::print(FILE * out)
+{
+   fprintf(out, "requests %lu\n", requests);
+   fprintf(out, "checked %lu\n", checked);
+   fprintf(out, "coalesced %lu\n", coalesced);
+   fprintf(out, "refreshes %lu\n", refreshes);
+   fprintf(out, "stale_served %lu\n", stale_served);
+   fprintf(out, "collapse_ratio %.2f\n", checked > 0 ? (double) (checked + coalesced) / checked : 1.0);
+   fprintf(out, "parse_failures %lu\n", parse_failures);
+   fprintf(out, "rejected_peer %lu\n", rejected_peer);
+   fprintf(out, "rejected_ip %lu\n", rejected_ip);
+   fprintf(out, "rejected_concurrency %lu\n", rejected_concurrency);
+   fprintf(out, "rejected_db_limit %lu\n", rejected_db_limit);
+   fprintf(out, "db_failures %lu\n", db_failures);
+   fprintf(out, "timeouts %lu\n", timeouts);
+   fprintf(out, "bad_signatures %lu\n", bad_signatures);
+   fprintf(out, "signed_cookies %lu\n", signed_cookies);
+   fprintf(out, "db_limit %d\n", db_limit);
+   fprintf(out, "db_in_flight %d\n", db_in_flight);
+   fprintf(out, "db_latency_us %lld\n", db_latency_us);
+   fprintf(out, "hedges %lu\n", hedges);
+   fprintf(out, "hedge_wins %lu\n", hedge_wins);
+   fprintf(out, "hedge_delay_us %lld\n", hedge_delay_us);
+   fprintf(out, "db_expired %lu\n", db_expired);
+   fprintf(out, "db_connections %d\n", db_connections);
+   fprintf(out, "pipeline_checks %lu\n", pipeline_checks);
+   fprintf(out, "pipeline_in_flight %d\n", pipeline_in_flight);
+   fprintf(out, "replica_db_reads %lu\n", replica_db_reads);
+   fprintf(out, "replica_db_fallbacks %lu\n", replica_db_fallbacks);
+   fprintf(out, "replica_db_ready %d\n", replica_db_ready);
+   fprintf(out, "replica_db_lag %ld\n", replica_db_lag);
+   fprintf(out, "touches_written %lu\n", touches_written);
+   fprintf(out, "touch_batches %lu\n", touch_batches);
+   fprintf(out, "touches_rejected %lu\n", touches_rejected);
+   fprintf(out, "touches_dropped %lu\n", touches_dropped);
+   fprintf(out, "replica_hits %lu\n", replica_hits);
+   fprintf(out, "replica_misses %lu\n", replica_misses);
+   fprintf(out, "replica_users %d\n", replica_users);
+   fprintf(out, "replica_cookies %d\n", replica_cookies);
+   fprintf(out, "replica_sync_age %ld\n", replica_sync_age);
+   fprintf(out, "cache_hits %lu\n", cache_hits);
+   fprintf(out, "cache_misses %lu\n", cache_misses);
+   fprintf(out, "cache_reclaimed %lu\n", cache_reclaimed);
+   fprintf(out, "timers %d\n", timers);
+   fprintf(out, "tcp_connections %d\n", tcp_connections);
+   fprintf(out, "tcp_accepted %lu\n", tcp_accepted);
+   fprintf(out, "io_uring_enters %lu\n", io_uring_enters);
+   fprintf(out, "log_dropped %lu\n", log_dropped);
+   fprintf(out, "log_suppressed %lu\n", log_suppressed);
+   fprintf(out, "captured %lu\n", captured);
+   fprintf(out, "allocations %ld\n", allocations);
+   fprintf(out, "startup_ms %lld\n", startup_ms);
+   fprintf(out, "first_verify_ms %lld\n", first_verify_ms);
+   fflush(out);
+}
@@ -0,0 +1,79 @@
+#ifndef DAEMON_METRICS_H
+#define DAEMON_METRICS_H
+
+#include <stdio.h>
+
+/*
+ * Struct Name : DaemonMetrics
+ *
+ * Description : Counters describing what cookieDaemon has done since it
+ *              started, plus a few gauges of its current state.  Written by
+ *              the request loop and dumped to a stream on demand (SIGUSR1).
+ *
+ * Method Index: void print(FILE * out) - writes one "name value" line per
+ *                  counter to out, plus collapse_ratio: checks that needed
+ *                  the database per checkCookie call made.
+ *
+ */
+struct DaemonMetrics
+{
+   DaemonMetrics();
+   void print(FILE * out);
+
+   unsigned long requests;           /* legacy connections accepted, plus TCP and binary checks */
+   unsigned long checked;            /* requests that reached checkCookie */
+   unsigned long coalesced;          /* checks that shared an identical one's checkCookie */
+   unsigned long refreshes;          /* cache entries re-checked in the background */
+   unsigned long stale_served;       /* checks answered from expired entries while the database failed */
+   unsigned long parse_failures;     /* cookies parseCookie rejected */
+   unsigned long rejected_peer;      /* shed by the per-peer token bucket */
+   unsigned long rejected_ip;        /* shed by the per-IP token bucket */
+   unsigned long rejected_concurrency; /* shed by the global in-flight limit */
+   unsigned long rejected_db_limit;  /* shed by the adaptive database limit */
+   unsigned long db_failures;        /* checkCookie and insertCookie calls that threw */
+   unsigned long timeouts;           /* requests answered TIMEOUT: their deadline passed first */
+   unsigned long bad_signatures;     /* VERIFY_SIGNED requests with a bad signature */
+   unsigned long signed_cookies;     /* cookies issued by SIGN requests */
+
+   /* refreshed from the ConcurrencyLimiter, DBPool, UserReplica,
+    * VerificationCache, TimerWheel, TcpFrontend, UringListener and
+    * DaemonLog before printing; the startup times are set once */
+   int db_limit;
+   int db_in_flight;
+   long long db_latency_us;          /* smoothed checkCookie latency */
+   unsigned long hedges;             /* checks re-issued on a second connection */
+   unsigned long hedge_wins;         /* hedges that answered first */
+   long long hedge_delay_us;         /* current percentile-based hedge delay */
+   unsigned long db_expired;         /* database calls dropped unmade for their deadline */
+   int db_connections;               /* primary database connections up */
+   unsigned long pipeline_checks;    /* checks answered on the non-blocking pipeline */
+   int pipeline_in_flight;           /* pipeline checks running now */
+   unsigned long replica_db_reads;   /* checks answered by the read replica */
+   unsigned long replica_db_fallbacks; /* checks the read replica passed to the primary */
+   int replica_db_ready;             /* read replica connections taking checks now */
+   long replica_db_lag;              /* seconds the read replica is behind; -1 = unknown */
+   unsigned long touches_written;    /* soft timestamps written back to the primary */
+   unsigned long touch_batches;      /* round trips they took */
+   unsigned long touches_rejected;   /* touches the primary answered 0 */
+   unsigned long touches_dropped;    /* touches never written */
+   unsigned long replica_hits;       /* checks answered from the UserReplica */
+   unsigned long replica_misses;     /* checks the replica passed to the database */
+   int replica_users;
+   int replica_cookies;
+   long replica_sync_age;            /* seconds since last sync; -1 = never */
+   unsigned long cache_hits;         /* checks answered from the VerificationCache */
+   unsigned long cache_misses;
+   unsigned long cache_reclaimed;    /* expired entries cleared by their timers */
+   int timers;                       /* scheduled on the daemon's TimerWheel */
+   int tcp_connections;              /* TCP and SOCKET_PATH connections open now */
+   unsigned long tcp_accepted;       /* TCP connections accepted, plus SOCKET_PATH ones adopted */
+   unsigned long io_uring_enters;    /* io_uring_enter calls; 0 with IO_ENGINE poll */
+   unsigned long log_dropped;        /* log records the DaemonLog ring had no room for */
+   unsigned long log_suppressed;     /* log messages over LOG_RATE_LIMIT */
+   unsigned long captured;           /* checks written to CAPTURE_PATH */
+   long allocations;                 /* heap allocations; -1 unless built with COUNT_ALLOCATIONS */
+   long long startup_ms;             /* from start to serving: keys loaded and a database connection up */
+   long long first_verify_ms;        /* from start to the first cookie the database found valid; -1 = none yet */
+};
+
+#endif
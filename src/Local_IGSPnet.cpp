@@ -0,0 +1,321 @@
+#include "Local_IGSPnet.h"
+#include "DaemonLog.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+Local_IGSPnet::Store * Local_IGSPnet::stores[2] = { NULL, NULL };
+pthread_mutex_t Local_IGSPnet::storeLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* copy a whitespace-free token into a fixed field; false if it won't fit */
+static bool copyField(char * field, size_t size, const std::string &value)
+{
+   if (value.length() >= size)
+      return false;
+   strcpy(field, value.c_str());
+   return true;
+}
+
+/*
+ * Method Name: Local_IGSPnet
+ *
+ * Description: Class constructor.  Loads the shared store from
+ *    LOCAL_BACKEND_PATH, or LOCAL_REPLICA_PATH, on first use.
+ *
+ * Arguments  : CookieDaemonConfig * config - supplies the paths
+ *              bool replica - use the read replica's store
+ *
+ * Returns    : none
+ */
+Local_IGSPnet::Local_IGSPnet(CookieDaemonConfig * config, bool replica)
+{
+   pthread_mutex_lock(&storeLock);
+   if (stores[replica] == NULL)
+   {
+      Store * s = new Store;
+      pthread_mutex_init(&s->lock, NULL);
+      s->path = replica ? config->getLocalReplicaPath() : config->getLocalBackendPath();
+      s->mtime.tv_sec = 0;
+      s->mtime.tv_nsec = 0;
+      if (!load(s))
+      {
+         pthread_mutex_unlock(&storeLock);
+         std::string path = s->path;
+         delete s;
+         throw std::runtime_error(std::string(replica ? "Cannot read LOCAL_REPLICA_PATH " : "Cannot read LOCAL_BACKEND_PATH ") + path);
+      }
+      stores[replica] = s;
+   }
+   store = stores[replica];
+   pthread_mutex_unlock(&storeLock);
+}
+
+/*
+ * Method Name: checkCookie
+ *
+ * Description: same contract as OCCI_IGSPnet::checkCookie.  The cookie must
+ *                 exist, its user must be enabled with a matching active
+ *                 version, and neither its hard nor soft lifetime may have
+ *                 run out.  A valid cookie's soft timestamp is refreshed.
+ *
+ * Returns    : int - 0 if any check fails, softLifetime otherwise
+ *
+ */
+int Local_IGSPnet::checkCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
+{
+   pthread_mutex_lock(&store->lock);
+   reloadIfChanged(store);
+   int softLifetime = refresh(store, userID, IP, clientID, cookieVersion, time(NULL));
+   pthread_mutex_unlock(&store->lock);
+   return softLifetime;
+}
+
+/*
+ * Method Name: readCookie
+ *
+ * Description: same contract as CookieBackend::readCookie: looks the
+ *                 cookie up without refreshing it
+ *
+ * Returns    : int - softLifetime, 0, or MISS
+ *
+ */
+int Local_IGSPnet::readCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
+{
+   pthread_mutex_lock(&store->lock);
+   reloadIfChanged(store);
+
+   std::map<RecordKey, UserRecord>::iterator u = store->users.find(userID);
+   std::map<RecordKey, CookieRecord>::iterator c = store->cookies.find(cookieKey(userID, IP, clientID));
+   int rval = judgeCookie(u == store->users.end() ? NULL : &u->second,
+      c == store->cookies.end() ? NULL : &c->second, cookieVersion, time(NULL));
+
+   pthread_mutex_unlock(&store->lock);
+   return rval;
+}
+
+/*
+ * Method Name: touchCookies
+ *
+ * Description: same contract as CookieBackend::touchCookies: checkCookie
+ *                 for each, under one hold of the store's lock
+ *
+ * Returns    : none
+ *
+ */
+void Local_IGSPnet::touchCookies(CookieTouch * touches, int count)
+{
+   time_t now = time(NULL);
+
+   pthread_mutex_lock(&store->lock);
+   reloadIfChanged(store);
+   for (int i = 0; i < count; i++)
+      touches[i].softLifetime = refresh(store, touches[i].userID, touches[i].IP, touches[i].clientID, touches[i].cookieVersion, now);
+   pthread_mutex_unlock(&store->lock);
+}
+
+/* the file's LAG; throws if the file has gone, to play an unreachable
+ * replica */
+long Local_IGSPnet::replicaLag()
+{
+   struct stat st;
+   if (stat(store->path.c_str(), &st) < 0)
+      throw std::runtime_error("Cannot read " + store->path);
+
+   pthread_mutex_lock(&store->lock);
+   reloadIfChanged(store);
+   long lag = store->lag;
+   pthread_mutex_unlock(&store->lock);
+   return lag;
+}
+
+/* checkCookie's work, for it and touchCookies; caller holds s->lock */
+int Local_IGSPnet::refresh(Store * s, const char * userID, const char * IP, const char * clientID, const char * cookieVersion, time_t now)
+{
+   std::map<RecordKey, UserRecord>::iterator u = s->users.find(userID);
+   std::map<RecordKey, CookieRecord>::iterator c = s->cookies.find(cookieKey(userID, IP, clientID));
+   if (u != s->users.end() && u->second.enabled
+      && strcmp(u->second.cookieVersion, cookieVersion) == 0
+      && c != s->cookies.end()
+      && strcmp(c->second.cookieVersion, cookieVersion) == 0
+      && now < c->second.hardTS
+      && now < c->second.softTS + c->second.softLifetime)
+   {
+      c->second.softTS = now;
+      c->second.modified = now;
+      return c->second.softLifetime;
+   }
+   return 0;
+}
+
+/*
+ * Method Name: insertCookie
+ *
+ * Description: same contract as OCCI_IGSPnet::insertCookie.  Client IDs are
+ *                 four random capital letters.
+ *
+ * Returns    : -1 if the user is unknown or disabled or the lifetimes are
+ *                 invalid, 0 otherwise
+ *
+ */
+int Local_IGSPnet::insertCookie(const char * userID, const char * IP, const int hardLifetime, const int softLifetime, char * dukey, char * cookieVersion, char * clientID)
+{
+   int rval = -1;
+   time_t now = time(NULL);
+
+   pthread_mutex_lock(&store->lock);
+   reloadIfChanged(store);
+
+   std::map<RecordKey, UserRecord>::iterator u = store->users.find(userID);
+   if (u != store->users.end() && u->second.enabled && hardLifetime >= softLifetime
+      && strlen(IP) < sizeof(((CookieRecord *) 0)->IP))
+   {
+      CookieRecord c;
+      strcpy(c.userID, userID);
+      strcpy(c.IP, IP);
+      for (int i = 0; i < 4; i++)
+         c.clientID[i] = 'A' + rand() % 26;
+      c.clientID[4] = '\0';
+      strcpy(c.cookieVersion, u->second.cookieVersion);
+      c.softLifetime = softLifetime;
+      c.softTS = now;
+      c.hardTS = now + hardLifetime;
+      c.modified = now;
+      store->cookies[cookieKey(c.userID, c.IP, c.clientID)] = c;
+
+      strcpy(dukey, u->second.dukey);
+      strcpy(cookieVersion, c.cookieVersion);
+      strcpy(clientID, c.clientID);
+      rval = 0;
+   }
+
+   pthread_mutex_unlock(&store->lock);
+   return rval;
+}
+
+int Local_IGSPnet::fetchUsers(long long since, std::vector<UserRecord> &users)
+{
+   pthread_mutex_lock(&store->lock);
+   reloadIfChanged(store);
+   for (std::map<RecordKey, UserRecord>::iterator u = store->users.begin(); u != store->users.end(); ++u)
+   {
+      if (u->second.modified > since)
+         users.push_back(u->second);
+   }
+   pthread_mutex_unlock(&store->lock);
+   return 0;
+}
+
+int Local_IGSPnet::fetchCookies(long long since, std::vector<CookieRecord> &cookies)
+{
+   time_t now = time(NULL);
+
+   pthread_mutex_lock(&store->lock);
+   reloadIfChanged(store);
+   for (std::map<RecordKey, CookieRecord>::iterator c = store->cookies.begin(); c != store->cookies.end(); ++c)
+   {
+      if (c->second.modified > since && c->second.hardTS > now)
+         cookies.push_back(c->second);
+   }
+   pthread_mutex_unlock(&store->lock);
+   return 0;
+}
+
+/*
+ * Method Name: load
+ *
+ * Description: replaces the store's contents with the records in its file.
+ *                 Every record is stamped modified now, so replicas pick up
+ *                 the whole file on their next incremental sync.  Malformed
+ *                 lines are reported and skipped.
+ *
+ * Arguments  : Store * s - store to fill; caller holds its lock (or owns it)
+ *
+ * Returns    : bool - false if the file cannot be opened
+ *
+ */
+bool Local_IGSPnet::load(Store * s)
+{
+   struct stat st;
+   if (stat(s->path.c_str(), &st) < 0)
+      return false;
+   std::ifstream infile(s->path.c_str());
+   if (!infile)
+      return false;
+
+   time_t now = time(NULL);
+   s->mtime = st.st_mtim;
+   s->users.clear();
+   s->cookies.clear();
+   s->lag = 0;
+
+   std::string line;
+   int lineNumber = 0;
+   while (std::getline(infile, line))
+   {
+      lineNumber++;
+      std::istringstream fields(line);
+      std::string kind;
+      if (!(fields >> kind) || kind[0] == '#')
+         continue;
+
+      bool ok = false;
+      if (kind.compare("USER") == 0)
+      {
+         std::string userID, version, dukey;
+         UserRecord u;
+         if ((fields >> userID >> u.enabled >> version >> dukey)
+            && copyField(u.userID, sizeof(u.userID), userID)
+            && copyField(u.cookieVersion, sizeof(u.cookieVersion), version)
+            && copyField(u.dukey, sizeof(u.dukey), dukey))
+         {
+            u.modified = now;
+            s->users[u.userID] = u;
+            ok = true;
+         }
+      }
+      else if (kind.compare("COOKIE") == 0)
+      {
+         std::string userID, IP, clientID, version;
+         int hardLifetime;
+         CookieRecord c;
+         if ((fields >> userID >> IP >> clientID >> version >> c.softLifetime >> hardLifetime)
+            && copyField(c.userID, sizeof(c.userID), userID)
+            && copyField(c.IP, sizeof(c.IP), IP)
+            && copyField(c.clientID, sizeof(c.clientID), clientID)
+            && copyField(c.cookieVersion, sizeof(c.cookieVersion), version))
+         {
+            c.softTS = now;
+            c.hardTS = now + hardLifetime;
+            c.modified = now;
+            s->cookies[cookieKey(c.userID, c.IP, c.clientID)] = c;
+            ok = true;
+         }
+      }
+      else if (kind.compare("LAG") == 0)
+      {
+         ok = (bool) (fields >> s->lag);
+      }
+      if (!ok)
+         DaemonLog::write("Local_IGSPnet: %s:%d: malformed record skipped\n", s->path.c_str(), lineNumber);
+   }
+   return true;
+}
+
+/* caller holds s->lock */
+void Local_IGSPnet::reloadIfChanged(Store * s)
+{
+   struct stat st;
+   if (stat(s->path.c_str(), &st) == 0
+      && (st.st_mtim.tv_sec != s->mtime.tv_sec || st.st_mtim.tv_nsec != s->mtime.tv_nsec))
+      load(s);
+}
+
+RecordKey Local_IGSPnet::cookieKey(const char * userID, const char * IP, const char * clientID)
+{
+   return RecordKey(userID, IP, clientID);
+}
@@ -0,0 +1,71 @@
+#ifndef LOCAL_IGSPNET_H
+#define LOCAL_IGSPNET_H
+
+#include <map>
+#include <string>
+#include <pthread.h>
+#include <time.h>
+#include "CookieBackend.h"
+
+/*
+ * Class Name  : Local_IGSPnet
+ *
+ * Description : In-memory stand-in for the IGSPnet database, selected with
+ *              DB_BACKEND local.  Implements the same checks as
+ *              IGSPNET2.CHECK_COOKIE / INSERT_COOKIE so cookieDaemon and its
+ *              replica can be exercised without Oracle.  All instances in a
+ *              process share one store, loaded from LOCAL_BACKEND_PATH and
+ *              re-loaded whenever that file's modification time changes
+ *              (which discards cookies inserted since the last load).
+ *              Instances made for the read replica share a second store,
+ *              loaded from LOCAL_REPLICA_PATH the same way; nothing is
+ *              copied between the two, so the replica file plays a replica
+ *              frozen at the moment it was written.
+ *
+ *              File format, one record per line (# starts a comment):
+ *                 USER <userID> <enabled 0|1> <cookieVersion> <dukey>
+ *                 COOKIE <userID> <IP> <clientID> <cookieVersion>
+ *                        <softLifetime> <hardLifetime>
+ *                 LAG <seconds>
+ *              Lifetimes are seconds from the time the file is loaded.
+ *              LAG is what replicaLag() reports (default 0), to play a
+ *              replica falling behind; removing the file plays one that
+ *              cannot be reached.
+ *
+ * Method Index: Local_IGSPnet(CookieDaemonConfig * config, bool replica) -
+ *                  constructor; throws std::runtime_error if the file
+ *                  cannot be read.
+ *               Remaining methods as CookieBackend.
+ *
+ */
+class Local_IGSPnet : public CookieBackend
+{
+   public:
+      Local_IGSPnet(CookieDaemonConfig * config, bool replica = false);
+      int checkCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion);
+      int insertCookie(const char * userID, const char * IP, const int hardLifetime, const int softLifetime, char * dukey, char * cookieVersion, char * clientID);
+      int readCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion);
+      void touchCookies(CookieTouch * touches, int count);
+      long replicaLag();
+      int fetchUsers(long long since, std::vector<UserRecord> &users);
+      int fetchCookies(long long since, std::vector<CookieRecord> &cookies);
+   private:
+      struct Store
+      {
+         pthread_mutex_t lock;
+         std::string path;
+         struct timespec mtime;
+         std::map<RecordKey, UserRecord> users;
+         std::map<RecordKey, CookieRecord> cookies;  /* key userID|IP|clientID */
+         long lag;
+      };
+      static Store * stores[2];    /* primary, read replica */
+      static pthread_mutex_t storeLock;
+      Store * store;
+      static bool load(Store * s);
+      static void reloadIfChanged(Store * s);
+      static int refresh(Store * s, const char * userID, const char * IP, const char * clientID, const char * cookieVersion, time_t now);
+      static RecordKey cookieKey(const char * userID, const char * IP, const char * clientID);
+};
+
+#endif
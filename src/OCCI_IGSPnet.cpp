@@ -1,23 +1,29 @@
 #include "OCCI_IGSPnet.h"
 #include <stdio.h>
 #include <stdexcept>
+#include <time.h>
 /*
  * Method Name: OCCI_IGSPnet
  *
  * Description: Class constructor.  Establishes connection to
  *    Oracle database and prepares SQL.
  *
- * Arguments  : none
+ * Arguments  : bool threaded - create a THREADED_MUTEXED environment so the
+ *                 connection may be driven from another thread (DBPool)
+ *              bool replica - connect to DB_REPLICA_CONN_STRING, for
+ *                 readCookie() and replicaLag()
  *
  * Returns    : none
  */
-OCCI_IGSPnet::OCCI_IGSPnet()
-: env(NULL), conn(NULL), stmtCheckCookie(NULL), stmtInsertCookie(NULL), stmtPing(NULL)
+OCCI_IGSPnet::OCCI_IGSPnet(bool threaded, bool replica)
+: env(NULL), conn(NULL), stmtCheckCookie(NULL), stmtInsertCookie(NULL), stmtPing(NULL),
+  stmtSyncUsers(NULL), stmtSyncCookies(NULL), stmtReadCookie(NULL), stmtLag(NULL),
+  stmtTouchCookies(NULL), replica(replica)
 {
    // creates default OCCI environment (http://download.oracle.com/docs/cd/B12037_01/appdev.101/b10778/toc.htm)
-   env = Environment::createEnvironment(Environment::DEFAULT);
-   // Instantiate an object with database connection parameters. Die fatally if null
-   config = CookieDaemonConfig::getConfig();
+   env = Environment::createEnvironment(threaded ? Environment::THREADED_MUTEXED : Environment::DEFAULT);
+   // Share the process's config for database connection parameters. Die fatally if null
+   config = CookieDaemonConfig::current();
    if(config == NULL) {
       throw std::runtime_error("No config found");
    }
@@ -42,11 +48,19 @@ OCCI_IGSPnet::~OCCI_IGSPnet()
    // free memory allocated by OCCI environment
    if (env != NULL)
       Environment::terminateEnvironment(env);
-   // Free up the config object
-   delete(config);
+   // Drop our reference to the config
+   config->release();
    config = NULL;
 }
 
+/* binds a NUL-terminated IN string where it lies; setString() would copy
+ * it into a std::string first.  length must outlive the execute. */
+static void bindText(Statement * stmt, unsigned int position, const char * text, ub2 * length)
+{
+   *length = (ub2) (strlen(text) + 1);
+   stmt->setDataBuffer(position, (void *) text, OCCI_SQLT_STR, *length, length);
+}
+
 /*
  * Method Name: checkCookie
  *
@@ -61,26 +75,29 @@ OCCI_IGSPnet::~OCCI_IGSPnet()
  *              const char * cookieVersion - version of this cookie
  *
  * Returns    : int - 0 if any of the above checks fail, or softLifetime of
- *                 cookie otherwise (for resetting client's cookie in browser)
+ *                 cookie otherwise (for resetting client's cookie in browser).
+ *                 Throws SQLException or std::runtime_error if the database
+ *                 cannot be reached; that is not an answer about the cookie.
  *
  */
 int OCCI_IGSPnet::checkCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
 {
-   int shortLifetime;
+   int shortLifetime = 0;
+   ub2 lengths[5];
    
-   if (!getConnection())
-      return 0;  //cannot establish connection
+   if (!getConnection(true))
+      throw std::runtime_error("cannot establish connection");
    
-   stmtCheckCookie->setString(1, userID);
-   stmtCheckCookie->setString(2, IP);
-   stmtCheckCookie->setString(3, clientID);
-   stmtCheckCookie->setString(4, cookieVersion);
-   stmtCheckCookie->registerOutParam(5, OCCIINT, sizeof(shortLifetime));
+   //bound in place, so a check allocates nothing of ours
+   bindText(stmtCheckCookie, 1, userID, &lengths[0]);
+   bindText(stmtCheckCookie, 2, IP, &lengths[1]);
+   bindText(stmtCheckCookie, 3, clientID, &lengths[2]);
+   bindText(stmtCheckCookie, 4, cookieVersion, &lengths[3]);
+   lengths[4] = sizeof(shortLifetime);
+   stmtCheckCookie->setDataBuffer(5, &shortLifetime, OCCIINT, sizeof(shortLifetime), &lengths[4]);
    stmtCheckCookie->executeUpdate();
    conn->commit();
 
-   shortLifetime = stmtCheckCookie->getInt(5);
-   
    return shortLifetime;  //0 indicates failure
 }
 
@@ -107,33 +124,243 @@ int OCCI_IGSPnet::checkCookie(const char * userID, const char * IP, const char *
  */
 int OCCI_IGSPnet::insertCookie(const char * userID, const char * IP, const int hardLifetime, const int softLifetime, char * dukey, char * cookieVersion, char * clientID)
 {
-   std::string dbDukey;
-   std::string dbCookieVersion;
-   std::string dbClientID;
+   char dbDukey[8] = "";
+   char dbCookieVersion[8] = "";
+   char dbClientID[8] = "";
+   ub2 lengths[7];
    
    if (!getConnection())
       return -1;  //cannot establish connection
 
 
-   stmtInsertCookie->setString(1, userID);
-   stmtInsertCookie->setString(2, IP);
+   bindText(stmtInsertCookie, 1, userID, &lengths[0]);
+   bindText(stmtInsertCookie, 2, IP, &lengths[1]);
    stmtInsertCookie->setInt(3, hardLifetime);
    stmtInsertCookie->setInt(4, softLifetime);
-   stmtInsertCookie->registerOutParam(5, OCCISTRING, sizeof(dbDukey));
-   stmtInsertCookie->registerOutParam(6, OCCISTRING, sizeof(dbCookieVersion));
-   stmtInsertCookie->registerOutParam(7, OCCISTRING, sizeof(dbClientID));
+   lengths[4] = lengths[5] = lengths[6] = sizeof(dbDukey);
+   stmtInsertCookie->setDataBuffer(5, dbDukey, OCCI_SQLT_STR, sizeof(dbDukey), &lengths[4]);
+   stmtInsertCookie->setDataBuffer(6, dbCookieVersion, OCCI_SQLT_STR, sizeof(dbCookieVersion), &lengths[5]);
+   stmtInsertCookie->setDataBuffer(7, dbClientID, OCCI_SQLT_STR, sizeof(dbClientID), &lengths[6]);
    stmtInsertCookie->execute();  //prepared in constructor
    conn->commit();
    
-   strcpy(dukey, (stmtInsertCookie->getString(5)).c_str());
-   strcpy(cookieVersion, (stmtInsertCookie->getString(6)).c_str());
-   strcpy(clientID, (stmtInsertCookie->getString(7)).c_str());
+   //the fields are one character, one character and four
+   snprintf(dukey, 2, "%s", dbDukey);
+   snprintf(cookieVersion, 2, "%s", dbCookieVersion);
+   snprintf(clientID, 5, "%s", dbClientID);
    if (strlen(dukey) > 0)
       return 0;
    else
       return -1;  //cannot insert cookie
 }
 
+/*
+ * Method Name: readCookie
+ *
+ * Description: reads the cookie specified by (userID, IP, clientID) and its
+ *                 user from the read replica, without refreshing anything,
+ *                 and judges them with CookieBackend::judgeCookie
+ *
+ * Arguments  : as checkCookie
+ *
+ * Returns    : int - softLifetime if valid, 0 if not, or MISS if the
+ *                 primary must decide.  Throws like checkCookie.
+ *
+ */
+int OCCI_IGSPnet::readCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
+{
+   UserRecord user;
+   CookieRecord cookie;
+   ub2 lengths[9];
+   sb2 nulls[6] = { 0 };
+
+   if (!getConnection(true))
+      throw std::runtime_error("cannot establish connection");
+   if (stmtReadCookie == NULL)
+      return MISS;  //no views to read it through
+
+   bindText(stmtReadCookie, 1, IP, &lengths[0]);
+   bindText(stmtReadCookie, 2, clientID, &lengths[1]);
+   bindText(stmtReadCookie, 3, userID, &lengths[2]);
+   ResultSet * rs = stmtReadCookie->executeQuery();
+   //defined in place, like the binds
+   rs->setDataBuffer(1, &user.enabled, OCCIINT, sizeof(user.enabled), &lengths[3], &nulls[0]);
+   rs->setDataBuffer(2, user.cookieVersion, OCCI_SQLT_STR, sizeof(user.cookieVersion), &lengths[4], &nulls[1]);
+   rs->setDataBuffer(3, cookie.cookieVersion, OCCI_SQLT_STR, sizeof(cookie.cookieVersion), &lengths[5], &nulls[2]);
+   rs->setDataBuffer(4, &cookie.softLifetime, OCCIINT, sizeof(cookie.softLifetime), &lengths[6], &nulls[3]);
+   rs->setDataBuffer(5, &cookie.softTS, OCCIINT, sizeof(cookie.softTS), &lengths[7], &nulls[4]);
+   rs->setDataBuffer(6, &cookie.hardTS, OCCIINT, sizeof(cookie.hardTS), &lengths[8], &nulls[5]);
+   bool found = rs->next();
+   stmtReadCookie->closeResultSet(rs);
+
+   if (!found)
+      return judgeCookie(NULL, NULL, cookieVersion, time(NULL));
+   return judgeCookie(&user, nulls[2] == -1 ? NULL : &cookie, cookieVersion, time(NULL));
+}
+
+/*
+ * Method Name: touchCookies
+ *
+ * Description: refreshes the soft timestamps of cookies a read replica
+ *                 found valid.  CHECK_COOKIE is what refreshes them, so it
+ *                 is run for each, bound as arrays so the whole batch is
+ *                 one round trip and one commit.
+ *
+ * Arguments  : CookieTouch * touches - the cookies; each one's softLifetime
+ *                 is set to CHECK_COOKIE's answer
+ *              int count - how many; at most TOUCH_BATCH
+ *
+ * Returns    : none.  Throws like checkCookie.
+ *
+ */
+void OCCI_IGSPnet::touchCookies(CookieTouch * touches, int count)
+{
+   if (!getConnection(true))
+      throw std::runtime_error("cannot establish connection");
+   if (count > TOUCH_BATCH)
+      count = TOUCH_BATCH;
+
+   for (int i = 0; i < count; i++)
+   {
+      strcpy(touchUserIDs[i], touches[i].userID);
+      strcpy(touchIPs[i], touches[i].IP);
+      strcpy(touchClientIDs[i], touches[i].clientID);
+      strcpy(touchVersions[i], touches[i].cookieVersion);
+      touchLengths[0][i] = (ub2) (strlen(touchUserIDs[i]) + 1);
+      touchLengths[1][i] = (ub2) (strlen(touchIPs[i]) + 1);
+      touchLengths[2][i] = (ub2) (strlen(touchClientIDs[i]) + 1);
+      touchLengths[3][i] = (ub2) (strlen(touchVersions[i]) + 1);
+      touchLengths[4][i] = sizeof(touchResults[i]);
+      touchResults[i] = 0;
+   }
+   stmtTouchCookies->setDataBuffer(1, touchUserIDs, OCCI_SQLT_STR, sizeof(touchUserIDs[0]), touchLengths[0]);
+   stmtTouchCookies->setDataBuffer(2, touchIPs, OCCI_SQLT_STR, sizeof(touchIPs[0]), touchLengths[1]);
+   stmtTouchCookies->setDataBuffer(3, touchClientIDs, OCCI_SQLT_STR, sizeof(touchClientIDs[0]), touchLengths[2]);
+   stmtTouchCookies->setDataBuffer(4, touchVersions, OCCI_SQLT_STR, sizeof(touchVersions[0]), touchLengths[3]);
+   stmtTouchCookies->setDataBuffer(5, touchResults, OCCIINT, sizeof(touchResults[0]), touchLengths[4]);
+   stmtTouchCookies->executeArrayUpdate(count);
+   conn->commit();
+
+   for (int i = 0; i < count; i++)
+      touches[i].softLifetime = touchResults[i];
+}
+
+/*
+ * Method Name: replicaLag
+ *
+ * Description: how far a read replica's redo apply is behind the primary,
+ *                 from V$DATAGUARD_STATS.  That needs an Active Data Guard
+ *                 standby and SELECT on the view; without them the lag is
+ *                 unknown.
+ *
+ * Arguments  : none
+ *
+ * Returns    : long - seconds behind; 0 on the primary; -1 if unknown.
+ *                 Throws if the database cannot be reached.
+ *
+ */
+long OCCI_IGSPnet::replicaLag()
+{
+   if (!getConnection(true))
+      throw std::runtime_error("cannot establish connection");
+   if (stmtLag == NULL)
+      return 0;
+
+   long lag = -1;
+   try
+   {
+      ResultSet * rs = stmtLag->executeQuery();
+      if (rs->next() && !rs->isNull(1))
+         lag = (long) rs->getDouble(1);
+      stmtLag->closeResultSet(rs);
+   }
+   catch (SQLException &e)
+   {
+      //not a standby, or no access to the view
+   }
+   return lag;
+}
+
+/* copy a column into a fixed field, truncating rather than overflowing */
+static void copyColumn(char * field, size_t size, const std::string &value)
+{
+   strncpy(field, value.c_str(), size - 1);
+   field[size - 1] = '\0';
+}
+
+/*
+ * Method Name: fetchUsers
+ *
+ * Description: reads users modified after since from REPLICA_USERS_VIEW.
+ *                 The view must expose USERID, ENABLED (0/1),
+ *                 COOKIE_VERSION, DUKEY and MODIFIED (epoch seconds).
+ *
+ * Arguments  : long long since - epoch seconds; only later rows are read
+ *              std::vector<UserRecord> &users - rows are appended here
+ *
+ * Returns    : 0 on success, -1 if no view is configured or no connection
+ *
+ */
+int OCCI_IGSPnet::fetchUsers(long long since, std::vector<UserRecord> &users)
+{
+   if (!getConnection() || stmtSyncUsers == NULL)
+      return -1;
+
+   stmtSyncUsers->setDouble(1, (double) since);
+   ResultSet * rs = stmtSyncUsers->executeQuery();
+   while (rs->next())
+   {
+      UserRecord u;
+      copyColumn(u.userID, sizeof(u.userID), rs->getString(1));
+      u.enabled = rs->getInt(2);
+      copyColumn(u.cookieVersion, sizeof(u.cookieVersion), rs->getString(3));
+      copyColumn(u.dukey, sizeof(u.dukey), rs->getString(4));
+      u.modified = (long long) rs->getDouble(5);
+      users.push_back(u);
+   }
+   stmtSyncUsers->closeResultSet(rs);
+   return 0;
+}
+
+/*
+ * Method Name: fetchCookies
+ *
+ * Description: reads unexpired cookies modified after since from
+ *                 REPLICA_COOKIES_VIEW.  The view must expose USERID, IP,
+ *                 CLIENTID, COOKIE_VERSION, SOFT_LIFETIME, SOFT_TS, HARD_TS
+ *                 and MODIFIED, with times in epoch seconds.
+ *
+ * Arguments  : long long since - epoch seconds; only later rows are read
+ *              std::vector<CookieRecord> &cookies - rows are appended here
+ *
+ * Returns    : 0 on success, -1 if no view is configured or no connection
+ *
+ */
+int OCCI_IGSPnet::fetchCookies(long long since, std::vector<CookieRecord> &cookies)
+{
+   if (!getConnection() || stmtSyncCookies == NULL)
+      return -1;
+
+   stmtSyncCookies->setDouble(1, (double) since);
+   stmtSyncCookies->setDouble(2, (double) time(NULL));
+   ResultSet * rs = stmtSyncCookies->executeQuery();
+   while (rs->next())
+   {
+      CookieRecord c;
+      copyColumn(c.userID, sizeof(c.userID), rs->getString(1));
+      copyColumn(c.IP, sizeof(c.IP), rs->getString(2));
+      copyColumn(c.clientID, sizeof(c.clientID), rs->getString(3));
+      copyColumn(c.cookieVersion, sizeof(c.cookieVersion), rs->getString(4));
+      c.softLifetime = rs->getInt(5);
+      c.softTS = (long long) rs->getDouble(6);
+      c.hardTS = (long long) rs->getDouble(7);
+      c.modified = (long long) rs->getDouble(8);
+      cookies.push_back(c);
+   }
+   stmtSyncCookies->closeResultSet(rs);
+   return 0;
+}
+
 void OCCI_IGSPnet::cleanupConnection()
 {
    // free resources tied up by prepared statements
@@ -164,6 +391,30 @@ void OCCI_IGSPnet::cleanupConnection()
    {
    }
 
+   try
+   {
+      if ((conn != NULL) && (stmtSyncUsers != NULL))
+         conn->terminateStatement(stmtSyncUsers);
+      if ((conn != NULL) && (stmtSyncCookies != NULL))
+         conn->terminateStatement(stmtSyncCookies);
+   }
+   catch (...)
+   {
+   }
+
+   try
+   {
+      if ((conn != NULL) && (stmtReadCookie != NULL))
+         conn->terminateStatement(stmtReadCookie);
+      if ((conn != NULL) && (stmtLag != NULL))
+         conn->terminateStatement(stmtLag);
+      if ((conn != NULL) && (stmtTouchCookies != NULL))
+         conn->terminateStatement(stmtTouchCookies);
+   }
+   catch (...)
+   {
+   }
+
    // kill the connection
    try
    {
@@ -177,6 +428,11 @@ void OCCI_IGSPnet::cleanupConnection()
    stmtCheckCookie = NULL;
    stmtInsertCookie = NULL;
    stmtPing = NULL;
+   stmtSyncUsers = NULL;
+   stmtSyncCookies = NULL;
+   stmtReadCookie = NULL;
+   stmtLag = NULL;
+   stmtTouchCookies = NULL;
    conn = NULL;
 
    return;
@@ -207,16 +463,56 @@ int OCCI_IGSPnet::getConnection(bool throwExceptions)
    //let's try to set one up
    
    cleanupConnection();
+
+   //connect with the latest credentials, in case the config was reloaded
+   CookieDaemonConfig *latest = CookieDaemonConfig::current();
+   if (latest != NULL)
+   {
+      config->release();
+      config = latest;
+   }
    
    try
    {
       // connects to DB
-      conn = env->createConnection(config->getDBUser(), config->getDBPass(), config->getConnectionString());
+      conn = env->createConnection(config->getDBUser(), config->getDBPass(),
+         replica ? config->getReplicaConnectionString() : config->getConnectionString());
+#ifdef OCI_ATTR_CALL_TIMEOUT
+      //Oracle 18c clients can bound each round trip, so a hung session
+      //fails its call after REQUEST_TIMEOUT rather than holding it forever
+      ub4 callTimeout = (ub4) config->getRequestTimeout();
+      OCIError * err = NULL;
+      if (callTimeout > 0 && OCIHandleAlloc(env->getOCIEnvironment(), (void **) &err, OCI_HTYPE_ERROR, 0, NULL) == OCI_SUCCESS)
+      {
+         OCIAttrSet(conn->getOCIServiceContext(), OCI_HTYPE_SVCCTX, &callTimeout, 0, OCI_ATTR_CALL_TIMEOUT, err);
+         OCIHandleFree(err, OCI_HTYPE_ERROR);
+      }
+#endif
    
-      //prepare the statements
-      stmtCheckCookie = conn->createStatement("BEGIN IGSPNET2.CHECK_COOKIE(:1, :2, :3, :4, :5); END;");
-      stmtInsertCookie = conn->createStatement("BEGIN IGSPNET2.INSERT_COOKIE(:1, :2, :3, :4, :5, :6, :7); END;");
+      //prepare the statements; a read replica only reads
+      if (!replica)
+      {
+         stmtCheckCookie = conn->createStatement("BEGIN IGSPNET2.CHECK_COOKIE(:1, :2, :3, :4, :5); END;");
+         stmtInsertCookie = conn->createStatement("BEGIN IGSPNET2.INSERT_COOKIE(:1, :2, :3, :4, :5, :6, :7); END;");
+         stmtTouchCookies = conn->createStatement("BEGIN IGSPNET2.CHECK_COOKIE(:1, :2, :3, :4, :5); END;");
+      }
+      else
+      {
+         if (config->getReplicaUsersView().length() > 0 && config->getReplicaCookiesView().length() > 0)
+            stmtReadCookie = conn->createStatement("SELECT U.ENABLED, U.COOKIE_VERSION, C.COOKIE_VERSION, C.SOFT_LIFETIME, C.SOFT_TS, C.HARD_TS FROM "
+               + config->getReplicaUsersView() + " U LEFT JOIN " + config->getReplicaCookiesView()
+               + " C ON C.USERID = U.USERID AND C.IP = :1 AND C.CLIENTID = :2 WHERE U.USERID = :3");
+         stmtLag = conn->createStatement("SELECT EXTRACT(DAY FROM L) * 86400 + EXTRACT(HOUR FROM L) * 3600"
+            " + EXTRACT(MINUTE FROM L) * 60 + EXTRACT(SECOND FROM L)"
+            " FROM (SELECT TO_DSINTERVAL(VALUE) L FROM V$DATAGUARD_STATS WHERE NAME = 'apply lag')");
+      }
       stmtPing = conn->createStatement("SELECT 1 FROM dual");
+      if (config->getReplicaUsersView().length() > 0)
+         stmtSyncUsers = conn->createStatement("SELECT USERID, ENABLED, COOKIE_VERSION, DUKEY, MODIFIED FROM "
+            + config->getReplicaUsersView() + " WHERE MODIFIED > :1");
+      if (config->getReplicaCookiesView().length() > 0)
+         stmtSyncCookies = conn->createStatement("SELECT USERID, IP, CLIENTID, COOKIE_VERSION, SOFT_LIFETIME, SOFT_TS, HARD_TS, MODIFIED FROM "
+            + config->getReplicaCookiesView() + " WHERE MODIFIED > :1 AND HARD_TS > :2");
       
       rs = stmtPing->executeQuery();
       if (rs->next())
@@ -4,6 +4,7 @@
 #include <occi.h>
 #include <string.h>
 #include "CookieDaemonConfig.h"
+#include "CookieBackend.h"
 
 using namespace oracle::occi;
 
@@ -14,8 +15,14 @@ using namespace oracle::occi;
  *              methods for managing IGSPnet user cookies.  Uses Oracle
  *              OCCI API.
  *
- * Method Index: OCCI_IGSPnet() - constructor; establishes connection
- *                  to Oracle using DB_CONN_STRING.
+ * Method Index: OCCI_IGSPnet(bool threaded, bool replica) - constructor;
+ *                  establishes connection to Oracle using DB_CONN_STRING,
+ *                  or DB_REPLICA_CONN_STRING if replica.  Pass
+ *                  threaded = true when the object will be used from a
+ *                  thread other than the one that created it.  Each
+ *                  reconnect uses the credentials of the config current
+ *                  at the time, so a reloaded config takes effect without
+ *                  dropping a working connection.
  *               ~OCCI_IGSPnet() - destructor; frees memory associated
  *                  with OCCI environment
  *               int checkCookie(const char * userID, const char * IP,
@@ -25,7 +32,9 @@ using namespace oracle::occi;
  *                 cookie is same as user's active version.  If all OK, then
  *                 update softTS of cookie in DB.  Returns 0 if any of the above
  *                 checks fail, or softLifetime of cookie otherwise (for
- *                 resetting client's cookie in browser)
+ *                 resetting client's cookie in browser).  Throws if the
+ *                 database cannot be reached, so an outage is not mistaken
+ *                 for an expired cookie.
  *               int insertCookie(const char * userID, const char * IP,
  *                  const int hardLifetime, const int softLifetime, 
  *                  char * dukey, char * cookieVersion, char * clientID) - 
@@ -33,22 +42,57 @@ using namespace oracle::occi;
  *                  into DB and returns DukeEmployee, active cookie version, and
  *                  client ID in remaining three args.  Returns -1 if cookie
  *                  info could not be inserted or 0 otherwise.
+ *               int readCookie(...) - on a read replica, reads the cookie
+ *                  and its user through REPLICA_USERS_VIEW and
+ *                  REPLICA_COOKIES_VIEW and judges them as
+ *                  CookieBackend::judgeCookie.  MISS if no view is
+ *                  configured.
+ *               void touchCookies(CookieTouch * touches, int count) - runs
+ *                  CHECK_COOKIE for every cookie in one array execute and
+ *                  one commit
+ *               long replicaLag() - the replica's apply lag from
+ *                  V$DATAGUARD_STATS; -1 if it cannot be read there
+ *               int fetchUsers(long long since,
+ *                  std::vector<UserRecord> &users),
+ *               int fetchCookies(long long since,
+ *                  std::vector<CookieRecord> &cookies) - incremental reads
+ *                  for the daemon's replica, from the views named by
+ *                  REPLICA_USERS_VIEW and REPLICA_COOKIES_VIEW.  Return -1
+ *                  if no view is configured or there is no connection.
  *
  */
-class OCCI_IGSPnet
+class OCCI_IGSPnet : public CookieBackend
 {
    public:
-      OCCI_IGSPnet();
+      OCCI_IGSPnet(bool threaded = false, bool replica = false);
       ~OCCI_IGSPnet();
       int checkCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion);
       int insertCookie(const char * userID, const char * IP, const int hardLifetime, const int softLifetime, char * dukey, char * cookieVersion, char * clientID);
+      int readCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion);
+      void touchCookies(CookieTouch * touches, int count);
+      long replicaLag();
+      int fetchUsers(long long since, std::vector<UserRecord> &users);
+      int fetchCookies(long long since, std::vector<CookieRecord> &cookies);
    private:
       Environment * env;
       Connection * conn;
       Statement * stmtCheckCookie;
       Statement * stmtInsertCookie;
       Statement * stmtPing;
-      CookieDaemonConfig *config;
+      Statement * stmtSyncUsers;
+      Statement * stmtSyncCookies;
+      Statement * stmtReadCookie;   /* read replica only */
+      Statement * stmtLag;          /* likewise */
+      Statement * stmtTouchCookies;
+      bool replica;
+      /* touchCookies() binds these as arrays, a column at a time */
+      char touchUserIDs[TOUCH_BATCH][13];
+      char touchIPs[TOUCH_BATCH][16];
+      char touchClientIDs[TOUCH_BATCH][5];
+      char touchVersions[TOUCH_BATCH][2];
+      int touchResults[TOUCH_BATCH];
+      ub2 touchLengths[5][TOUCH_BATCH];
+      CookieDaemonConfig *config;   /* counted reference; see CookieDaemonConfig::current() */
       void cleanupConnection();
       int getConnection(bool throwExceptions = false);
 };
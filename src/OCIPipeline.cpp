@@ -0,0 +1,227 @@
+#include "OCIPipeline.h"
+#include <occi.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+
+using namespace oracle::occi;
+
+static const char CHECK_SQL[] = "BEGIN IGSPNET2.CHECK_COOKIE(:1, :2, :3, :4, :5); END;";
+
+/* one non-blocking connection and its CHECK_COOKIE, bound to the fields
+ * below */
+struct OCIPipeline::Session
+{
+   Connection * conn;
+   OCIStmt * stmt;
+   OCIBind * binds[5];
+   char userID[13];
+   char IP[16];
+   char clientID[5];
+   char cookieVersion[2];
+   int softLifetime;
+   sb2 softLifetimeNull;
+   bool broken;      /* last call failed; reconnect before the next */
+};
+
+/*
+ * Method Name: OCIPipeline
+ *
+ * Description: Class constructor.  Connects depth sessions, switches each
+ *    to non-blocking mode and prepares CHECK_COOKIE on it.
+ *
+ * Arguments  : int depth - sessions; at least 1
+ *
+ * Returns    : none
+ */
+OCIPipeline::OCIPipeline(int depth)
+: env(NULL), err(NULL), sessions(NULL), depth(depth < 1 ? 1 : depth), config(NULL)
+{
+   config = CookieDaemonConfig::current();
+   if (config == NULL)
+      throw std::runtime_error("No config found");
+   env = Environment::createEnvironment(Environment::THREADED_MUTEXED);
+   if (OCIHandleAlloc(env->getOCIEnvironment(), (void **) &err, OCI_HTYPE_ERROR, 0, NULL) != OCI_SUCCESS)
+   {
+      Environment::terminateEnvironment(env);
+      config->release();
+      throw std::runtime_error("cannot allocate an OCI error handle");
+   }
+
+   sessions = new Session[this->depth];
+   for (int i = 0; i < this->depth; i++)
+   {
+      sessions[i].conn = NULL;
+      sessions[i].stmt = NULL;
+      sessions[i].broken = true;
+   }
+   try
+   {
+      reconnect();
+   }
+   catch (...)
+   {
+      for (int i = 0; i < this->depth; i++)
+         disconnect(&sessions[i]);
+      delete [] sessions;
+      OCIHandleFree(err, OCI_HTYPE_ERROR);
+      Environment::terminateEnvironment(env);
+      config->release();
+      throw;
+   }
+}
+
+OCIPipeline::~OCIPipeline()
+{
+   for (int i = 0; i < depth; i++)
+      disconnect(&sessions[i]);
+   delete [] sessions;
+   OCIHandleFree(err, OCI_HTYPE_ERROR);
+   Environment::terminateEnvironment(env);
+   config->release();
+}
+
+int OCIPipeline::getDepth() { return depth; }
+
+void OCIPipeline::reconnect()
+{
+   for (int i = 0; i < depth; i++)
+   {
+      if (sessions[i].broken)
+         connect(&sessions[i]);
+   }
+}
+
+/*
+ * Method Name: connect
+ *
+ * Description: (re)opens session s with the latest credentials, in case
+ *                 the config was reloaded, and prepares its CHECK_COOKIE.
+ *                 The connect itself blocks.
+ *
+ * Arguments  : Session * s - a session with no call in flight
+ *
+ * Returns    : none; throws SQLException or std::runtime_error
+ */
+void OCIPipeline::connect(Session * s)
+{
+   disconnect(s);
+   CookieDaemonConfig * latest = CookieDaemonConfig::current();
+   if (latest != NULL)
+   {
+      config->release();
+      config = latest;
+   }
+
+   s->conn = env->createConnection(config->getDBUser(), config->getDBPass(), config->getConnectionString());
+   OCISvcCtx * svc = (OCISvcCtx *) s->conn->getOCIServiceContext();
+   bool ok = OCIStmtPrepare2(svc, &s->stmt, err, (const OraText *) CHECK_SQL, (ub4) strlen(CHECK_SQL),
+      NULL, 0, OCI_NTV_SYNTAX, OCI_DEFAULT) == OCI_SUCCESS;
+   if (!ok)
+      s->stmt = NULL;
+
+   //bound once, in place; a check only copies its fields in
+   void * fields[4] = { s->userID, s->IP, s->clientID, s->cookieVersion };
+   sb4 sizes[4] = { sizeof (s->userID), sizeof (s->IP), sizeof (s->clientID), sizeof (s->cookieVersion) };
+   for (int i = 0; ok && i < 4; i++)
+      ok = OCIBindByPos(s->stmt, &s->binds[i], err, i + 1, fields[i], sizes[i], SQLT_STR,
+         NULL, NULL, NULL, 0, NULL, OCI_DEFAULT) == OCI_SUCCESS;
+   if (ok)
+      ok = OCIBindByPos(s->stmt, &s->binds[4], err, 5, &s->softLifetime, sizeof (s->softLifetime), SQLT_INT,
+         &s->softLifetimeNull, NULL, NULL, 0, NULL, OCI_DEFAULT) == OCI_SUCCESS;
+
+   //the server handle toggles between blocking and non-blocking mode
+   if (ok)
+      ok = OCIAttrSet(s->conn->getOCIServer(), OCI_HTYPE_SERVER, NULL, 0, OCI_ATTR_NONBLOCKING_MODE, err) == OCI_SUCCESS;
+   if (!ok)
+   {
+      disconnect(s);
+      throw std::runtime_error("cannot prepare CHECK_COOKIE for non-blocking use");
+   }
+   s->broken = false;
+}
+
+/* breaks off any call in flight on s, puts it back in blocking mode for the
+ * logoff, and closes it */
+void OCIPipeline::disconnect(Session * s)
+{
+   if (s->conn == NULL)
+      return;
+   OCIServer * server = (OCIServer *) s->conn->getOCIServer();
+   ub1 nonBlocking = 0;
+   OCIAttrGet(server, OCI_HTYPE_SERVER, &nonBlocking, NULL, OCI_ATTR_NONBLOCKING_MODE, err);
+   if (nonBlocking)
+   {
+      OCIBreak(server, err);
+      OCIReset(server, err);
+      OCIAttrSet(server, OCI_HTYPE_SERVER, NULL, 0, OCI_ATTR_NONBLOCKING_MODE, err);
+   }
+   if (s->stmt != NULL)
+      OCIStmtRelease(s->stmt, err, NULL, 0, OCI_DEFAULT);
+   try
+   {
+      env->terminateConnection(s->conn);
+   }
+   catch (...)
+   {
+   }
+   s->stmt = NULL;
+   s->conn = NULL;
+   s->broken = true;
+}
+
+/*
+ * Method Name: startCheck
+ *
+ * Description: copies the cookie's fields into session's binds and starts
+ *                 CHECK_COOKIE, reconnecting the session first if its last
+ *                 call failed
+ *
+ * Arguments  : int session - an idle session, 0 to getDepth() - 1
+ *              const char * userID, IP, clientID, cookieVersion - as
+ *                 CookieBackend::checkCookie; must fit the cookie field
+ *                 sizes enforced by parseCookie()
+ *
+ * Returns    : int - softLifetime, 0 if the cookie is not valid, or
+ *                 STILL_EXECUTING.  Throws SQLException or
+ *                 std::runtime_error if the database cannot be reached.
+ */
+int OCIPipeline::startCheck(int session, const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
+{
+   Session * s = &sessions[session];
+   if (s->broken)
+      connect(s);
+   strcpy(s->userID, userID);
+   strcpy(s->IP, IP);
+   strcpy(s->clientID, clientID);
+   strcpy(s->cookieVersion, cookieVersion);
+   s->softLifetime = 0;
+   s->softLifetimeNull = 0;
+   return pollCheck(session);
+}
+
+/* a non-blocking call is continued by making it again, unchanged */
+int OCIPipeline::pollCheck(int session)
+{
+   Session * s = &sessions[session];
+   return finish(s, OCIStmtExecute((OCISvcCtx *) s->conn->getOCIServiceContext(), s->stmt, err,
+      1, 0, NULL, NULL, OCI_COMMIT_ON_SUCCESS));
+}
+
+/* the answer for an OCIStmtExecute() status; throws with the database's
+ * message, marking s for reconnection, if the call failed */
+int OCIPipeline::finish(Session * s, int status)
+{
+   if (status == OCI_STILL_EXECUTING)
+      return STILL_EXECUTING;
+   if (status == OCI_SUCCESS || status == OCI_SUCCESS_WITH_INFO)
+      return (s->softLifetimeNull == -1) ? 0 : s->softLifetime;  //0 indicates failure
+
+   char message[256] = "CHECK_COOKIE failed";
+   sb4 code = 0;
+   if (status == OCI_ERROR)
+      OCIErrorGet(err, 1, NULL, &code, (OraText *) message, sizeof (message), OCI_HTYPE_ERROR);
+   message[strcspn(message, "\n")] = '\0';
+   s->broken = true;
+   throw std::runtime_error(message);
+}
@@ -0,0 +1,82 @@
+#ifndef OCI_PIPELINE_H
+#define OCI_PIPELINE_H
+
+#include "CookieDaemonConfig.h"
+
+/* kept opaque here, so DBPool builds without the Oracle headers */
+namespace oracle { namespace occi { class Environment; } }
+struct OCIError;
+
+/*
+ * Class Name  : OCIPipeline
+ *
+ * Description : DB_PIPELINE_DEPTH sessions to the primary database, each
+ *              running IGSPNET2.CHECK_COOKIE in OCI non-blocking mode, so
+ *              one thread can keep that many checks in flight at once.
+ *              OCCI_IGSPnet blocks its thread for every round trip; here a
+ *              call that is still waiting on the database returns
+ *              STILL_EXECUTING instead, and the caller polls it again
+ *              later while it starts and polls the others.  OCI gives no
+ *              descriptor to wait on, so the caller polls on a short
+ *              interval.
+ *
+ *              The sessions are opened through OCCI, like OCCI_IGSPnet's,
+ *              and switched to non-blocking mode; CHECK_COOKIE is then
+ *              prepared with plain OCI and bound once to buffers in each
+ *              session, so a check copies its cookie fields in and
+ *              allocates nothing.  Each check commits as it executes
+ *              (OCI_COMMIT_ON_SUCCESS), saving OCCI_IGSPnet's separate
+ *              commit round trip.  Only checks run here: inserts and the
+ *              rest stay with OCCI_IGSPnet.
+ *
+ *              A session whose call fails is reconnected before its next
+ *              check.  Not thread-safe: one thread drives every session.
+ *
+ * Method Index: OCIPipeline(int depth) - constructor; connects depth
+ *                  sessions with the current config's DB_CONN_STRING and
+ *                  credentials.  Throws SQLException or std::runtime_error
+ *                  if one cannot connect.
+ *               ~OCIPipeline() - breaks off any call in flight and
+ *                  disconnects
+ *               int getDepth() - sessions
+ *               int startCheck(int session, const char * userID,
+ *                  const char * IP, const char * clientID,
+ *                  const char * cookieVersion) - starts a check, as
+ *                  CookieBackend::checkCookie, on an idle session.  Returns
+ *                  its answer if the database already gave it, else
+ *                  STILL_EXECUTING.  Throws if the call fails.
+ *               int pollCheck(int session) - continues the session's
+ *                  check; returns as startCheck()
+ *               void reconnect() - reconnects every session whose last
+ *                  call failed; throws if one cannot
+ *
+ */
+class OCIPipeline
+{
+   public:
+      static const int STILL_EXECUTING = -2;
+
+      OCIPipeline(int depth);
+      ~OCIPipeline();
+      int getDepth();
+      int startCheck(int session, const char * userID, const char * IP, const char * clientID, const char * cookieVersion);
+      int pollCheck(int session);
+      void reconnect();
+   private:
+      struct Session;
+
+      OCIPipeline(const OCIPipeline &);             /* not copyable */
+      OCIPipeline &operator=(const OCIPipeline &);
+
+      void connect(Session * s);
+      void disconnect(Session * s);
+      int finish(Session * s, int status);
+
+      oracle::occi::Environment * env;
+      OCIError * err;
+      Session * sessions;
+      int depth;
+      CookieDaemonConfig * config;   /* counted reference; see CookieDaemonConfig::current() */
+};
+
+#endif
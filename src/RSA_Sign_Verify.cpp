@@ -5,6 +5,10 @@
 const int RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE;
 const int RSA_Sign_Verify::RSA_SIG_BUFFER_SIZE;
 
+EVP_PKEY * RSA_Sign_Verify::privateKey = NULL;
+EVP_PKEY * RSA_Sign_Verify::publicKey = NULL;
+bool RSA_Sign_Verify::quiet = false;
+
 /*
  * Method Name: signString
  *
@@ -26,48 +30,26 @@ int RSA_Sign_Verify::signString(const char * cookieData, char * hexSig)
    EVP_MD_CTX     md_ctx;
    EVP_PKEY *     pkey;
 
-   /* Read private key */
-   // Path to key file is in CookieDaemonConfig. Since this method is static,
-   // we'll just use the static getConfig() method.
-   CookieDaemonConfig *config = CookieDaemonConfig::getConfig();
-   if(config == NULL) {
-      fprintf(stderr, "No config found, exiting\n");
-      return -1;
-   }
-
-   FILE *keyFile = fopen(config->getPrivateKeyPath().c_str(), "r");
-   // Clean up config early
-   if(config != NULL) {
-     delete config;
-   }
-   if(keyFile == NULL) {
-     fprintf(stderr, "Can't open private key file %s!\n", config->getPrivateKeyPath().c_str());
-     return -1;
-   }
-   // Use openssl to read the key directly from the pem file.
-   pkey = PEM_read_PrivateKey(keyFile, NULL, NULL, NULL);
-   // Key in memory, close the file
-   fclose(keyFile);
-
+   /* the key loadKeys() read, or else the file's */
+   pkey = (privateKey != NULL) ? privateKey : readPrivateKey();
    if (pkey == NULL)
-   {
-      fprintf(stderr, "Error reading private key.\n");
       return -1;
-   }
 
    /* Do the signature */
    EVP_SignInit   (&md_ctx, EVP_sha1());
    EVP_SignUpdate (&md_ctx, cookieData, strlen(cookieData));
    sig_len = sizeof(sig_buf);
    err = EVP_SignFinal (&md_ctx, sig_buf, &sig_len, pkey);
+   if (pkey != privateKey)
+      EVP_PKEY_free (pkey);
 
    if (err != 1)
    {
-      fprintf(stderr, "Error signing cookie.\n");
+      if (!quiet)
+         fprintf(stderr, "Error signing cookie.\n");
       return -1;
    }
 
-   EVP_PKEY_free (pkey);
    bin2hex (sig_buf, sig_len, hexSig);
    return 0;
 }
@@ -91,26 +73,133 @@ int RSA_Sign_Verify::verifySig(const char * cookieData, const char * hexSig)
    unsigned char  sig_buf [RSA_SIG_BUFFER_SIZE];
    EVP_MD_CTX     md_ctx;
    EVP_PKEY *     pubkey;
+
+   /* the key loadKeys() read, or else the certificate file's */
+   pubkey = (publicKey != NULL) ? publicKey : readPublicKey();
+   if (pubkey == NULL)
+      return -1;
+
+   /* Decode the cookie (it's in hex) */
+   hex2bin(hexSig, sig_buf, sig_len);
+
+   /* Verify the signature */
+   EVP_VerifyInit   (&md_ctx, EVP_sha1());
+   EVP_VerifyUpdate (&md_ctx, cookieData, strlen((char*)cookieData));
+   err = EVP_VerifyFinal (&md_ctx, sig_buf, sig_len, pubkey);
+   if (pubkey != publicKey)
+      EVP_PKEY_free (pubkey);
+
+   if (err != 1)
+   {
+      if (!quiet)
+         fprintf(stderr, "Signature verification failed.\n");
+      return -1;
+   }
+
+   return 0;
+}
+
+/*
+ * Method Name: loadKeys
+ *
+ * Description: reads the private key and the certificate's public key and
+ *                 keeps them, so signString() and verifySig() need not
+ *                 read their files on every call.  Any keys loaded before
+ *                 are freed, so a caller that reloads must not be signing
+ *                 or verifying meanwhile.
+ *
+ * Arguments  : None
+ *
+ * Returns    : int - 0 if both keys were read, -1 otherwise
+ *
+ */
+int RSA_Sign_Verify::loadKeys()
+{
+   EVP_PKEY * key = readPrivateKey();
+   EVP_PKEY * cert = readPublicKey();
+   if (privateKey != NULL)
+      EVP_PKEY_free (privateKey);
+   if (publicKey != NULL)
+      EVP_PKEY_free (publicKey);
+   privateKey = key;
+   publicKey = cert;
+   return (key != NULL && cert != NULL) ? 0 : -1;
+}
+
+/*
+ * Method Name: setQuiet
+ *
+ * Description: sets whether signString() and verifySig() write their
+ *                 failures to stderr.  cookieDaemon counts bad signatures
+ *                 and logs signing errors itself, and an unthrottled write
+ *                 per bad cookie would let a flood of them stall it.
+ *
+ * Arguments  : bool quiet - true to keep them off stderr
+ *
+ * Returns    : None
+ *
+ */
+void RSA_Sign_Verify::setQuiet(bool quiet)
+{
+   RSA_Sign_Verify::quiet = quiet;
+}
+
+/* reads PRIVATE_KEY_PATH; NULL, with the reason on stderr, if it can't */
+EVP_PKEY * RSA_Sign_Verify::readPrivateKey()
+{
+   EVP_PKEY * pkey;
+
+   /* Read private key */
+   // Path to key file is in CookieDaemonConfig. Since this method is static,
+   // we'll just use the process's shared config.
+   CookieDaemonConfig *config = CookieDaemonConfig::current();
+   if(config == NULL) {
+      fprintf(stderr, "No config found, exiting\n");
+      return NULL;
+   }
+
+   FILE *keyFile = fopen(config->getPrivateKeyPath().c_str(), "r");
+   if(keyFile == NULL) {
+     fprintf(stderr, "Can't open private key file %s!\n", config->getPrivateKeyPath().c_str());
+     config->release();
+     return NULL;
+   }
+   // Done with config
+   config->release();
+   // Use openssl to read the key directly from the pem file.
+   pkey = PEM_read_PrivateKey(keyFile, NULL, NULL, NULL);
+   // Key in memory, close the file
+   fclose(keyFile);
+
+   if (pkey == NULL)
+      fprintf(stderr, "Error reading private key.\n");
+   return pkey;
+}
+
+/* reads the public key from CERT_PATH; NULL, with the reason on stderr, if
+ * it can't */
+EVP_PKEY * RSA_Sign_Verify::readPublicKey()
+{
+   EVP_PKEY *     pubkey;
    X509 *         x509;
 
    /* Read public key (certificate) */
    // Path to certificate file is in CookieDaemonConfig. Since this method is static,
-   // we'll just use the static getConfig() method.
-   CookieDaemonConfig *config = CookieDaemonConfig::getConfig();
+   // we'll just use the process's shared config.
+   CookieDaemonConfig *config = CookieDaemonConfig::current();
    if(config == NULL) {
       fprintf(stderr, "No config found, exiting\n");
-      return -1;
+      return NULL;
    }
 
    FILE *certFile = fopen(config->getCertPath().c_str(), "r");
-   // Clean up config early
-   if(config != NULL) {
-     delete config;
-   }
    if(certFile == NULL) {
      fprintf(stderr, "Can't open certificate file %s!\n", config->getCertPath().c_str());
-     return -1;
+     config->release();
+     return NULL;
    }
+   // Done with config
+   config->release();
 
    // Read the cert directly from the pem file.
    x509 = PEM_read_X509(certFile, NULL, NULL, NULL);
@@ -121,33 +210,15 @@ int RSA_Sign_Verify::verifySig(const char * cookieData, const char * hexSig)
    if (x509 == NULL)
    {
       fprintf(stderr, "Error reading public key cert.\n");
-      return -1;
+      return NULL;
    }
 
    /* Get public key - eay */
    pubkey=X509_get_pubkey(x509);
+   X509_free(x509);
    if (pubkey == NULL)
-   {
       fprintf(stderr, "Error getting public key.\n");
-      return -1;
-   }
-
-   /* Decode the cookie (it's in hex) */
-   hex2bin(hexSig, sig_buf, sig_len);
-
-   /* Verify the signature */
-   EVP_VerifyInit   (&md_ctx, EVP_sha1());
-   EVP_VerifyUpdate (&md_ctx, cookieData, strlen((char*)cookieData));
-   err = EVP_VerifyFinal (&md_ctx, sig_buf, sig_len, pubkey);
-   EVP_PKEY_free (pubkey);
-
-   if (err != 1)
-   {
-      fprintf(stderr, "Signature verification failed.\n");
-      return -1;
-   }
-
-   return 0;
+   return pubkey;
 }
 
 char RSA_Sign_Verify::binToHexMapping(const unsigned char c)
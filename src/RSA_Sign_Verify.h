@@ -24,6 +24,15 @@
  *                  const char * hexSig) - verifies signature hexSig is valid
  *                  over string cookieData.  Returns 0 if signature is valid,
  *                  -1 otherwise.
+ *               static int loadKeys() - reads the private key and the
+ *                  certificate's public key once, for the two methods above
+ *                  to use instead of reading their files on every call.
+ *                  Replaces any loaded before.  Returns 0 if both were
+ *                  read, -1 otherwise; either method still reads its file
+ *                  if its key is missing.
+ *               static void setQuiet(bool quiet) - whether signString()
+ *                  and verifySig() keep their failures off stderr, for a
+ *                  caller that reports them itself.
  */
 class RSA_Sign_Verify
 {
@@ -31,6 +40,8 @@ class RSA_Sign_Verify
       //uses default constructor and destructor
       static int signString(const char * cookieData, char * hexSig);
       static int verifySig(const char * cookieData, const char * hexSig);
+      static int loadKeys();
+      static void setQuiet(bool quiet);
 /* Emperically, it appears that the length of the binhex-coded RSA signature 
  * is 4X the length of the private key.  So, for a 2048-bit key, the binhex
  * sig may be 512 characters long.
@@ -49,8 +60,15 @@ class RSA_Sign_Verify
       static unsigned char hexToBinMapping(const char c);
       static void bin2hex(const unsigned char * data, const unsigned int data_len, char * buffer);
       static void hex2bin(const char * data, unsigned char * buffer, unsigned int &buffer_len);
+      static EVP_PKEY * readPrivateKey();
+      static EVP_PKEY * readPublicKey();
+
+      static bool quiet;  //setQuiet()
       /* RSA signature, in binary, is 2X length of a signed cookie in hex */
       static const int RSA_SIG_BUFFER_SIZE = 2048;  //overestimate
+
+      static EVP_PKEY * privateKey;  /* from loadKeys(); NULL if not loaded */
+      static EVP_PKEY * publicKey;   /* likewise, from the certificate */
       
 };
 
@@ -0,0 +1,96 @@
+#ifndef RING_QUEUE_H
+#define RING_QUEUE_H
+
+#include <stddef.h>
+
+/*
+ * Class Name  : RingQueue
+ *
+ * Description : A double-ended queue in one power-of-two array, for the
+ *              queues on the request path.  std::deque allocates and frees
+ *              a block every few dozen pushes as it moves through memory;
+ *              a RingQueue wraps around instead, and only allocates when it
+ *              grows past the most it has ever held.  It never shrinks, so
+ *              once a queue has seen its busiest moment it allocates
+ *              nothing.  The names follow std::deque's; T must be
+ *              copyable.  Not thread-safe.
+ *
+ * Method Index: RingQueue(size_t capacity) - constructor; room for
+ *                  capacity items before the first growth
+ *               void push_back(const T &item), void pop_front(),
+ *                  void pop_back()
+ *               T &front(), T &back(), T &operator[](size_t i) - i from
+ *                  the front
+ *               void erase(size_t i) - removes the i-th item, keeping the
+ *                  order of the rest
+ *               size_t size(), bool empty(), void clear()
+ *
+ */
+template <class T>
+class RingQueue
+{
+   public:
+      RingQueue(size_t capacity = 16)
+      : items(NULL), mask(0), head(0), count(0)
+      {
+         size_t size = 1;
+         while (size < capacity)
+            size <<= 1;
+         items = new T[size];
+         mask = size - 1;
+      }
+
+      ~RingQueue() { delete[] items; }
+
+      void push_back(const T &item)
+      {
+         if (count > mask)
+            grow();
+         items[(head + count) & mask] = item;
+         count++;
+      }
+
+      void pop_front()
+      {
+         head = (head + 1) & mask;
+         count--;
+      }
+
+      void pop_back() { count--; }
+      T &front() { return items[head]; }
+      T &back() { return items[(head + count - 1) & mask]; }
+      T &operator[](size_t i) { return items[(head + i) & mask]; }
+
+      void erase(size_t i)
+      {
+         for (; i + 1 < count; i++)
+            (*this)[i] = (*this)[i + 1];
+         count--;
+      }
+
+      size_t size() const { return count; }
+      bool empty() const { return count == 0; }
+      void clear() { head = 0; count = 0; }
+
+   private:
+      RingQueue(const RingQueue &);             /* not copyable */
+      RingQueue &operator=(const RingQueue &);
+
+      void grow()
+      {
+         T * larger = new T[(mask + 1) * 2];
+         for (size_t i = 0; i < count; i++)
+            larger[i] = (*this)[i];
+         delete[] items;
+         items = larger;
+         mask = mask * 2 + 1;
+         head = 0;
+      }
+
+      T * items;
+      size_t mask;    /* capacity - 1 */
+      size_t head;    /* index of the front item */
+      size_t count;
+};
+
+#endif
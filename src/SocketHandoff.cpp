@@ -0,0 +1,217 @@
+#include "SocketHandoff.h"
+#include "DaemonLog.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/types.h>
+
+/*
+ * Method Name: offer
+ *
+ * Description: sends the listening sockets to the daemon taking over.  The
+ *                 caller keeps its own copies and goes on accepting until
+ *                 awaitReady() says otherwise.
+ *
+ * Arguments  : int conn - accepted connection on HANDOFF_SOCKET_PATH
+ *              const int * fds - sockets to send, in slots both sides
+ *                 agree on; -1 for an empty slot
+ *              int count - number of slots, at most MAX_SOCKETS
+ *
+ * Returns    : int - 0 on success, -1 on error (already logged)
+ */
+int SocketHandoff::offer(int conn, const int * fds, int count)
+{
+   if (count < 1 || count > MAX_SOCKETS)
+      return -1;
+
+   Greeting greeting;
+   greeting.magic = MAGIC;
+   greeting.pid = (int) getpid();
+   greeting.slots = 0;
+   int sending[MAX_SOCKETS];
+   int sent = 0;
+   for (int i = 0; i < count; i++)
+   {
+      if (fds[i] < 0)
+         continue;
+      greeting.slots |= 1u << i;
+      sending[sent++] = fds[i];
+   }
+   if (sent == 0)
+      return -1;
+
+   struct iovec iov;
+   iov.iov_base = &greeting;
+   iov.iov_len = sizeof (greeting);
+
+   char control[CMSG_SPACE(MAX_SOCKETS * sizeof (int))];
+   bzero(control, sizeof (control));
+   struct msghdr msg;
+   bzero(&msg, sizeof (msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = CMSG_SPACE(sent * sizeof (int));
+
+   struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+   cmsg->cmsg_level = SOL_SOCKET;
+   cmsg->cmsg_type = SCM_RIGHTS;
+   cmsg->cmsg_len = CMSG_LEN(sent * sizeof (int));
+   memcpy(CMSG_DATA(cmsg), sending, sent * sizeof (int));
+
+   if (sendmsg(conn, &msg, 0) != (ssize_t) sizeof (greeting))
+   {
+      DaemonLog::write("SocketHandoff: cannot send sockets - %s\n", strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+/*
+ * Method Name: takeOver
+ *
+ * Description: asks the daemon listening on path for its sockets.
+ *
+ * Arguments  : const char * path - HANDOFF_SOCKET_PATH
+ *              int * fds - receives the sockets by slot; -1 for empty slots
+ *              int max - room in fds
+ *              int &conn - receives the connection to pass to
+ *                 signalReady(), if any sockets were received
+ *              pid_t &from - receives the old daemon's pid
+ *
+ * Returns    : int - slots filled; 0 if no daemon answers on path; -1 if one
+ *                 does but the handoff failed (already logged)
+ */
+int SocketHandoff::takeOver(const char * path, int * fds, int max, int &conn, pid_t &from)
+{
+   struct sockaddr_un sa;
+
+   conn = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (conn < 0)
+   {
+      DaemonLog::write("SocketHandoff: cannot create socket - %s\n", strerror(errno));
+      return -1;
+   }
+
+   bzero(&sa, sizeof (sa));
+   sa.sun_family = AF_UNIX;
+   strncpy(sa.sun_path, path, sizeof (sa.sun_path) - 1);
+   if (connect(conn, (struct sockaddr *) &sa, sizeof (sa)) < 0)
+   {
+      int err = errno;
+      close(conn);
+      conn = -1;
+      if (err == ENOENT || err == ECONNREFUSED)
+         return 0;  //nobody to take over from
+      DaemonLog::write("SocketHandoff: cannot connect to %s - %s\n", path, strerror(err));
+      return -1;
+   }
+
+   struct timeval tv;
+   tv.tv_sec = TIMEOUT;
+   tv.tv_usec = 0;
+   setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+
+   Greeting greeting;
+   greeting.magic = 0;
+   struct iovec iov;
+   iov.iov_base = &greeting;
+   iov.iov_len = sizeof (greeting);
+
+   char control[CMSG_SPACE(MAX_SOCKETS * sizeof (int))];
+   struct msghdr msg;
+   bzero(&msg, sizeof (msg));
+   msg.msg_iov = &iov;
+   msg.msg_iovlen = 1;
+   msg.msg_control = control;
+   msg.msg_controllen = sizeof (control);
+
+   ssize_t count = recvmsg(conn, &msg, 0);
+   struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+   int received[MAX_SOCKETS];
+   int nreceived = 0;
+   if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+   {
+      nreceived = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+      memcpy(received, CMSG_DATA(cmsg), nreceived * sizeof (int));
+   }
+
+   /* deal the sockets out to their slots */
+   for (int i = 0; i < max; i++)
+      fds[i] = -1;
+   int filled = 0;
+   bool valid = count == (ssize_t) sizeof (greeting) && greeting.magic == MAGIC
+      && nreceived > 0 && !(msg.msg_flags & MSG_CTRUNC);
+   int dealt = 0;
+   for (int i = 0; valid && i < MAX_SOCKETS; i++)
+   {
+      if (!(greeting.slots & (1u << i)))
+         continue;
+      if (dealt == nreceived)
+      {
+         valid = false;  //fewer sockets than slots
+         break;
+      }
+      if (i < max)
+      {
+         fds[i] = received[dealt];
+         filled++;
+      }
+      dealt++;
+   }
+
+   if (!valid)
+   {
+      if (count < 0)
+         DaemonLog::write("SocketHandoff: no sockets from %s - %s\n", path, strerror(errno));
+      else
+         DaemonLog::write("SocketHandoff: bad reply from %s\n", path);
+      for (int i = 0; i < nreceived; i++)
+         close(received[i]);
+      for (int i = 0; i < max; i++)
+         fds[i] = -1;
+      close(conn);
+      conn = -1;
+      return -1;
+   }
+   for (int k = 0; k < nreceived; k++)
+   {
+      bool used = false;
+      for (int i = 0; i < max; i++)
+         used = used || fds[i] == received[k];
+      if (!used)
+         close(received[k]);  //a slot we do not know
+   }
+   from = (pid_t) greeting.pid;
+   return filled;
+}
+
+int SocketHandoff::signalReady(int conn)
+{
+   char ready = READY;
+   if (write(conn, &ready, 1) != 1)
+   {
+      DaemonLog::write("SocketHandoff: cannot tell the old daemon to drain - %s\n", strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+bool SocketHandoff::awaitReady(int conn)
+{
+   char ready = 0;
+   return read(conn, &ready, 1) == 1 && ready == READY;
+}
+
+pid_t SocketHandoff::peer(int conn)
+{
+   struct ucred cred;
+   socklen_t len = sizeof (cred);
+   if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+      return -1;
+   return cred.pid;
+}
@@ -0,0 +1,71 @@
+#ifndef SOCKET_HANDOFF_H
+#define SOCKET_HANDOFF_H
+
+#include <sys/types.h>
+
+/*
+ * Class Name  : SocketHandoff
+ *
+ * Description : Passes a running cookieDaemon's listening sockets to a newly
+ *              started one (normally a new binary) over HANDOFF_SOCKET_PATH,
+ *              so an upgrade never leaves SOCKET_PATH unbound.
+ *
+ *              The new daemon connects and the old one answers with its
+ *              listening sockets as SCM_RIGHTS.  Both then accept from the
+ *              same sockets, and connections queued on them are served by
+ *              whichever accepts first.  Once the new daemon can serve it
+ *              sends one ready byte, and the old one stops accepting,
+ *              finishes what it has accepted and exits without unlinking
+ *              the socket files.  If the new daemon dies before it is
+ *              ready, the old one sees the connection close and carries on.
+ *
+ *              Sockets travel in numbered slots that both sides agree on; a
+ *              slot may be empty (-1), for a socket the old daemon does not
+ *              have.
+ *
+ * Method Index: int offer(int conn, const int * fds, int count) - old side.
+ *                  Sends count slots on an accepted handoff connection.
+ *                  Returns 0, or -1 (error logged).
+ *               int takeOver(const char * path, int * fds, int max,
+ *                  int &conn, pid_t &from) - new side.  Receives up to max
+ *                  slots from the daemon on path, whose pid is from; slots
+ *                  it did not fill are -1.  Returns how many slots were
+ *                  filled, with conn left open for signalReady(); 0 if no
+ *                  daemon is listening there; -1 (error logged) if one is
+ *                  but the handoff failed.
+ *               int signalReady(int conn) - new side; tells the old daemon
+ *                  to drain.  Returns 0, or -1 (error logged).
+ *               bool awaitReady(int conn) - old side; call once conn is
+ *                  readable.  True if the new daemon is ready, false if it
+ *                  gave up.
+ *               pid_t peer(int conn) - old side; the process that
+ *                  connected, or -1.  (The new side cannot ask, since a
+ *                  listener's credentials are those of whoever bound it.)
+ *
+ */
+class SocketHandoff
+{
+   public:
+      static const int MAX_SOCKETS = 4;
+
+      static int offer(int conn, const int * fds, int count);
+      static int takeOver(const char * path, int * fds, int max, int &conn, pid_t &from);
+      static int signalReady(int conn);
+      static bool awaitReady(int conn);
+      static pid_t peer(int conn);
+   private:
+      static const unsigned int MAGIC = 0x434b4831;  /* "CKH1" */
+
+      /* sent along with the sockets */
+      struct Greeting
+      {
+         unsigned int magic;
+         int pid;
+         unsigned int slots;  /* bit i set if slot i carries a socket */
+      };
+
+      static const char READY = 'R';
+      static const int TIMEOUT = 5;  /* seconds to wait for the old daemon */
+};
+
+#endif
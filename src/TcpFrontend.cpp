@@ -0,0 +1,751 @@
+#include "TcpFrontend.h"
+#include "AdmissionControl.h"
+#include "CookieProtocol.h"
+#include "DaemonLog.h"
+#include "RSA_Sign_Verify.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/*
+ * Method Name: listen
+ *
+ * Description: creates a non-blocking TCP socket bound to address:port and
+ *                 listening.
+ *
+ * Arguments  : const char * address - host name or numeric address;
+ *                 "0.0.0.0" or "::" for every interface
+ *              int port - TCP port
+ *
+ * Returns    : int - listening socket, or -1 (error already logged)
+ */
+int TcpFrontend::listen(const char * address, int port)
+{
+   struct addrinfo hints;
+   struct addrinfo * found;
+   char service[16];
+
+   bzero(&hints, sizeof (hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = AI_PASSIVE;
+   sprintf(service, "%d", port);
+   int rc = getaddrinfo(address, service, &hints, &found);
+   if (rc != 0)
+   {
+      DaemonLog::write("TcpFrontend: Cannot resolve %s - %s\n", address, gai_strerror(rc));
+      return -1;
+   }
+
+   int s = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+   if (s < 0)
+   {
+      DaemonLog::write("socket(): Cannot create TCP listener - %s\n", strerror(errno));
+      freeaddrinfo(found);
+      return -1;
+   }
+   int on = 1;
+   setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+   if (bind(s, found->ai_addr, found->ai_addrlen) < 0)
+   {
+      DaemonLog::write("bind(): Cannot bind TCP listener to %s port %d - %s\n", address, port, strerror(errno));
+      freeaddrinfo(found);
+      ::close(s);
+      return -1;
+   }
+   freeaddrinfo(found);
+   fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+
+   if (::listen(s, SOMAXCONN) < 0)
+   {
+      DaemonLog::write("listen(): Cannot listen on TCP socket - %s\n", strerror(errno));
+      ::close(s);
+      return -1;
+   }
+   return s;
+}
+
+/*
+ * Method Name: TcpFrontend
+ *
+ * Description: Class constructor.  Watches listener, if any; it stays open
+ *    when the frontend is destroyed, since the daemon owns it.
+ *
+ * Arguments  : int listener - from listen(), or handed over; -1 to serve
+ *                 only adopted connections
+ *              CookieDaemonConfig * config - TCP_MAX_CONNECTIONS and
+ *                 TCP_IDLE_TIMEOUT
+ *              TimerWheel * timers - for idle timeouts; driven by the
+ *                 caller's loop
+ *              Handler handler - answers each text request
+ *              FrameHandler frames - answers each binary request
+ *
+ * Returns    : none
+ */
+TcpFrontend::TcpFrontend(int listener, CookieDaemonConfig * config, TimerWheel * timers, Handler handler, FrameHandler frames)
+: listener(listener), epoll(-1), listening(false), handler(handler), frames(frames),
+  timers(timers), maxConnections(config->getTcpMaxConnections()),
+  idleTimeout(config->getTcpIdleTimeout()), freeConnections(NULL), connections(0),
+  accepted(0), drainStarted(0)
+{
+   epoll = epoll_create(MAX_EVENTS);
+   if (epoll < 0)
+   {
+      DaemonLog::write("epoll_create(): Cannot watch TCP connections - %s\n", strerror(errno));
+      return;
+   }
+   if (listener < 0)
+      return;
+   struct epoll_event ev;
+   bzero(&ev, sizeof (ev));
+   ev.events = EPOLLIN;
+   ev.data.ptr = NULL;  //the listener
+   listening = epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &ev) == 0;
+}
+
+TcpFrontend::~TcpFrontend()
+{
+   for (size_t i = 0; i < slots.size(); i++)
+   {
+      if (slots[i]->fd >= 0)
+         closeConnection(slots[i]);
+      delete slots[i];
+   }
+   if (epoll >= 0)
+      ::close(epoll);
+}
+
+int TcpFrontend::getFd() { return epoll; }
+
+/*
+ * Method Name: service
+ *
+ * Description: handles the connections epoll reports ready: accepts new
+ *                 ones, reads requests, answers every complete request and
+ *                 writes as much of the replies as the sockets take.
+ *
+ * Arguments  : none
+ *
+ * Returns    : none
+ */
+void TcpFrontend::service()
+{
+   struct epoll_event events[MAX_EVENTS];
+   int count = epoll_wait(epoll, events, MAX_EVENTS, 0);
+
+   for (int i = 0; i < count; i++)
+   {
+      Connection * c = (Connection *) events[i].data.ptr;
+      if (c == NULL)
+      {
+         acceptAll();
+         continue;
+      }
+
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+         readInput(c);
+      if (events[i].events & (EPOLLHUP | EPOLLERR))
+         c->broken = true;  //no reply can reach the peer now
+      progress(c);
+   }
+}
+
+/*
+ * Method Name: adopt
+ *
+ * Description: takes over a connection just accepted on SOCKET_PATH, before
+ *                 anything is read from it; its first byte decides whether
+ *                 it speaks the binary protocol or sends one verifyCookie
+ *                 request.  It has FIRST_REQUEST_TIMEOUT to send
+ *                 something.  The connection is closed if it cannot be
+ *                 watched.
+ *
+ * Arguments  : int fd - the connection; now owned by the frontend
+ *
+ * Returns    : none
+ */
+void TcpFrontend::adopt(int fd)
+{
+   Connection * c = watch(fd, true);
+   if (c != NULL)
+      timers->schedule(&c->idle, FIRST_REQUEST_TIMEOUT);
+}
+
+/*
+ * Method Name: adopt
+ *
+ * Description: takes over a local connection whose first read, made
+ *                 elsewhere, showed it speaks the binary protocol, and
+ *                 answers whatever requests that read already holds.  The
+ *                 connection is closed if it cannot be watched.
+ *
+ * Arguments  : int fd - the connection; now owned by the frontend
+ *              const char * data, size_t length - bytes already read
+ *
+ * Returns    : none
+ */
+void TcpFrontend::adopt(int fd, const char * data, size_t length)
+{
+   Connection * c = watch(fd, true);
+   if (c == NULL)
+      return;
+   c->input.assign(data, length);
+   progress(c);
+}
+
+void TcpFrontend::acceptAll()
+{
+   while (maxConnections <= 0 || connections < maxConnections)
+   {
+      int fd = accept(listener, NULL, NULL);
+      if (fd < 0)
+      {
+         if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+            DaemonLog::write("accept(): Error accepting TCP connection - %s\n", strerror(errno));
+         break;
+      }
+      int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+      watch(fd, false);
+   }
+
+   /* full: leave further connections in the backlog until one closes */
+   if (maxConnections > 0 && connections >= maxConnections && listening)
+   {
+      epoll_ctl(epoll, EPOLL_CTL_DEL, listener, NULL);
+      listening = false;
+   }
+}
+
+/* makes fd non-blocking and adds it to the epoll set; NULL (fd closed)
+ * if it cannot be watched */
+TcpFrontend::Connection * TcpFrontend::watch(int fd, bool local)
+{
+   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+   Connection * c = freeConnections;
+   if (c != NULL)
+      freeConnections = c->nextFree;
+   else
+   {
+      c = new Connection;
+      c->slot = slots.size();
+      c->sequence = 0;
+      slots.push_back(c);
+   }
+   c->fd = fd;
+   c->peer = AdmissionControl::peerKey(fd);
+   c->local = local;
+   c->mode = UNKNOWN;
+   c->lastActive = time(NULL);
+   c->closing = false;
+   c->broken = false;
+   c->events = EPOLLIN;
+   c->idle.callback = idleExpired;
+   c->idle.context = c;
+   c->frontend = this;
+
+   struct epoll_event ev;
+   bzero(&ev, sizeof (ev));
+   ev.events = c->events;
+   ev.data.ptr = c;
+   if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+   {
+      DaemonLog::write("epoll_ctl(): Cannot watch connection - %s\n", strerror(errno));
+      ::close(fd);
+      c->fd = -1;
+      c->nextFree = freeConnections;
+      freeConnections = c;
+      return NULL;
+   }
+   connections++;
+   accepted++;
+   timers->schedule(&c->idle, (idleTimeout > 0 ? idleTimeout : IDLE_RECHECK) * 1000LL);
+   return c;
+}
+
+/* answers and sends until the socket, OUTPUT_LIMIT or MAX_WAITING stops
+ * us, then closes c or updates what epoll watches it for */
+void TcpFrontend::progress(Connection * c)
+{
+   do
+   {
+      answer(c);
+      flush(c);
+   } while (c->output.empty() && c->waiting.size() < MAX_WAITING && pending(c));
+   update(c);
+}
+
+/* whether c may take on another request */
+bool TcpFrontend::room(Connection * c)
+{
+   return c->output.length() < OUTPUT_LIMIT && c->waiting.size() < MAX_WAITING;
+}
+
+/* adds a slot for a request about to be deferred; returns its ticket */
+unsigned long long TcpFrontend::defer(Connection * c)
+{
+   Slot slot;
+   slot.sequence = c->sequence++;
+   slot.ready = false;
+   slot.op = 0;
+   slot.id = 0;
+   c->waiting.push_back(slot);
+   return ((unsigned long long) c->slot << 32) | slot.sequence;
+}
+
+/*
+ * Method Name: complete
+ *
+ * Description: answers a request a handler deferred.  A text reply waits
+ *                 behind any earlier request still unanswered; a frame is
+ *                 sent at once.
+ *
+ * Arguments  : unsigned long long ticket - as given to the handler
+ *              int status - CookieProtocol status for a frame; ignored
+ *                 for text
+ *              const char * body, size_t length - the reply text, without
+ *                 its newline, or the frame's body
+ *
+ * Returns    : none
+ */
+void TcpFrontend::complete(unsigned long long ticket, int status, const char * body, size_t length)
+{
+   if ((ticket >> 32) >= slots.size())
+      return;
+   Connection * c = slots[ticket >> 32];
+
+   /* none matches if the connection closed while the answer was being
+    * worked out, even if another has its slot now */
+   size_t i = 0;
+   while (i < c->waiting.size() && c->waiting[i].sequence != (unsigned int) ticket)
+      i++;
+   if (i == c->waiting.size())
+      return;
+
+   Slot &slot = c->waiting[i];
+   if (c->mode == BINARY)
+   {
+      CookieProtocol::appendFrame(c->output, slot.op, status, slot.id, body, length, slot.version);
+      c->waiting.erase(i);
+   }
+   else
+   {
+      slot.ready = true;
+      snprintf(slot.text, sizeof (slot.text), "%.*s", (int) length, body);
+      while (!c->waiting.empty() && c->waiting.front().ready)
+      {
+         c->output += c->waiting.front().text;
+         if (c->mode != ONE_SHOT)
+            c->output += '\n';
+         c->waiting.pop_front();
+      }
+   }
+   progress(c);
+}
+
+void TcpFrontend::readInput(Connection * c)
+{
+   char buffer[4096];
+   ssize_t count = read(c->fd, buffer, sizeof (buffer));
+   if (count > 0)
+   {
+      c->input.append(buffer, count);
+      c->lastActive = time(NULL);
+   }
+   else if (count == 0)
+   {
+      /* a last text request may end at EOF instead of a newline */
+      if (!c->input.empty() && c->input[c->input.length() - 1] != '\n'
+         && (unsigned char) c->input[0] != CookieProtocol::MAGIC)
+         c->input += '\n';
+      c->closing = true;
+   }
+   else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+   {
+      c->input.clear();
+      c->output.clear();
+      c->closing = true;
+      c->broken = true;
+   }
+}
+
+/*
+ * Method Name: pending
+ *
+ * Description: whether c holds a request answer() can act on: a whole
+ *                 line, or a whole frame (or a header that answer() will
+ *                 reject without waiting for its body).
+ *
+ * Arguments  : Connection * c - connection to look at
+ *
+ * Returns    : bool - true if answer() has work
+ */
+bool TcpFrontend::pending(Connection * c)
+{
+   if (c->mode != BINARY)
+      return c->input.find('\n') != std::string::npos;
+
+   CookieProtocol::Header header;
+   const unsigned char * in = (const unsigned char *) c->input.data();
+   if (c->input.length() < CookieProtocol::HEADER_SIZE)
+      return false;
+   if (in[0] != CookieProtocol::MAGIC || !speaks(in[1]))
+      return true;
+   size_t size = CookieProtocol::headerSize(in);
+   if (c->input.length() < size)
+      return false;
+   CookieProtocol::decodeHeader(in, header);
+   return header.length > CookieProtocol::MAX_REQUEST || c->input.length() >= size + header.length;
+}
+
+/* whether frames of this version are understood: 1, or 2 with a timeout */
+bool TcpFrontend::speaks(int version)
+{
+   return version >= 1 && version <= CookieProtocol::VERSION;
+}
+
+/* answers what c has received, in whichever protocol its first byte chose */
+void TcpFrontend::answer(Connection * c)
+{
+   if (c->mode == UNKNOWN && !c->input.empty())
+   {
+      if ((unsigned char) c->input[0] == CookieProtocol::MAGIC)
+         c->mode = BINARY;
+      else if (c->local)
+      {
+         /* verifyCookie's whole request, as one read, unterminated;
+          * anything past a first line is ignored */
+         c->mode = ONE_SHOT;
+         size_t end = c->input.find('\n');
+         if (end == std::string::npos)
+            c->input += '\n';
+         else
+            c->input.erase(end + 1);
+         c->closing = true;
+      }
+      else
+         c->mode = TEXT;
+   }
+
+   if (c->mode == BINARY)
+      answerFrames(c);
+   else if (c->mode != UNKNOWN)
+      answerLines(c);
+}
+
+/*
+ * Method Name: answerLines
+ *
+ * Description: answers complete request lines until the replies waiting to
+ *                 be sent reach OUTPUT_LIMIT or MAX_WAITING are deferred.
+ *                 Replies keep request order: one answered at once waits
+ *                 behind any deferred before it.  Blank lines are ignored;
+ *                 a line longer than any cookie ends the connection after
+ *                 the replies before it.
+ *
+ * Arguments  : Connection * c - text connection with input
+ *
+ * Returns    : none
+ */
+void TcpFrontend::answerLines(Connection * c)
+{
+   char request[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
+   char response[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
+   size_t start = 0;
+   size_t end;
+
+   while (room(c) && (end = c->input.find('\n', start)) != std::string::npos)
+   {
+      size_t line = start;
+      size_t length = end - start;
+      if (length > 0 && c->input[end - 1] == '\r')
+         length--;
+      if (length >= sizeof (request))
+      {
+         DaemonLog::write("TcpFrontend: request too long; closing connection\n");
+         c->input.clear();
+         c->closing = true;
+         return;
+      }
+      start = end + 1;
+      if (length == 0)
+         continue;
+
+      memcpy(request, c->input.data() + line, length);
+      request[length] = '\0';
+      unsigned long long ticket = defer(c);
+      if (!handler(c->peer, request, response, ticket))
+         continue;  //stays in waiting for complete()
+      if (c->waiting.size() == 1)
+      {
+         c->waiting.pop_back();
+         c->output += response;
+         if (c->mode != ONE_SHOT)
+            c->output += '\n';
+      }
+      else
+      {
+         Slot &slot = c->waiting.back();
+         slot.ready = true;
+         snprintf(slot.text, sizeof (slot.text), "%.*s", (int) sizeof (slot.text) - 1, response);
+      }
+   }
+   c->input.erase(0, start);
+
+   if (c->input.length() >= sizeof (request) && c->input.find('\n') == std::string::npos)
+   {
+      DaemonLog::write("TcpFrontend: request too long; closing connection\n");
+      c->input.clear();
+      c->closing = true;
+   }
+}
+
+/*
+ * Method Name: answerFrames
+ *
+ * Description: answers complete request frames until the replies waiting
+ *                 to be sent reach OUTPUT_LIMIT or MAX_WAITING are
+ *                 deferred.  Each is answered in its own version.  A
+ *                 frame that does not start with MAGIC, has a version not
+ *                 spoken here or is longer than MAX_REQUEST ends the
+ *                 connection, the last two after a reply saying why.
+ *
+ * Arguments  : Connection * c - binary connection with input
+ *
+ * Returns    : none
+ */
+void TcpFrontend::answerFrames(Connection * c)
+{
+   CookieProtocol::Header header;
+   size_t start = 0;
+
+   while (room(c) && c->input.length() - start >= CookieProtocol::HEADER_SIZE)
+   {
+      const unsigned char * in = (const unsigned char *) c->input.data() + start;
+      if (in[0] != CookieProtocol::MAGIC)
+      {
+         DaemonLog::write("TcpFrontend: bad frame; closing connection\n");
+         c->input.clear();
+         c->closing = true;
+         return;
+      }
+      size_t size = CookieProtocol::headerSize(in);
+      if (speaks(in[1]) && c->input.length() - start < size)
+         break;  //rest of the header is still on its way
+      CookieProtocol::decodeHeader(in, header);
+      if (!speaks(header.version) || header.length > CookieProtocol::MAX_REQUEST)
+      {
+         if (speaks(header.version))
+            CookieProtocol::appendFrame(c->output, header.op, CookieProtocol::BAD_REQUEST, header.id, "", 0, header.version);
+         else
+            CookieProtocol::appendFrame(c->output, header.op, CookieProtocol::UNSUPPORTED, header.id, "", 0);
+         c->input.clear();
+         c->closing = true;
+         return;
+      }
+      if (c->input.length() - start < size + header.length)
+         break;  //rest of the body is still on its way
+
+      reply.clear();
+      unsigned long long ticket = defer(c);
+      int status = frames(c->peer, c->local, header.op, header.timeout, c->input.data() + start + size, header.length, reply, ticket);
+      if (status == DEFERRED)
+      {
+         c->waiting.back().op = header.op;
+         c->waiting.back().id = header.id;
+         c->waiting.back().version = header.version;
+      }
+      else
+      {
+         c->waiting.pop_back();
+         CookieProtocol::appendFrame(c->output, header.op, status, header.id, reply.data(), reply.length(), header.version);
+      }
+      start += size + header.length;
+   }
+   c->input.erase(0, start);
+}
+
+void TcpFrontend::flush(Connection * c)
+{
+   while (!c->output.empty())
+   {
+      ssize_t count = send(c->fd, c->output.data(), c->output.length(), MSG_NOSIGNAL);
+      if (count > 0)
+      {
+         c->output.erase(0, count);
+         c->lastActive = time(NULL);
+      }
+      else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+         break;
+      }
+      else if (count < 0 && errno == EINTR)
+      {
+         continue;
+      }
+      else
+      {
+         c->input.clear();
+         c->output.clear();
+         c->closing = true;
+         c->broken = true;
+      }
+   }
+}
+
+/*
+ * Method Name: update
+ *
+ * Description: closes a finished or broken connection, or sets what epoll
+ *                 watches it for: input while it has room() for requests,
+ *                 and room to write while there are replies unsent.
+ *
+ * Arguments  : Connection * c - connection just serviced; may be deleted
+ *
+ * Returns    : none
+ */
+void TcpFrontend::update(Connection * c)
+{
+   bool answered = c->output.empty() && c->waiting.empty() && !pending(c);
+   bool unread = c->local && c->mode == UNKNOWN;  //its request may be on its way
+   if (c->broken || (answered && (c->closing || (drainStarted != 0 && c->input.empty() && !unread))))
+   {
+      closeConnection(c);
+      return;
+   }
+
+   unsigned int events = 0;
+   if (!c->closing && room(c))
+      events |= EPOLLIN;
+   if (!c->output.empty())
+      events |= EPOLLOUT;
+   if (events == c->events)
+      return;
+
+   struct epoll_event ev;
+   bzero(&ev, sizeof (ev));
+   ev.events = events;
+   ev.data.ptr = c;
+   epoll_ctl(epoll, EPOLL_CTL_MOD, c->fd, &ev);
+   c->events = events;
+}
+
+void TcpFrontend::closeConnection(Connection * c)
+{
+   epoll_ctl(epoll, EPOLL_CTL_DEL, c->fd, NULL);
+   ::close(c->fd);
+   timers->cancel(&c->idle);
+   c->fd = -1;
+   c->input.clear();   //keeping their capacity for the next connection
+   c->output.clear();
+   c->waiting.clear();
+   c->nextFree = freeConnections;
+   freeConnections = c;
+   connections--;
+
+   if (!listening && drainStarted == 0 && epoll >= 0 && listener >= 0
+      && (maxConnections <= 0 || connections < maxConnections))
+   {
+      struct epoll_event ev;
+      bzero(&ev, sizeof (ev));
+      ev.events = EPOLLIN;
+      ev.data.ptr = NULL;
+      listening = epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &ev) == 0;
+   }
+}
+
+void TcpFrontend::idleExpired(TimerWheel::Timer * timer)
+{
+   Connection * c = (Connection *) timer->context;
+   c->frontend->expireIdle(c);
+}
+
+/*
+ * Method Name: expireIdle
+ *
+ * Description: runs when a connection's idle timer fires.  Closes it if
+ *                 it has neither sent a request nor taken a reply for
+ *                 TCP_IDLE_TIMEOUT seconds and is not waiting on a deferred
+ *                 one, or if it was adopted and has sent nothing in
+ *                 FIRST_REQUEST_TIMEOUT; otherwise sets the timer for when
+ *                 it next could be.
+ *                 Activity only stamps lastActive, so a busy connection
+ *                 costs one timer event per timeout, not one per request.
+ *
+ * Arguments  : Connection * c - the connection
+ *
+ * Returns    : none
+ */
+void TcpFrontend::expireIdle(Connection * c)
+{
+   if (c->local && c->mode == UNKNOWN && c->input.empty())
+   {
+      closeConnection(c);
+      return;
+   }
+   if (idleTimeout <= 0)
+   {
+      timers->schedule(&c->idle, IDLE_RECHECK * 1000LL);  //in case a reload sets one
+      return;
+   }
+   time_t idleFor = time(NULL) - c->lastActive;
+   if (idleFor < idleTimeout)
+      timers->schedule(&c->idle, (idleTimeout - idleFor) * 1000LL);
+   else if (!c->waiting.empty())
+      timers->schedule(&c->idle, idleTimeout * 1000LL);
+   else
+      closeConnection(c);
+}
+
+/*
+ * Method Name: drain
+ *
+ * Description: stops accepting.  Connections with nothing outstanding are
+ *                 closed now and the rest as soon as their replies are
+ *                 sent; a client that sent a request the daemon had not yet
+ *                 read sees the connection close and should resend it.
+ *
+ * Arguments  : none
+ *
+ * Returns    : none
+ */
+void TcpFrontend::drain()
+{
+   if (drainStarted != 0)
+      return;
+   drainStarted = time(NULL);
+   if (listening)
+   {
+      epoll_ctl(epoll, EPOLL_CTL_DEL, listener, NULL);
+      listening = false;
+   }
+
+   for (size_t i = 0; i < slots.size(); i++)
+   {
+      if (slots[i]->fd >= 0)
+         update(slots[i]);
+   }
+}
+
+bool TcpFrontend::drained()
+{
+   return drainStarted != 0 && (connections == 0 || time(NULL) - drainStarted >= DRAIN_TIMEOUT);
+}
+
+void TcpFrontend::reconfigure(CookieDaemonConfig * config)
+{
+   maxConnections = config->getTcpMaxConnections();
+   idleTimeout = config->getTcpIdleTimeout();
+}
+
+int TcpFrontend::getConnections() { return connections; }
+unsigned long TcpFrontend::getAccepted() { return accepted; }
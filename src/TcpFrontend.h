@@ -0,0 +1,186 @@
+#ifndef TCP_FRONTEND_H
+#define TCP_FRONTEND_H
+
+#include <string>
+#include <vector>
+#include <time.h>
+#include "CookieDaemonConfig.h"
+#include "RingQueue.h"
+#include "TimerWheel.h"
+
+/*
+ * Class Name  : TcpFrontend
+ *
+ * Description : Serves cookie checks to remote web nodes over TCP
+ *              (TCP_LISTEN_ADDRESS, TCP_LISTEN_PORT), so a fleet can share
+ *              one well-cached daemon and a few database sessions.
+ *
+ *              Requests are framed by newlines: the client sends one cookie
+ *              text per line and gets one reply line per request, in order.
+ *              Connections stay open, and a client may send many requests
+ *              before reading any replies.  Every connection is
+ *              non-blocking and watched by one epoll set, so a slow client
+ *              only ever delays itself; while a client is not reading its
+ *              replies, its further requests wait in the kernel.
+ *
+ *              A connection whose first byte is CookieProtocol::MAGIC
+ *              speaks the binary protocol instead, and its frames go to a
+ *              FrameHandler.  The daemon also adopts every connection
+ *              accepted on SOCKET_PATH before reading from it, so a client
+ *              that connects and sends nothing holds up no one; those are
+ *              marked local, since only they may ask for SIGN.  A local
+ *              connection that does not speak the binary protocol is a
+ *              verifyCookie one: its first read is its only request, with
+ *              no newline, and it is closed once the reply, also with no
+ *              newline, is sent.  One that sends nothing within
+ *              FIRST_REQUEST_TIMEOUT is closed.
+ *
+ *              A handler may answer at once or defer: it keeps the ticket
+ *              it was given and later passes the answer to complete(),
+ *              while the connection goes on with its other requests.  Text
+ *              replies still go out in request order; binary ones as they
+ *              come.  A connection stops reading once MAX_WAITING of its
+ *              requests are deferred.
+ *
+ *              A closed connection is kept, buffers and all, for the next
+ *              one to reuse, so serving requests on connections that come
+ *              and go allocates nothing once the frontend has held as many
+ *              at once as it ever will.
+ *
+ *              Each process that serves (each pre-fork worker) builds its
+ *              own TcpFrontend on the shared listening socket, or with no
+ *              listener (-1) just for adopted connections.
+ *
+ * Method Index: static int listen(const char * address, int port) - binds
+ *                  and listens; the socket, or -1 (error logged)
+ *               TcpFrontend(int listener, CookieDaemonConfig * config,
+ *                  TimerWheel * timers, Handler handler,
+ *                  FrameHandler frames) - constructor.  handler answers
+ *                  each text request, frames each binary one.  Each
+ *                  connection's idle timeout is a timer on timers.
+ *               void adopt(int fd) - takes over a local connection,
+ *                  nothing yet read from it
+ *               void adopt(int fd, const char * data, size_t length) -
+ *                  takes over a local binary connection from which data
+ *                  has already been read
+ *               int getFd() - an fd that polls readable when there is work
+ *                  for service()
+ *               void service() - accepts, reads, answers and writes
+ *                  whatever is ready, without blocking
+ *               void complete(unsigned long long ticket, int status,
+ *                  const char * body, size_t length) - answers a deferred
+ *                  request: a text reply (status ignored) or a frame's
+ *                  status and body.  Ignored if the connection has closed.
+ *               void drain() - stops accepting and closes each connection
+ *                  once its requests have been answered
+ *               bool drained() - true when a drain has closed every
+ *                  connection, or given up on the stragglers
+ *               void reconfigure(CookieDaemonConfig * config) - takes new
+ *                  limits from a reloaded config
+ *               getConnections(), getAccepted() - open connections, and
+ *                  connections ever accepted or adopted
+ *
+ */
+class TcpFrontend
+{
+   public:
+      /* answers one request line (modifiable, NUL-terminated) from the
+       * peer identified by AdmissionControl::peerKey().  Returns false if
+       * it deferred the answer to complete(ticket). */
+      typedef bool (*Handler)(unsigned long long peer, char * request, char * response, unsigned long long ticket);
+      /* answers one binary request, putting the response body in reply;
+       * returns a CookieProtocol status, or DEFERRED.  timeout is the
+       * frame's, in milliseconds; 0 if it has none. */
+      typedef int (*FrameHandler)(unsigned long long peer, bool local, int op, unsigned int timeout, const char * body, size_t length, std::string &reply, unsigned long long ticket);
+      static const int DEFERRED = -1;
+
+      static int listen(const char * address, int port);
+      TcpFrontend(int listener, CookieDaemonConfig * config, TimerWheel * timers, Handler handler, FrameHandler frames);
+      ~TcpFrontend();
+      int getFd();
+      void adopt(int fd);
+      void adopt(int fd, const char * data, size_t length);
+      void service();
+      void complete(unsigned long long ticket, int status, const char * body, size_t length);
+      void drain();
+      bool drained();
+      void reconfigure(CookieDaemonConfig * config);
+      int getConnections();
+      unsigned long getAccepted();
+   private:
+      static const int MAX_EVENTS = 64;
+      static const size_t OUTPUT_LIMIT = 65536;  /* stop reading past this much unsent */
+      static const int DRAIN_TIMEOUT = 5;        /* seconds */
+      static const int IDLE_RECHECK = 60;        /* seconds, with no TCP_IDLE_TIMEOUT */
+      static const size_t MAX_WAITING = 256;     /* stop reading past this many deferred */
+      static const int FIRST_REQUEST_TIMEOUT = 200;  /* ms an adopted connection has to send */
+
+      /* what a connection speaks; decided by its first byte.  ONE_SHOT is
+       * a local text connection: one request, as verifyCookie sends it. */
+      enum Mode { UNKNOWN, TEXT, BINARY, ONE_SHOT };
+
+      /* a deferred request */
+      struct Slot
+      {
+         unsigned int sequence; /* low half of its ticket */
+         bool ready;            /* text: answered, held for the ones before it */
+         char text[16];         /* text: the reply, a number */
+         int op;                /* binary: for the response header */
+         unsigned int id;
+         int version;
+      };
+
+      struct Connection
+      {
+         unsigned int slot;    /* in slots, and the high half of its tickets */
+         unsigned int sequence;  /* never reset, so old tickets match no Slot */
+         int fd;
+         unsigned long long peer;
+         bool local;           /* adopted from SOCKET_PATH */
+         Mode mode;
+         std::string input;    /* received, not yet answered */
+         std::string output;   /* answered, not yet sent */
+         RingQueue<Slot> waiting;  /* deferred, oldest first */
+         time_t lastActive;
+         TimerWheel::Timer idle;  /* context: this connection */
+         TcpFrontend * frontend;  /* for the idle timer */
+         bool closing;         /* peer has shut down its side */
+         bool broken;          /* cannot be written; close regardless */
+         unsigned int events;  /* registered with epoll */
+         Connection * nextFree;
+      };
+
+      void acceptAll();
+      Connection * watch(int fd, bool local);
+      void progress(Connection * c);
+      bool room(Connection * c);
+      unsigned long long defer(Connection * c);
+      void readInput(Connection * c);
+      bool pending(Connection * c);
+      static bool speaks(int version);
+      void answer(Connection * c);
+      void answerLines(Connection * c);
+      void answerFrames(Connection * c);
+      void flush(Connection * c);
+      void update(Connection * c);
+      void closeConnection(Connection * c);
+      static void idleExpired(TimerWheel::Timer * timer);
+      void expireIdle(Connection * c);
+
+      int listener;
+      int epoll;
+      bool listening;       /* listener is in the epoll set */
+      Handler handler;
+      FrameHandler frames;
+      TimerWheel * timers;
+      int maxConnections;
+      int idleTimeout;
+      std::vector<Connection *> slots;  /* every Connection, open or not */
+      Connection * freeConnections;     /* closed (fd -1), for watch() */
+      int connections;                  /* open */
+      std::string reply;                /* answerFrames()' scratch */
+      unsigned long accepted;
+      time_t drainStarted;  /* 0 unless draining */
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "TimerWheel.h"
+
+TimerWheel::TimerWheel(long long now)
+: origin(now), current(0), count(0)
+{
+   for (int level = 0; level < LEVELS; level++)
+   {
+      for (int i = 0; i < SLOTS; i++)
+      {
+         slots[level][i].next = &slots[level][i];
+         slots[level][i].prev = &slots[level][i];
+      }
+   }
+}
+
+/*
+ * Method Name: schedule
+ *
+ * Description: (re)schedules a timer.  The deadline is rounded up to a
+ *                 whole tick, and is at least the next one.
+ *
+ * Arguments  : Timer * timer - with its callback set
+ *              long long delay - milliseconds after the last advance()
+ *
+ * Returns    : none
+ */
+void TimerWheel::schedule(Timer * timer, long long delay)
+{
+   cancel(timer);
+   unsigned long long ticks = delay <= 0 ? 1 : (delay + TICK_MS - 1) / TICK_MS;
+   unsigned long long span = 1ULL << (BITS * LEVELS);
+   if (ticks >= span)
+      ticks = span - 1;
+   timer->due = current + ticks;
+   link(timer);
+   count++;
+}
+
+void TimerWheel::cancel(Timer * timer)
+{
+   if (!scheduled(timer))
+      return;
+   unlink(timer);
+   count--;
+}
+
+/* puts a timer in the slot its deadline hashes to, on the innermost wheel
+ * that reaches that far */
+void TimerWheel::link(Timer * timer)
+{
+   unsigned long long delta = timer->due - current;
+   int level = 0;
+   while (level < LEVELS - 1 && delta >= 1ULL << (BITS * (level + 1)))
+      level++;
+   Timer * head = &slots[level][(timer->due >> (BITS * level)) & (SLOTS - 1)];
+   timer->next = head;
+   timer->prev = head->prev;
+   head->prev->next = timer;
+   head->prev = timer;
+}
+
+void TimerWheel::unlink(Timer * timer)
+{
+   timer->prev->next = timer->next;
+   timer->next->prev = timer->prev;
+   timer->next = NULL;
+   timer->prev = NULL;
+}
+
+/* re-files the timers of the outer slot that has come due; every one now
+ * lands on an inner wheel */
+void TimerWheel::cascade(int level)
+{
+   Timer * head = &slots[level][(current >> (BITS * level)) & (SLOTS - 1)];
+   while (head->next != head)
+   {
+      Timer * timer = head->next;
+      unlink(timer);
+      link(timer);
+   }
+}
+
+/*
+ * Method Name: advance
+ *
+ * Description: moves the wheel to now, a tick at a time, firing each
+ *                 timer as its tick is reached
+ *
+ * Arguments  : long long now - milliseconds on the constructor's clock
+ *
+ * Returns    : none
+ */
+void TimerWheel::advance(long long now)
+{
+   if (now < origin)
+      return;
+   unsigned long long target = (unsigned long long) (now - origin) / TICK_MS;
+   while (current < target)
+   {
+      current++;
+      for (int level = 1; level < LEVELS; level++)
+      {
+         if (((current >> (BITS * (level - 1))) & (SLOTS - 1)) != 0)
+            break;
+         cascade(level);
+      }
+
+      Timer * head = &slots[0][current & (SLOTS - 1)];
+      while (head->next != head)
+      {
+         Timer * timer = head->next;
+         unlink(timer);
+         count--;
+         timer->callback(timer);
+      }
+   }
+}
+
+/*
+ * Method Name: wait
+ *
+ * Description: how long the loop may block before calling advance().
+ *                 Looks at the innermost wheel only; if it is empty, the
+ *                 answer is the next time it comes round, when an outer
+ *                 slot may cascade into it.
+ *
+ * Arguments  : long long now - milliseconds on the constructor's clock
+ *
+ * Returns    : int - milliseconds, 0 if a timer is already due, or -1 if
+ *                 nothing is scheduled
+ */
+int TimerWheel::wait(long long now)
+{
+   if (count == 0)
+      return -1;
+   unsigned long long tick = current + 1;
+   for (int i = 0; i < SLOTS; i++, tick++)
+   {
+      Timer * head = &slots[0][tick & (SLOTS - 1)];
+      if (head->next != head || (tick & (SLOTS - 1)) == 0)
+         break;
+   }
+   long long delay = origin + (long long) tick * TICK_MS - now;
+   if (delay < 0)
+      return 0;
+   return (int) delay;
+}
+
+size_t TimerWheel::size() { return count; }
@@ -0,0 +1,83 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+
+/*
+ * Class Name  : TimerWheel
+ *
+ * Description : Hierarchical hashed timer wheel for the daemon's deadlines:
+ *              cache entry expiry, idle connections and whatever else must
+ *              happen "in n seconds" without a scan to find it.
+ *
+ *              Time is counted in ticks of TICK_MS.  The innermost wheel
+ *              has a slot per tick for the next SLOTS ticks; each outer
+ *              wheel has a slot per turn of the one inside it.  A timer is
+ *              linked into the slot its deadline hashes to, so scheduling
+ *              and cancelling are O(1).  Whenever the inner wheel comes
+ *              round, the outer slot now due is cascaded into it.  A timer
+ *              is never early and at most one tick late.
+ *
+ *              Timers are intrusive: the owner embeds a Timer, sets its
+ *              callback and context, and hands it to schedule().  Nothing
+ *              is allocated.  Not thread-safe; the daemon's loop drives it.
+ *
+ * Method Index: TimerWheel(long long now) - constructor.  now is the
+ *                  current time in milliseconds on any monotonic clock.
+ *               void schedule(Timer * timer, long long delay) - fires
+ *                  timer delay milliseconds after the last advance(),
+ *                  replacing any deadline it had
+ *               void cancel(Timer * timer) - unschedules timer, if it is
+ *                  scheduled
+ *               static bool scheduled(const Timer * timer)
+ *               void advance(long long now) - fires every timer due by
+ *                  now, in deadline order to the tick.  A callback may
+ *                  schedule or cancel any timer, its own included.
+ *               int wait(long long now) - milliseconds the caller may
+ *                  sleep before the next advance() has work, or -1 if no
+ *                  timer is scheduled
+ *               size_t size() - timers scheduled
+ *
+ */
+class TimerWheel
+{
+   public:
+      struct Timer;
+      typedef void (*Callback)(Timer * timer);
+
+      struct Timer
+      {
+         Timer * next;
+         Timer * prev;          /* NULL while not scheduled */
+         unsigned long long due;  /* tick */
+         Callback callback;
+         void * context;        /* for the callback */
+
+         Timer() : next(NULL), prev(NULL), due(0), callback(NULL), context(NULL) {}
+      };
+
+      static const int TICK_MS = 100;
+
+      TimerWheel(long long now);
+      void schedule(Timer * timer, long long delay);
+      void cancel(Timer * timer);
+      static bool scheduled(const Timer * timer) { return timer->prev != NULL; }
+      void advance(long long now);
+      int wait(long long now);
+      size_t size();
+   private:
+      static const int LEVELS = 4;
+      static const int BITS = 8;
+      static const int SLOTS = 1 << BITS;  /* per wheel; 4 x 8 bits spans 13 years of ticks */
+
+      void link(Timer * timer);
+      static void unlink(Timer * timer);
+      void cascade(int level);
+
+      Timer slots[LEVELS][SLOTS];  /* list heads; each circular */
+      long long origin;            /* milliseconds at tick 0 */
+      unsigned long long current;  /* last tick advanced to */
+      size_t count;
+};
+
+#endif
@@ -0,0 +1,451 @@
+#include "UringListener.h"
+#include "AdmissionControl.h"
+#include "CookieProtocol.h"
+#include "DaemonLog.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+/* liburing is not assumed; these are the three io_uring system calls */
+static int uringSetup(unsigned int entries, struct io_uring_params * params)
+{
+   return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int ring, unsigned int toSubmit, unsigned int minComplete, unsigned int flags)
+{
+   return (int) syscall(__NR_io_uring_enter, ring, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int uringRegister(int ring, unsigned int opcode, void * arg, unsigned int count)
+{
+   return (int) syscall(__NR_io_uring_register, ring, opcode, arg, count);
+}
+
+UringListener * UringListener::create(int listener, TcpFrontend::Handler handler, TcpFrontend * frontend)
+{
+   UringListener * uring = new UringListener(listener, handler, frontend);
+   if (!uring->setup())
+   {
+      delete uring;
+      return NULL;
+   }
+   uring->armAccept();
+   uring->submit();
+   return uring;
+}
+
+UringListener::UringListener(int listener, TcpFrontend::Handler handler, TcpFrontend * frontend)
+: listener(listener), handler(handler), frontend(frontend), ring(-1),
+  sqMap(MAP_FAILED), sqMapSize(0), cqMap(MAP_FAILED), cqMapSize(0), sqes(NULL), sqesSize(0),
+  sqEntries(0), sqeTail(0), submitted(0), buffers(NULL),
+  accepting(false), draining(false), connections(0), freeConnections(NULL), enters(0)
+{
+   readTimeout[0] = READ_TIMEOUT;
+   readTimeout[1] = 0;
+}
+
+/*
+ * Method Name: ~UringListener
+ *
+ * Description: Class destructor.  Closing the ring cancels whatever is in
+ *    flight; connections it was serving are closed without a reply.  The
+ *    listener stays open, since the daemon owns it.
+ *
+ * Arguments  : none
+ *
+ * Returns    : none
+ */
+UringListener::~UringListener()
+{
+   if (ring >= 0)
+      close(ring);
+   if (sqes != NULL)
+      munmap(sqes, sqesSize);
+   if (cqMap != MAP_FAILED && cqMap != sqMap)
+      munmap(cqMap, cqMapSize);
+   if (sqMap != MAP_FAILED)
+      munmap(sqMap, sqMapSize);
+   delete [] buffers;
+   while (freeConnections != NULL)
+   {
+      Connection * c = freeConnections;
+      freeConnections = c->nextFree;
+      delete c;
+   }
+}
+
+/*
+ * Method Name: setup
+ *
+ * Description: creates the ring, maps its queues and queues the receive
+ *                 buffers for the kernel
+ *
+ * Arguments  : none
+ *
+ * Returns    : bool - false (reason logged) if the kernel cannot do it
+ */
+bool UringListener::setup()
+{
+   struct io_uring_params params;
+   bzero(&params, sizeof (params));
+   ring = uringSetup(QUEUE_DEPTH, &params);
+   if (ring < 0)
+   {
+      DaemonLog::write("io_uring_setup(): %s\n", strerror(errno));
+      return false;
+   }
+
+   sqMapSize = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+   cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+   bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+   if (single && cqMapSize > sqMapSize)
+      sqMapSize = cqMapSize;
+   sqMap = mmap(NULL, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+   if (sqMap == MAP_FAILED)
+   {
+      DaemonLog::write("mmap(): Cannot map io_uring submission queue - %s\n", strerror(errno));
+      return false;
+   }
+   cqMap = single ? sqMap : mmap(NULL, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+   sqesSize = params.sq_entries * sizeof (struct io_uring_sqe);
+   void * sqeMap = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+   if (cqMap == MAP_FAILED || sqeMap == MAP_FAILED)
+   {
+      DaemonLog::write("mmap(): Cannot map io_uring queues - %s\n", strerror(errno));
+      return false;
+   }
+   sqes = (struct io_uring_sqe *) sqeMap;
+
+   char * sq = (char *) sqMap;
+   sqHead = (unsigned int *) (sq + params.sq_off.head);
+   sqTail = (unsigned int *) (sq + params.sq_off.tail);
+   sqMask = (unsigned int *) (sq + params.sq_off.ring_mask);
+   sqArray = (unsigned int *) (sq + params.sq_off.array);
+   sqEntries = params.sq_entries;
+   char * cq = (char *) cqMap;
+   cqHead = (unsigned int *) (cq + params.cq_off.head);
+   cqTail = (unsigned int *) (cq + params.cq_off.tail);
+   cqMask = (unsigned int *) (cq + params.cq_off.ring_mask);
+   cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+   sqeTail = submitted = *sqTail;
+
+   /* the receive buffers, lent to the kernel as one group */
+   buffers = new char[BUFFERS * BUFFER_SIZE];
+   struct io_uring_sqe * sqe = getSqe();
+   sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+   sqe->fd = BUFFERS;
+   sqe->addr = (unsigned long) buffers;
+   sqe->len = BUFFER_SIZE;  //receives take one less, leaving room for the NUL
+   sqe->off = 0;
+   sqe->buf_group = 0;
+   sqe->user_data = 0;
+   return true;
+}
+
+int UringListener::getFd() { return ring; }
+int UringListener::getConnections() { return connections; }
+unsigned long UringListener::getEnters() { return enters; }
+
+/* next free sqe, zeroed; submits first if the queue is full */
+struct io_uring_sqe * UringListener::getSqe()
+{
+   reserve(1);
+   struct io_uring_sqe * sqe = &sqes[sqeTail & *sqMask];
+   bzero(sqe, sizeof (*sqe));
+   sqArray[sqeTail & *sqMask] = sqeTail & *sqMask;
+   sqeTail++;
+   return sqe;
+}
+
+/* makes room for count sqes, so linked ones go in the same submission */
+void UringListener::reserve(unsigned int count)
+{
+   if (sqEntries - (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)) < count)
+      submit();
+}
+
+void UringListener::submit()
+{
+   unsigned int pending = sqeTail - submitted;
+   if (pending == 0)
+      return;
+   __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+   int count = uringEnter(ring, pending, 0, 0);
+   enters++;
+   if (count < 0)
+   {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+         DaemonLog::write("io_uring_enter(): %s\n", strerror(errno));
+      return;  //the rest go with the next submission
+   }
+   submitted += count;
+}
+
+void UringListener::armAccept()
+{
+   struct io_uring_sqe * sqe = getSqe();
+   sqe->opcode = IORING_OP_ACCEPT;
+   sqe->fd = listener;
+   sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+   sqe->user_data = ACCEPTED;
+   accepting = true;
+}
+
+/* a receive into whichever buffer is free, cut short by READ_TIMEOUT */
+void UringListener::receive(Connection * c)
+{
+   reserve(2);
+   struct io_uring_sqe * sqe = getSqe();
+   sqe->opcode = IORING_OP_RECV;
+   sqe->fd = c->fd;
+   sqe->len = BUFFER_SIZE - 1;  //room for the NUL
+   sqe->flags = IOSQE_BUFFER_SELECT | IOSQE_IO_LINK;
+   sqe->buf_group = 0;
+   sqe->user_data = (unsigned long long) c | RECEIVED;
+
+   sqe = getSqe();
+   sqe->opcode = IORING_OP_LINK_TIMEOUT;
+   sqe->addr = (unsigned long) readTimeout;
+   sqe->len = 1;
+   sqe->user_data = 0;  //completion ignored
+}
+
+/* sends the response and then closes, whether or not the send worked */
+void UringListener::reply(Connection * c)
+{
+   reserve(2);
+   struct io_uring_sqe * sqe = getSqe();
+   sqe->opcode = IORING_OP_SEND;
+   sqe->fd = c->fd;
+   sqe->addr = (unsigned long) c->response;
+   sqe->len = strlen(c->response);
+   sqe->msg_flags = MSG_NOSIGNAL;
+   sqe->flags = IOSQE_IO_HARDLINK;
+   sqe->user_data = (unsigned long long) c | SENT;
+   closeConnection(c);
+}
+
+void UringListener::closeConnection(Connection * c)
+{
+   struct io_uring_sqe * sqe = getSqe();
+   sqe->opcode = IORING_OP_CLOSE;
+   sqe->fd = c->fd;
+   sqe->user_data = (unsigned long long) c | CLOSED;
+}
+
+/* hands buffer back to the kernel, and to a connection that ran out */
+void UringListener::recycle(unsigned short buffer)
+{
+   struct io_uring_sqe * sqe = getSqe();
+   sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+   sqe->fd = 1;
+   sqe->addr = (unsigned long) (buffers + buffer * BUFFER_SIZE);
+   sqe->len = BUFFER_SIZE;
+   sqe->off = buffer;
+   sqe->buf_group = 0;
+   sqe->user_data = 0;
+
+   if (!starved.empty())
+   {
+      Connection * c = starved.front();
+      starved.pop_front();
+      receive(c);
+   }
+}
+
+/*
+ * Method Name: service
+ *
+ * Description: handles every waiting completion, then submits in one call
+ *                 all the work they queued
+ *
+ * Arguments  : none
+ *
+ * Returns    : none
+ */
+void UringListener::service()
+{
+   unsigned int head = *cqHead;
+   unsigned int tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+   while (head != tail)
+   {
+      struct io_uring_cqe * cqe = &cqes[head & *cqMask];
+      unsigned long long data = cqe->user_data;
+      int result = cqe->res;
+      unsigned int flags = cqe->flags;
+      head++;
+      __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+      completed(data, result, flags);
+      if (head == tail)
+         tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+   }
+   submit();
+}
+
+void UringListener::completed(unsigned long long data, int result, unsigned int flags)
+{
+   if (data == 0)
+      return;  //a receive timeout or a returned buffer
+
+   if (data == ACCEPTED)
+   {
+      if (!(flags & IORING_CQE_F_MORE))
+         accepting = false;
+      if (result >= 0)
+      {
+         Connection * c = freeConnections;
+         if (c != NULL)
+            freeConnections = c->nextFree;
+         else
+            c = new Connection;
+         c->fd = result;
+         connections++;
+         receive(c);
+      }
+      else if (result != -ECANCELED && result != -EAGAIN && result != -EINTR)
+      {
+         DaemonLog::write("accept(): Error accepting on socket - %s\n", strerror(-result));
+      }
+      if (!accepting && !draining)
+         armAccept();
+      return;
+   }
+
+   Connection * c = (Connection *) (data & ~STEP);
+   switch (data & STEP)
+   {
+      case RECEIVED:
+         received(c, result, flags);
+         break;
+      case SENT:
+         if (result < 0 && result != -ECANCELED)
+            DaemonLog::write("write(): Error writing socket - %s\n", strerror(-result));
+         break;
+      case CLOSED:
+         c->nextFree = freeConnections;
+         freeConnections = c;
+         connections--;
+         break;
+   }
+}
+
+/*
+ * Method Name: received
+ *
+ * Description: answers a connection's request, as the poll() loop would
+ *                 after its read()
+ *
+ * Arguments  : Connection * c - the connection
+ *              int result, unsigned int flags - from the receive's cqe
+ *
+ * Returns    : none
+ */
+void UringListener::received(Connection * c, int result, unsigned int flags)
+{
+   if (result == -ENOBUFS)
+   {
+      starved.push_back(c);  //every buffer is in use; wait for one
+      return;
+   }
+   if (!(flags & IORING_CQE_F_BUFFER))
+   {
+      if (result < 0 && result != -ECANCELED)
+         DaemonLog::write("read(): Error reading socket - %s\n", strerror(-result));
+      closeConnection(c);  //timed out, failed or closed before sending
+      return;
+   }
+
+   unsigned short buffer = flags >> IORING_CQE_BUFFER_SHIFT;
+   char * request = buffers + buffer * BUFFER_SIZE;
+   if (result > 0 && (unsigned char) request[0] == CookieProtocol::MAGIC)
+   {
+      frontend->adopt(c->fd, request, result);  //now the frontend's
+      c->nextFree = freeConnections;
+      freeConnections = c;
+      connections--;
+   }
+   else if (result >= BUFFER_SIZE - 1)
+   {
+      DaemonLog::write("read(): Buffer full reading socket; discarding\n");
+      closeConnection(c);
+   }
+   else if (result <= 0)
+   {
+      closeConnection(c);
+   }
+   else
+   {
+      request[result] = '\0';
+      if (handler(AdmissionControl::peerKey(c->fd), request, c->response, (unsigned long long) c))
+         reply(c);  //else complete() replies
+   }
+   recycle(buffer);
+}
+
+/*
+ * Method Name: complete
+ *
+ * Description: replies to a request the handler deferred.  The reply is
+ *                 submitted by the next service().
+ *
+ * Arguments  : unsigned long long ticket - as given to the handler
+ *              const char * response - the reply text
+ *
+ * Returns    : none
+ */
+void UringListener::complete(unsigned long long ticket, const char * response)
+{
+   Connection * c = (Connection *) ticket;
+   strncpy(c->response, response, BUFFER_SIZE - 1);
+   c->response[BUFFER_SIZE - 1] = '\0';
+   reply(c);
+}
+
+void UringListener::drain()
+{
+   if (draining)
+      return;
+   draining = true;
+   if (accepting)
+   {
+      struct io_uring_sqe * sqe = getSqe();
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = ACCEPTED;
+      sqe->user_data = 0;
+   }
+   submit();
+}
+
+bool UringListener::drained()
+{
+   return draining && !accepting && connections == 0;
+}
+
+#else
+
+UringListener * UringListener::create(int listener, TcpFrontend::Handler handler, TcpFrontend * frontend)
+{
+   DaemonLog::write("UringListener: not built with io_uring support (make IO_URING=1)\n");
+   return NULL;
+}
+
+UringListener::~UringListener() {}
+int UringListener::getFd() { return -1; }
+void UringListener::service() {}
+void UringListener::complete(unsigned long long ticket, const char * response) {}
+void UringListener::drain() {}
+bool UringListener::drained() { return true; }
+int UringListener::getConnections() { return 0; }
+unsigned long UringListener::getEnters() { return 0; }
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef URING_LISTENER_H
+#define URING_LISTENER_H
+
+#include "RingQueue.h"
+#include "TcpFrontend.h"
+#include "RSA_Sign_Verify.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/*
+ * Class Name  : UringListener
+ *
+ * Description : Serves the one-shot requests on SOCKET_PATH through an
+ *              io_uring instead of a syscall per step (IO_ENGINE io_uring).
+ *              Only built with HAVE_IO_URING (make IO_URING=1); otherwise,
+ *              or if the kernel lacks what it needs (Linux 5.19 or later),
+ *              create() fails and the daemon keeps its poll() loop.
+ *
+ *              One multishot accept delivers every connection.  Each one
+ *              gets a receive that takes whichever buffer is free from a
+ *              group provided to the kernel, with a linked timeout.  Its
+ *              reply, made at once or when the handler completes it, is a
+ *              send hard-linked to a close.  Everything
+ *              queued while a batch of completions is handled goes to the
+ *              kernel in one io_uring_enter().  Replies are the same as the
+ *              poll() loop's, and a connection whose first byte is
+ *              CookieProtocol::MAGIC is handed to the TcpFrontend.  A
+ *              closed connection is kept for the next accept to reuse.
+ *
+ *              The ring's fd polls readable when completions are waiting,
+ *              so the daemon watches it alongside its other sockets.
+ *
+ * Method Index: static UringListener * create(int listener,
+ *                  TcpFrontend::Handler handler, TcpFrontend * frontend) -
+ *                  starts accepting on listener.  handler answers each
+ *                  request; frontend adopts binary clients.  NULL (reason
+ *                  logged) if io_uring is unavailable.
+ *               int getFd() - the ring, for poll()
+ *               void service() - handles every completion and submits
+ *                  what that queued
+ *               void complete(unsigned long long ticket,
+ *                  const char * response) - replies to a request the
+ *                  handler deferred (ticket is the one it was given)
+ *               void drain() - stops accepting; connections already
+ *                  accepted are still answered
+ *               bool drained() - true once a drain has finished every
+ *                  connection
+ *               int getConnections() - connections accepted but not yet
+ *                  closed
+ *               unsigned long getEnters() - io_uring_enter() calls made
+ *
+ */
+class UringListener
+{
+   public:
+      static UringListener * create(int listener, TcpFrontend::Handler handler, TcpFrontend * frontend);
+      ~UringListener();
+      int getFd();
+      void service();
+      void complete(unsigned long long ticket, const char * response);
+      void drain();
+      bool drained();
+      int getConnections();
+      unsigned long getEnters();
+   private:
+      static const unsigned int QUEUE_DEPTH = 256;
+      static const unsigned int BUFFERS = 256;    /* power of two */
+      static const int BUFFER_SIZE = RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE;
+      static const int READ_TIMEOUT = 5;          /* seconds */
+
+      /* low bits of user_data say which step completed */
+      static const unsigned long long ACCEPTED = 1;
+      static const unsigned long long RECEIVED = 0;
+      static const unsigned long long SENT = 1;
+      static const unsigned long long CLOSED = 2;
+      static const unsigned long long STEP = 3;
+
+      struct Connection
+      {
+         int fd;
+         char response[BUFFER_SIZE];
+         Connection * nextFree;
+      };
+
+      UringListener(int listener, TcpFrontend::Handler handler, TcpFrontend * frontend);
+      bool setup();
+      struct io_uring_sqe * getSqe();
+      void reserve(unsigned int count);
+      void submit();
+      void armAccept();
+      void receive(Connection * c);
+      void reply(Connection * c);
+      void closeConnection(Connection * c);
+      void recycle(unsigned short buffer);
+      void completed(unsigned long long data, int result, unsigned int flags);
+      void received(Connection * c, int result, unsigned int flags);
+
+      int listener;
+      TcpFrontend::Handler handler;
+      TcpFrontend * frontend;
+
+      int ring;
+      void * sqMap;
+      size_t sqMapSize;
+      void * cqMap;
+      size_t cqMapSize;
+      struct io_uring_sqe * sqes;
+      size_t sqesSize;
+      unsigned int * sqHead;
+      unsigned int * sqTail;
+      unsigned int * sqMask;
+      unsigned int * sqArray;
+      unsigned int sqEntries;
+      unsigned int * cqHead;
+      unsigned int * cqTail;
+      unsigned int * cqMask;
+      struct io_uring_cqe * cqes;
+      unsigned int sqeTail;     /* next sqe to fill */
+      unsigned int submitted;   /* sqes handed to the kernel */
+
+      char * buffers;           /* BUFFERS of BUFFER_SIZE, lent to the kernel */
+
+      bool accepting;           /* the multishot accept is armed */
+      bool draining;
+      int connections;
+      RingQueue<Connection *> starved;  /* waiting for a free buffer */
+      Connection * freeConnections;     /* closed, for the next accept */
+      unsigned long enters;
+      long long readTimeout[2]; /* struct __kernel_timespec */
+};
+
+#endif
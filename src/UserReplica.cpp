@@ -0,0 +1,335 @@
+#include "UserReplica.h"
+#include "DaemonLog.h"
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <exception>
+
+/*
+ * Method Name: UserReplica
+ *
+ * Description: Class constructor.  Connects the sync thread's backend and
+ *    starts the thread; the first sync runs immediately.
+ *
+ * Arguments  : CookieDaemonConfig * config - sync intervals and backend
+ *
+ * Returns    : none
+ */
+UserReplica::UserReplica(CookieDaemonConfig * config)
+: backend(NULL), stopping(false), interval(config->getReplicaSyncInterval()),
+  fullInterval(config->getReplicaFullSyncInterval()), usersSince(0), cookiesSince(0),
+  lastSync(0), lastFullSync(0), hits(0), misses(0)
+{
+   backend = CookieBackend::create(config, true);
+
+   pthread_mutex_init(&lock, NULL);
+   pthread_condattr_t attr;
+   pthread_condattr_init(&attr);
+   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+   pthread_cond_init(&wake, &attr);
+   pthread_condattr_destroy(&attr);
+
+   //signals belong to the request loop
+   sigset_t all, old;
+   sigfillset(&all);
+   pthread_sigmask(SIG_BLOCK, &all, &old);
+   pthread_create(&thread, NULL, syncMain, this);
+   pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/*
+ * Method Name: ~UserReplica
+ *
+ * Description: Class destructor.  Stops the sync thread (after any sync in
+ *    progress) and disconnects its backend.  Called from cookieDaemon's
+ *    cleanup(), once the request loop has stopped.
+ *
+ * Arguments  : none
+ *
+ * Returns    : none
+ */
+UserReplica::~UserReplica()
+{
+   pthread_mutex_lock(&lock);
+   stopping = true;
+   pthread_cond_signal(&wake);
+   pthread_mutex_unlock(&lock);
+   pthread_join(thread, NULL);
+   delete backend;
+}
+
+/*
+ * Method Name: check
+ *
+ * Description: decides a cookie from the snapshot if it can.  A locally
+ *                 validated cookie has its soft timestamp refreshed in the
+ *                 snapshot and queued for write-back.
+ *
+ * Arguments  : const char * userID, IP, clientID, cookieVersion - fields of
+ *                 a parsed cookie
+ *
+ * Returns    : int - softLifetime if valid, 0 if invalid, MISS if the
+ *                 database must decide
+ *
+ */
+int UserReplica::check(const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
+{
+   time_t now = time(NULL);
+   int rval = MISS;
+
+   pthread_mutex_lock(&lock);
+
+   if (lastSync != 0 && now - lastSync <= 3 * interval)
+   {
+      std::map<RecordKey, UserRecord>::iterator u = users.find(userID);
+      /* a disabled user or another cookie version may have changed since
+       * our last sync (re-enabled, or a new login); let the database decide */
+      if (u != users.end() && u->second.enabled && strcmp(u->second.cookieVersion, cookieVersion) == 0)
+      {
+         std::map<RecordKey, CookieRecord>::iterator c = cookies.find(cookieKey(userID, IP, clientID));
+         if (c != cookies.end() && strcmp(c->second.cookieVersion, cookieVersion) == 0)
+         {
+            if (now >= c->second.hardTS)
+            {
+               rval = 0;
+            }
+            else if (now < c->second.softTS + c->second.softLifetime)
+            {
+               c->second.softTS = now;
+               touches[c->first] = c->second;
+               rval = c->second.softLifetime;
+            }
+            //else soft-expired here, but another host may have
+            //refreshed it since our last sync; let the database decide
+         }
+      }
+   }
+
+   if (rval == MISS)
+      misses++;
+   else
+      hits++;
+   pthread_mutex_unlock(&lock);
+   return rval;
+}
+
+/*
+ * Method Name: invalidateUser
+ *
+ * Description: drops userID from the snapshot so its cookies are checked
+ *                 against the database until a full sync reloads it.
+ *
+ * Arguments  : const char * userID - user to forget
+ *
+ * Returns    : none
+ *
+ */
+void UserReplica::invalidateUser(const char * userID)
+{
+   pthread_mutex_lock(&lock);
+   users.erase(userID);
+   pthread_mutex_unlock(&lock);
+}
+
+void UserReplica::reconfigure(CookieDaemonConfig * config)
+{
+   pthread_mutex_lock(&lock);
+   if (config->getReplicaSyncInterval() > 0)
+      interval = config->getReplicaSyncInterval();
+   fullInterval = config->getReplicaFullSyncInterval();
+   pthread_mutex_unlock(&lock);
+}
+
+unsigned long UserReplica::getHits() { return hits; }
+unsigned long UserReplica::getMisses() { return misses; }
+
+int UserReplica::getUserCount()
+{
+   pthread_mutex_lock(&lock);
+   int count = (int) users.size();
+   pthread_mutex_unlock(&lock);
+   return count;
+}
+
+int UserReplica::getCookieCount()
+{
+   pthread_mutex_lock(&lock);
+   int count = (int) cookies.size();
+   pthread_mutex_unlock(&lock);
+   return count;
+}
+
+/* seconds since the last successful sync, or -1 if there has been none */
+long UserReplica::getSyncAge()
+{
+   pthread_mutex_lock(&lock);
+   long age = (lastSync == 0) ? -1 : (long) (time(NULL) - lastSync);
+   pthread_mutex_unlock(&lock);
+   return age;
+}
+
+void * UserReplica::syncMain(void * arg)
+{
+   ((UserReplica *) arg)->runSync();
+   return NULL;
+}
+
+/*
+ * Method Name: runSync
+ *
+ * Description: sync thread body.  Each interval, writes back queued soft
+ *                 timestamps and then pulls changes from the backend.
+ *
+ * Arguments  : none
+ *
+ * Returns    : none
+ */
+void UserReplica::runSync()
+{
+   while (1)
+   {
+      flushTouches();
+      time_t now = time(NULL);
+      pthread_mutex_lock(&lock);  //intervals may be reconfigured
+      bool full = lastFullSync == 0 || now - lastFullSync >= fullInterval;
+      pthread_mutex_unlock(&lock);
+      sync(full);
+
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      pthread_mutex_lock(&lock);
+      ts.tv_sec += interval;
+      while (!stopping)
+      {
+         if (pthread_cond_timedwait(&wake, &lock, &ts) != 0)
+            break;
+      }
+      bool done = stopping;
+      pthread_mutex_unlock(&lock);
+      if (done)
+         break;
+   }
+}
+
+/*
+ * Method Name: flushTouches
+ *
+ * Description: writes the soft timestamps of locally validated cookies back
+ *                 to the database.  CHECK_COOKIE is what refreshes them, so
+ *                 each one is re-checked; any the database now rejects are
+ *                 removed from the snapshot.
+ *
+ * Arguments  : none
+ *
+ * Returns    : none
+ */
+void UserReplica::flushTouches()
+{
+   std::map<RecordKey, CookieRecord> pending;
+   pthread_mutex_lock(&lock);
+   pending.swap(touches);
+   pthread_mutex_unlock(&lock);
+
+   for (std::map<RecordKey, CookieRecord>::iterator t = pending.begin(); t != pending.end(); ++t)
+   {
+      int softLifetime;
+      try
+      {
+         softLifetime = backend->checkCookie(t->second.userID, t->second.IP, t->second.clientID, t->second.cookieVersion);
+      }
+      catch (std::exception &e)
+      {
+         DaemonLog::write("UserReplica: soft timestamp write-back failed - %s\n", e.what());
+         return;  //the rest are retried when those cookies are next used
+      }
+      if (softLifetime == 0)
+      {
+         pthread_mutex_lock(&lock);
+         cookies.erase(t->first);
+         pthread_mutex_unlock(&lock);
+      }
+   }
+}
+
+/*
+ * Method Name: sync
+ *
+ * Description: reads users and cookies changed since the last sync (or
+ *                 everything, for a full sync) and merges them into the
+ *                 snapshot.  The backend is read without holding the lock.
+ *
+ * Arguments  : bool full - replace the snapshot instead of merging
+ *
+ * Returns    : bool - true if the backend answered
+ */
+bool UserReplica::sync(bool full)
+{
+   std::vector<UserRecord> changedUsers;
+   std::vector<CookieRecord> changedCookies;
+   time_t started = time(NULL);
+
+   try
+   {
+      if (backend->fetchUsers(full ? -1 : usersSince - SYNC_OVERLAP, changedUsers) != 0
+         || backend->fetchCookies(full ? -1 : cookiesSince - SYNC_OVERLAP, changedCookies) != 0)
+      {
+         DaemonLog::write("UserReplica: backend cannot sync\n");
+         return false;
+      }
+   }
+   catch (std::exception &e)
+   {
+      DaemonLog::write("UserReplica: sync failed - %s\n", e.what());
+      return false;
+   }
+
+   pthread_mutex_lock(&lock);
+   if (full)
+   {
+      users.clear();
+      std::map<RecordKey, CookieRecord> old;
+      old.swap(cookies);
+      //keep soft timestamps refreshed here but not yet written back
+      for (size_t i = 0; i < changedCookies.size(); i++)
+      {
+         CookieRecord &c = changedCookies[i];
+         std::map<RecordKey, CookieRecord>::iterator o = old.find(cookieKey(c.userID, c.IP, c.clientID));
+         if (o != old.end() && o->second.softTS > c.softTS)
+            c.softTS = o->second.softTS;
+      }
+      lastFullSync = started;
+   }
+   for (size_t i = 0; i < changedUsers.size(); i++)
+   {
+      users[changedUsers[i].userID] = changedUsers[i];
+      if (changedUsers[i].modified > usersSince)
+         usersSince = changedUsers[i].modified;
+   }
+   for (size_t i = 0; i < changedCookies.size(); i++)
+   {
+      CookieRecord &c = changedCookies[i];
+      RecordKey key = cookieKey(c.userID, c.IP, c.clientID);
+      std::map<RecordKey, CookieRecord>::iterator o = cookies.find(key);
+      if (o != cookies.end() && o->second.softTS > c.softTS)
+         c.softTS = o->second.softTS;
+      cookies[key] = c;
+      if (c.modified > cookiesSince)
+         cookiesSince = c.modified;
+   }
+   //expired cookies are not re-read, so drop them here
+   for (std::map<RecordKey, CookieRecord>::iterator c = cookies.begin(); c != cookies.end(); )
+   {
+      if (c->second.hardTS <= started)
+         cookies.erase(c++);
+      else
+         ++c;
+   }
+   lastSync = started;
+   pthread_mutex_unlock(&lock);
+   return true;
+}
+
+RecordKey UserReplica::cookieKey(const char * userID, const char * IP, const char * clientID)
+{
+   return RecordKey(userID, IP, clientID);
+}
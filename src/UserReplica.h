@@ -0,0 +1,99 @@
+#ifndef USER_REPLICA_H
+#define USER_REPLICA_H
+
+#include <map>
+#include <string>
+#include <pthread.h>
+#include <time.h>
+#include "CookieBackend.h"
+#include "CookieDaemonConfig.h"
+
+/*
+ * Class Name  : UserReplica
+ *
+ * Description : In-memory snapshot of IGSPnet users (userID -> enabled,
+ *              active cookie version, dukey) and unexpired cookies, so
+ *              cookieDaemon can decide most checks without a database round
+ *              trip.  A background thread with its own backend connection
+ *              syncs every REPLICA_SYNC_INTERVAL seconds, reading only rows
+ *              modified since the previous sync, and does a full re-read
+ *              every REPLICA_FULL_SYNC_INTERVAL seconds to drop deleted rows.
+ *
+ *              Locally a cookie is only found valid or hard-expired.  A
+ *              disabled user or another cookie version may have changed
+ *              since the last sync (re-enabled, or a new login), so those
+ *              are a MISS and go to the database, as does anything the
+ *              snapshot does not know or whose soft timestamp may have been
+ *              refreshed elsewhere.  If syncing has failed for three
+ *              intervals every check is a MISS.
+ *
+ *              Cookies validated locally still need their soft timestamp
+ *              refreshed in the database.  Those writes are queued and
+ *              flushed by the sync thread (via CHECK_COOKIE, which refreshes
+ *              the timestamp) once per interval; a cookie the database then
+ *              rejects is dropped from the snapshot.
+ *
+ * Method Index: UserReplica(CookieDaemonConfig * config) - constructor;
+ *                  starts the sync thread.  Throws like
+ *                  CookieBackend::create().
+ *               ~UserReplica() - stops the sync thread
+ *               int check(const char * userID, const char * IP,
+ *                  const char * clientID, const char * cookieVersion) -
+ *                  softLifetime if the cookie is valid, 0 if it is not, or
+ *                  MISS if the snapshot cannot tell.
+ *               void invalidateUser(const char * userID) - forgets userID
+ *                  so its checks go to the database until the next full
+ *                  sync.
+ *               void reconfigure(CookieDaemonConfig * config) - takes new
+ *                  sync intervals from a reloaded config, from the next
+ *                  sync on
+ *               getHits(), getMisses(), getUserCount(), getCookieCount(),
+ *                  getSyncAge() - figures for the daemon's metrics
+ *
+ */
+class UserReplica
+{
+   public:
+      static const int MISS = -1;
+
+      UserReplica(CookieDaemonConfig * config);
+      ~UserReplica();
+      int check(const char * userID, const char * IP, const char * clientID, const char * cookieVersion);
+      void invalidateUser(const char * userID);
+      void reconfigure(CookieDaemonConfig * config);
+      unsigned long getHits();
+      unsigned long getMisses();
+      int getUserCount();
+      int getCookieCount();
+      long getSyncAge();
+   private:
+      /* rows modified this close to the last sync are read again, in case
+       * their transaction committed after we read */
+      static const int SYNC_OVERLAP = 5;
+
+      static void * syncMain(void * arg);
+      void runSync();
+      void flushTouches();
+      bool sync(bool full);
+      static RecordKey cookieKey(const char * userID, const char * IP, const char * clientID);
+
+      CookieBackend * backend;
+      pthread_t thread;
+      pthread_mutex_t lock;
+      pthread_cond_t wake;
+      bool stopping;
+      int interval;
+      int fullInterval;
+
+      std::map<RecordKey, UserRecord> users;
+      std::map<RecordKey, CookieRecord> cookies;   /* key userID|IP|clientID */
+      std::map<RecordKey, CookieRecord> touches;   /* soft timestamps to write back */
+      long long usersSince;
+      long long cookiesSince;
+      time_t lastSync;
+      time_t lastFullSync;
+      unsigned long hits;
+      unsigned long misses;
+};
+
+#endif
@@ -0,0 +1,646 @@
+#include "VerificationCache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <new>
+
+/* FNV-1a over a string, continuing from h */
+static unsigned long long fnv(unsigned long long h, const char * s)
+{
+   while (*s != '\0')
+   {
+      h ^= (unsigned char) *s++;
+      h *= 1099511628211ULL;
+   }
+   h ^= 0xff;  //field separator, so "ab"+"c" != "a"+"bc"
+   h *= 1099511628211ULL;
+   return h;
+}
+
+/*
+ * Method Name: VerificationCache
+ *
+ * Description: Class constructor.  Maps CACHE_CAPACITY slots (rounded up to
+ *    a power of two) from CACHE_SHM_PATH, or anonymous memory if that is not
+ *    set or cannot be used.
+ *
+ * Arguments  : CookieDaemonConfig * config - CACHE_CAPACITY, CACHE_TTL,
+ *                 CACHE_STALE_GRACE and CACHE_SHM_PATH
+ *              bool shareWithChildren - keep an anonymous table shared with
+ *                 processes forked after this
+ *
+ * Returns    : none.  Throws std::bad_alloc if no memory can be mapped.
+ */
+VerificationCache::VerificationCache(CookieDaemonConfig * config, bool shareWithChildren)
+: header(NULL), entries(NULL), mask(0), mapped(0), ttl(config->getCacheTTL()),
+  grace(config->getCacheStaleGrace()), timers(NULL), expiry(NULL), hits(0), misses(0),
+  reclaimed(0)
+{
+   unsigned int capacity = PROBE_WINDOW;
+   while (capacity < (unsigned int) config->getCacheCapacity())
+      capacity <<= 1;
+   mask = capacity - 1;
+
+   std::string path = config->getCacheShmPath();
+   if (path.length() == 0 || !mapFile(path.c_str(), capacity, config->getCacheShmMode()))
+      mapAnonymous(capacity, shareWithChildren);
+   entries = (Entry *) (header + 1);
+}
+
+/* for attach() */
+VerificationCache::VerificationCache()
+: header(NULL), entries(NULL), mask(0), mapped(0), ttl(0), grace(0), timers(NULL), expiry(NULL),
+  hits(0), misses(0), reclaimed(0)
+{
+}
+
+VerificationCache::~VerificationCache()
+{
+   if (expiry != NULL)
+   {
+      for (unsigned int slot = 0; slot <= mask; slot++)
+         timers->cancel(&expiry[slot]);
+      delete[] expiry;
+   }
+   munmap(header, mapped);
+}
+
+/*
+ * Method Name: attach
+ *
+ * Description: maps a cache file written by cookieDaemon, read-only.  Only
+ *                 lookup() and the counters may be used on the result.
+ *
+ * Arguments  : const char * path - the daemon's CACHE_SHM_PATH
+ *
+ * Returns    : VerificationCache * - caller deletes; NULL if the file is
+ *                 missing, unreadable or not a cache this code understands
+ */
+VerificationCache * VerificationCache::attach(const char * path)
+{
+   int fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return NULL;
+
+   struct stat st;
+   void * p = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(Header))
+      p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (p == MAP_FAILED)
+      return NULL;
+
+   Header * h = (Header *) p;
+   if (h->magic != MAGIC || h->entrySize != sizeof(Entry) || (h->capacity & (h->capacity - 1)) != 0
+      || (off_t) mappingSize(h->capacity) != st.st_size)
+   {
+      munmap(p, st.st_size);
+      return NULL;
+   }
+
+   VerificationCache * cache = new VerificationCache();
+   cache->header = h;
+   cache->entries = (Entry *) (h + 1);
+   cache->mask = h->capacity - 1;
+   cache->mapped = st.st_size;
+   return cache;
+}
+
+/*
+ * Method Name: lookup
+ *
+ * Description: finds a cached result for the cookie tuple.  Expired entries
+ *                 and entries from an older user or global epoch are misses.
+ *
+ * Arguments  : const char * userID, IP, clientID, cookieVersion - fields of
+ *                 a parsed cookie
+ *              time_t now - current time
+ *              int minRemaining - seconds the entry must still have to live
+ *              int * remaining - if not NULL, receives the seconds a hit
+ *                 has left to live
+ *
+ * Returns    : int - cached softLifetime, or MISS
+ *
+ */
+int VerificationCache::lookup(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, time_t now, int minRemaining, int * remaining)
+{
+   Entry copy;
+   if (findSlot(hashCookie(userID, IP, clientID, cookieVersion), userID, IP, clientID, cookieVersion, copy) < 0
+      || copy.expires - now <= minRemaining || copy.globalEpoch != header->globalEpoch
+      || copy.userEpoch != header->userEpochs[userSlot(userID)])
+   {
+      misses++;
+      return MISS;
+   }
+   hits++;
+   if (remaining != NULL)
+      *remaining = (int) (copy.expires - now);
+   return copy.softLifetime;
+}
+
+/*
+ * Method Name: lookupStale
+ *
+ * Description: finds a result for the cookie tuple that is still current
+ *                 or expired no more than CACHE_STALE_GRACE seconds ago, for
+ *                 when the database cannot be asked.  Entries from an older
+ *                 user or global epoch are still misses: an invalidation is
+ *                 never undone by an outage.  Not counted as a hit or miss.
+ *
+ * Arguments  : const char * userID, IP, clientID, cookieVersion - fields of
+ *                 a parsed cookie
+ *              time_t now - current time
+ *
+ * Returns    : int - cached softLifetime, or MISS
+ *
+ */
+int VerificationCache::lookupStale(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, time_t now)
+{
+   Entry copy;
+   if (findSlot(hashCookie(userID, IP, clientID, cookieVersion), userID, IP, clientID, cookieVersion, copy) < 0
+      || copy.expires + grace <= now || copy.globalEpoch != header->globalEpoch
+      || copy.userEpoch != header->userEpochs[userSlot(userID)])
+      return MISS;
+   return copy.softLifetime;
+}
+
+unsigned long long VerificationCache::stamp(const char * userID)
+{
+   return ((unsigned long long) header->globalEpoch << 32) | header->userEpochs[userSlot(userID)];
+}
+
+/*
+ * Method Name: insert
+ *
+ * Description: caches a valid cookie.  Reuses the tuple's slot if present,
+ *                 otherwise the first empty slot in the probe window, otherwise
+ *                 the slot closest to expiry.  Nothing is cached if the user
+ *                 or the whole cache was invalidated since stamp was taken, or
+ *                 if another process is writing the chosen slot.
+ *
+ * Arguments  : const char * userID, IP, clientID, cookieVersion - fields of
+ *                 a parsed cookie
+ *              int softLifetime - result of checkCookie; must be > 0
+ *              unsigned long long stamp - from stamp(), taken before the
+ *                 result was computed
+ *              time_t now - current time
+ *
+ * Returns    : none
+ *
+ */
+void VerificationCache::insert(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, int softLifetime, unsigned long long stamp, time_t now)
+{
+   if (stamp != this->stamp(userID))
+      return;  //invalidated while the result was being computed
+
+   int lifetime = ttl;
+   if (softLifetime / 2 < lifetime)
+      lifetime = softLifetime / 2;
+   if (lifetime <= 0)
+      return;
+   store(userID, IP, clientID, cookieVersion, softLifetime, stamp, now + lifetime, now);
+}
+
+/* writes an entry expiring at expires; see insert() */
+void VerificationCache::store(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, int softLifetime, unsigned long long stamp, time_t expires, time_t now)
+{
+   unsigned long long hash = hashCookie(userID, IP, clientID, cookieVersion);
+   Entry copy;
+   int slot = findSlot(hash, userID, IP, clientID, cookieVersion, copy);
+   if (slot < 0)
+   {
+      time_t oldest = 0;
+      for (int i = 0; i < PROBE_WINDOW; i++)
+      {
+         unsigned int candidate = (hash + i) & mask;
+         if (!readSlot(candidate, copy))
+            continue;  //being written
+         if (copy.hash == 0 || copy.expires + grace <= now)
+         {
+            slot = candidate;
+            break;
+         }
+         if (slot < 0 || copy.expires < oldest)
+         {
+            slot = candidate;
+            oldest = copy.expires;
+         }
+      }
+      if (slot < 0)
+         return;
+   }
+
+   Entry * e = lockSlot(slot);
+   if (e == NULL)
+      return;
+   e->hash = hash;
+   strcpy(e->userID, userID);
+   strcpy(e->IP, IP);
+   strcpy(e->clientID, clientID);
+   strcpy(e->cookieVersion, cookieVersion);
+   e->softLifetime = softLifetime;
+   e->userEpoch = (unsigned int) stamp;
+   e->globalEpoch = (unsigned int) (stamp >> 32);
+   e->expires = expires;
+   unlockSlot(e);
+   if (timers != NULL)
+      timers->schedule(&expiry[slot], (expires + grace - now) * 1000LL);
+}
+
+/* counters may be shared with other processes, so bump them atomically */
+void VerificationCache::invalidateUser(const char * userID)
+{
+   __sync_fetch_and_add(&header->userEpochs[userSlot(userID)], 1);
+   header->userInvalidated[userSlot(userID)] = time(NULL);
+}
+
+/* clears every slot holding the tuple; two processes inserting it at once
+ * can leave it in two */
+void VerificationCache::invalidateCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
+{
+   unsigned long long hash = hashCookie(userID, IP, clientID, cookieVersion);
+   Entry copy;
+   header->userInvalidated[userSlot(userID)] = time(NULL);
+   for (int i = 0; i < PROBE_WINDOW; i++)
+   {
+      unsigned int slot = (hash + i) & mask;
+      if (!readSlot(slot, copy) || !matches(copy, hash, userID, IP, clientID, cookieVersion))
+         continue;
+      Entry * e = lockSlot(slot);
+      if (e == NULL)
+      {
+         invalidateUser(userID);  //can't clear it, so outdate it
+         continue;
+      }
+      e->hash = 0;
+      unlockSlot(e);
+   }
+}
+
+/* lets cookieDaemon keep a just-invalidated user off a lagging read
+ * replica, which could otherwise put back what was dropped */
+time_t VerificationCache::invalidatedAt(const char * userID)
+{
+   return header->userInvalidated[userSlot(userID)];
+}
+
+void VerificationCache::flush()
+{
+   __sync_fetch_and_add(&header->globalEpoch, 1);
+}
+
+/*
+ * Method Name: saveSnapshot
+ *
+ * Description: writes the live entries to a file that loadSnapshot() can
+ *                 read after a restart.  The file is written beside path and
+ *                 renamed over it, so a crash mid-write leaves the previous
+ *                 snapshot.
+ *
+ * Arguments  : const char * path - snapshot file
+ *              time_t now - current time; expired entries are left out
+ *
+ * Returns    : int - number of entries written, or -1 on error
+ */
+int VerificationCache::saveSnapshot(const char * path, time_t now)
+{
+   char tmp[PATH_MAX];
+   if (snprintf(tmp, sizeof (tmp), "%s.tmp", path) >= (int) sizeof (tmp))
+      return -1;
+   int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+   if (fd < 0)
+      return -1;
+
+   SnapshotHeader sh;
+   memset(&sh, 0, sizeof (sh));
+   sh.magic = SNAPSHOT_MAGIC;
+   sh.recordSize = sizeof (SnapshotRecord);
+   sh.written = now;
+   bool ok = write(fd, &sh, sizeof (sh)) == (ssize_t) sizeof (sh);
+
+   SnapshotRecord batch[256];
+   int batched = 0;
+   Entry copy;
+   for (unsigned int slot = 0; ok && slot <= mask; slot++)
+   {
+      if (!readSlot(slot, copy) || copy.hash == 0 || copy.expires <= now
+         || copy.globalEpoch != header->globalEpoch
+         || copy.userEpoch != header->userEpochs[userSlot(copy.userID)])
+         continue;
+      SnapshotRecord &r = batch[batched++];
+      memset(&r, 0, sizeof (r));
+      strcpy(r.userID, copy.userID);
+      strcpy(r.IP, copy.IP);
+      strcpy(r.clientID, copy.clientID);
+      strcpy(r.cookieVersion, copy.cookieVersion);
+      r.softLifetime = copy.softLifetime;
+      r.expires = copy.expires;
+      sh.count++;
+      if (batched == 256)
+      {
+         ok = write(fd, batch, sizeof (SnapshotRecord) * batched) == (ssize_t) (sizeof (SnapshotRecord) * batched);
+         batched = 0;
+      }
+   }
+   if (ok && batched > 0)
+      ok = write(fd, batch, sizeof (SnapshotRecord) * batched) == (ssize_t) (sizeof (SnapshotRecord) * batched);
+
+   //the count goes in last, so a short file never validates
+   ok = ok && pwrite(fd, &sh, sizeof (sh), 0) == (ssize_t) sizeof (sh) && fsync(fd) == 0;
+   if (close(fd) != 0 || !ok || rename(tmp, path) != 0)
+   {
+      unlink(tmp);
+      return -1;
+   }
+   return (int) sh.count;
+}
+
+/*
+ * Method Name: loadSnapshot
+ *
+ * Description: maps a file from saveSnapshot() and re-inserts its entries
+ *                 that have not expired, keeping their expiry times.  A file
+ *                 that is short, truncated or from another layout is
+ *                 ignored.
+ *
+ * Arguments  : const char * path - snapshot file
+ *              time_t now - current time
+ *
+ * Returns    : int - number of entries loaded, or -1 if there was no usable
+ *                 snapshot
+ */
+int VerificationCache::loadSnapshot(const char * path, time_t now)
+{
+   int fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return -1;
+   struct stat st;
+   void * p = MAP_FAILED;
+   if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof (SnapshotHeader))
+      p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (p == MAP_FAILED)
+      return -1;
+
+   const SnapshotHeader * sh = (const SnapshotHeader *) p;
+   if (sh->magic != SNAPSHOT_MAGIC || sh->recordSize != sizeof (SnapshotRecord)
+      || st.st_size != (off_t) (sizeof (SnapshotHeader) + (off_t) sh->count * sizeof (SnapshotRecord)))
+   {
+      munmap(p, st.st_size);
+      return -1;
+   }
+
+   const SnapshotRecord * records = (const SnapshotRecord *) (sh + 1);
+   int loaded = 0;
+   for (unsigned int i = 0; i < sh->count; i++)
+   {
+      const SnapshotRecord &r = records[i];
+      //trust nothing: the fields must be terminated strings
+      if (r.expires <= now || r.softLifetime <= 0
+         || memchr(r.userID, '\0', sizeof (r.userID)) == NULL || memchr(r.IP, '\0', sizeof (r.IP)) == NULL
+         || memchr(r.clientID, '\0', sizeof (r.clientID)) == NULL
+         || memchr(r.cookieVersion, '\0', sizeof (r.cookieVersion)) == NULL)
+         continue;
+      time_t expires = r.expires;
+      if (expires > now + ttl)
+         expires = now + ttl;  //CACHE_TTL may have been lowered since
+      store(r.userID, r.IP, r.clientID, r.cookieVersion, r.softLifetime, stamp(r.userID), expires, now);
+      loaded++;
+   }
+   munmap(p, st.st_size);
+   return loaded;
+}
+
+void VerificationCache::setTTL(int ttl) { this->ttl = ttl; }
+void VerificationCache::setStaleGrace(int grace) { this->grace = grace; }
+unsigned long VerificationCache::getHits() { return hits; }
+unsigned long VerificationCache::getMisses() { return misses; }
+unsigned long VerificationCache::getReclaimed() { return reclaimed; }
+
+/*
+ * Method Name: setTimers
+ *
+ * Description: arms a timer on timers for every entry stored from now on,
+ *                 which clears the entry's slot once it has expired and its
+ *                 CACHE_STALE_GRACE has run out.  Costs a TimerWheel::Timer
+ *                 per slot in this process.
+ *
+ * Arguments  : TimerWheel * timers - driven by this process's loop; must
+ *                 outlive the cache
+ *
+ * Returns    : none
+ */
+void VerificationCache::setTimers(TimerWheel * timers)
+{
+   if (expiry != NULL)
+      return;
+   this->timers = timers;
+   expiry = new TimerWheel::Timer[mask + 1];
+   for (unsigned int slot = 0; slot <= mask; slot++)
+   {
+      expiry[slot].callback = reclaimExpired;
+      expiry[slot].context = this;
+   }
+}
+
+void VerificationCache::reclaimExpired(TimerWheel::Timer * timer)
+{
+   VerificationCache * cache = (VerificationCache *) timer->context;
+   cache->reclaim(timer - cache->expiry, time(NULL));
+}
+
+/* empties a slot whose entry is past its grace.  A slot rewritten since
+ * its timer was armed, here or by another process, is left alone. */
+void VerificationCache::reclaim(unsigned int slot, time_t now)
+{
+   Entry * e = lockSlot(slot);
+   if (e == NULL)
+   {
+      timers->schedule(&expiry[slot], 1000);  //being written; look again
+      return;
+   }
+   if (e->hash != 0 && e->expires + grace <= now)
+   {
+      e->hash = 0;
+      reclaimed++;
+   }
+   unlockSlot(e);
+}
+
+/*
+ * Method Name: readSlot
+ *
+ * Description: copies a slot without locking it
+ *
+ * Arguments  : unsigned int slot - index into entries
+ *              Entry &copy - receives the slot's contents
+ *
+ * Returns    : bool - false if the slot was being written, in which case
+ *                 copy is garbage
+ */
+bool VerificationCache::readSlot(unsigned int slot, Entry &copy)
+{
+   Entry * e = &entries[slot];
+   unsigned int before = e->seq;
+   if (before & 1)
+      return false;
+   __sync_synchronize();
+   memcpy(&copy, (const void *) e, sizeof(Entry));
+   __sync_synchronize();
+   return e->seq == before;
+}
+
+/* claims a slot for writing, or returns NULL if someone else has it.  A
+ * process that dies while holding a slot leaves that one slot unusable. */
+VerificationCache::Entry * VerificationCache::lockSlot(unsigned int slot)
+{
+   Entry * e = &entries[slot];
+   unsigned int seq = e->seq;
+   if ((seq & 1) || !__sync_bool_compare_and_swap(&e->seq, seq, seq + 1))
+      return NULL;
+   return e;
+}
+
+void VerificationCache::unlockSlot(Entry * e)
+{
+   __sync_fetch_and_add(&e->seq, 1);  //full barrier, so the fields land first
+}
+
+/* index of a slot holding exactly this tuple (copied into copy), or -1 */
+int VerificationCache::findSlot(unsigned long long hash, const char * userID, const char * IP, const char * clientID, const char * cookieVersion, Entry &copy)
+{
+   for (int i = 0; i < PROBE_WINDOW; i++)
+   {
+      unsigned int slot = (hash + i) & mask;
+      if (readSlot(slot, copy) && matches(copy, hash, userID, IP, clientID, cookieVersion))
+         return slot;
+   }
+   return -1;
+}
+
+bool VerificationCache::matches(const Entry &e, unsigned long long hash, const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
+{
+   return e.hash == hash && strcmp(e.userID, userID) == 0 && strcmp(e.IP, IP) == 0
+      && strcmp(e.clientID, clientID) == 0 && strcmp(e.cookieVersion, cookieVersion) == 0;
+}
+
+/*
+ * Method Name: mapFile
+ *
+ * Description: maps the table from a file shared with other processes,
+ *                 setting the file up if it is new.  A file with another
+ *                 layout or capacity is replaced; processes still using it
+ *                 keep their copy until they exit.
+ *
+ * Arguments  : const char * path - file to map, normally under /dev/shm
+ *              unsigned int capacity - number of slots
+ *              mode_t mode - permissions for the file
+ *
+ * Returns    : bool - true if mapped; errors are logged
+ */
+bool VerificationCache::mapFile(const char * path, unsigned int capacity, mode_t mode)
+{
+   size_t size = mappingSize(capacity);
+   for (int attempt = 0; attempt < 3; attempt++)
+   {
+      int fd = open(path, O_RDWR | O_CREAT, mode);
+      if (fd < 0)
+      {
+         fprintf(stderr, "VerificationCache(): Cannot open %s - %s\n", path, strerror(errno));
+         return false;
+      }
+      flock(fd, LOCK_EX);  //one process sets the file up at a time
+      fchmod(fd, mode);  //despite umask, and for files made by older settings
+
+      struct stat st, current;
+      if (fstat(fd, &st) != 0 || stat(path, &current) != 0 || st.st_ino != current.st_ino)
+      {
+         close(fd);  //replaced while we waited for the lock
+         continue;
+      }
+      if (st.st_size != 0 && st.st_size != (off_t) size)
+      {
+         unlink(path);
+         close(fd);
+         continue;
+      }
+      if (st.st_size == 0 && ftruncate(fd, size) != 0)
+      {
+         fprintf(stderr, "VerificationCache(): Cannot size %s - %s\n", path, strerror(errno));
+         close(fd);
+         return false;
+      }
+
+      void * p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED)
+      {
+         fprintf(stderr, "VerificationCache(): Cannot map %s - %s\n", path, strerror(errno));
+         close(fd);
+         return false;
+      }
+      Header * h = (Header *) p;
+      if (h->magic != MAGIC || h->capacity != capacity || h->entrySize != sizeof(Entry))
+      {
+         if (h->magic != 0)
+         {
+            munmap(p, size);
+            unlink(path);
+            close(fd);
+            continue;
+         }
+         h->capacity = capacity;  //new file; ftruncate zeroed the rest
+         h->entrySize = sizeof(Entry);
+         h->globalEpoch = 1;
+         __sync_synchronize();
+         h->magic = MAGIC;
+      }
+      flock(fd, LOCK_UN);  //explicitly: the mapping keeps the file open
+      close(fd);
+      header = h;
+      mapped = size;
+      return true;
+   }
+   fprintf(stderr, "VerificationCache(): Cannot set up %s\n", path);
+   return false;
+}
+
+void VerificationCache::mapAnonymous(unsigned int capacity, bool shared)
+{
+   size_t size = mappingSize(capacity);
+   void * p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+      (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS, -1, 0);
+   if (p == MAP_FAILED)
+      throw std::bad_alloc();
+   header = (Header *) p;  //already zeroed
+   header->magic = MAGIC;
+   header->capacity = capacity;
+   header->entrySize = sizeof(Entry);
+   header->globalEpoch = 1;
+   mapped = size;
+}
+
+size_t VerificationCache::mappingSize(unsigned int capacity)
+{
+   return sizeof(Header) + sizeof(Entry) * capacity;
+}
+
+unsigned long long VerificationCache::hashCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
+{
+   unsigned long long h = 14695981039346656037ULL;
+   h = fnv(h, userID);
+   h = fnv(h, IP);
+   h = fnv(h, clientID);
+   h = fnv(h, cookieVersion);
+   return h == 0 ? 1 : h;  //0 marks an empty slot
+}
+
+unsigned int VerificationCache::userSlot(const char * userID)
+{
+   return (unsigned int) fnv(14695981039346656037ULL, userID) & (USER_EPOCHS - 1);
+}
@@ -0,0 +1,207 @@
+#ifndef VERIFICATION_CACHE_H
+#define VERIFICATION_CACHE_H
+
+#include <time.h>
+#include <sys/types.h>
+#include "CookieDaemonConfig.h"
+#include "TimerWheel.h"
+
+/*
+ * Class Name  : VerificationCache
+ *
+ * Description : Fixed-capacity cache of recent positive checkCookie results,
+ *              keyed by the cookie tuple (userID, IP, clientID,
+ *              cookieVersion).  Entries live for CACHE_TTL seconds, or half
+ *              the cookie's soft lifetime if that is shorter, so the
+ *              database's soft timestamp never lags far behind real use.
+ *
+ *              The table is open-addressed with a short probe window and
+ *              never grows; inserting into a full window replaces the entry
+ *              closest to expiry.  An expired entry is kept for
+ *              CACHE_STALE_GRACE seconds, while room allows, so the daemon
+ *              can fall back on it while the database is down.
+ *
+ *              Given a TimerWheel, the cache arms a timer for each entry
+ *              this process stores and clears the slot when it fires, so
+ *              expired entries give their slots back without any sweep of
+ *              the table.  lookup() still compares the expiry itself: a
+ *              timer may be a tick late, and entries stored by other
+ *              processes sharing the table are reclaimed by their timers.
+ *
+ *              Invalidation is O(1).  Every entry records the epoch of its
+ *              user (from a fixed table of per-user epoch counters indexed
+ *              by a hash of userID) and the global epoch when it was stored;
+ *              a lookup whose epochs no longer match is a miss.  Bumping a
+ *              user's counter invalidates all of that user's cookies (and, on
+ *              a hash collision, some innocent user's, which only costs a
+ *              database round trip).  Bumping the global epoch flushes
+ *              everything.
+ *
+ *              The table and counters are one mapping, which may be shared:
+ *              with CACHE_SHM_PATH set it is a file (normally in /dev/shm)
+ *              mapped by every daemon process on the host, and a cache
+ *              built before the pre-fork master forks is shared by its
+ *              workers.  A result verified by any process then serves all
+ *              of them, and an invalidation sent to any one applies
+ *              everywhere.  Each slot is guarded by a sequence lock: a
+ *              reader treats a slot that changed while it was copied as a
+ *              miss, and a writer that finds a slot already being written
+ *              skips its insert.  Nobody ever waits.
+ *
+ *              Clients may attach() the file read-only and answer repeat
+ *              cookies without a round trip to the daemon; CACHE_SHM_MODE
+ *              decides who can.
+ *
+ * Method Index: VerificationCache(CookieDaemonConfig * config,
+ *                  bool shareWithChildren) - constructor.  Maps CACHE_SHM_PATH
+ *                  if set; otherwise the table is shared with children
+ *                  forked later if shareWithChildren is true.
+ *               static VerificationCache * attach(const char * path) - maps
+ *                  a daemon's CACHE_SHM_PATH read-only, for lookup() only.
+ *                  NULL if there is no usable cache there.
+ *               int lookup(const char * userID, const char * IP,
+ *                  const char * clientID, const char * cookieVersion,
+ *                  time_t now, int minRemaining, int * remaining) - cached
+ *                  softLifetime, or MISS if there is none with more than
+ *                  minRemaining seconds to live.  remaining, if not NULL,
+ *                  receives the seconds a hit has left.
+ *               int lookupStale(const char * userID, const char * IP,
+ *                  const char * clientID, const char * cookieVersion,
+ *                  time_t now) - as lookup(), but also finds an entry that
+ *                  expired no more than CACHE_STALE_GRACE seconds ago
+ *               unsigned long long stamp(const char * userID) - the epochs
+ *                  an entry for userID would be stored under now.  Take it
+ *                  before asking the database and pass it to insert(), so a
+ *                  result that raced with an invalidation is not cached.
+ *               void insert(const char * userID, const char * IP,
+ *                  const char * clientID, const char * cookieVersion,
+ *                  int softLifetime, unsigned long long stamp, time_t now) -
+ *                  caches a valid cookie
+ *               void invalidateUser(const char * userID) - drops every
+ *                  cached cookie of userID
+ *               void invalidateCookie(const char * userID, const char * IP,
+ *                  const char * clientID, const char * cookieVersion) -
+ *                  drops one cookie
+ *               time_t invalidatedAt(const char * userID) - when userID, or
+ *                  one of its cookies, was last invalidated by any process
+ *                  sharing the cache (or another user hashed alongside it);
+ *                  0 if never
+ *               void flush() - drops everything
+ *               int saveSnapshot(const char * path, time_t now) - writes the
+ *                  live entries to a file; returns how many, or -1
+ *               int loadSnapshot(const char * path, time_t now) - re-inserts
+ *                  the unexpired entries from such a file; returns how many,
+ *                  or -1 if there is no usable snapshot
+ *               void setTTL(int ttl) - CACHE_TTL from a reloaded config;
+ *                  applies to entries inserted from now on
+ *               void setStaleGrace(int grace) - CACHE_STALE_GRACE from a
+ *                  reloaded config
+ *               void setTimers(TimerWheel * timers) - reclaims entries
+ *                  this process stores as they expire, on timers
+ *               getHits(), getMisses(), getReclaimed() - counts for this
+ *                  process only
+ *
+ */
+class VerificationCache
+{
+   public:
+      static const int MISS = -1;
+
+      VerificationCache(CookieDaemonConfig * config, bool shareWithChildren = false);
+      ~VerificationCache();
+      static VerificationCache * attach(const char * path);
+      int lookup(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, time_t now, int minRemaining = 0, int * remaining = NULL);
+      int lookupStale(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, time_t now);
+      unsigned long long stamp(const char * userID);
+      void insert(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, int softLifetime, unsigned long long stamp, time_t now);
+      void invalidateUser(const char * userID);
+      void invalidateCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion);
+      time_t invalidatedAt(const char * userID);
+      void flush();
+      int saveSnapshot(const char * path, time_t now);
+      int loadSnapshot(const char * path, time_t now);
+      void setTTL(int ttl);
+      void setStaleGrace(int grace);
+      void setTimers(TimerWheel * timers);
+      unsigned long getHits();
+      unsigned long getMisses();
+      unsigned long getReclaimed();
+   private:
+      static const int PROBE_WINDOW = 8;
+      static const int USER_EPOCHS = 4096;  /* must be a power of two */
+      static const unsigned int MAGIC = 0x434b4332;  /* "CKC2"; change with the layout */
+
+      struct Entry
+      {
+         volatile unsigned int seq;   /* odd while being written */
+         unsigned long long hash;     /* 0 = empty slot */
+         char userID[13];
+         char IP[16];
+         char clientID[5];
+         char cookieVersion[2];
+         int softLifetime;
+         unsigned int userEpoch;
+         unsigned int globalEpoch;
+         time_t expires;
+      };
+
+      /* start of the mapping; the entries follow */
+      struct Header
+      {
+         unsigned int magic;          /* written last when a file is set up */
+         unsigned int capacity;
+         unsigned int entrySize;
+         volatile unsigned int globalEpoch;
+         volatile unsigned int userEpochs[USER_EPOCHS];
+         volatile time_t userInvalidated[USER_EPOCHS];  /* invalidatedAt() */
+      };
+
+      /* snapshot file: a header, then count records */
+      static const unsigned int SNAPSHOT_MAGIC = 0x434b5331;  /* "CKS1" */
+      struct SnapshotHeader
+      {
+         unsigned int magic;
+         unsigned int recordSize;
+         unsigned int count;
+         unsigned int reserved;
+         long long written;
+      };
+      struct SnapshotRecord
+      {
+         char userID[13];
+         char IP[16];
+         char clientID[5];
+         char cookieVersion[2];
+         int softLifetime;
+         long long expires;
+      };
+
+      VerificationCache();
+      void store(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, int softLifetime, unsigned long long stamp, time_t expires, time_t now);
+      bool readSlot(unsigned int slot, Entry &copy);
+      Entry * lockSlot(unsigned int slot);
+      void unlockSlot(Entry * e);
+      int findSlot(unsigned long long hash, const char * userID, const char * IP, const char * clientID, const char * cookieVersion, Entry &copy);
+      bool mapFile(const char * path, unsigned int capacity, mode_t mode);
+      void mapAnonymous(unsigned int capacity, bool shared);
+      static bool matches(const Entry &e, unsigned long long hash, const char * userID, const char * IP, const char * clientID, const char * cookieVersion);
+      static void reclaimExpired(TimerWheel::Timer * timer);
+      void reclaim(unsigned int slot, time_t now);
+      static unsigned long long hashCookie(const char * userID, const char * IP, const char * clientID, const char * cookieVersion);
+      static unsigned int userSlot(const char * userID);
+      static size_t mappingSize(unsigned int capacity);
+
+      Header * header;
+      Entry * entries;
+      unsigned int mask;           /* capacity - 1 */
+      size_t mapped;               /* bytes mapped at header */
+      int ttl;
+      int grace;                   /* CACHE_STALE_GRACE */
+      TimerWheel * timers;         /* NULL unless setTimers() */
+      TimerWheel::Timer * expiry;  /* a timer per slot, with timers */
+      unsigned long hits;
+      unsigned long misses;
+      unsigned long reclaimed;
+};
+
+#endif
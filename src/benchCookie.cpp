@@ -0,0 +1,386 @@
+/* benchCookie.cpp
+ *
+ * Load generator for cookieDaemon.  Sends one cookie over and over from
+ * several client threads for a fixed time and reports throughput and
+ * latency, plus what the daemon spent per request: CPU time for the pids
+ * given with -p, and io_uring_enter calls and, in a daemon built with
+ * COUNT_ALLOCATIONS, heap allocations from its STATS.  Run it once with
+ * IO_ENGINE poll and once with IO_ENGINE io_uring to compare them.
+ *
+ * By default each request is a connection of its own, like verifyCookie's;
+ * with -b each client keeps one connection and keeps that many binary CHECK
+ * requests in flight on it.
+ *
+ * The daemon is found as verifyCookie finds it: SOCKET_PATH, or DAEMON_HOST
+ * and DAEMON_PORT.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "CookieDaemonConfig.h"
+#include "CookieProtocol.h"
+#include "RSA_Sign_Verify.h"
+
+static std::string socketPath;
+static std::string daemonHost;
+static int daemonPort = 0;
+static const char * cookie = NULL;
+static int depth = 0;        /* binary requests in flight per client; 0 = one-shot text */
+static volatile int running = 1;
+
+/* one client thread's results */
+struct ClientResult
+{
+   pthread_t thread;
+   std::vector<long> latencies;   /* microseconds */
+   unsigned long errors;
+   unsigned long busy;
+};
+
+void printUsage(char * programName)
+{
+   fprintf(stderr, "USAGE: %s [-c clients] [-d seconds] [-b depth] [-p pid]... <cookie>\n", programName);
+   fprintf(stderr, "where: clients = concurrent client threads (default 8)\n");
+   fprintf(stderr, "       seconds = length of the run (default 10)\n");
+   fprintf(stderr, "       depth   = binary requests in flight per connection (default 0, one text request per connection)\n");
+   fprintf(stderr, "       pid     = a daemon process whose CPU time to report; repeat for each worker\n");
+   fprintf(stderr, "       cookie  = cookie text, userID::dukey::IP::cookieVersion::clientID\n");
+   exit(FATAL_EXIT);
+}
+
+static long long nowMicros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int connectDaemon()
+{
+   int s = -1;
+
+   if (daemonHost.length() > 0)
+   {
+      struct addrinfo hints;
+      struct addrinfo * found;
+      char service[16];
+
+      bzero(&hints, sizeof (hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      sprintf(service, "%d", daemonPort);
+      if (getaddrinfo(daemonHost.c_str(), service, &hints, &found) != 0)
+         return -1;
+      for (struct addrinfo * a = found; a != NULL && s < 0; a = a->ai_next)
+      {
+         s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+         if (s >= 0 && connect(s, a->ai_addr, a->ai_addrlen) < 0)
+         {
+            close(s);
+            s = -1;
+         }
+      }
+      freeaddrinfo(found);
+      return s;
+   }
+
+   struct sockaddr_un sa;
+   if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+      return -1;
+   bzero(&sa, sizeof (sa));
+   sa.sun_family = AF_UNIX;
+   strncpy(sa.sun_path, socketPath.c_str(), sizeof (sa.sun_path) - 1);
+   if (connect(s, (struct sockaddr *) &sa, sizeof (sa)) < 0)
+   {
+      close(s);
+      return -1;
+   }
+   return s;
+}
+
+/* reads one whole response frame, and its body if body is not NULL; -1 if
+ * the connection failed */
+static int readFrame(int s, std::string &pending, CookieProtocol::Header &header, std::string * body)
+{
+   char buffer[4096];
+   while (1)
+   {
+      const unsigned char * in = (const unsigned char *) pending.data();
+      size_t size = (pending.length() >= CookieProtocol::HEADER_SIZE) ? CookieProtocol::headerSize(in) : CookieProtocol::HEADER_SIZE;
+      if (pending.length() >= size)
+      {
+         if (CookieProtocol::decodeHeader(in, header) != 0)
+            return -1;
+         if (pending.length() >= size + header.length)
+         {
+            if (body != NULL)
+               body->assign(pending, size, header.length);
+            pending.erase(0, size + header.length);
+            return 0;
+         }
+      }
+      ssize_t count = recv(s, buffer, sizeof (buffer), 0);
+      if (count <= 0)
+         return -1;
+      pending.append(buffer, count);
+   }
+}
+
+/* one text request per connection, as verifyCookie sends them */
+static void runOneShot(ClientResult * result)
+{
+   char response[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
+   std::string request(cookie);
+   if (daemonHost.length() > 0)
+      request += '\n';
+
+   while (running)
+   {
+      long long started = nowMicros();
+      int s = connectDaemon();
+      if (s < 0)
+      {
+         result->errors++;
+         continue;
+      }
+      ssize_t count = -1;
+      if (send(s, request.data(), request.length(), MSG_NOSIGNAL) == (ssize_t) request.length())
+         count = recv(s, response, sizeof (response) - 1, 0);
+      close(s);
+      if (count <= 0)
+      {
+         result->errors++;
+         continue;
+      }
+      response[count] = '\0';
+      //a shed text request is answered "0"; the benchmark cookie is valid
+      if (strncmp(response, "0", 1) == 0)
+         result->busy++;
+      result->latencies.push_back((long) (nowMicros() - started));
+   }
+}
+
+/* depth binary CHECKs in flight on one connection; each answer sends the next */
+static void runPipelined(ClientResult * result)
+{
+   int s = connectDaemon();
+   if (s < 0)
+   {
+      result->errors++;
+      return;
+   }
+
+   std::vector<long long> sentAt(depth);
+   std::string frames;
+   for (int i = 0; i < depth; i++)
+   {
+      CookieProtocol::appendFrame(frames, CookieProtocol::CHECK, CookieProtocol::OK, i, cookie, strlen(cookie));
+      sentAt[i] = nowMicros();
+   }
+   if (send(s, frames.data(), frames.length(), MSG_NOSIGNAL) != (ssize_t) frames.length())
+   {
+      result->errors++;
+      close(s);
+      return;
+   }
+
+   std::string pending;
+   CookieProtocol::Header header;
+   while (running)
+   {
+      if (readFrame(s, pending, header, NULL) != 0 || header.id >= (unsigned int) depth)
+      {
+         result->errors++;
+         break;
+      }
+      if (header.status == CookieProtocol::BUSY)
+         result->busy++;
+      else if (header.status != CookieProtocol::OK)
+         result->errors++;
+      result->latencies.push_back((long) (nowMicros() - sentAt[header.id]));
+
+      frames.clear();
+      CookieProtocol::appendFrame(frames, CookieProtocol::CHECK, CookieProtocol::OK, header.id, cookie, strlen(cookie));
+      sentAt[header.id] = nowMicros();
+      if (send(s, frames.data(), frames.length(), MSG_NOSIGNAL) != (ssize_t) frames.length())
+      {
+         result->errors++;
+         break;
+      }
+   }
+   close(s);
+}
+
+static void * clientMain(void * arg)
+{
+   ClientResult * result = (ClientResult *) arg;
+   if (depth > 0)
+      runPipelined(result);
+   else
+      runOneShot(result);
+   return NULL;
+}
+
+/* user plus system CPU time of pid, in microseconds; -1 if unknown */
+static long long cpuMicros(int pid)
+{
+   char path[64];
+   char line[1024];
+   sprintf(path, "/proc/%d/stat", pid);
+   FILE * f = fopen(path, "r");
+   if (f == NULL)
+      return -1;
+   char * got = fgets(line, sizeof (line), f);
+   fclose(f);
+   char * fields = (got == NULL) ? NULL : strrchr(line, ')');  //the name may hold spaces
+   if (fields == NULL)
+      return -1;
+   unsigned long utime, stime;
+   if (sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+      return -1;
+   return (long long) (utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+/* the daemon's STATS text, or "" */
+static std::string daemonStats()
+{
+   int s = connectDaemon();
+   if (s < 0)
+      return "";
+   std::string request;
+   CookieProtocol::appendFrame(request, CookieProtocol::STATS, CookieProtocol::OK, 0, "", 0);
+   std::string pending;
+   std::string stats;
+   CookieProtocol::Header header;
+   if (send(s, request.data(), request.length(), MSG_NOSIGNAL) != (ssize_t) request.length()
+      || readFrame(s, pending, header, &stats) != 0 || header.status != CookieProtocol::OK)
+      stats = "";
+   close(s);
+   return stats;
+}
+
+/* a counter from STATS text, or -1 */
+static long long daemonCounter(const std::string &stats, const char * name)
+{
+   std::string key = std::string("\n") + name + " ";
+   size_t at = ("\n" + stats).find(key);
+   if (at == std::string::npos)
+      return -1;
+   return atoll(stats.c_str() + at + key.length() - 1);
+}
+
+int main(int argc, char * argv[])
+{
+   int clients = 8;
+   int seconds = 10;
+   std::vector<int> pids;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "c:d:b:p:")) != -1)
+   {
+      switch (opt)
+      {
+         case 'c': clients = atoi(optarg); break;
+         case 'd': seconds = atoi(optarg); break;
+         case 'b': depth = atoi(optarg); break;
+         case 'p': pids.push_back(atoi(optarg)); break;
+         default: printUsage(argv[0]);
+      }
+   }
+   if (optind != argc - 1 || clients <= 0 || seconds <= 0 || depth < 0)
+      printUsage(argv[0]);
+   cookie = argv[optind];
+
+   CookieDaemonConfig *config = CookieDaemonConfig::getConfig();
+   if (config == NULL)
+   {
+      fprintf(stderr, "No config found, exiting\n");
+      exit(FATAL_EXIT);
+   }
+   socketPath = config->getSocketPath();
+   daemonHost = config->getDaemonHost();
+   daemonPort = config->getDaemonPort();
+   delete config;
+
+   std::string statsBefore = daemonStats();
+   std::vector<long long> cpuBefore;
+   for (size_t i = 0; i < pids.size(); i++)
+      cpuBefore.push_back(cpuMicros(pids[i]));
+
+   std::vector<ClientResult> results(clients);
+   long long started = nowMicros();
+   for (int i = 0; i < clients; i++)
+   {
+      results[i].errors = 0;
+      results[i].busy = 0;
+      pthread_create(&results[i].thread, NULL, clientMain, &results[i]);
+   }
+   sleep(seconds);
+   running = 0;
+   for (int i = 0; i < clients; i++)
+      pthread_join(results[i].thread, NULL);
+   double elapsed = (nowMicros() - started) / 1e6;
+
+   std::vector<long> latencies;
+   unsigned long errors = 0;
+   unsigned long busy = 0;
+   for (int i = 0; i < clients; i++)
+   {
+      latencies.insert(latencies.end(), results[i].latencies.begin(), results[i].latencies.end());
+      errors += results[i].errors;
+      busy += results[i].busy;
+   }
+   std::sort(latencies.begin(), latencies.end());
+   unsigned long answered = latencies.size();
+
+   printf("requests %lu\n", answered);
+   printf("errors %lu\n", errors);
+   printf("busy %lu\n", busy);
+   printf("requests_per_second %.0f\n", answered / elapsed);
+   if (answered > 0)
+   {
+      printf("latency_p50_us %ld\n", latencies[answered / 2]);
+      printf("latency_p99_us %ld\n", latencies[answered * 99 / 100]);
+      printf("latency_max_us %ld\n", latencies[answered - 1]);
+   }
+
+   long long cpu = 0;
+   for (size_t i = 0; i < pids.size(); i++)
+   {
+      long long after = cpuMicros(pids[i]);
+      if (after < 0 || cpuBefore[i] < 0)
+      {
+         fprintf(stderr, "cannot read CPU time of pid %d\n", pids[i]);
+         cpu = -1;
+         break;
+      }
+      cpu += after - cpuBefore[i];
+   }
+   if (!pids.empty() && cpu >= 0 && answered > 0)
+      printf("daemon_cpu_us_per_request %.2f\n", (double) cpu / answered);
+
+   /* STATS comes from one process, so this is only exact without workers */
+   std::string statsAfter = daemonStats();
+   long long requestsBefore = daemonCounter(statsBefore, "requests");
+   long long requests = daemonCounter(statsAfter, "requests") - requestsBefore;
+   long long enters = daemonCounter(statsAfter, "io_uring_enters") - daemonCounter(statsBefore, "io_uring_enters");
+   long long allocationsBefore = daemonCounter(statsBefore, "allocations");
+   long long allocations = daemonCounter(statsAfter, "allocations") - allocationsBefore;
+   if (requestsBefore >= 0 && requests > 0 && enters > 0)
+      printf("io_uring_enters_per_request %.3f\n", (double) enters / requests);
+   /* includes the allocations of the second STATS itself */
+   if (requestsBefore >= 0 && requests > 0 && allocationsBefore >= 0)
+      printf("daemon_allocations_per_request %.3f\n", (double) allocations / requests);
+   return NORMAL_EXIT;
+}
@@ -5,7 +5,28 @@
  * in IGSPnet.
  *  
  * Runs as a daemon process.  Any errors are logged to stderr; fatal errors
- * exit with -1.  SIGHUP, SIGINT, SIGTERM are trapped and return 0.
+ * exit with -1.  SIGINT, SIGTERM are trapped and return 0.  SIGHUP re-reads
+ * the config file and applies it without dropping the listener, the cache
+ * or database connections.  SIGUSR1 dumps the daemon's counters to stderr.
+ *
+ * With WORKER_PROCESSES set, the process that binds the sockets becomes a
+ * master that forks that many workers, restarts any that die, and relays
+ * signals to them.
+ *
+ * With HANDOFF_SOCKET_PATH set, a daemon started while another is running
+ * takes over its listening sockets instead of binding new ones, and the old
+ * daemon drains and exits once the new one is ready (see SocketHandoff.h).
+ *
+ * With TCP_LISTEN_PORT set, remote web nodes may also send newline-framed
+ * requests over TCP on long-lived connections (see TcpFrontend.h).
+ *
+ * With IO_ENGINE io_uring (and a build with IO_URING=1), requests on
+ * SOCKET_PATH are accepted, read and answered through an io_uring instead
+ * (see UringListener.h).
+ *
+ * On either socket, a client whose first byte is CookieProtocol::MAGIC speaks
+ * the binary protocol instead: length-prefixed frames with request IDs, for
+ * CHECK, VERIFY_SIGNED, SIGN and STATS (see CookieProtocol.h).
  *
  */
  
@@ -16,48 +37,159 @@
 
 /* listener socket must be close-able by signal handler,
  * so must be global */
-int l; //listener socket handle
-OCCI_IGSPnet *db = NULL;  //db handler must be freed on exit
+int l = -1; //listener socket handle
+int a = -1; //admin socket handle; -1 if ADMIN_SOCKET_PATH is not set
+int h = -1; //handoff socket handle; -1 if HANDOFF_SOCKET_PATH is not set
+int t = -1; //TCP listener handle; -1 if TCP_LISTEN_PORT is not set
+TcpFrontend *tcp = NULL; // this process's TCP and binary-protocol connections; NULL in the pre-fork master
+UringListener *uring = NULL; // serves SOCKET_PATH if IO_ENGINE is io_uring; NULL for the poll() loop
+int predecessor = -1; // connection to the daemon whose sockets we took, until we are ready
+pid_t predecessorPid = 0; // and its pid, for the log
+int successor = -1; // connection to a daemon taking our sockets over
+DBPool *db = NULL;  //db connections must be freed on exit
 CookieDaemonConfig *config = NULL; // Shared configuration object. Global to parallel *db
+AdmissionControl *admission = NULL; // rate and concurrency limits, built from config
+ConcurrencyLimiter *dbLimiter = NULL; // adaptive bound on in-flight checkCookie calls
+UserReplica *replica = NULL; // local snapshot of user/cookie state; NULL if disabled
+VerificationCache *cache = NULL; // recent positive results; NULL if disabled
+TimerWheel *timers = NULL; // every deadline the loop keeps: cache expiry, idle connections
+CaptureLog *capture = NULL; // CAPTURE_PATH; NULL if not capturing, and in the pre-fork master
+DaemonMetrics metrics;
+volatile sig_atomic_t metricsRequested = 0;
+volatile sig_atomic_t stopRequested = 0; // SIGINT, SIGTERM
+volatile sig_atomic_t snapshotRequested = 0; // CACHE_SNAPSHOT_INTERVAL alarm
+volatile sig_atomic_t reloadRequested = 0; // SIGHUP
+volatile sig_atomic_t drainRequested = 0; // SIGUSR2; the sockets now belong to a successor
+std::string socketPath; // SOCKET_PATH as bound; a reload cannot move it
+std::string adminSocketPath; // likewise ADMIN_SOCKET_PATH
+std::string handoffSocketPath; // and HANDOFF_SOCKET_PATH
+int workerIndex = -1; // pre-fork worker number; -1 in the master or a single process
+
+/* a worker that dies sooner than this after starting is restarted only
+ * after this many seconds, so a worker that cannot connect does not spin */
+static const int RESPAWN_DELAY = 1;
 
-/* Convenience function to get the socket path from config */
+static long long startedAt = 0;  // monotonicMicros() this process began; a pre-fork worker's, when it was forked
+static int keysLoaded = -1;      // RSA_Sign_Verify::loadKeys(), from the thread that ran it
+
+/* Convenience function to get the socket path from config.  The path is
+ * copied out of the config, which a reload may replace. */
 const char * socket_path() {
   if(config == NULL) {
-    config = CookieDaemonConfig::getConfig();
+    config = CookieDaemonConfig::current();
     if(config == NULL) {
       // No valid config, exit now. This will be encountered before
       // anything that would need cleanup(), so we don't call cleanup()
       // And doing so would recurse infinitely.
-      fprintf(stderr, "socket_path(): No config found, exiting\n");
+      DaemonLog::write("socket_path(): No config found, exiting\n");
       exit (FATAL_EXIT);
     }
+    socketPath = config->getSocketPath();
+    adminSocketPath = config->getAdminSocketPath();
+    handoffSocketPath = config->getHandoffSocketPath();
   }
   
-  return config->getSocketPath().c_str();
+  return socketPath.c_str();
 }
 
 /*
- * Function Name: cleanup
+ * Function Name: writeSnapshot
+ *
+ * Description  : saves the verification cache to CACHE_SNAPSHOT_PATH, if
+ *                   both are configured, so a restart starts warm
+ *
+ * Arguments    : None
+ *
+ * Returns      : None
+ *
+ */
+static void writeSnapshot()
+{
+   if (cache == NULL || config->getCacheSnapshotPath().length() == 0)
+      return;
+   if (cache->saveSnapshot(config->getCacheSnapshotPath().c_str(), time(NULL)) < 0)
+      DaemonLog::write("saveSnapshot(): Cannot write %s - %s\n", config->getCacheSnapshotPath().c_str(), strerror(errno));
+}
+
+/*
+ * Function Name: requestSnapshot
  *
- * Description  : closes listener socket, if open
+ * Description  : flags the main loop (or pre-fork master) to save the cache
+ *                   snapshot; SIGALRM handler
  *
- * Arguments    : int signum - signal number.  Ignored, but required by
- *                   signal.h API.
+ * Arguments    : int signum - signal number.  Ignored.
  *
  * Returns      : None
  *
  */
-void cleanup(int signum)
+static void requestSnapshot(int signum)
+{
+   snapshotRequested = 1;
+}
+
+/*
+ * Function Name: cleanup
+ *
+ * Description  : closes listener socket, if open, frees what the daemon
+ *                   holds and exits.  The socket files are left in place if
+ *                   a successor has taken the sockets over.  Called from
+ *                   the loop once a stop is requested, never from a signal
+ *                   handler: stopping the pool takes locks and joins
+ *                   threads, and the snapshot and the log need stdio.
+ *
+ * Arguments    : None
+ *
+ * Returns      : None; exits
+ *
+ */
+void cleanup()
 {
+   /* the sockets outlive any one worker, and a handed-off daemon's
+    * successor still listens on them */
+   bool ownsFiles = workerIndex < 0 && !drainRequested;
+
    close(l);
-   unlink(socket_path());
+   if (ownsFiles)
+      unlink(socket_path());
+   if (a >= 0)
+   {
+      close(a);
+      if (ownsFiles)
+         unlink(adminSocketPath.c_str());
+   }
+   if (h >= 0)
+   {
+      close(h);
+      if (ownsFiles)
+         unlink(handoffSocketPath.c_str());
+   }
+   delete tcp;
+   tcp = NULL;
+   delete capture;
+   capture = NULL;
+   if (t >= 0)
+      close(t);
+   if (successor >= 0)
+      close(successor);
+   if (predecessor >= 0)
+      close(predecessor);
 
+   if (workerIndex < 0)  //workers' caches are the master's to save
+      writeSnapshot();
+   delete cache;
+   cache = NULL;
+   delete replica;
+   replica = NULL;
    if (db != NULL)
    {
       delete db;
       db = NULL;
    }
-   delete(config);
+   delete admission;
+   admission = NULL;
+   delete dbLimiter;
+   dbLimiter = NULL;
+   config->release();
    config = NULL;
    
    //if we got here, assume normal termination
@@ -65,152 +197,1921 @@ void cleanup(int signum)
 }
 
 /*
- * Function Name: main
+ * Function Name: requestMetrics
  *
- * Description  : program entry point
+ * Description  : flags the main loop to print its counters to stderr.  The
+ *                   printing happens outside the handler since stdio is not
+ *                   async-signal-safe.
+ *
+ * Arguments    : int signum - signal number.  Ignored.
+ *
+ * Returns      : None
+ *
+ */
+void requestMetrics(int signum)
+{
+   metricsRequested = 1;
+}
+
+/*
+ * Function Name: requestReload
+ *
+ * Description  : flags the main loop (or pre-fork master) to re-read the
+ *                   config file; SIGHUP handler
+ *
+ * Arguments    : int signum - signal number.  Ignored.
+ *
+ * Returns      : None
+ *
+ */
+void requestReload(int signum)
+{
+   reloadRequested = 1;
+}
+
+/*
+ * Function Name: requestDrain
+ *
+ * Description  : flags the main loop (or pre-fork master) to stop accepting,
+ *                   finish what it has accepted and exit, leaving the socket
+ *                   files to the daemon that took them over; SIGUSR2 handler
+ *
+ * Arguments    : int signum - signal number.  Ignored.
+ *
+ * Returns      : None
+ *
+ */
+void requestDrain(int signum)
+{
+   drainRequested = 1;
+}
+
+/*
+ * Function Name: openCapture
+ *
+ * Description  : starts, stops or moves CAPTURE_PATH to match path.  A file
+ *                   that cannot be opened is logged and capture stays off.
+ *
+ * Arguments    : const std::string &path - CAPTURE_PATH; empty for none
+ *
+ * Returns      : None
+ *
+ */
+static void openCapture(const std::string &path)
+{
+   if (capture != NULL && capture->getPath() == path)
+      return;
+   delete capture;
+   capture = NULL;
+   if (path.length() == 0)
+      return;
+   try
+   {
+      capture = new CaptureLog(path, timers);
+   }
+   catch (std::runtime_error &e)
+   {
+      DaemonLog::write("openCapture(): %s\n", e.what());
+   }
+}
+
+/*
+ * Function Name: restartOnly
+ *
+ * Description  : warns that a reloaded key has changed but cannot take
+ *                   effect until the daemon restarts
+ *
+ * Arguments    : const char * key - config key
+ *                bool changed - whether the reload changed it
+ *
+ * Returns      : None
+ *
+ */
+static void restartOnly(const char * key, bool changed)
+{
+   if (changed)
+      DaemonLog::write("reloadConfig(): %s changed; takes effect on restart\n", key);
+}
+
+/*
+ * Function Name: reloadConfig
+ *
+ * Description  : re-reads the config file and swaps it in.  Limits, hedging,
+ *                   cache TTL and replica intervals change in place; database
+ *                   credentials are used from the next reconnect, so working
+ *                   connections are not dropped.  Sockets, pool and cache
+ *                   sizes and the backend only change on restart.  An invalid
+ *                   file leaves the running config alone.
  *
  * Arguments    : None
  *
- * Returns      : 0 in theory, but exit only ever actually occurs following
- *                   fatal error (-1) or signal (SIGHUG, SIGINT, SIGTERM) (0).
+ * Returns      : None
  *
  */
-int main(int argc, char * argv[])
+static void reloadConfig()
+{
+   if (!CookieDaemonConfig::reload())
+   {
+      DaemonLog::write("reloadConfig(): keeping the running config\n");
+      return;
+   }
+   CookieDaemonConfig * fresh = CookieDaemonConfig::current();
+
+   restartOnly("SOCKET_PATH", fresh->getSocketPath() != socketPath);
+   restartOnly("ADMIN_SOCKET_PATH", fresh->getAdminSocketPath() != adminSocketPath);
+   restartOnly("HANDOFF_SOCKET_PATH", fresh->getHandoffSocketPath() != handoffSocketPath);
+   restartOnly("TCP_LISTEN_ADDRESS", fresh->getTcpListenAddress() != config->getTcpListenAddress());
+   restartOnly("TCP_LISTEN_PORT", fresh->getTcpListenPort() != config->getTcpListenPort());
+   restartOnly("IO_ENGINE", fresh->getIoEngine() != config->getIoEngine());
+   restartOnly("DB_BACKEND", fresh->getBackend() != config->getBackend());
+   restartOnly("LOCAL_BACKEND_PATH", fresh->getLocalBackendPath() != config->getLocalBackendPath());
+   restartOnly("DB_POOL_SIZE", fresh->getDBPoolSize() != config->getDBPoolSize());
+   restartOnly("DB_PIPELINE_DEPTH", fresh->getDBPipelineDepth() != config->getDBPipelineDepth());
+   restartOnly("DB_REPLICA_CONN_STRING", fresh->getReplicaConnectionString() != config->getReplicaConnectionString());
+   restartOnly("LOCAL_REPLICA_PATH", fresh->getLocalReplicaPath() != config->getLocalReplicaPath());
+   restartOnly("DB_REPLICA_POOL_SIZE", fresh->getDBReplicaPoolSize() != config->getDBReplicaPoolSize());
+   restartOnly("WORKER_PROCESSES", fresh->getWorkerProcesses() != config->getWorkerProcesses());
+   restartOnly("CACHE_CAPACITY", fresh->getCacheCapacity() != config->getCacheCapacity());
+   restartOnly("CACHE_SHM_PATH", fresh->getCacheShmPath() != config->getCacheShmPath());
+   restartOnly("LOG_BUFFER", fresh->getLogBuffer() != config->getLogBuffer());
+   restartOnly("REPLICA_SYNC_INTERVAL",
+      (fresh->getReplicaSyncInterval() > 0) != (config->getReplicaSyncInterval() > 0));
+
+   if (admission != NULL)
+      admission->reconfigure(fresh);
+   if (dbLimiter != NULL)
+      dbLimiter->reconfigure(fresh);
+   if (db != NULL)
+      db->reconfigure(fresh);
+   if (replica != NULL)
+      replica->reconfigure(fresh);
+   if (cache != NULL)
+   {
+      cache->setTTL(fresh->getCacheTTL());
+      cache->setStaleGrace(fresh->getCacheStaleGrace());
+   }
+   if (tcp != NULL)
+      tcp->reconfigure(fresh);
+   if (db != NULL)  //a process that serves: not the pre-fork master
+   {
+      openCapture(fresh->getCapturePath());
+      if (RSA_Sign_Verify::loadKeys() != 0)
+         DaemonLog::write("reloadConfig(): cannot load PRIVATE_KEY_PATH and CERT_PATH; each SIGN and VERIFY_SIGNED will read them\n");
+   }
+   DaemonLog::reconfigure(fresh);
+
+   CookieDaemonConfig * old = config;
+   config = fresh;
+   old->release();
+
+   /* the pre-fork master, or a single process, keeps the snapshot timer */
+   if (workerIndex < 0 && cache != NULL && config->getCacheSnapshotPath().length() > 0)
+      alarm(config->getCacheSnapshotInterval());
+   DaemonLog::write("reloadConfig(): config reloaded\n");
+}
+
+/*
+ * Function Name: requestStop
+ *
+ * Description  : flags the main loop to shut down, or the pre-fork master
+ *                   to stop its workers and exit; SIGINT and SIGTERM handler
+ *
+ * Arguments    : int signum - signal number.  Ignored.
+ *
+ * Returns      : None
+ *
+ */
+static void requestStop(int signum)
+{
+   stopRequested = 1;
+}
+
+/*
+ * Function Name: printMetrics
+ *
+ * Description  : refreshes the limiter gauges and prints all counters
+ *
+ * Arguments    : FILE * out - stream to print to
+ *
+ * Returns      : None
+ *
+ */
+static void printMetrics(FILE * out)
+{
+   metrics.db_limit = dbLimiter->getLimit();
+   metrics.db_in_flight = dbLimiter->getInFlight();
+   metrics.db_latency_us = dbLimiter->getSmoothedLatency();
+   metrics.hedges = db->getHedges();
+   metrics.hedge_wins = db->getHedgeWins();
+   metrics.hedge_delay_us = db->getHedgeDelay();
+   metrics.db_expired = db->getExpired();
+   metrics.db_connections = db->getConnected();
+   metrics.pipeline_checks = db->getPipelined();
+   metrics.pipeline_in_flight = db->getPipelineInFlight();
+   metrics.replica_db_reads = db->getReplicaReads();
+   metrics.replica_db_fallbacks = db->getReplicaFallbacks();
+   metrics.replica_db_ready = db->getReplicasReady();
+   metrics.replica_db_lag = db->getReplicaLag();
+   metrics.touches_written = db->getTouchesWritten();
+   metrics.touch_batches = db->getTouchBatches();
+   metrics.touches_rejected = db->getTouchesRejected();
+   metrics.touches_dropped = db->getTouchesDropped();
+   if (cache != NULL)
+   {
+      metrics.cache_hits = cache->getHits();
+      metrics.cache_misses = cache->getMisses();
+      metrics.cache_reclaimed = cache->getReclaimed();
+   }
+   metrics.timers = (int) timers->size();
+   metrics.log_dropped = DaemonLog::getDropped();
+   metrics.log_suppressed = DaemonLog::getSuppressed();
+#ifdef COUNT_ALLOCATIONS
+   metrics.allocations = AllocationCounter::getCount();
+#endif
+   if (replica != NULL)
+   {
+      metrics.replica_hits = replica->getHits();
+      metrics.replica_misses = replica->getMisses();
+      metrics.replica_users = replica->getUserCount();
+      metrics.replica_cookies = replica->getCookieCount();
+      metrics.replica_sync_age = replica->getSyncAge();
+   }
+   if (tcp != NULL)
+   {
+      metrics.tcp_connections = tcp->getConnections();
+      metrics.tcp_accepted = tcp->getAccepted();
+   }
+   if (uring != NULL)
+      metrics.io_uring_enters = uring->getEnters();
+   if (workerIndex >= 0)
+      fprintf(out, "worker %d pid %d\n", workerIndex, (int) getpid());
+   metrics.print(out);
+}
+
+/*
+ * Function Name: openListener
+ *
+ * Description  : creates a Unix domain socket bound to path and listening,
+ *                   replacing any socket file left from a prior run.  The
+ *                   socket is non-blocking, since pre-fork workers all poll
+ *                   it and only one wins each accept().
+ *
+ * Arguments    : const char * path - filesystem path to bind
+ *                mode_t mode - permissions for the socket file
+ *
+ * Returns      : listening socket, or -1 (error already logged)
+ *
+ */
+static int openListener(const char * path, mode_t mode)
 {
-   int w;   /* listener and worker sockets */
    struct sockaddr_un sa;   /* socket address */
-   int count;  /* length of stream read by socket */
-   char buffer[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE]; /* socket read/write buffer */
-   
-   /* set up signal handlers */
-   signal(SIGHUP, cleanup);
-   signal(SIGINT, cleanup);
-   signal(SIGTERM, cleanup);
 
-   /* create listener socket */
-   l = socket(AF_UNIX, SOCK_STREAM, 0);
-   if (l < 0)
+   int s = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (s < 0)
    {
-      fprintf(stderr, "socket(): Cannot create listener socket - %s\n", strerror(errno));
-      return FATAL_EXIT;
+      DaemonLog::write("socket(): Cannot create listener socket - %s\n", strerror(errno));
+      return -1;
    }
 
    /* initialize sockaddr_in struct */
    bzero(&sa, sizeof (struct sockaddr_un));
    sa.sun_family = AF_UNIX;
-   strcpy(sa.sun_path, socket_path());
+   strcpy(sa.sun_path, path);
 
    /* bind listener socket  */
-   unlink(socket_path());  /* in case it already exists from prior run */
-   if (bind(l, (struct sockaddr *) &sa, sizeof (sa)) < 0)
+   unlink(path);  /* in case it already exists from prior run */
+   if (bind(s, (struct sockaddr *) &sa, sizeof (sa)) < 0)
    {
-      fprintf(stderr, "bind(): Cannot bind socket to %s - %s\n", socket_path(), strerror(errno));
-      return FATAL_EXIT;
+      DaemonLog::write("bind(): Cannot bind socket to %s - %s\n", path, strerror(errno));
+      close(s);
+      return -1;
    }
+   chmod(path, mode);
+   fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
 
    /* listening */
-   if (listen(l, 5) < 0)
+   if (listen(s, 5) < 0)
    {
-      fprintf(stderr, "listen(): Cannot listen on socket - %s\n", strerror(errno));
-      return FATAL_EXIT;
+      DaemonLog::write("listen(): Cannot listen on socket - %s\n", strerror(errno));
+      close(s);
+      return -1;
    }
-   
-   fprintf(stderr, "Listening on socket (bound to %s)\n", socket_path()); 
 
-   char responseBuffer[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
-   
-   /* enable us to talk to verify signatures and talk w/ Oracle */
-   try
+   return s;
+}
+
+/*
+ * Function Name: openSockets
+ *
+ * Description  : takes the listening sockets over from the daemon on
+ *                   HANDOFF_SOCKET_PATH, if one is running, and binds any
+ *                   it did not hand over.  After a takeover, predecessor
+ *                   stays open until readyToServe().
+ *
+ * Arguments    : None
+ *
+ * Returns      : bool - false on a fatal error (already logged)
+ *
+ */
+static bool openSockets()
+{
+   if (handoffSocketPath.length() > 0)
    {
-      db = new OCCI_IGSPnet();  //die if can't connect
+      int fds[4];  /* listener, handoff, admin, TCP listener */
+      int count = SocketHandoff::takeOver(handoffSocketPath.c_str(), fds, 4, predecessor, predecessorPid);
+      if (count < 0)
+         return false;  //binding our own would cut off the running daemon
+      if (count > 0 && (fds[0] < 0 || fds[1] < 0))
+      {
+         DaemonLog::write("openSockets(): Handoff without a listener\n");
+         for (int i = 0; i < 4; i++)
+         {
+            if (fds[i] >= 0)
+               close(fds[i]);
+         }
+         return false;
+      }
+      if (count > 0)
+      {
+         l = fds[0];
+         h = fds[1];
+         a = fds[2];
+         t = fds[3];
+         DaemonLog::write("Took over sockets (bound to %s) from pid %d\n", socket_path(), (int) predecessorPid);
+      }
    }
-   catch (SQLException &e)
+
+   if (l < 0)
    {
-      fprintf(stderr, "OCCI_IGSPnet(): Can't connect to database - %s\n", e.what());
-      return FATAL_EXIT;
+      l = openListener(socket_path(), 0777);
+      if (l < 0)
+         return false;
+      DaemonLog::write("Listening on socket (bound to %s)\n", socket_path());
    }
-   catch (std::runtime_error &e)
+
+   if (h < 0 && handoffSocketPath.length() > 0)
    {
-      fprintf(stderr, "OCCI_IGSPnet(): Runtime error - %s\n", e.what());
-      exit(FATAL_EXIT);
+      h = openListener(handoffSocketPath.c_str(), 0600);
+      if (h < 0)
+         return false;
    }
 
-   while (1)
+   /* admin socket is only for the daemon's own user */
+   if (a >= 0 && adminSocketPath.length() == 0)
    {
-      /* accept connection; pass to worker */
-      w = accept(l, NULL, NULL);
-      if (w < 0)
-      {
-         fprintf(stderr, "accept(): Error accepting on socket - %s\n", strerror(errno));
-         close(w);
-         continue;
-      }
-      
-      /* read up to READ_BUFFER_SIZE-1 bytes - if more, close the socket */
-      count = read(w, buffer, RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE - 1);
-      
-      if (count < 0)
-      {
-         fprintf(stderr, "read(): Error reading socket - %s\n", strerror(errno));
-         close(w);
-         continue;
-      }
-      else
-      if (count >= RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE - 1) /* buffer overflow */
-      {
-         fprintf(stderr, "read(): Buffer full reading socket; discarding\n");
-         close(w);
-         continue;
-      }
-      else /* all is well */
-      { 
-         buffer[count] = '\0'; /* buffer now has the cookie text */
+      close(a);  //the old daemon had one; we do not
+      a = -1;
+   }
+   else if (a < 0 && adminSocketPath.length() > 0)
+   {
+      a = openListener(adminSocketPath.c_str(), 0600);
+      if (a < 0)
+         return false;
+      DaemonLog::write("Admin commands on %s\n", adminSocketPath.c_str());
+   }
+
+   if (t >= 0 && config->getTcpListenPort() <= 0)
+   {
+      close(t);
+      t = -1;
+   }
+   else if (t < 0 && config->getTcpListenPort() > 0)
+   {
+      t = TcpFrontend::listen(config->getTcpListenAddress().c_str(), config->getTcpListenPort());
+      if (t < 0)
+         return false;
+      DaemonLog::write("Listening on TCP %s port %d\n", config->getTcpListenAddress().c_str(), config->getTcpListenPort());
+   }
+   return true;
+}
 
-         /* userID::dukey::IP::cookieVersion::clientID */
-         /* verify the cookie and send back result */
+/*
+ * Function Name: readyToServe
+ *
+ * Description  : after a takeover, tells the old daemon to drain
+ *
+ * Arguments    : None
+ *
+ * Returns      : None
+ *
+ */
+static void readyToServe()
+{
+   if (predecessor < 0)
+      return;
+   if (SocketHandoff::signalReady(predecessor) == 0)
+      DaemonLog::write("Ready; pid %d is draining\n", (int) predecessorPid);
+   close(predecessor);
+   predecessor = -1;
+}
 
-         /* These buffers are maximum possible for a valid cookie. */
-         /* parseCookie() checks these to prevent overflow. */
-         char userID[13];
-         char dukey[2];
-         char IP[16];
-         char cookieVersion[2];
-         char clientID[5];
-         int failure = 0;
+/*
+ * Function Name: offerSockets
+ *
+ * Description  : hands the listening sockets to a daemon that connected to
+ *                   the handoff socket, then keeps serving until it is
+ *                   ready.  One handoff at a time.
+ *
+ * Arguments    : int c - accepted handoff connection
+ *
+ * Returns      : None
+ *
+ */
+static void offerSockets(int c)
+{
+   if (successor >= 0 || drainRequested)
+   {
+      close(c);
+      return;
+   }
 
-         if (IGSPnet_Cookie_Streamer::parseCookie(buffer, userID, dukey, IP, cookieVersion, clientID) != 0)
-         {
-            fprintf(stderr, "parseCookie(): Could not parse cookie data\n");
-            strcpy(responseBuffer, "0");  //failed response
-            failure = 1;
-         }
-         int shortLifetime;
-         if (!failure)
-         {
-            shortLifetime = db->checkCookie(userID, IP, clientID, cookieVersion);
-            //fprintf(stderr, "responseBuffer = %d\n", shortLifetime);
-            sprintf(responseBuffer, "%d", shortLifetime);
-         }
-         
-         /* responseBuffer contains the response */
+   int fds[4];  /* the slots openSockets() expects */
+   fds[0] = l;
+   fds[1] = h;
+   fds[2] = a;
+   fds[3] = t;
+   if (SocketHandoff::offer(c, fds, 4) < 0)
+   {
+      close(c);
+      return;
+   }
+   successor = c;
+   DaemonLog::write("Handed sockets to pid %d; serving until it is ready\n", (int) SocketHandoff::peer(c));
+}
 
-         /* write the results here */
+/*
+ * Function Name: successorReady
+ *
+ * Description  : reads the verdict of the daemon the sockets were handed
+ *                   to.  If it is ready, this process (and, in pre-fork
+ *                   mode, every worker) drains and exits; if it died, this
+ *                   one carries on.
+ *
+ * Arguments    : None
+ *
+ * Returns      : None
+ *
+ */
+static void successorReady()
+{
+   bool ready = SocketHandoff::awaitReady(successor);
+   close(successor);
+   successor = -1;
+   if (!ready)
+   {
+      DaemonLog::write("Handoff abandoned by the new daemon; still serving\n");
+      return;
+   }
+   DaemonLog::write("New daemon is ready; draining\n");
+   drainRequested = 1;
+   if (workerIndex >= 0)
+      kill(getppid(), SIGUSR2);  //the master drains the other workers
+}
 
-         if (write(w, responseBuffer, strlen(responseBuffer)) < 0)
-         {
-            fprintf(stderr, "write(): Error writing socket - %s\n", strerror(errno));
-         }
+/* A request parked while the database works on it.  Rather than a thread
+ * (or a stack) per request, each one runs as a chain of steps:
+ * answerRequest() and signRequest() take it as far as they can without
+ * blocking, and if it needs the database they start the call with the
+ * Request as its context and return.  When DBPool posts the answer,
+ * finishRequest() resumes it and deliver() sends the reply back the way the
+ * request came.  The loop meanwhile goes on serving, so many requests can
+ * wait on a few database connections at once.  Requests come from slabs and
+ * go back on a free list, and the lists they are on are threaded through
+ * them, so parking one allocates nothing once the loop has been as busy as
+ * it gets.
+ *
+ * Each request has a deadline, from its frame's timeout or REQUEST_TIMEOUT.
+ * If it passes first, the request is answered TIMEOUT by its expiry timer
+ * and its answer, when it comes, goes only to whoever else waits on the
+ * call. */
+struct Request
+{
+   enum Origin { URING, TCP_LINE, TCP_FRAME, REFRESH };
+   Origin origin;              /* REFRESH: a cache refresh nobody is waiting on */
+   unsigned long long ticket;  /* the front end's */
+   int op;                     /* CookieProtocol::CHECK or SIGN */
+   char userID[13];
+   char IP[16];
+   char clientID[5];
+   char cookieVersion[2];
+   time_t now;                 /* when the check started, for the cache */
+   unsigned long long stamp;   /* VerificationCache::stamp() before the database call */
+   Request * followers;        /* identical checks sharing this one's call */
+   Request * lastFollower;
+   int followerCount;
+   Request * next;             /* the next follower, or on the free list */
+   Request * nextFlight;       /* in a flights bucket */
+   long long deadline;         /* monotonicMicros() to answer by; 0 = none */
+   bool answered;              /* timed out before its answer came */
+   TimerWheel::Timer expiry;   /* fires at deadline; context: this */
+   long long arrived;          /* CAPTURE_PATH: as in arrival, with the text */
+   long long started;
+   char text[IGSPnet_Cookie_Streamer::IGSPNET_COOKIE_SIZE];
+};
+
+static const int REQUEST_SLAB = 256;   // Requests allocated at a time
+static const int FLIGHT_BUCKETS = 4096;
+
+static int waiting = 0;  // Requests parked on the database
+static time_t dbDownSince = 0;  // first failure of the current database outage, or 0
+static Request * freeRequests = NULL;
+/* checks at the database, hashed by flightHash(), so identical ones can
+ * share a call instead of each making their own */
+static Request * flights[FLIGHT_BUCKETS];
+/* the check answerRequest() is working on, while capturing, so that park()
+ * can copy it into the request it makes */
+static struct
+{
+   long long time;      /* microseconds since the epoch */
+   long long started;   /* monotonicMicros() */
+   const char * text;   /* NULL if not capturing */
+} arrival;
+/* the deadline of the request being answered, for park() to copy */
+static long long requestDeadline = 0;
+
+static void requestExpired(TimerWheel::Timer * timer);
+
+/* what makes two checks identical: the CHECK_COOKIE arguments */
+static unsigned int flightHash(const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
+{
+   const char * fields[4] = { userID, IP, clientID, cookieVersion };
+   unsigned int hash = 2166136261u;  //FNV-1a, with a NUL after each field
+   for (int i = 0; i < 4; i++)
+   {
+      for (const char * p = fields[i]; ; p++)
+      {
+         hash = (hash ^ (unsigned char) *p) * 16777619u;
+         if (*p == '\0')
+            break;
+      }
+   }
+   return hash & (FLIGHT_BUCKETS - 1);
+}
+
+/* the check at the database identical to this one, or NULL */
+static Request * findFlight(const char * userID, const char * IP, const char * clientID, const char * cookieVersion)
+{
+   Request * f = flights[flightHash(userID, IP, clientID, cookieVersion)];
+   for (; f != NULL; f = f->nextFlight)
+   {
+      if (strcmp(f->userID, userID) == 0 && strcmp(f->IP, IP) == 0
+         && strcmp(f->clientID, clientID) == 0 && strcmp(f->cookieVersion, cookieVersion) == 0)
+         break;
+   }
+   return f;
+}
 
-         //* and then close the socket */
-      
-         close(w);
+static void removeFlight(Request * r)
+{
+   Request ** link = &flights[flightHash(r->userID, r->IP, r->clientID, r->cookieVersion)];
+   while (*link != NULL && *link != r)
+      link = &(*link)->nextFlight;
+   if (*link == r)
+      *link = r->nextFlight;
+}
+
+/* makes r the flight identical checks join, in place of any older one */
+static void addFlight(Request * r)
+{
+   Request * older = findFlight(r->userID, r->IP, r->clientID, r->cookieVersion);
+   if (older != NULL)
+      removeFlight(older);
+   Request ** bucket = &flights[flightHash(r->userID, r->IP, r->clientID, r->cookieVersion)];
+   r->nextFlight = *bucket;
+   *bucket = r;
+}
+
+/* a Request off the free list, refilled a slab at a time */
+static Request * newRequest()
+{
+   if (freeRequests == NULL)
+   {
+      Request * slab = new Request[REQUEST_SLAB];
+      for (int i = 0; i < REQUEST_SLAB; i++)
+      {
+         slab[i].next = freeRequests;
+         freeRequests = &slab[i];
+      }
+   }
+   Request * r = freeRequests;
+   freeRequests = r->next;
+   return r;
+}
+
+static void releaseRequest(Request * r)
+{
+   timers->cancel(&r->expiry);
+   r->next = freeRequests;
+   freeRequests = r;
+}
+
+/* when a request arriving now must be answered by, in monotonicMicros():
+ * timeout milliseconds from now, or REQUEST_TIMEOUT if timeout is 0; 0 if
+ * neither sets a limit */
+static long long deadlineFor(unsigned int timeout)
+{
+   if (timeout == 0 && config->getRequestTimeout() > 0)
+      timeout = config->getRequestTimeout();
+   if (timeout == 0)
+      return 0;
+   return monotonicMicros() + timeout * 1000LL;
+}
+
+/*
+ * Function Name: park
+ *
+ * Description  : makes a Request for a check or insert about to go to the
+ *                   database
+ *
+ * Arguments    : Request::Origin origin, unsigned long long ticket - where
+ *                   the reply goes
+ *                int op - CookieProtocol::CHECK or SIGN
+ *                const char * userID, const char * IP - from the request
+ *
+ * Returns      : Request * - to pass to the DBPool as context
+ *
+ */
+static Request * park(Request::Origin origin, unsigned long long ticket, int op, const char * userID, const char * IP)
+{
+   Request * r = newRequest();
+   r->origin = origin;
+   r->ticket = ticket;
+   r->op = op;
+   strcpy(r->userID, userID);
+   strcpy(r->IP, IP);
+   r->clientID[0] = '\0';
+   r->cookieVersion[0] = '\0';
+   r->now = 0;
+   r->stamp = 0;
+   r->followers = NULL;
+   r->lastFollower = NULL;
+   r->followerCount = 0;
+   r->next = NULL;
+   r->nextFlight = NULL;
+   r->deadline = (origin == Request::REFRESH) ? 0 : requestDeadline;
+   r->answered = false;
+   r->expiry.callback = requestExpired;
+   r->expiry.context = r;
+   if (r->deadline != 0)
+      timers->schedule(&r->expiry, (r->deadline - monotonicMicros() + 999) / 1000);
+   r->text[0] = '\0';
+   if (arrival.text != NULL && origin != Request::REFRESH)
+   {
+      r->arrived = arrival.time;
+      r->started = arrival.started;
+      strncpy(r->text, arrival.text, sizeof (r->text) - 1);  //parked checks parsed, so fit
+      r->text[sizeof (r->text) - 1] = '\0';
+   }
+   waiting++;
+   return r;
+}
+
+/* logs an answered check to CAPTURE_PATH */
+static void captureReply(long long time, long long started, const char * text, const char * responseBuffer)
+{
+   metrics.captured++;
+   capture->record(time, (int) (monotonicMicros() - started), atoi(responseBuffer), text);
+}
+
+/*
+ * Function Name: parkCheck
+ *
+ * Description  : parks a check as the call identical checks may share
+ *                   until it is answered; startCheck() also sends it
+ *
+ * Arguments    : Request::Origin origin, unsigned long long ticket - where
+ *                   the reply goes
+ *                const char * userID, IP, clientID, cookieVersion - from
+ *                   the cookie
+ *                time_t now, unsigned long long stamp - for the cache
+ *
+ * Returns      : Request * - to pass to the DBPool as context
+ *
+ */
+static Request * parkCheck(Request::Origin origin, unsigned long long ticket, const char * userID, const char * IP, const char * clientID, const char * cookieVersion, time_t now, unsigned long long stamp)
+{
+   metrics.checked++;
+   Request * r = park(origin, ticket, CookieProtocol::CHECK, userID, IP);
+   strcpy(r->clientID, clientID);
+   strcpy(r->cookieVersion, cookieVersion);
+   r->now = now;
+   r->stamp = stamp;
+   addFlight(r);
+   return r;
+}
+
+/* whether userID was invalidated so recently that a read replica within
+ * DB_REPLICA_MAX_LAG (probed once a second) may not have the change, and
+ * could answer as if it had not happened; its answer would then be cached
+ * again.  Such checks go to the primary. */
+static bool needsPrimary(const char * userID)
+{
+   return cache != NULL && time(NULL) - cache->invalidatedAt(userID) <= config->getDBReplicaMaxLag() + 1;
+}
+
+/* parkCheck(), then sends the check to the database */
+static void startCheck(Request::Origin origin, unsigned long long ticket, const char * userID, const char * IP, const char * clientID, const char * cookieVersion, time_t now, unsigned long long stamp)
+{
+   Request * r = parkCheck(origin, ticket, userID, IP, clientID, cookieVersion, now, stamp);
+   db->startCheck(userID, IP, clientID, cookieVersion, r, r->deadline, needsPrimary(userID));
+}
+
+/* a deferred refresh's timer: makes its call, now that the reply it was
+ * deferred behind has gone */
+static void refreshDue(TimerWheel::Timer * timer)
+{
+   Request * r = (Request *) timer->context;
+   db->startCheck(r->userID, r->IP, r->clientID, r->cookieVersion, r, r->deadline, needsPrimary(r->userID));
+}
+
+/* takes a DB_LIMIT slot for a call about to go to the pool.  A pool that
+ * runs its calls inline has only that one call at the database at a time,
+ * however many requests are parked on answers not yet taken, so its calls
+ * take no slot: they wait their turn rather than being shed. */
+static bool acquireDBSlot()
+{
+   return !db->isThreaded() || dbLimiter->acquire();
+}
+
+/* re-checks a cached cookie, unless that is already under way or the
+ * database has no room for it.  The entry is served meanwhile.  A pool
+ * that runs its calls inline would make the call before the cached reply
+ * is written, so the call is deferred to a timer; it still holds up the
+ * loop when it runs, but not the reply it was found for. */
+static void refreshCheck(const char * userID, const char * IP, const char * clientID, const char * cookieVersion, time_t now, unsigned long long stamp)
+{
+   Request * flight = findFlight(userID, IP, clientID, cookieVersion);
+   if (flight != NULL && flight->stamp == stamp)
+      return;
+   if (!acquireDBSlot())
+      return;
+   metrics.refreshes++;
+   if (db->isThreaded())
+   {
+      startCheck(Request::REFRESH, 0, userID, IP, clientID, cookieVersion, now, stamp);
+      return;
+   }
+   Request * r = parkCheck(Request::REFRESH, 0, userID, IP, clientID, cookieVersion, now, stamp);
+   r->expiry.callback = refreshDue;  //a refresh has no deadline to expire at
+   timers->schedule(&r->expiry, 0);
+}
+
+/*
+ * Function Name: checkRequest
+ *
+ * Description  : answers one cookie check.  The cheapest source that can
+ *                   answer does: admission control, then the verification
+ *                   cache, then the replica, then the database.  A request
+ *                   that needs the database is parked and answered later by
+ *                   finishRequest().  If an identical check is already at
+ *                   the database, it waits for that answer instead of
+ *                   making a call of its own.
+ *
+ *                   A cache entry with CACHE_REFRESH_AHEAD seconds or less
+ *                   to live is served and re-checked by refreshCheck().
+ *                   While the database is failing, an entry that expired
+ *                   within CACHE_STALE_GRACE seconds is served too.
+ *
+ * Arguments    : char * buffer - cookie text; destroyed by parsing
+ *                char * responseBuffer - receives the reply text
+ *                Request::Origin origin, unsigned long long ticket - where
+ *                   a parked request's reply goes
+ *
+ * Returns      : bool - true if responseBuffer holds the answer, false if
+ *                   the request was parked
+ *
+ */
+static bool checkRequest(char * buffer, char * responseBuffer, Request::Origin origin, unsigned long long ticket)
+{
+   /* userID::dukey::IP::cookieVersion::clientID */
+   /* verify the cookie and send back result */
+
+   /* These buffers are maximum possible for a valid cookie. */
+   /* parseCookie() checks these to prevent overflow. */
+   char userID[13];
+   char dukey[2];
+   char IP[16];
+   char cookieVersion[2];
+   char clientID[5];
+
+   if (IGSPnet_Cookie_Streamer::parseCookie(buffer, userID, dukey, IP, cookieVersion, clientID) != 0)
+   {
+      DaemonLog::write("parseCookie(): Could not parse cookie data\n");
+      metrics.parse_failures++;
+      strcpy(responseBuffer, "0");  //failed response
+      return true;
+   }
+   if (!admission->admitIP(IP))
+   {
+      metrics.rejected_ip++;
+      strcpy(responseBuffer, BUSY_RESPONSE);
+      return true;
+   }
+
+   int shortLifetime;
+   time_t now = time(NULL);
+   unsigned long long stamp = 0;
+   if (cache != NULL)
+   {
+      int remaining = 0;
+      shortLifetime = cache->lookup(userID, IP, clientID, cookieVersion, now, 0, &remaining);
+      stamp = cache->stamp(userID);
+      if (shortLifetime == VerificationCache::MISS && dbDownSince != 0 && config->getCacheStaleGrace() > 0)
+      {
+         /* the refresh below notices when the database is back */
+         shortLifetime = cache->lookupStale(userID, IP, clientID, cookieVersion, now);
+         if (shortLifetime != VerificationCache::MISS)
+            metrics.stale_served++;
+      }
+      if (shortLifetime != VerificationCache::MISS)
+      {
+         if (remaining <= config->getCacheRefreshAhead())
+            refreshCheck(userID, IP, clientID, cookieVersion, now, stamp);
+         sprintf(responseBuffer, "%d", shortLifetime);
+         return true;
+      }
+   }
+
+   shortLifetime = UserReplica::MISS;
+   if (replica != NULL)
+   {
+      /* the replica answers whenever its snapshot can */
+      shortLifetime = replica->check(userID, IP, clientID, cookieVersion);
+   }
+   if (shortLifetime == UserReplica::MISS)
+   {
+      Request * flight = findFlight(userID, IP, clientID, cookieVersion);
+      /* unless the user was invalidated since that call started */
+      if (flight != NULL && flight->stamp == stamp)
+      {
+         metrics.coalesced++;
+         Request * follower = park(origin, ticket, CookieProtocol::CHECK, userID, IP);
+         if (flight->lastFollower == NULL)
+            flight->followers = follower;
+         else
+            flight->lastFollower->next = follower;
+         flight->lastFollower = follower;
+         flight->followerCount++;
+         return false;
+      }
+
+      if (!acquireDBSlot())
+      {
+         /* database is already at its limit; fail fast rather than queue */
+         metrics.rejected_db_limit++;
+         strcpy(responseBuffer, BUSY_RESPONSE);
+         return true;
+      }
+      startCheck(origin, ticket, userID, IP, clientID, cookieVersion, now, stamp);
+      return false;
+   }
+
+   if (cache != NULL && shortLifetime > 0)
+      cache->insert(userID, IP, clientID, cookieVersion, shortLifetime, stamp, now);
+   //DaemonLog::write("responseBuffer = %d\n", shortLifetime);
+   sprintf(responseBuffer, "%d", shortLifetime);
+   return true;
+}
+
+/*
+ * Function Name: admitRequest
+ *
+ * Description  : answers one request from a peer, shedding load before any
+ *                   parsing, signature or database work: global in-flight
+ *                   limit, then per-peer rate, then the signature if there
+ *                   is one, then checkRequest().  A parked request stays
+ *                   in flight until finishRequest().
+ *
+ * Arguments    : unsigned long long peer - AdmissionControl::peerKey() of
+ *                   the connection
+ *                char * buffer - cookie text; destroyed by parsing
+ *                const char * signature - VERIFY_SIGNED's signature over
+ *                   buffer, or NULL
+ *                char * responseBuffer - receives the reply text
+ *                Request::Origin origin, unsigned long long ticket - where
+ *                   a parked request's reply goes
+ *
+ * Returns      : bool - true if answered, false if parked
+ *
+ */
+static bool admitRequest(unsigned long long peer, char * buffer, const char * signature, char * responseBuffer, Request::Origin origin, unsigned long long ticket)
+{
+   if (!admission->enter())
+   {
+      metrics.rejected_concurrency++;
+      strcpy(responseBuffer, BUSY_RESPONSE);
+      return true;
+   }
+   if (!admission->admitPeerKey(peer))
+   {
+      admission->leave();
+      metrics.rejected_peer++;
+      strcpy(responseBuffer, BUSY_RESPONSE);
+      return true;
+   }
+   if (signature != NULL && RSA_Sign_Verify::verifySig(buffer, signature) != 0)
+   {
+      admission->leave();
+      metrics.bad_signatures++;
+      strcpy(responseBuffer, "0");
+      arrival.text = NULL;  //the capture has no signature to replay
+      return true;
+   }
+   if (!checkRequest(buffer, responseBuffer, origin, ticket))
+      return false;
+   admission->leave();
+   return true;
+}
+
+/* admitRequest(), capturing the check if CAPTURE_PATH is set: here if it
+ * is answered at once, else by deliver() */
+static bool answerRequest(unsigned long long peer, char * buffer, const char * signature, char * responseBuffer, Request::Origin origin, unsigned long long ticket)
+{
+   if (capture == NULL)
+      return admitRequest(peer, buffer, signature, responseBuffer, origin, ticket);
+
+   char text[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
+   struct timeval tv;
+   snprintf(text, sizeof (text), "%s", buffer);  //parsing destroys buffer
+   gettimeofday(&tv, NULL);
+   arrival.time = (long long) tv.tv_sec * 1000000LL + tv.tv_usec;
+   arrival.started = monotonicMicros();
+   arrival.text = text;
+   bool answered = admitRequest(peer, buffer, signature, responseBuffer, origin, ticket);
+   bool captured = arrival.text != NULL;
+   arrival.text = NULL;
+   if (answered && captured)
+      captureReply(arrival.time, arrival.started, text, responseBuffer);
+   return answered;
+}
+
+/* the text reply for responseBuffer.  A legacy verifyCookie takes any
+ * reply but "0" as a soft lifetime, so text clients are never sent
+ * BUSY_RESPONSE: a shed request fails closed as "0".  Only binary frames
+ * can say BUSY. */
+static const char * textReply(const char * responseBuffer)
+{
+   return (strcmp(responseBuffer, BUSY_RESPONSE) == 0) ? "0" : responseBuffer;
+}
+
+/* answerRequest() for a text client, its reply as textReply() */
+static bool answerTextRequest(unsigned long long peer, char * buffer, char * responseBuffer, Request::Origin origin, unsigned long long ticket)
+{
+   if (!answerRequest(peer, buffer, NULL, responseBuffer, origin, ticket))
+      return false;
+   const char * text = textReply(responseBuffer);
+   if (text != responseBuffer)
+      strcpy(responseBuffer, text);
+   return true;
+}
+
+/* TcpFrontend::Handler for one request line */
+static bool answerLineRequest(unsigned long long peer, char * buffer, char * responseBuffer, unsigned long long ticket)
+{
+   metrics.requests++;
+   requestDeadline = deadlineFor(0);
+   return answerTextRequest(peer, buffer, responseBuffer, Request::TCP_LINE, ticket);
+}
+
+/* UringListener's handler for one request on SOCKET_PATH */
+static bool answerUringRequest(unsigned long long peer, char * buffer, char * responseBuffer, unsigned long long ticket)
+{
+   metrics.requests++;
+   requestDeadline = deadlineFor(0);
+   return answerTextRequest(peer, buffer, responseBuffer, Request::URING, ticket);
+}
+
+/* the body of a CHECK or VERIFY_SIGNED response, which is 4 bytes if OK */
+static int checkFrameReply(const char * responseBuffer, unsigned char * softLifetime)
+{
+   if (strcmp(responseBuffer, BUSY_RESPONSE) == 0)
+      return CookieProtocol::BUSY;
+   CookieProtocol::putInt((unsigned int) atoi(responseBuffer), softLifetime);
+   return CookieProtocol::OK;
+}
+
+/* answers one cookie for a binary CHECK, or VERIFY_SIGNED with its
+ * signature */
+static int answerCheckFrame(unsigned long long peer, char * cookieText, const char * signature, std::string &reply, unsigned long long ticket)
+{
+   char responseBuffer[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
+
+   unsigned char softLifetime[4];
+
+   if (!answerRequest(peer, cookieText, signature, responseBuffer, Request::TCP_FRAME, ticket))
+      return TcpFrontend::DEFERRED;
+   int status = checkFrameReply(responseBuffer, softLifetime);
+   if (status == CookieProtocol::OK)
+      reply.assign((const char *) softLifetime, sizeof (softLifetime));
+   return status;
+}
+
+/*
+ * Function Name: signRequest
+ *
+ * Description  : starts issuing a cookie for a binary SIGN request, as
+ *                   signCookie does but on the daemon's database
+ *                   connections.  finishSign() completes it.
+ *
+ * Arguments    : unsigned long long peer - AdmissionControl::peerKey()
+ *                char * body - "userID IP softLifetime hardLifetime";
+ *                   destroyed by parsing
+ *                unsigned long long ticket - the frame's, for the reply
+ *
+ * Returns      : int - CookieProtocol status, or TcpFrontend::DEFERRED
+ *
+ */
+static int signRequest(unsigned long long peer, char * body, unsigned long long ticket)
+{
+   char * userID = strtok(body, " \t\r\n");
+   char * IP = strtok(NULL, " \t\r\n");
+   char * soft = strtok(NULL, " \t\r\n");
+   char * hard = strtok(NULL, " \t\r\n");
+   if (hard == NULL || strlen(userID) > 12 || strlen(IP) > 15)
+      return CookieProtocol::BAD_REQUEST;
+   int softLifetime = atoi(soft);
+   int hardLifetime = atoi(hard);
+   if (softLifetime <= 0 || hardLifetime < softLifetime)
+      return CookieProtocol::BAD_REQUEST;
+
+   if (!admission->enter())
+   {
+      metrics.rejected_concurrency++;
+      return CookieProtocol::BUSY;
+   }
+   if (!admission->admitPeerKey(peer))
+   {
+      admission->leave();
+      metrics.rejected_peer++;
+      return CookieProtocol::BUSY;
+   }
+   if (!acquireDBSlot())
+   {
+      admission->leave();
+      metrics.rejected_db_limit++;
+      return CookieProtocol::BUSY;
+   }
+
+   Request * r = park(Request::TCP_FRAME, ticket, CookieProtocol::SIGN, userID, IP);
+   db->startInsert(userID, IP, hardLifetime, softLifetime, r, r->deadline);
+   return TcpFrontend::DEFERRED;
+}
+
+/*
+ * Function Name: finishSign
+ *
+ * Description  : builds and signs the cookie a SIGN request's insert made
+ *
+ * Arguments    : Request * r - the parked SIGN request
+ *                const DBPool::Answer &answer - its insert's answer
+ *                std::string &reply - receives the signed cookie
+ *
+ * Returns      : int - CookieProtocol status
+ *
+ */
+static int finishSign(Request * r, const DBPool::Answer &answer, std::string &reply)
+{
+   if (answer.failed)
+      return CookieProtocol::FAILED;
+   if (answer.result != 0)
+      return CookieProtocol::REFUSED;  //user not enabled or lifetime invalid
+
+   char cookieText[IGSPnet_Cookie_Streamer::IGSPNET_COOKIE_SIZE];
+   char signatureText[IGSPnet_Cookie_Streamer::RSA_HEX_SIG_SIZE];
+   char signedCookie[IGSPnet_Cookie_Streamer::IGSPNET_COOKIE_SIZE + IGSPnet_Cookie_Streamer::RSA_HEX_SIG_SIZE + 3];
+   IGSPnet_Cookie_Streamer::buildCookie(r->userID, (char *) answer.dukey, r->IP, (char *) answer.cookieVersion, (char *) answer.clientID, cookieText);
+   if (RSA_Sign_Verify::signString(cookieText, signatureText) != 0)
+   {
+      DaemonLog::write("signString(): cannot sign cookie\n");
+      return CookieProtocol::FAILED;
+   }
+   IGSPnet_Cookie_Streamer::buildSignedCookie(cookieText, signatureText, signedCookie);
+   metrics.signed_cookies++;
+   reply = signedCookie;
+   return CookieProtocol::OK;
+}
+
+/*
+ * Function Name: deliver
+ *
+ * Description  : sends a parked request's reply back the way it came, and
+ *                   captures it if CAPTURE_PATH is set
+ *
+ * Arguments    : Request * r - the request
+ *                const char * responseBuffer - reply text, as
+ *                   checkRequest() would have written it
+ *                int status - CookieProtocol status (SIGN, or TIMEOUT)
+ *                const std::string &reply - response body (SIGN only)
+ *
+ * Returns      : None
+ *
+ */
+static void deliver(Request * r, const char * responseBuffer, int status, const std::string &reply)
+{
+   unsigned char softLifetime[4];
+   const char * text = textReply(responseBuffer);
+   if (capture != NULL && r->text[0] != '\0')
+      captureReply(r->arrived, r->started, r->text, responseBuffer);
+   switch (r->origin)
+   {
+      case Request::URING:
+         uring->complete(r->ticket, text);
+         break;
+      case Request::TCP_LINE:
+         tcp->complete(r->ticket, CookieProtocol::OK, text, strlen(text));
+         break;
+      case Request::TCP_FRAME:
+         if (r->op == CookieProtocol::SIGN || status == CookieProtocol::TIMEOUT)
+            tcp->complete(r->ticket, status, reply.data(), reply.length());
+         else
+         {
+            status = checkFrameReply(responseBuffer, softLifetime);
+            tcp->complete(r->ticket, status, (const char *) softLifetime, status == CookieProtocol::OK ? sizeof (softLifetime) : 0);
+         }
+         break;
+      case Request::REFRESH:
+         break;  //the answer only updates the cache
+   }
+}
+
+/* answers r TIMEOUT, ahead of its database answer if that is still to come.
+ * Only a version 2 frame can say TIMEOUT; a version 1 frame says BUSY, and
+ * a text client, like one that was shed, is answered "0" by deliver(), so
+ * a slow database never passes a cookie for an older verifyCookie. */
+static void timeOut(Request * r)
+{
+   metrics.timeouts++;
+   r->answered = true;
+   deliver(r, BUSY_RESPONSE, CookieProtocol::TIMEOUT, std::string());
+}
+
+/* a parked request's expiry timer, which may have been scheduled early
+ * from the time the wheel last advanced */
+static void requestExpired(TimerWheel::Timer * timer)
+{
+   Request * r = (Request *) timer->context;
+   long long left = r->deadline - monotonicMicros();
+   if (left > 0)
+   {
+      timers->schedule(timer, (left + 999) / 1000);
+      return;
+   }
+   admission->leave();
+   timeOut(r);
+}
+
+/*
+ * Function Name: retryFollowers
+ *
+ * Description  : passes on the followers of a check whose call was dropped
+ *                   unmade.  Those with time left share a new call, the
+ *                   first as its flight, if the database limit allows;
+ *                   the rest are answered TIMEOUT, or BUSY if only the
+ *                   limit stopped them.
+ *
+ * Arguments    : Request * r - the check; its followers are taken
+ *
+ * Returns      : None
+ *
+ */
+static void retryFollowers(Request * r)
+{
+   long long now = monotonicMicros();
+   Request * leader = NULL;
+   while (r->followers != NULL)
+   {
+      Request * follower = r->followers;
+      r->followers = follower->next;
+      follower->next = NULL;
+      bool alive = !follower->answered && (follower->deadline == 0 || follower->deadline > now);
+      if (alive && leader != NULL)
+      {
+         if (leader->lastFollower == NULL)
+            leader->followers = follower;
+         else
+            leader->lastFollower->next = follower;
+         leader->lastFollower = follower;
+         leader->followerCount++;
+         continue;
+      }
+      if (alive && acquireDBSlot())
+      {
+         leader = follower;
+         strcpy(leader->clientID, r->clientID);
+         strcpy(leader->cookieVersion, r->cookieVersion);
+         leader->now = r->now;
+         leader->stamp = r->stamp;
+         metrics.checked++;
+         addFlight(leader);
+         db->startCheck(leader->userID, leader->IP, leader->clientID, leader->cookieVersion, leader, leader->deadline, needsPrimary(leader->userID));
+         continue;
+      }
+
+      waiting--;
+      if (!follower->answered)
+      {
+         admission->leave();
+         if (alive)
+         {
+            metrics.rejected_db_limit++;
+            deliver(follower, BUSY_RESPONSE, CookieProtocol::BUSY, std::string());
+         }
+         else
+            timeOut(follower);
+      }
+      releaseRequest(follower);
+   }
+}
+
+/*
+ * Function Name: finishRequest
+ *
+ * Description  : resumes a parked request with its database answer: feeds
+ *                   the limiter, caches a valid cookie (or signs a new
+ *                   one), replies and lets the request out of admission
+ *                   control.  A check's followers get the same reply.  A
+ *                   failed check is answered from a stale cache entry if
+ *                   CACHE_STALE_GRACE allows.  The first failure and the
+ *                   first success after it are logged.  A request that
+ *                   has timed out meanwhile gets no second reply.  A call
+ *                   the pool dropped for its deadline times the request
+ *                   out and retries its followers.
+ *
+ * Arguments    : const DBPool::Answer &answer - its context is the Request
+ *
+ * Returns      : None
+ *
+ */
+static void finishRequest(const DBPool::Answer &answer)
+{
+   Request * r = (Request *) answer.context;
+   char responseBuffer[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
+   std::string reply;
+   int status = CookieProtocol::OK;
+
+   waiting--;
+   if (answer.failed)
+   {
+      metrics.db_failures++;
+      if (dbDownSince == 0)
+      {
+         dbDownSince = time(NULL);
+         DaemonLog::write("finishRequest(): database unavailable\n");
+      }
+   }
+   else if (dbDownSince != 0 && !answer.expired)
+   {
+      DaemonLog::write("finishRequest(): database available again after %ld seconds\n", (long) (time(NULL) - dbDownSince));
+      dbDownSince = 0;
+   }
+   if (db->isThreaded())
+      dbLimiter->release(answer.latency, answer.failed);
+   else
+      dbLimiter->record(answer.latency, answer.failed);  //took no slot
+   if (r->origin != Request::REFRESH && !r->answered)
+      admission->leave();
+
+   if (answer.expired)
+   {
+      if (r->op == CookieProtocol::CHECK)
+      {
+         removeFlight(r);
+         retryFollowers(r);
+      }
+      if (!r->answered)
+         timeOut(r);
+      releaseRequest(r);
+      return;
+   }
+
+   if (r->op == CookieProtocol::SIGN)
+   {
+      status = finishSign(r, answer, reply);
+      responseBuffer[0] = '\0';
+   }
+   else
+   {
+      removeFlight(r);
+      int shortLifetime = answer.result;
+      if (cache != NULL && answer.failed)
+      {
+         shortLifetime = VerificationCache::MISS;
+         if (config->getCacheStaleGrace() > 0)
+            shortLifetime = cache->lookupStale(r->userID, r->IP, r->clientID, r->cookieVersion, time(NULL));
+         if (shortLifetime == VerificationCache::MISS)
+            shortLifetime = 0;
+         else
+            metrics.stale_served += r->followerCount + (r->origin != Request::REFRESH);
+      }
+      else if (cache != NULL && answer.result > 0)
+         cache->insert(r->userID, r->IP, r->clientID, r->cookieVersion, answer.result, r->stamp, r->now);
+      else if (cache != NULL)
+         cache->invalidateCookie(r->userID, r->IP, r->clientID, r->cookieVersion);  //no stale fallback either
+      if (answer.result > 0 && !answer.failed && metrics.first_verify_ms < 0)
+      {
+         metrics.first_verify_ms = (monotonicMicros() - startedAt) / 1000;
+         DaemonLog::write("First cookie verified %lld ms after start\n", metrics.first_verify_ms);
+      }
+      sprintf(responseBuffer, "%d", shortLifetime);
+   }
+   if (!r->answered)
+      deliver(r, responseBuffer, status, reply);
+
+   while (r->followers != NULL)
+   {
+      Request * follower = r->followers;
+      r->followers = follower->next;
+      waiting--;
+      if (!follower->answered)
+      {
+         admission->leave();
+         deliver(follower, responseBuffer, status, reply);
+      }
+      releaseRequest(follower);
+   }
+   releaseRequest(r);
+}
+
+/* resumes every parked request the database has answered */
+static void finishRequests()
+{
+   static std::vector<DBPool::Answer> answers;  //keeps its capacity
+   answers.clear();
+   db->takeAnswers(answers);
+   for (size_t i = 0; i < answers.size(); i++)
+      finishRequest(answers[i]);
+}
+
+/*
+ * Function Name: answerFrame
+ *
+ * Description  : TcpFrontend::FrameHandler for one binary request.  SIGN
+ *                   is only served to connections on SOCKET_PATH, since
+ *                   anyone who can reach the TCP listener could otherwise
+ *                   mint cookies.
+ *
+ * Arguments    : unsigned long long peer - AdmissionControl::peerKey()
+ *                bool local - the connection came in on SOCKET_PATH
+ *                int op - CookieProtocol op code
+ *                unsigned int timeout - the frame's, in milliseconds
+ *                const char * body, size_t length - request body
+ *                std::string &reply - receives the response body
+ *                unsigned long long ticket - for a deferred response
+ *
+ * Returns      : int - CookieProtocol status, or TcpFrontend::DEFERRED
+ *
+ */
+static int answerFrame(unsigned long long peer, bool local, int op, unsigned int timeout, const char * body, size_t length, std::string &reply, unsigned long long ticket)
+{
+   char buffer[CookieProtocol::MAX_REQUEST + 1];
+   requestDeadline = deadlineFor(timeout);
+   memcpy(buffer, body, length);
+   buffer[length] = '\0';
+   if (strlen(buffer) != length)
+      return CookieProtocol::BAD_REQUEST;  //no NULs in text fields
+
+   if (op == CookieProtocol::CHECK)
+   {
+      metrics.requests++;
+      if (length >= (size_t) RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE)
+         return CookieProtocol::BAD_REQUEST;
+      return answerCheckFrame(peer, buffer, NULL, reply, ticket);
+   }
+   else if (op == CookieProtocol::VERIFY_SIGNED)
+   {
+      char cookieText[IGSPnet_Cookie_Streamer::IGSPNET_COOKIE_SIZE];
+      char signatureText[IGSPnet_Cookie_Streamer::RSA_HEX_SIG_SIZE];
+
+      metrics.requests++;
+      /* parseSignedCookie() trusts its buffers to be big enough */
+      const char * delimiter = strstr(buffer, ":::");
+      if (delimiter == NULL || delimiter - buffer >= IGSPnet_Cookie_Streamer::IGSPNET_COOKIE_SIZE
+         || strlen(delimiter + 3) >= (size_t) IGSPnet_Cookie_Streamer::RSA_HEX_SIG_SIZE
+         || IGSPnet_Cookie_Streamer::parseSignedCookie(buffer, cookieText, signatureText) != 0)
+         return CookieProtocol::BAD_REQUEST;
+      /* verified once admitted, so the limits cover the RSA work */
+      return answerCheckFrame(peer, cookieText, signatureText, reply, ticket);
+   }
+   else if (op == CookieProtocol::SIGN)
+   {
+      if (!local)
+         return CookieProtocol::FORBIDDEN;
+      return signRequest(peer, buffer, ticket);
+   }
+   else if (op == CookieProtocol::STATS)
+   {
+      char * text = NULL;
+      size_t size = 0;
+      FILE * out = open_memstream(&text, &size);
+      if (out == NULL)
+         return CookieProtocol::FAILED;
+      printMetrics(out);
+      fclose(out);
+      reply.assign(text, size);
+      free(text);
+      return CookieProtocol::OK;
+   }
+   return CookieProtocol::UNSUPPORTED;
+}
+
+/*
+ * Function Name: adminCommand
+ *
+ * Description  : carries out one admin socket command and writes its reply.
+ *                   Commands are:
+ *                      INVALIDATE USER <userID>
+ *                      INVALIDATE COOKIE <userID::dukey::IP::version::clientID>
+ *                      FLUSH
+ *                      STATS
+ *
+ * Arguments    : char * command - one line, without its newline
+ *                FILE * out - stream for the reply
+ *
+ * Returns      : None
+ *
+ */
+static void adminCommand(char * command, FILE * out)
+{
+   char * verb = strtok(command, " \t\r");
+   char * what = strtok(NULL, " \t\r");
+   char * arg = strtok(NULL, " \t\r");
+
+   if (verb == NULL)
+      return;  //blank line
+
+   if (strcmp(verb, "INVALIDATE") == 0 && what != NULL && arg != NULL && strcmp(what, "USER") == 0)
+   {
+      if (cache != NULL)
+         cache->invalidateUser(arg);
+      if (replica != NULL)
+         replica->invalidateUser(arg);
+      fprintf(out, "OK\n");
+   }
+   else if (strcmp(verb, "INVALIDATE") == 0 && what != NULL && arg != NULL && strcmp(what, "COOKIE") == 0)
+   {
+      char userID[13];
+      char dukey[2];
+      char IP[16];
+      char cookieVersion[2];
+      char clientID[5];
+      if (IGSPnet_Cookie_Streamer::parseCookie(arg, userID, dukey, IP, cookieVersion, clientID) != 0)
+      {
+         fprintf(out, "ERR cannot parse cookie\n");
+         return;
+      }
+      if (cache != NULL)
+         cache->invalidateCookie(userID, IP, clientID, cookieVersion);
+      fprintf(out, "OK\n");
+   }
+   else if (strcmp(verb, "FLUSH") == 0)
+   {
+      if (cache != NULL)
+         cache->flush();
+      fprintf(out, "OK\n");
+   }
+   else if (strcmp(verb, "STATS") == 0)
+   {
+      printMetrics(out);
+      fprintf(out, "OK\n");
+   }
+   else
+   {
+      fprintf(out, "ERR unknown command\n");
+   }
+}
+
+/*
+ * Function Name: handleAdmin
+ *
+ * Description  : reads newline-separated commands from an admin connection
+ *                   until the client shuts down its side, answering each.
+ *                   Admin clients are trusted (the socket is mode 0600) but
+ *                   a slow one is cut off after a few seconds.
+ *
+ * Arguments    : int c - accepted admin connection
+ *
+ * Returns      : None
+ *
+ */
+static void handleAdmin(int c)
+{
+   struct timeval tv;
+   tv.tv_sec = 5;
+   tv.tv_usec = 0;
+   setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+
+   /* a stdio stream cannot switch between reading and writing a socket */
+   FILE * in = fdopen(c, "r");
+   FILE * out = fdopen(dup(c), "w");
+   if (in == NULL || out == NULL)
+   {
+      if (in != NULL)
+         fclose(in);
+      else
+         close(c);
+      if (out != NULL)
+         fclose(out);
+      return;
+   }
+
+   char line[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
+   while (fgets(line, sizeof (line), in) != NULL)
+   {
+      line[strcspn(line, "\n")] = '\0';
+      adminCommand(line, out);
+      fflush(out);
+   }
+   fclose(out);
+   fclose(in);
+}
+
+/*
+ * Function Name: superviseWorkers
+ *
+ * Description  : pre-fork mode.  Forks count workers that share the
+ *                   listening sockets, each with its own database
+ *                   connections, and restarts any that exit.  Signals go to
+ *                   this master: SIGUSR1 and SIGHUP are relayed to every
+ *                   worker (the master reloads its own config first),
+ *                   SIGINT and SIGTERM stop the workers and then the master,
+ *                   and SIGUSR2 (from a worker that handed the sockets off)
+ *                   drains the workers and then the master.
+ *
+ * Arguments    : int count - number of workers to keep running
+ *
+ * Returns      : only in a new worker; the master exits from here
+ *
+ */
+static void superviseWorkers(int count)
+{
+   pid_t * pids = new pid_t[count];
+   time_t * started = new time_t[count];
+   for (int i = 0; i < count; i++)
+   {
+      pids[i] = 0;
+      started[i] = 0;
+   }
+
+   /* no SA_RESTART, so waitpid() wakes up for these */
+   struct sigaction stop;
+   bzero(&stop, sizeof (stop));
+   stop.sa_handler = requestStop;
+   sigaction(SIGINT, &stop, NULL);
+   sigaction(SIGTERM, &stop, NULL);
+
+   sigset_t stopSignals, old;
+   sigemptyset(&stopSignals);
+   sigaddset(&stopSignals, SIGHUP);
+   sigaddset(&stopSignals, SIGINT);
+   sigaddset(&stopSignals, SIGTERM);
+
+   while (!stopRequested && !drainRequested)
+   {
+      bool missing = false;
+      for (int i = 0; i < count && !stopRequested; i++)
+      {
+         if (pids[i] != 0)
+            continue;
+         if (started[i] != 0 && time(NULL) - started[i] < RESPAWN_DELAY)
+         {
+            sleep(RESPAWN_DELAY);
+            if (stopRequested)
+               break;
+         }
+
+         /* signals wait until the child has set itself up */
+         sigprocmask(SIG_BLOCK, &stopSignals, &old);
+         pid_t pid = fork();
+         if (pid == 0)
+         {
+            startedAt = monotonicMicros();
+            DaemonLog::restart();  //the master's writer thread stayed behind
+            prctl(PR_SET_PDEATHSIG, SIGTERM);  //don't outlive the master
+            sigprocmask(SIG_SETMASK, &old, NULL);
+            workerIndex = i;
+            if (predecessor >= 0)
+            {
+               close(predecessor);  //the master answers it
+               predecessor = -1;
+            }
+            delete [] pids;
+            delete [] started;
+            return;
+         }
+         sigprocmask(SIG_SETMASK, &old, NULL);
+
+         if (pid < 0)
+         {
+            DaemonLog::write("fork(): Cannot start worker %d - %s\n", i, strerror(errno));
+            missing = true;
+            continue;
+         }
+         pids[i] = pid;
+         started[i] = time(NULL);
+         DaemonLog::write("Started worker %d (pid %d)\n", i, (int) pid);
+      }
+      if (!missing && !stopRequested)
+         readyToServe();
+
+      if (snapshotRequested)
+      {
+         snapshotRequested = 0;
+         writeSnapshot();
+         alarm(config->getCacheSnapshotInterval());
+      }
+
+      if (metricsRequested)
+      {
+         metricsRequested = 0;
+         for (int i = 0; i < count; i++)
+         {
+            if (pids[i] != 0)
+               kill(pids[i], SIGUSR1);
+         }
+      }
+
+      if (reloadRequested)
+      {
+         reloadRequested = 0;
+         reloadConfig();
+         for (int i = 0; i < count; i++)
+         {
+            if (pids[i] != 0)
+               kill(pids[i], SIGHUP);
+         }
+      }
+
+      if (missing)
+      {
+         sleep(RESPAWN_DELAY);  //try the fork again
+         continue;
+      }
+
+      int status;
+      pid_t pid = waitpid(-1, &status, 0);
+      if (pid <= 0)
+         continue;  //interrupted by a signal
+      for (int i = 0; i < count; i++)
+      {
+         if (pids[i] != pid)
+            continue;
+         if (WIFSIGNALED(status))
+            DaemonLog::write("Worker %d (pid %d) killed by signal %d; restarting\n", i, (int) pid, WTERMSIG(status));
+         else
+            DaemonLog::write("Worker %d (pid %d) exited with status %d; restarting\n", i, (int) pid, WEXITSTATUS(status));
+         pids[i] = 0;
+      }
+   }
+
+   for (int i = 0; i < count; i++)
+   {
+      if (pids[i] != 0)
+         kill(pids[i], drainRequested ? SIGUSR2 : SIGTERM);
+   }
+   while (waitpid(-1, NULL, 0) > 0 || errno == EINTR)
+      ;
+   cleanup();
+}
+
+/* startup thread body: reads the signing keys while main() connects */
+static void * loadKeys(void * unused)
+{
+   keysLoaded = RSA_Sign_Verify::loadKeys();
+   return NULL;
+}
+
+/*
+ * Function Name: main
+ *
+ * Description  : program entry point
+ *
+ * Arguments    : None
+ *
+ * Returns      : 0 in theory, but exit only ever actually occurs following
+ *                   fatal error (-1) or signal (SIGINT, SIGTERM) (0).
+ *
+ */
+int main(int argc, char * argv[])
+{
+   int w;   /* worker socket */
+   
+   startedAt = monotonicMicros();
+
+   /* set up signal handlers; the loop stops the daemon, as nothing it
+    * frees is safe to touch from a handler */
+   struct sigaction stop;
+   bzero(&stop, sizeof (stop));
+   stop.sa_handler = requestStop;
+   sigaction(SIGINT, &stop, NULL);
+   sigaction(SIGTERM, &stop, NULL);
+   signal(SIGPIPE, SIG_IGN);  /* a client that hangs up early must not kill us */
+
+   /* bad signatures are counted, and signing errors logged, here */
+   RSA_Sign_Verify::setQuiet(true);
+
+   /* no SA_RESTART, so a blocked poll() wakes up to print the metrics */
+   struct sigaction usr1;
+   bzero(&usr1, sizeof (usr1));
+   usr1.sa_handler = requestMetrics;
+   sigaction(SIGUSR1, &usr1, NULL);
+
+   struct sigaction hup;
+   bzero(&hup, sizeof (hup));
+   hup.sa_handler = requestReload;
+   sigaction(SIGHUP, &hup, NULL);
+
+   struct sigaction usr2;
+   bzero(&usr2, sizeof (usr2));
+   usr2.sa_handler = requestDrain;
+   sigaction(SIGUSR2, &usr2, NULL);
+
+   /* create listener sockets, or take them over */
+   socket_path();
+   DaemonLog::start(config);
+   if (!openSockets())
+      return FATAL_EXIT;
+
+   /* each process drives its own copy from its loop */
+   timers = new TimerWheel(monotonicMicros() / 1000);
+
+   /* built before forking so that pre-fork workers share one table */
+   if (config->getCacheCapacity() > 0)
+   {
+      cache = new VerificationCache(config, config->getWorkerProcesses() > 0);
+      cache->setTimers(timers);
+      if (config->getCacheSnapshotPath().length() > 0)
+      {
+         int loaded = cache->loadSnapshot(config->getCacheSnapshotPath().c_str(), time(NULL));
+         if (loaded >= 0)
+            DaemonLog::write("Loaded %d cached cookies from %s\n", loaded, config->getCacheSnapshotPath().c_str());
+
+         /* saved periodically by this process: the master in pre-fork mode,
+          * since alarms do not survive fork() */
+         struct sigaction alrm;
+         bzero(&alrm, sizeof (alrm));
+         alrm.sa_handler = requestSnapshot;
+         sigaction(SIGALRM, &alrm, NULL);
+         alarm(config->getCacheSnapshotInterval());
+      }
+   }
+
+   if (config->getWorkerProcesses() > 0)
+      superviseWorkers(config->getWorkerProcesses());
+
+   /* enable us to talk to verify signatures and talk w/ Oracle; the keys
+    * load while the pool connects */
+   sigset_t all, old;
+   sigfillset(&all);
+   pthread_sigmask(SIG_BLOCK, &all, &old);  //signals stay with this thread
+   pthread_t keyLoader;
+   bool loading = pthread_create(&keyLoader, NULL, loadKeys, NULL) == 0;
+   pthread_sigmask(SIG_SETMASK, &old, NULL);
+   if (!loading)
+      loadKeys(NULL);
+   try
+   {
+      db = new DBPool(config);  //die if can't connect
+      if (config->getReplicaSyncInterval() > 0)
+         replica = new UserReplica(config);
+   }
+   catch (SQLException &e)
+   {
+      DaemonLog::write("OCCI_IGSPnet(): Can't connect to database - %s\n", e.what());
+      return FATAL_EXIT;
+   }
+   catch (std::runtime_error &e)
+   {
+      DaemonLog::write("OCCI_IGSPnet(): Runtime error - %s\n", e.what());
+      exit(FATAL_EXIT);
+   }
+
+   if (loading)
+      pthread_join(keyLoader, NULL);
+   if (keysLoaded != 0)
+      DaemonLog::write("loadKeys(): cannot load PRIVATE_KEY_PATH and CERT_PATH; each SIGN and VERIFY_SIGNED will read them\n");
+
+   admission = new AdmissionControl(config);
+   dbLimiter = new ConcurrencyLimiter(config);
+   openCapture(config->getCapturePath());
+   /* with no TCP listener, still serves binary clients on SOCKET_PATH */
+   tcp = new TcpFrontend(t, config, timers, answerLineRequest, answerFrame);
+   if (config->getIoEngine() == "io_uring")
+   {
+      uring = UringListener::create(l, answerUringRequest, tcp);
+      if (uring == NULL)
+         DaemonLog::write("IO_ENGINE io_uring unavailable; using poll()\n");
+   }
+   metrics.startup_ms = (monotonicMicros() - startedAt) / 1000;
+   DaemonLog::write("Serving after %lld ms; database connections up: %d\n", metrics.startup_ms, db->getConnected());
+   readyToServe();
+
+   struct pollfd listeners[7];
+   listeners[0].fd = (uring != NULL) ? -1 : l;  /* else the ring accepts */
+   listeners[0].events = POLLIN;
+   listeners[1].fd = a;  /* poll() skips negative fds */
+   listeners[1].events = POLLIN;
+   listeners[2].fd = h;
+   listeners[2].events = POLLIN;
+   listeners[3].events = POLLIN;
+   listeners[4].fd = tcp->getFd();
+   listeners[4].events = POLLIN;
+   listeners[5].fd = (uring != NULL) ? uring->getFd() : -1;
+   listeners[5].events = POLLIN;
+   listeners[6].fd = db->getFd();  /* answers for parked requests */
+   listeners[6].events = POLLIN;
+
+   /* once handed off, only requests already accepted keep us going */
+   while (!stopRequested && (!drainRequested || waiting > 0 || !tcp->drained() || (uring != NULL && !uring->drained())))
+   {
+      if (metricsRequested)
+      {
+         metricsRequested = 0;
+         printMetrics(stderr);
+      }
+      if (snapshotRequested)
+      {
+         snapshotRequested = 0;
+         writeSnapshot();
+         alarm(config->getCacheSnapshotInterval());
+      }
+      if (reloadRequested)
+      {
+         reloadRequested = 0;
+         reloadConfig();
+      }
+
+      if (drainRequested)
+      {
+         listeners[0].fd = listeners[1].fd = listeners[2].fd = -1;
+         tcp->drain();
+         if (uring != NULL)
+            uring->drain();
+         if (waiting == 0 && tcp->drained() && (uring == NULL || uring->drained()))
+            break;
+      }
+
+      listeners[3].fd = successor;
+      /* wake for the next timer or hedge, and at least once a second */
+      db->hedge();
+      int timeout = db->hedgeWait();
+      int next = timers->wait(monotonicMicros() / 1000);
+      if (next >= 0 && (timeout < 0 || next < timeout))
+         timeout = next;
+      if (timeout < 0 || timeout > 1000)
+         timeout = 1000;
+      if (poll(listeners, 7, timeout) < 0)
+      {
+         if (errno != EINTR)
+            DaemonLog::write("poll(): Error waiting on sockets - %s\n", strerror(errno));
+         continue;
+      }
+
+      if (listeners[6].revents & POLLIN)
+         finishRequests();
+      timers->advance(monotonicMicros() / 1000);
+      if (uring != NULL)
+         uring->service();  //also submits the replies just finished or timed out
+      if (listeners[4].revents & POLLIN)
+         tcp->service();
+
+      if (a >= 0 && (listeners[1].revents & POLLIN))
+      {
+         w = accept(a, NULL, NULL);  /* another worker may have taken it */
+         if (w >= 0)
+            handleAdmin(w);
+      }
+
+      if (h >= 0 && (listeners[2].revents & POLLIN))
+      {
+         w = accept(h, NULL, NULL);
+         if (w >= 0)
+            offerSockets(w);
+      }
+
+      if (successor >= 0 && (listeners[3].revents & (POLLIN | POLLHUP)))
+      {
+         successorReady();
+         continue;
+      }
+
+      if (listeners[0].fd < 0 || !(listeners[0].revents & POLLIN))
+         continue;
+
+      /* accept connection; the frontend reads it, so a client that
+       * connects and sends nothing cannot hold up the loop */
+      w = accept(l, NULL, NULL);
+      if (w < 0)
+      {
+         if (errno != EINTR && errno != EAGAIN)
+            DaemonLog::write("accept(): Error accepting on socket - %s\n", strerror(errno));
+         continue;
       }
+      tcp->adopt(w);  //made non-blocking there
    }
   
-  /* we'll never get here b/c of the infinite while.  Program exit
-   * actually occurs from cleanup(), which returns 0, but main() should
-   * return something, so return 0.
+  /* we get here once stopped, or after handing the sockets off; cleanup()
+   * exits 0, but main() should return something, so return 0.
    */
-   cleanup(0);  //0 is used as dummy sig handler
+   cleanup();  //exits
    return NORMAL_EXIT;
 }
@@ -5,7 +5,54 @@
  * in IGSPnet.
  *  
  * Runs as a daemon process.  Any errors are logged to stderr; fatal errors
- * exit with -1.  SIGHUP, SIGINT, SIGTERM are trapped and return 0.
+ * exit with -1.  SIGINT, SIGTERM are trapped and return 0.  SIGHUP re-reads
+ * the config file and applies it without dropping the listener, the cache
+ * or database connections.  SIGUSR1 dumps the daemon's counters to stderr.
+ *
+ * Requests are subject to admission control (see AdmissionControl.h) before
+ * any database work is done, and database calls themselves are bounded by
+ * an adaptive limit (see ConcurrencyLimiter.h).  Shed requests are answered
+ * BUSY in the binary protocol and "0" to text clients, which cannot all
+ * tell BUSY_RESPONSE from a soft lifetime.  Checks run on a pool of
+ * database connections that can hedge slow calls (see DBPool.h), unless
+ * the optional local replica of user and cookie state can answer them (see
+ * UserReplica.h).  Recent positive results may be cached (see
+ * VerificationCache.h).
+ *
+ * With more than one pooled connection the loop does not wait for the
+ * database: a request that needs it is parked with its call and resumed
+ * when the pool posts the answer, so one process serves many requests while
+ * they wait.  Each parked request is answered by its deadline (a binary
+ * frame's timeout, or REQUEST_TIMEOUT) even if its call has not returned.
+ *
+ * If ADMIN_SOCKET_PATH is set, a second socket accepts line-based admin
+ * commands: INVALIDATE USER <userID>, INVALIDATE COOKIE <cookie>, FLUSH and
+ * STATS.
+ *
+ * If WORKER_PROCESSES is set, a master process binds the sockets and forks
+ * that many workers, each with its own database connections, which compete
+ * to accept requests.  The master restarts workers that die and relays
+ * SIGUSR1 and SIGHUP to them; SIGINT and SIGTERM sent to the master stop
+ * everything.
+ *
+ * If HANDOFF_SOCKET_PATH is set, a new daemon (normally a new binary)
+ * started while this one runs takes over its listening sockets, and this
+ * one drains and exits once the new one is ready, so an upgrade refuses no
+ * connections (see SocketHandoff.h).  SIGUSR2 is how a handed-off worker
+ * tells its master to drain.
+ *
+ * If TCP_LISTEN_PORT is set, the daemon also serves remote web nodes over
+ * TCP, one newline-framed request per line on long-lived connections (see
+ * TcpFrontend.h).
+ *
+ * Clients on either socket may instead speak the binary protocol (see
+ * CookieProtocol.h): length-prefixed frames carrying an op code and a
+ * request ID, so requests can be pipelined and their responses matched out
+ * of order.  Besides cookie checks it verifies signed cookies in the
+ * daemon, issues cookies (SIGN, local clients only) and reports STATS.
+ *
+ * If CAPTURE_PATH is set, every cookie check answered is appended to a
+ * binary log (see CaptureLog.h) that replayCookie can play back.
  *
  */
  
@@ -21,21 +68,79 @@
 #include <sys/un.h>
 #include <errno.h>
 #include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <fcntl.h>
+#include <string>
+#include <vector>
 #include "OCCI_IGSPnet.h"
+#include "DBPool.h"
+#include "UserReplica.h"
+#include "VerificationCache.h"
+#include "SocketHandoff.h"
+#include "TcpFrontend.h"
+#include "CookieProtocol.h"
+#include "UringListener.h"
 #include "RSA_Sign_Verify.h"
 #include "IGSPnet_Cookie_Streamer.h"
 #include "CookieDaemonConfig.h"
+#include "AdmissionControl.h"
+#include "DaemonMetrics.h"
+#include "ConcurrencyLimiter.h"
+#include "DaemonClock.h"
+#include "TimerWheel.h"
+#include "DaemonLog.h"
+#include "CaptureLog.h"
+#include "AllocationCounter.h"
 
 /*
  * Function Name: cleanup
  *
- * Description  : closes listener socket, if open
+ * Description  : closes listener socket, if open, and exits; called from
+ *                   the main loop once SIGINT or SIGTERM is caught
+ *
+ * Arguments    : None
+ *
+ * Returns      : None
+ */
+void cleanup();
+
+/*
+ * Function Name: requestReload
+ *
+ * Description  : flags the main loop to re-read the config file
+ *
+ * Arguments    : int signum - signal number.  Ignored.
+ *
+ * Returns      : None
+ */
+void requestReload(int signum);
+
+/*
+ * Function Name: requestDrain
+ *
+ * Description  : flags the main loop to finish what it has accepted and exit
+ *                   without unlinking the sockets, which a successor now owns
+ *
+ * Arguments    : int signum - signal number.  Ignored.
+ *
+ * Returns      : None
+ */
+void requestDrain(int signum);
+
+/*
+ * Function Name: requestMetrics
+ *
+ * Description  : flags the main loop to print its counters to stderr
  *
- * Arguments    : int signum - signal number.  Ignored, but required by
- *                   signal.h API.
+ * Arguments    : int signum - signal number.  Ignored.
  *
  * Returns      : None
  */
-void cleanup(int signum);
+void requestMetrics(int signum);
 
 #endif  /* COOKIEDAEMON_H */
@@ -0,0 +1,418 @@
+/* replayCookie.cpp
+ *
+ * Plays a cookieDaemon capture (CAPTURE_PATH; see CaptureLog.h) back
+ * against a daemon, each check sent at its captured time scaled by the
+ * speed, and reports where the replies and latencies differ from those
+ * captured.  Each check is one text request on a connection of its own,
+ * as verifyCookie sends them, from a pool of client threads; a check whose
+ * time comes while every client is busy goes out late, and the lateness is
+ * reported too.  Captured latencies are the daemon's own, from arrival to
+ * reply; replayed ones are as the client sees them, connection included.
+ *
+ * With -w it writes a LOCAL_BACKEND_PATH file instead: every user and
+ * cookie in the capture, with each cookie that was ever valid given the
+ * soft lifetime it was answered with.  A daemon run with DB_BACKEND local on
+ * that file answers the replay as the database answered the capture, except
+ * for cookies that expired or were revoked while it was taken.
+ *
+ * The daemon is found as verifyCookie finds it: SOCKET_PATH, or DAEMON_HOST
+ * and DAEMON_PORT.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "CookieDaemonConfig.h"
+#include "CaptureLog.h"
+#include "IGSPnet_Cookie_Streamer.h"
+#include "RSA_Sign_Verify.h"
+
+static const int ERROR_RESULT = -2;     /* replayed result when the daemon could not be reached */
+static const long LATE_US = 10000;      /* sent this much after its time counts as late */
+static const int HARD_LIFETIME_SLACK = 86400;  /* -w: beyond the capture's own length */
+
+static std::string socketPath;
+static std::string daemonHost;
+static int daemonPort = 0;
+static double speed = 1;
+
+/* the capture, in time order, and what the replay made of each check */
+static std::vector<CaptureLog::Record> records;
+static std::vector<int> results;
+static std::vector<long> latencies;   /* microseconds */
+static std::vector<long> lags;        /* microseconds sent after its time */
+static long long firstTime = 0;
+static long long replayStart = 0;
+static volatile unsigned long nextRecord = 0;
+
+void printUsage(char * programName)
+{
+   fprintf(stderr, "USAGE: %s [-s speed] [-c clients] <capture>\n", programName);
+   fprintf(stderr, "       %s -w <backend file> <capture>\n", programName);
+   fprintf(stderr, "where: speed        = multiple of the captured rate (default 1; 0 = as fast as possible)\n");
+   fprintf(stderr, "       clients      = concurrent client threads (default 32)\n");
+   fprintf(stderr, "       backend file = LOCAL_BACKEND_PATH to write from the capture\n");
+   fprintf(stderr, "       capture      = a daemon's CAPTURE_PATH\n");
+   exit(FATAL_EXIT);
+}
+
+static long long nowMicros()
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool byTime(const CaptureLog::Record &a, const CaptureLog::Record &b)
+{
+   return a.time < b.time;
+}
+
+/* reads the whole capture, sorted, since pre-fork workers append out of
+ * order; false if it is not a capture */
+static bool readCapture(const char * path)
+{
+   FILE * in = fopen(path, "rb");
+   if (in == NULL)
+   {
+      perror(path);
+      return false;
+   }
+   CaptureLog::Record record;
+   int got;
+   while ((got = CaptureLog::read(in, record)) == 1)
+      records.push_back(record);
+   fclose(in);
+   if (got < 0)
+   {
+      fprintf(stderr, "%s: not a capture, or cut short after %lu records\n", path, (unsigned long) records.size());
+      return false;
+   }
+   std::stable_sort(records.begin(), records.end(), byTime);
+   return true;
+}
+
+/* a cookie seen in the capture, for writeBackend() */
+struct Cookie
+{
+   std::string userID, IP, clientID, cookieVersion;
+   int softLifetime;   /* longest answered; 0 if never valid */
+   bool revoked;       /* invalid after being valid */
+};
+
+/*
+ * Function Name: writeBackend
+ *
+ * Description  : writes a Local_IGSPnet file that answers the captured
+ *                   checks as they were answered.  Users get the cookie
+ *                   version of their valid cookies (else of any), and every
+ *                   cookie that was ever valid is listed with the longest
+ *                   soft lifetime it was answered with.  Others are left
+ *                   out, so they check invalid.
+ *
+ * Arguments    : const char * path - file to write
+ *
+ * Returns      : int - exit code
+ *
+ */
+static int writeBackend(const char * path)
+{
+   std::map<std::string, std::string> users;   /* userID -> "version dukey" */
+   std::map<std::string, Cookie> cookies;
+   unsigned long unparsed = 0;
+
+   for (size_t i = 0; i < records.size(); i++)
+   {
+      char buffer[CaptureLog::MAX_TEXT + 1];
+      char userID[13];
+      char dukey[2];
+      char IP[16];
+      char cookieVersion[2];
+      char clientID[5];
+      strcpy(buffer, records[i].text);
+      if (IGSPnet_Cookie_Streamer::parseCookie(buffer, userID, dukey, IP, cookieVersion, clientID) != 0)
+      {
+         unparsed++;
+         continue;
+      }
+
+      std::string user = std::string(cookieVersion) + " " + dukey;
+      if (users.find(userID) == users.end() || records[i].result > 0)
+         users[userID] = user;
+      if (records[i].result < 0)
+         continue;  //busy: says nothing about the cookie
+
+      std::string key = std::string(userID) + " " + IP + " " + clientID + " " + cookieVersion;
+      std::map<std::string, Cookie>::iterator c = cookies.find(key);
+      if (c == cookies.end())
+      {
+         Cookie cookie;
+         cookie.userID = userID;
+         cookie.IP = IP;
+         cookie.clientID = clientID;
+         cookie.cookieVersion = cookieVersion;
+         cookie.softLifetime = 0;
+         cookie.revoked = false;
+         c = cookies.insert(std::make_pair(key, cookie)).first;
+      }
+      if (records[i].result > 0)
+         c->second.softLifetime = std::max(c->second.softLifetime, records[i].result);
+      else if (c->second.softLifetime > 0)
+         c->second.revoked = true;
+   }
+
+   FILE * out = fopen(path, "w");
+   if (out == NULL)
+   {
+      perror(path);
+      return FATAL_EXIT;
+   }
+   int hardLifetime = HARD_LIFETIME_SLACK;
+   if (!records.empty())
+      hardLifetime += (int) ((records.back().time - records.front().time) / 1000000);
+
+   fprintf(out, "# written by replayCookie from %lu captured checks\n", (unsigned long) records.size());
+   for (std::map<std::string, std::string>::iterator u = users.begin(); u != users.end(); ++u)
+      fprintf(out, "USER %s 1 %s\n", u->first.c_str(), u->second.c_str());
+   unsigned long valid = 0;
+   unsigned long revoked = 0;
+   for (std::map<std::string, Cookie>::iterator c = cookies.begin(); c != cookies.end(); ++c)
+   {
+      if (c->second.softLifetime == 0)
+         continue;
+      fprintf(out, "COOKIE %s %s %s %s %d %d\n", c->second.userID.c_str(), c->second.IP.c_str(),
+         c->second.clientID.c_str(), c->second.cookieVersion.c_str(), c->second.softLifetime, hardLifetime);
+      valid++;
+      if (c->second.revoked)
+         revoked++;
+   }
+   fclose(out);
+
+   printf("users %lu\n", (unsigned long) users.size());
+   printf("cookies_valid %lu\n", valid);
+   printf("cookies_invalid %lu\n", (unsigned long) cookies.size() - valid);
+   printf("cookies_revoked %lu\n", revoked);  //their later checks will differ
+   printf("unparsed %lu\n", unparsed);
+   return NORMAL_EXIT;
+}
+
+static int connectDaemon()
+{
+   int s = -1;
+
+   if (daemonHost.length() > 0)
+   {
+      struct addrinfo hints;
+      struct addrinfo * found;
+      char service[16];
+
+      bzero(&hints, sizeof (hints));
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      sprintf(service, "%d", daemonPort);
+      if (getaddrinfo(daemonHost.c_str(), service, &hints, &found) != 0)
+         return -1;
+      for (struct addrinfo * a = found; a != NULL && s < 0; a = a->ai_next)
+      {
+         s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+         if (s >= 0 && connect(s, a->ai_addr, a->ai_addrlen) < 0)
+         {
+            close(s);
+            s = -1;
+         }
+      }
+      freeaddrinfo(found);
+      return s;
+   }
+
+   struct sockaddr_un sa;
+   if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+      return -1;
+   bzero(&sa, sizeof (sa));
+   sa.sun_family = AF_UNIX;
+   strncpy(sa.sun_path, socketPath.c_str(), sizeof (sa.sun_path) - 1);
+   if (connect(s, (struct sockaddr *) &sa, sizeof (sa)) < 0)
+   {
+      close(s);
+      return -1;
+   }
+   return s;
+}
+
+/* sends one check; its reply, or ERROR_RESULT */
+static int check(const char * text)
+{
+   char response[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
+   std::string request(text);
+   if (daemonHost.length() > 0)
+      request += '\n';
+
+   int s = connectDaemon();
+   if (s < 0)
+      return ERROR_RESULT;
+   ssize_t count = -1;
+   if (send(s, request.data(), request.length(), MSG_NOSIGNAL) == (ssize_t) request.length())
+      count = recv(s, response, sizeof (response) - 1, 0);
+   close(s);
+   if (count <= 0)
+      return ERROR_RESULT;
+   response[count] = '\0';
+   return atoi(response);
+}
+
+/* takes the next check, waits for its time and sends it, until none are left */
+static void * clientMain(void * arg)
+{
+   for (;;)
+   {
+      unsigned long i = __sync_fetch_and_add(&nextRecord, 1);
+      if (i >= records.size())
+         break;
+      long long due = replayStart;
+      if (speed > 0)
+         due += (long long) ((records[i].time - firstTime) / speed);
+      long long now = nowMicros();
+      if (due > now)
+      {
+         usleep((useconds_t) (due - now));
+         now = nowMicros();
+      }
+      lags[i] = (long) (now - due);
+      results[i] = check(records[i].text);
+      latencies[i] = (long) (nowMicros() - now);
+   }
+   return NULL;
+}
+
+/* what a reply means, for the report */
+static const char * resultName(int result)
+{
+   if (result == ERROR_RESULT)
+      return "error";
+   if (result < 0)
+      return "busy";
+   if (result == 0)
+      return "invalid";
+   return "valid";
+}
+
+static long percentile(std::vector<long> &sorted, int p)
+{
+   if (sorted.empty())
+      return 0;
+   return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+/* one line per percentile: captured at the daemon, replayed at the client */
+static void printLatencies(std::vector<long> captured, std::vector<long> replayed)
+{
+   static const int points[] = { 50, 90, 99, 100 };
+   std::sort(captured.begin(), captured.end());
+   std::sort(replayed.begin(), replayed.end());
+   printf("%-16s %12s %12s\n", "latency_us", "daemon", "client");
+   for (size_t i = 0; i < sizeof (points) / sizeof (points[0]); i++)
+   {
+      char name[16];
+      if (points[i] == 100)
+         strcpy(name, "max");
+      else
+         sprintf(name, "p%d", points[i]);
+      printf("%-16s %12ld %12ld\n", name, percentile(captured, points[i]), percentile(replayed, points[i]));
+   }
+}
+
+int main(int argc, char * argv[])
+{
+   int clients = 32;
+   const char * backendPath = NULL;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "s:c:w:")) != -1)
+   {
+      switch (opt)
+      {
+         case 's': speed = atof(optarg); break;
+         case 'c': clients = atoi(optarg); break;
+         case 'w': backendPath = optarg; break;
+         default: printUsage(argv[0]);
+      }
+   }
+   if (optind != argc - 1 || clients <= 0 || speed < 0)
+      printUsage(argv[0]);
+   if (!readCapture(argv[optind]))
+      exit(FATAL_EXIT);
+   if (backendPath != NULL)
+      return writeBackend(backendPath);
+   if (records.empty())
+   {
+      fprintf(stderr, "%s: no checks captured\n", argv[optind]);
+      exit(FATAL_EXIT);
+   }
+
+   CookieDaemonConfig *config = CookieDaemonConfig::getConfig();
+   if (config == NULL)
+   {
+      fprintf(stderr, "No config found, exiting\n");
+      exit(FATAL_EXIT);
+   }
+   socketPath = config->getSocketPath();
+   daemonHost = config->getDaemonHost();
+   daemonPort = config->getDaemonPort();
+   delete config;
+
+   results.resize(records.size());
+   latencies.resize(records.size());
+   lags.resize(records.size());
+   firstTime = records.front().time;
+   replayStart = nowMicros();
+   std::vector<pthread_t> threads(clients);
+   for (int i = 0; i < clients; i++)
+      pthread_create(&threads[i], NULL, clientMain, NULL);
+   for (int i = 0; i < clients; i++)
+      pthread_join(threads[i], NULL);
+   double elapsed = (nowMicros() - replayStart) / 1e6;
+
+   /* (captured, replayed) pairs that differ, by reply */
+   std::map<std::pair<int, int>, unsigned long> differences;
+   std::vector<long> captured;
+   unsigned long matched = 0;
+   unsigned long late = 0;
+   for (size_t i = 0; i < records.size(); i++)
+   {
+      captured.push_back(records[i].latency);
+      if (results[i] == records[i].result)
+         matched++;
+      else
+         differences[std::make_pair(records[i].result, results[i])]++;
+      if (speed > 0 && lags[i] > LATE_US)
+         late++;
+   }
+
+   printf("requests %lu\n", (unsigned long) records.size());
+   printf("captured_seconds %.1f\n", (records.back().time - firstTime) / 1e6);
+   printf("replay_seconds %.1f\n", elapsed);
+   printf("late %lu\n", late);
+   printf("matched %lu\n", matched);
+   printf("differed %lu\n", (unsigned long) records.size() - matched);
+   std::vector<std::pair<unsigned long, std::pair<int, int> > > ranked;
+   for (std::map<std::pair<int, int>, unsigned long>::iterator d = differences.begin(); d != differences.end(); ++d)
+      ranked.push_back(std::make_pair(d->second, d->first));
+   std::sort(ranked.rbegin(), ranked.rend());
+   for (size_t i = 0; i < ranked.size() && i < 10; i++)
+      printf("  %lu captured %d (%s) replayed %d (%s)\n", ranked[i].first,
+         ranked[i].second.first, resultName(ranked[i].second.first),
+         ranked[i].second.second, resultName(ranked[i].second.second));
+   printLatencies(captured, latencies);
+   return NORMAL_EXIT;
+}
@@ -2,12 +2,10 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <sys/un.h>
 #include "RSA_Sign_Verify.h"
 #include "IGSPnet_Cookie_Streamer.h"
 #include "CookieDaemonConfig.h"
+#include "CookieClient.h"
 
 void printUsage(char * programName)
 {
@@ -76,56 +74,29 @@ int main(int argc, char * argv[])
       }
    }
 
-   //now time to connect to cookieDaemon
-   int s;
-   struct sockaddr_un sa;
+   //now ask cookieDaemon, or the cache it publishes
    char buffer[RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE];
-   int count;
-   
-   if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
-   {
-      fprintf(stderr, "socket(): could not open socket\n");
-      exit(FATAL_EXIT);
-   }
 
-   sa.sun_family = AF_UNIX;
    CookieDaemonConfig *config = CookieDaemonConfig::getConfig();
    if(config == NULL) {
       fprintf(stderr, "No config found, exiting\n");
       exit (FATAL_EXIT);
    }
-   strcpy(sa.sun_path, config->getSocketPath().c_str());
+   CookieClient *client = new CookieClient(config);
    delete(config);
 
-   if (connect(s, (struct sockaddr *) &sa, sizeof (sa)) < 0)
-   {
-      fprintf(stderr, "connect(): could not connect to socket %s\n", sa.sun_path);
-      exit(FATAL_EXIT);
-   }
+   if (client->check(cookieText, buffer) != 0)
+      exit(FATAL_EXIT);  //already reported
+   delete client;
 
-   if (send(s, cookieText, strlen(cookieText), 0) < 0)
-   {
-      fprintf(stderr, "send(): error sending cookie to daemon\n");
-      exit(FATAL_EXIT);
-   }
-   
-   count = recv(s, buffer, RSA_Sign_Verify::SOCKET_RW_BUFFER_SIZE - 1, 0);
-   if (count > 0)
-      buffer[count] = '\0';
-   else if (count < 0)
-   {
-      fprintf(stderr, "recv(): error receiving from daemon\n");
-      exit(FATAL_EXIT);
-   }
-   else
+   //now, buffer has the response from the daemon
+   //the daemon sheds load rather than answer; that is not an expired cookie
+   if (strcmp (buffer, BUSY_RESPONSE) == 0)
    {
-      fprintf(stderr, "server closed connection\n");
-      exit(FATAL_EXIT);
+      fprintf(stderr, "daemon is busy\n");
+      return FATAL_EXIT;
    }
-   
-   close(s);
 
-   //now, buffer has the response from the daemon
    //if it is zero, then the cookie has expired
    if (strcmp (buffer, "0") == 0)
    {